@@ -17,10 +17,93 @@ As long as this comment is preserved at the top of the file
 #include "AAD.h"
 #include <algorithm>
 
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <cstdlib>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 //  Statics
 
 size_t Node::numAdj = 1;
+size_t Node::adjStride = ADJPACK;
 bool Tape::multi = false;
+size_t Tape::defaultBudget = numeric_limits<size_t>::max();
 
 Tape globalTape;
 thread_local Tape* Number::tape = &globalTape;
+#if AADET
+thread_local double Number::passiveAdjoint = 0.0;
+#endif
+
+//  Spill of tapes over budget, see blocklist.h
+//  Temporary files in the temp directory, deleted when unmapped, 
+//      or by the OS if the process dies
+
+#ifdef _WIN32
+
+void* spillMap(const size_t bytes, void*& handle)
+{
+    wchar_t dir[MAX_PATH + 1], path[MAX_PATH + 1];
+    if (!GetTempPathW(MAX_PATH + 1, dir) || !GetTempFileNameW(dir, L"tap", 0, path)) return nullptr;
+
+    HANDLE file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return nullptr;
+
+    //  The mapping keeps the file open
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE,
+        DWORD(uint64_t(bytes) >> 32), DWORD(bytes & 0xFFFFFFFF), nullptr);
+    CloseHandle(file);
+    if (!mapping) return nullptr;
+
+    void* memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+    if (!memory)
+    {
+        CloseHandle(mapping);
+        return nullptr;
+    }
+
+    handle = mapping;
+    return memory;
+}
+
+void spillUnmap(void* memory, const size_t, void* handle)
+{
+    UnmapViewOfFile(memory);
+    CloseHandle(handle);
+}
+
+#else
+
+void* spillMap(const size_t bytes, void*& handle)
+{
+    const char* tmp = getenv("TMPDIR");
+    string path = string(tmp && *tmp ? tmp : "/tmp") + "/tapeXXXXXX";
+
+    const int fd = mkstemp(&path[0]);
+    if (fd < 0) return nullptr;
+    unlink(path.c_str());
+
+    void* memory = ftruncate(fd, off_t(bytes)) == 0
+        ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+    //  The mapping keeps the file open
+    close(fd);
+    if (memory == MAP_FAILED) return nullptr;
+
+    handle = nullptr;
+    return memory;
+}
+
+void spillUnmap(void* memory, const size_t bytes, void*)
+{
+    munmap(memory, bytes);
+}
+
+#endif
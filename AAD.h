@@ -16,6 +16,8 @@ As long as this comment is preserved at the top of the file
 
 #pragma once
 
+#include <memory>
+
 //  So we can instrument Gaussians like standard math functions
 #include "gaussians.h"
 
@@ -26,6 +28,8 @@ As long as this comment is preserved at the top of the file
 #if AADET
 
 #include "AADExpr.h"
+//  Forward mode, on the same operators
+#include "AADDual.h"
 
 #else
 
@@ -42,7 +46,7 @@ struct numResultsResetterForAAD
 	~numResultsResetterForAAD()
 	{
 		Tape::multi = false;
-		Node::numAdj = 1;
+		Node::setNumAdj(1);
 	}
 };
 
@@ -50,12 +54,27 @@ struct numResultsResetterForAAD
 inline auto setNumResultsForAAD(const bool multi = false, const size_t numResults = 1)
 {
 	Tape::multi = multi;
-	Node::numAdj = numResults;
+	Node::setNumAdj(numResults);
 	return make_unique<numResultsResetterForAAD>();
 }
 
 //  Other utilities
 
+//  Put on tape, so templated code can make its inputs active
+//  Does nothing for doubles
+inline void putOnTape(Number& x)
+{
+    x.putOnTape();
+}
+inline void putOnTape(double&) {}
+inline void putOnTape(float&) {}
+inline void putOnTape(Dual&) {}
+//  Second order: the value goes on tape, the tangent is the direction
+inline void putOnTape(DualNumber& x)
+{
+    x.value().putOnTape();
+}
+
 //	Put collection on tape
 template <class IT>
 inline void putOnTape(IT begin, IT end)
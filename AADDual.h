@@ -0,0 +1,223 @@
+/*
+Written by Antoine Savine in 2018
+
+This code is the strict IP of Antoine Savine
+
+License to use and alter this code for personal and commercial applications
+is freely granted to any person or company who purchased a copy of the book
+
+Modern Computational Finance: AAD and Parallel Simulations
+Antoine Savine
+Wiley, 2018
+
+As long as this comment is preserved at the top of the file
+*/
+
+#pragma once
+
+//  Forward mode (tangent) AD
+//  A Dual carries a value and its derivative in one direction,
+//      both computed in the same forward pass, without tape
+
+//  For one input or one direction in the inputs,
+//      like a delta or a scenario derivative of many payoffs,
+//      this is cheaper than AAD:
+//      no recording, no mark and rewind, no backward sweep
+//  AAD remains the choice for many inputs, one pass computes all its risks
+
+//  Derivatives are computed with the same operators as AADET, see AADExpr.h
+//  Included from AAD.h
+
+//  Dual = DualT<double> is the forward mode
+//  DualNumber = DualT<Number> is the second order mode, forward over reverse:
+//      value and tangent are Numbers, recorded on tape,
+//      so the adjoints of the tangent are the Hessian in the direction
+//      times the direction, see mcSimulAAD2()
+
+#include "AADExpr.h"
+
+template <class T>
+class DualT
+{
+    T   myValue;
+    T   myTangent;
+
+    //  Dual operations from the AADET operators
+    template <class OP>
+    static DualT binary(const DualT& lhs, const DualT& rhs)
+    {
+        const T v = OP::eval(lhs.myValue, rhs.myValue);
+        return DualT(v,
+            OP::leftDerivative(lhs.myValue, rhs.myValue, v) * lhs.myTangent
+            + OP::rightDerivative(lhs.myValue, rhs.myValue, v) * rhs.myTangent);
+    }
+
+    //  Also binaries with a double on one side
+    template <class OP>
+    static DualT unary(const DualT& arg, const double d = 0.0)
+    {
+        const T v = OP::eval(arg.myValue, d);
+        return DualT(v, OP::derivative(arg.myValue, v, d) * arg.myTangent);
+    }
+
+public:
+
+    //  Constructors
+
+    //  Duals constructed or assigned from doubles are constants, with zero tangent
+    //  Inputs are seeded with their direction, see mcSimulTangent()
+
+    DualT() : myTangent(0.0) {}
+
+    explicit DualT(const double val) : myValue(val), myTangent(0.0) {}
+
+    DualT(const T& val, const T& tangent) : myValue(val), myTangent(tangent) {}
+
+    DualT& operator=(const double val)
+    {
+        myValue = val;
+        myTangent = 0.0;
+        return *this;
+    }
+
+    //  Explicit coversion to double
+    explicit operator double& () { return static_cast<double&>(myValue); }
+    explicit operator double () const { return double(myValue); }
+
+    //  Accessors: value and tangent
+
+    T& value()
+    {
+        return myValue;
+    }
+    const T& value() const
+    {
+        return myValue;
+    }
+
+    T& tangent()
+    {
+        return myTangent;
+    }
+    const T& tangent() const
+    {
+        return myTangent;
+    }
+
+    //  Operators
+
+    friend DualT operator*(const DualT& lhs, const DualT& rhs) { return binary<OPMult>(lhs, rhs); }
+    friend DualT operator+(const DualT& lhs, const DualT& rhs) { return binary<OPAdd>(lhs, rhs); }
+    friend DualT operator-(const DualT& lhs, const DualT& rhs) { return binary<OPSub>(lhs, rhs); }
+    friend DualT operator/(const DualT& lhs, const DualT& rhs) { return binary<OPDiv>(lhs, rhs); }
+    friend DualT pow(const DualT& lhs, const DualT& rhs) { return binary<OPPow>(lhs, rhs); }
+    friend DualT max(const DualT& lhs, const DualT& rhs) { return binary<OPMax>(lhs, rhs); }
+    friend DualT min(const DualT& lhs, const DualT& rhs) { return binary<OPMin>(lhs, rhs); }
+
+    friend DualT exp(const DualT& arg) { return unary<OPExp>(arg); }
+    friend DualT log(const DualT& arg) { return unary<OPLog>(arg); }
+    friend DualT sqrt(const DualT& arg) { return unary<OPSqrt>(arg); }
+    friend DualT fabs(const DualT& arg) { return unary<OPFabs>(arg); }
+    friend DualT normalDens(const DualT& arg) { return unary<OPNormalDens>(arg); }
+    friend DualT normalCdf(const DualT& arg) { return unary<OPNormalCdf>(arg); }
+
+    //  With a double on one side
+
+    friend DualT operator*(const double d, const DualT& rhs) { return unary<OPMultD>(rhs, d); }
+    friend DualT operator*(const DualT& lhs, const double d) { return unary<OPMultD>(lhs, d); }
+    friend DualT operator+(const double d, const DualT& rhs) { return unary<OPAddD>(rhs, d); }
+    friend DualT operator+(const DualT& lhs, const double d) { return unary<OPAddD>(lhs, d); }
+    friend DualT operator-(const double d, const DualT& rhs) { return unary<OPSubDL>(rhs, d); }
+    friend DualT operator-(const DualT& lhs, const double d) { return unary<OPSubDR>(lhs, d); }
+    friend DualT operator/(const double d, const DualT& rhs) { return unary<OPDivDL>(rhs, d); }
+    friend DualT operator/(const DualT& lhs, const double d) { return unary<OPDivDR>(lhs, d); }
+    friend DualT pow(const double d, const DualT& rhs) { return unary<OPPowDL>(rhs, d); }
+    friend DualT pow(const DualT& lhs, const double d) { return unary<OPPowDR>(lhs, d); }
+    friend DualT max(const double d, const DualT& rhs) { return unary<OPMaxD>(rhs, d); }
+    friend DualT max(const DualT& lhs, const double d) { return unary<OPMaxD>(lhs, d); }
+    friend DualT min(const double d, const DualT& rhs) { return unary<OPMinD>(rhs, d); }
+    friend DualT min(const DualT& lhs, const double d) { return unary<OPMinD>(lhs, d); }
+
+    //  Unary +/-
+
+    friend DualT operator-(const DualT& rhs) { return DualT(-rhs.myValue, -rhs.myTangent); }
+    friend DualT operator+(const DualT& rhs) { return rhs; }
+
+    //  Comparison, on values
+
+    friend bool operator==(const DualT& lhs, const DualT& rhs) { return lhs.myValue == rhs.myValue; }
+    friend bool operator==(const DualT& lhs, const double rhs) { return lhs.myValue == rhs; }
+    friend bool operator==(const double lhs, const DualT& rhs) { return lhs == rhs.myValue; }
+    friend bool operator!=(const DualT& lhs, const DualT& rhs) { return lhs.myValue != rhs.myValue; }
+    friend bool operator!=(const DualT& lhs, const double rhs) { return lhs.myValue != rhs; }
+    friend bool operator!=(const double lhs, const DualT& rhs) { return lhs != rhs.myValue; }
+    friend bool operator<(const DualT& lhs, const DualT& rhs) { return lhs.myValue < rhs.myValue; }
+    friend bool operator<(const DualT& lhs, const double rhs) { return lhs.myValue < rhs; }
+    friend bool operator<(const double lhs, const DualT& rhs) { return lhs < rhs.myValue; }
+    friend bool operator>(const DualT& lhs, const DualT& rhs) { return lhs.myValue > rhs.myValue; }
+    friend bool operator>(const DualT& lhs, const double rhs) { return lhs.myValue > rhs; }
+    friend bool operator>(const double lhs, const DualT& rhs) { return lhs > rhs.myValue; }
+    friend bool operator<=(const DualT& lhs, const DualT& rhs) { return lhs.myValue <= rhs.myValue; }
+    friend bool operator<=(const DualT& lhs, const double rhs) { return lhs.myValue <= rhs; }
+    friend bool operator<=(const double lhs, const DualT& rhs) { return lhs <= rhs.myValue; }
+    friend bool operator>=(const DualT& lhs, const DualT& rhs) { return lhs.myValue >= rhs.myValue; }
+    friend bool operator>=(const DualT& lhs, const double rhs) { return lhs.myValue >= rhs; }
+    friend bool operator>=(const double lhs, const DualT& rhs) { return lhs >= rhs.myValue; }
+
+    //  Compound assignment
+
+    DualT& operator+=(const DualT& rhs)
+    {
+        myValue = myValue + rhs.myValue;
+        myTangent = myTangent + rhs.myTangent;
+        return *this;
+    }
+
+    DualT& operator-=(const DualT& rhs)
+    {
+        myValue = myValue - rhs.myValue;
+        myTangent = myTangent - rhs.myTangent;
+        return *this;
+    }
+
+    DualT& operator*=(const DualT& rhs)
+    {
+        *this = *this * rhs;
+        return *this;
+    }
+
+    DualT& operator/=(const DualT& rhs)
+    {
+        *this = *this / rhs;
+        return *this;
+    }
+
+    DualT& operator+=(const double d)
+    {
+        myValue = myValue + d;
+        return *this;
+    }
+
+    DualT& operator-=(const double d)
+    {
+        myValue = myValue - d;
+        return *this;
+    }
+
+    DualT& operator*=(const double d)
+    {
+        myValue = myValue * d;
+        myTangent = myTangent * d;
+        return *this;
+    }
+
+    DualT& operator/=(const double d)
+    {
+        myValue = myValue / d;
+        myTangent = myTangent / d;
+        return *this;
+    }
+};
+
+using Dual = DualT<double>;
+using DualNumber = DualT<Number>;
@@ -78,7 +78,7 @@ public:
     //  Expressions know
     //  AT COMPILE TIME
     //  the number of active inputs in their sub-expressions
-    enum { numNumbers = LHS::numNumbers + RHS::numNumbers };
+    static constexpr size_t numNumbers = LHS::numNumbers + RHS::numNumbers;
 
     //  Push adjoint down the expression
     //  N : total number of active inputs in the expression
@@ -92,163 +92,210 @@ public:
         const
     {
         //  Push on the left
-        if (LHS::numNumbers > 0)
+        if constexpr (LHS::numNumbers > 0)
         {
-            lhs.pushAdjoint<N, n>(
+            lhs.template pushAdjoint<N, n>(
                 exprNode, 
                 adjoint * OP::leftDerivative(lhs.value(), rhs.value(), value()));
         }
 
         //  Push on the right
-        if (RHS::numNumbers > 0)
+        if constexpr (RHS::numNumbers > 0)
         {
             //  Note left push processed LHS::numNumbers numbers
             //  So the next number to be processed is n + LHS::numNumbers
-            rhs.pushAdjoint<N, n + LHS::numNumbers>(
+            rhs.template pushAdjoint<N, n + LHS::numNumbers>(
                 exprNode, 
                 adjoint * OP::rightDerivative(lhs.value(), rhs.value(), value()));
         }
     }
+
+    //  Activity: number of inputs actually on tape, known at run time
+    size_t numActive() const
+    {
+        return lhs.numActive() + rhs.numActive();
+    }
+
+    //  Push adjoint down the expression, skipping passive inputs
+    //  i : index of the next active input on the node, incremented
+    void pushAdjointActive(
+        Node&		exprNode,
+        const double	adjoint,
+        size_t&     i)
+        const
+    {
+        lhs.pushAdjointActive(
+            exprNode,
+            adjoint * OP::leftDerivative(lhs.value(), rhs.value(), value()),
+            i);
+        rhs.pushAdjointActive(
+            exprNode,
+            adjoint * OP::rightDerivative(lhs.value(), rhs.value(), value()),
+            i);
+    }
 };
 
 //  "Concrete" binaries, we only need to define operations and derivatives
+//  Templated on the argument type, double here, 
+//      Number in second order forward mode, see AADDual.h
 struct OPMult
 {
-    static const double eval(const double l, const double r) 
+    template <class T>
+    static T eval(const T& l, const T& r) 
     { 
-        return l * r; 
+        return T(l * r); 
     }
     
-    static const double leftDerivative
-        (const double l, const double r, const double v) 
+    template <class T>
+    static T leftDerivative
+        (const T& l, const T& r, const T& v) 
     { 
-        return r; 
+        return T(r); 
     }
     
-    static const double rightDerivative
-        (const double l, const double r, const double v) 
+    template <class T>
+    static T rightDerivative
+        (const T& l, const T& r, const T& v) 
     { 
-        return l; 
+        return T(l); 
     }
 };
 
 struct OPAdd
 {
-    static const double eval(const double l, const double r)
+    template <class T>
+    static T eval(const T& l, const T& r)
     { 
-        return l + r; 
+        return T(l + r); 
     }
     
-    static const double leftDerivative
-        (const double l, const double r, const double v)
+    template <class T>
+    static T leftDerivative
+        (const T& l, const T& r, const T& v)
     { 
-        return 1.0; 
+        return T(1.0); 
     }
     
-    static const double rightDerivative
-        (const double l, const double r, const double v)
+    template <class T>
+    static T rightDerivative
+        (const T& l, const T& r, const T& v)
     { 
-        return 1.0; 
+        return T(1.0); 
     }
 };
 
 struct OPSub
 {
-    static const double eval(const double l, const double r)
+    template <class T>
+    static T eval(const T& l, const T& r)
     {
-        return l - r;
+        return T(l - r);
     }
 
-    static const double leftDerivative
-    (const double l, const double r, const double v)
+    template <class T>
+    static T leftDerivative
+    (const T& l, const T& r, const T& v)
     {
-        return 1.0;
+        return T(1.0);
     }
 
-    static const double rightDerivative
-    (const double l, const double r, const double v)
+    template <class T>
+    static T rightDerivative
+    (const T& l, const T& r, const T& v)
     {
-        return -1.0;
+        return T(-1.0);
     }
 };
 
 struct OPDiv
 {
-    static const double eval(const double l, const double r)
+    template <class T>
+    static T eval(const T& l, const T& r)
     {
-        return l / r;
+        return T(l / r);
     }
 
-    static const double leftDerivative
-    (const double l, const double r, const double v)
+    template <class T>
+    static T leftDerivative
+    (const T& l, const T& r, const T& v)
     {
-        return 1.0 / r;
+        return T(1.0 / r);
     }
 
-    static const double rightDerivative
-    (const double l, const double r, const double v)
+    template <class T>
+    static T rightDerivative
+    (const T& l, const T& r, const T& v)
     {
-        return -l / r / r;
+        return T(-l / r / r);
     }
 };
 
 struct OPPow
 {
-    static const double eval(const double l, const double r)
+    template <class T>
+    static T eval(const T& l, const T& r)
     {
-        return pow(l, r);
+        return T(pow(l, r));
     }
 
-    static const double leftDerivative
-    (const double l, const double r, const double v)
+    template <class T>
+    static T leftDerivative
+    (const T& l, const T& r, const T& v)
     {
-        return r*v / l;
+        return T(r*v / l);
     }
 
-    static const double rightDerivative
-    (const double l, const double r, const double v)
+    template <class T>
+    static T rightDerivative
+    (const T& l, const T& r, const T& v)
     {
-        return log(l)*v;
+        return T(log(l)*v);
     }
 };
 
 struct OPMax
 {
-    static const double eval(const double l, const double r)
+    template <class T>
+    static T eval(const T& l, const T& r)
     {
-        return max(l, r);
+        return T(max(l, r));
     }
 
-    static const double leftDerivative
-    (const double l, const double r, const double v)
+    template <class T>
+    static T leftDerivative
+    (const T& l, const T& r, const T& v)
     {
-        return l > r ? 1.0 : 0.0;
+        return T(l > r ? 1.0 : 0.0);
     }
 
-    static const double rightDerivative
-    (const double l, const double r, const double v)
+    template <class T>
+    static T rightDerivative
+    (const T& l, const T& r, const T& v)
     {
-        return r > l? 1.0 : 0.0;
+        return T(r > l? 1.0 : 0.0);
     }
 };
 
 struct OPMin
 {
-    static const double eval(const double l, const double r)
+    template <class T>
+    static T eval(const T& l, const T& r)
     {
-        return min(l, r);
+        return T(min(l, r));
     }
 
-    static const double leftDerivative
-    (const double l, const double r, const double v)
+    template <class T>
+    static T leftDerivative
+    (const T& l, const T& r, const T& v)
     {
-        return l < r ? 1.0 : 0.0;
+        return T(l < r ? 1.0 : 0.0);
     }
 
-    static const double rightDerivative
-    (const double l, const double r, const double v)
+    template <class T>
+    static T rightDerivative
+    (const T& l, const T& r, const T& v)
     {
-        return r < l ? 1.0 : 0.0;
+        return T(r < l ? 1.0 : 0.0);
     }
 };
 
@@ -338,7 +385,7 @@ public:
     double value() const { return myValue; }
 
     //	Expression template magic
-    enum { numNumbers = ARG::numNumbers };
+    static constexpr size_t numNumbers = ARG::numNumbers;
 
     //  Push adjoint down the expression 
     template <size_t N, size_t n>
@@ -350,98 +397,128 @@ public:
         const
     {
         //  Push into argument
-        if (ARG::numNumbers > 0)
+        if constexpr (ARG::numNumbers > 0)
         {
-            arg.pushAdjoint<N, n>(
+            arg.template pushAdjoint<N, n>(
                 exprNode, 
                 adjoint * OP::derivative(arg.value(), value(), dArg));
         }
     }
+
+    //  Activity
+    size_t numActive() const
+    {
+        return arg.numActive();
+    }
+
+    void pushAdjointActive(
+        Node&		exprNode,
+        const double	adjoint,
+        size_t&     i)
+        const
+    {
+        arg.pushAdjointActive(
+            exprNode, 
+            adjoint * OP::derivative(arg.value(), value(), dArg),
+            i);
+    }
 };
 
 //  The unary operators
 
 struct OPExp
 {
-    static const double eval(const double r, const double d) 
+    template <class T>
+    static T eval(const T& r, const double d) 
     { 
-        return exp(r); 
+        return T(exp(r)); 
     }
     
-    static const double derivative
-        (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+        (const T& r, const T& v, const double d)
     { 
-        return v; 
+        return T(v); 
     }
 };
 
 struct OPLog
 {
-    static const double eval(const double r, const double d)
+    template <class T>
+    static T eval(const T& r, const double d)
     { 
-        return log(r); 
+        return T(log(r)); 
     }
     
-    static const double derivative
-        (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+        (const T& r, const T& v, const double d)
     { 
-        return 1.0 / r; 
+        return T(1.0 / r); 
     }
 };
 
 struct OPSqrt
 {
-    static const double eval(const double r, const double d)
+    template <class T>
+    static T eval(const T& r, const double d)
     { 
-        return sqrt(r); 
+        return T(sqrt(r)); 
     }
 
-    static const double derivative
-        (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+        (const T& r, const T& v, const double d)
     { 
-        return 0.5 / v; 
+        return T(0.5 / v); 
     }
 };
 
 struct OPFabs
 {
-    static const double eval(const double r, const double d)
+    template <class T>
+    static T eval(const T& r, const double d)
     {
-        return fabs(r);
+        return T(fabs(r));
     }
 
-    static const double derivative
-    (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+    (const T& r, const T& v, const double d)
     {
-        return r > 0.0 ? 1.0 : -1.0;
+        return T(r > 0.0 ? 1.0 : -1.0);
     }
 };
 
 struct OPNormalDens
 {
-    static const double eval(const double r, const double d)
+    template <class T>
+    static T eval(const T& r, const double d)
     {
-        return normalDens(r);
+        return T(normalDens(r));
     }
 
-    static const double derivative
-    (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+    (const T& r, const T& v, const double d)
     {
-        return - r * v;
+        return T(- r * v);
     }
 };
 
 struct OPNormalCdf
 {
-    static const double eval(const double r, const double d)
+    template <class T>
+    static T eval(const T& r, const double d)
     {
-        return normalCdf(r);
+        return T(normalCdf(r));
     }
 
-    static const double derivative
-    (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+    (const T& r, const T& v, const double d)
     {
-        return normalDens(r);
+        return T(normalDens(r));
     }
 };
 
@@ -450,150 +527,170 @@ struct OPNormalCdf
 //  * double or double *
 struct OPMultD
 {
-    static const double eval(const double r, const double d)
+    template <class T>
+    static T eval(const T& r, const double d)
     {
-        return r * d;
+        return T(r * d);
     }
 
-    static const double derivative
-    (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+    (const T& r, const T& v, const double d)
     {
-        return d;
+        return T(d);
     }
 };
 
 //  + double or double +
 struct OPAddD
 {
-    static const double eval(const double r, const double d)
+    template <class T>
+    static T eval(const T& r, const double d)
     {
-        return r + d;
+        return T(r + d);
     }
 
-    static const double derivative
-    (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+    (const T& r, const T& v, const double d)
     {
-        return 1.0;
+        return T(1.0);
     }
 };
 
 //  double -
 struct OPSubDL
 {
-    static const double eval(const double r, const double d)
+    template <class T>
+    static T eval(const T& r, const double d)
     {
-        return d - r;
+        return T(d - r);
     }
 
-    static const double derivative
-    (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+    (const T& r, const T& v, const double d)
     {
-        return -1.0;
+        return T(-1.0);
     }
 };
 
 //  - double
 struct OPSubDR
 {
-    static const double eval(const double r, const double d)
+    template <class T>
+    static T eval(const T& r, const double d)
     {
-        return r - d;
+        return T(r - d);
     }
 
-    static const double derivative
-    (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+    (const T& r, const T& v, const double d)
     {
-        return 1.0;
+        return T(1.0);
     }
 };
 
 //  double /
 struct OPDivDL
 {
-    static const double eval(const double r, const double d)
+    template <class T>
+    static T eval(const T& r, const double d)
     {
-        return d / r;
+        return T(d / r);
     }
 
-    static const double derivative
-    (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+    (const T& r, const T& v, const double d)
     {
-        return -d / r / r;
+        return T(-d / r / r);
     }
 };
 
 //  / double
 struct OPDivDR
 {
-    static const double eval(const double r, const double d)
+    template <class T>
+    static T eval(const T& r, const double d)
     {
-        return r / d;
+        return T(r / d);
     }
 
-    static const double derivative
-    (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+    (const T& r, const T& v, const double d)
     {
-        return 1.0 / d;
+        return T(1.0 / d);
     }
 };
 
 //  pow (d,)
 struct OPPowDL
 {
-    static const double eval(const double r, const double d)
+    template <class T>
+    static T eval(const T& r, const double d)
     {
-        return pow(d, r);
+        return T(pow(d, r));
     }
 
-    static const double derivative
-    (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+    (const T& r, const T& v, const double d)
     {
-        return log(d) * v;
+        return T(log(d) * v);
     }
 };
 
 //  pow (,d)
 struct OPPowDR
 {
-    static const double eval(const double r, const double d)
+    template <class T>
+    static T eval(const T& r, const double d)
     {
-        return pow(r, d);
+        return T(pow(r, d));
     }
 
-    static const double derivative
-    (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+    (const T& r, const T& v, const double d)
     {
-        return d * v / r;
+        return T(d * v / r);
     }
 };
 
 //  max (d,)
 struct OPMaxD
 {
-    static const double eval(const double r, const double d)
+    template <class T>
+    static T eval(const T& r, const double d)
     {
-        return max(r, d);
+        return T(max(r, d));
     }
 
-    static const double derivative
-    (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+    (const T& r, const T& v, const double d)
     {
-        return r > d ? 1.0 : 0.0;
+        return T(r > d ? 1.0 : 0.0);
     }
 };
 
 //  min (d,)
 struct OPMinD
 {
-    static const double eval(const double r, const double d)
+    template <class T>
+    static T eval(const T& r, const double d)
     {
-        return min(r, d);
+        return T(min(r, d));
     }
 
-    static const double derivative
-    (const double r, const double v, const double d)
+    template <class T>
+    static T derivative
+    (const T& r, const T& v, const double d)
     {
-        return r < d ? 1.0 : 0.0;
+        return T(r < d ? 1.0 : 0.0);
     }
 };
 
@@ -870,25 +967,64 @@ class Number : public Expression<Number>
     //  Flattening:
     //      This is where, on assignment or construction from an expression,
     //      that derivatives are pushed through the expression's DAG 
+
+    //  Activity:
+    //      Numbers that don't depend on anything on tape are passive,
+    //      with a null node: constants, or expressions of constants
+    //      Passive numbers are never recorded
     template<class E>
     void fromExpr(
         //  RHS expression, will be flattened into this Number
         const Expression<E>& e)
     {
-        //  Build expression node on tape
-        auto* node = createMultiNode<E::numNumbers>();
-        
-        //  Push adjoints through expression with adjoint = 1 on top
-        static_cast<const E&>(e).pushAdjoint<E::numNumbers, 0>(*node, 1.0);
+        const E& expr = static_cast<const E&>(e);
+
+        //  Number of active inputs
+        const size_t active = expr.numActive();
+
+        //  All inputs active, the usual case in models
+        //      the node size is known at compile time
+        if (active == E::numNumbers)
+        {
+            //  Build expression node on tape
+            auto* node = createMultiNode<E::numNumbers>();
+
+            //  Push adjoints through expression with adjoint = 1 on top
+            expr.template pushAdjoint<E::numNumbers, 0>(*node, 1.0);
+
+            //  Set my node
+            myNode = node;
+        }
+        //  No active input: passive result
+        else if (!active)
+        {
+            myNode = nullptr;
+        }
+        //  Some active inputs: record them only
+        else
+        {
+            auto* node = tape->recordNode(active);
 
-        //  Set my node
-        myNode = node;
+            size_t i = 0;
+            expr.pushAdjointActive(*node, 1.0, i);
+
+            myNode = node;
+        }
+    }
+
+    //  Adjoint of passive numbers, always zero, writes are discarded
+    static thread_local double passiveAdjoint;
+
+    double& passive() const
+    {
+        passiveAdjoint = 0.0;
+        return passiveAdjoint;
     }
 
 public:
 
     //  Expression template magic
-    enum { numNumbers = 1 };
+    static constexpr size_t numNumbers = 1;
 
     //  Push adjoint
     //  Numbers are expression leaves, 
@@ -906,10 +1042,36 @@ public:
         //  note n: index of this number on the node on tape
 
         //  Register adjoint
-        exprNode.pAdjPtrs[n] = Tape::multi? myNode->pAdjoints : &myNode->mAdjoint;
+        exprNode.adjPtrs()[n] = adjPtr();
 		
         //  Register derivative
-        exprNode.pDerivatives[n] = adjoint;
+        exprNode.derivatives()[n] = adjoint;
+    }
+
+    //  Activity
+    size_t numActive() const
+    {
+        return myNode != nullptr;
+    }
+
+    //  Pointer to adjoint(s), for the nodes of dependents
+    double* adjPtr() const
+    {
+        return Tape::multi ? myNode->pAdjoints : &myNode->mAdjoint;
+    }
+
+    //  Register on the next slot, if active
+    void pushAdjointActive(
+        Node&		    exprNode,
+        const double	adjoint,
+        size_t&         i)
+        const
+    {
+        if (!myNode) return;
+
+        exprNode.adjPtrs()[i] = adjPtr();
+        exprNode.derivatives()[i] = adjoint;
+        ++i;
     }
 
     //  Static access to tape, same as traditional
@@ -917,19 +1079,17 @@ public:
 
     //  Constructors
 
-    Number() {}
+    //  Numbers constructed or assigned from doubles are passive
+    //  putOnTape() makes them active, for instance model parameters
 
-    explicit Number(const double val) : myValue(val)
-    {
-        //  Create leaf
-        myNode = createMultiNode<0>();
-    }
+    Number() : myNode(nullptr) {}
+
+    explicit Number(const double val) : myValue(val), myNode(nullptr) {}
 
     Number& operator=(const double val)
     {
         myValue = val;
-        //  Create leaf
-        myNode = createMultiNode<0>();
+        myNode = nullptr;
         return *this;
     }
 
@@ -979,24 +1139,30 @@ public:
         return myValue;
     }
     
+    //  Active?
+    bool active() const
+    {
+        return myNode != nullptr;
+    }
+
     //  Single dimensional
     double& adjoint()
     {
-        return myNode->adjoint();
+        return myNode ? myNode->adjoint() : passive();
     }
     double adjoint() const
     {
-        return myNode->adjoint();
+        return myNode ? myNode->adjoint() : 0.0;
     }
 
     //  Multi dimensional
     double& adjoint(const size_t n)
     {
-        return myNode->adjoint(n);
+        return myNode ? myNode->adjoint(n) : passive();
     }
     double adjoint(const size_t n) const
     {
-        return myNode->adjoint(n);
+        return myNode ? myNode->adjoint(n) : 0.0;
     }
 
 	//  Reset all adjoints on the tape
@@ -1006,6 +1172,152 @@ public:
 		tape->resetAdjoints();
 	}
 
+    //  N-ary sums and products
+    //  Recorded as one node with a child per active input, 
+    //      where a chain of binary operations records a node per input
+    //  Passive inputs are skipped, as in expressions
+
+    //  Sum of weights[i] * x[i]
+    template <class IT, class WIT>
+    static Number weightedSum(IT begin, IT end, WIT weights)
+    {
+        Number result(0.0);
+        size_t active = 0;
+        WIT w = weights;
+        for (IT it = begin; it != end; ++it, ++w)
+        {
+            result.myValue += it->myValue * *w;
+            active += it->active();
+        }
+        if (!active) return result;
+
+        Node* node = tape->recordNode(active);
+        double* ders = node->derivatives();
+        double** ptrs = node->adjPtrs();
+        size_t i = 0;
+        w = weights;
+        for (IT it = begin; it != end; ++it, ++w)
+        {
+            if (!it->active()) continue;
+            ders[i] = *w;
+            ptrs[i] = it->adjPtr();
+            ++i;
+        }
+        result.myNode = node;
+
+        return result;
+    }
+
+    //  Sum of x[i]
+    template <class IT>
+    static Number sum(IT begin, IT end)
+    {
+        Number result(0.0);
+        size_t active = 0;
+        for (IT it = begin; it != end; ++it)
+        {
+            result.myValue += it->myValue;
+            active += it->active();
+        }
+        if (!active) return result;
+
+        Node* node = tape->recordNode(active);
+        double* ders = node->derivatives();
+        double** ptrs = node->adjPtrs();
+        size_t i = 0;
+        for (IT it = begin; it != end; ++it)
+        {
+            if (!it->active()) continue;
+            ders[i] = 1.0;
+            ptrs[i] = it->adjPtr();
+            ++i;
+        }
+        result.myNode = node;
+
+        return result;
+    }
+
+    //  Product of x[i]
+    //  Derivatives are products of all other inputs, 
+    //      with prefix and suffix products so zeros are fine
+    //  Bidirectional iterators
+    template <class IT>
+    static Number product(IT begin, IT end)
+    {
+        Number result(1.0);
+        size_t active = 0;
+        for (IT it = begin; it != end; ++it)
+        {
+            active += it->active();
+        }
+        if (!active)
+        {
+            for (IT it = begin; it != end; ++it) result.myValue *= it->myValue;
+            return result;
+        }
+
+        Node* node = tape->recordNode(active);
+        double* ders = node->derivatives();
+        double** ptrs = node->adjPtrs();
+
+        //  Prefix products, and value
+        size_t i = 0;
+        for (IT it = begin; it != end; ++it)
+        {
+            if (it->active())
+            {
+                ders[i] = result.myValue;
+                ptrs[i] = it->adjPtr();
+                ++i;
+            }
+            result.myValue *= it->myValue;
+        }
+
+        //  Times suffix products
+        double suffix = 1.0;
+        for (IT it = end; it != begin;)
+        {
+            --it;
+            if (it->active()) ders[--i] *= suffix;
+            suffix *= it->myValue;
+        }
+        result.myNode = node;
+
+        return result;
+    }
+
+    //  Number with a given value and given derivatives to x[i]
+    //      typically computed on another tape, see dupireCalib()
+    //  Inputs with zero derivatives are skipped, as passive inputs
+    template <class IT, class DIT>
+    static Number fromDerivatives(const double value, IT begin, IT end, DIT derivs)
+    {
+        Number result(value);
+        size_t active = 0;
+        DIT d = derivs;
+        for (IT it = begin; it != end; ++it, ++d)
+        {
+            active += it->active() && *d != 0.0;
+        }
+        if (!active) return result;
+
+        Node* node = tape->recordNode(active);
+        double* ders = node->derivatives();
+        double** ptrs = node->adjPtrs();
+        size_t i = 0;
+        d = derivs;
+        for (IT it = begin; it != end; ++it, ++d)
+        {
+            if (!it->active() || *d == 0.0) continue;
+            ders[i] = *d;
+            ptrs[i] = it->adjPtr();
+            ++i;
+        }
+        result.myNode = node;
+
+        return result;
+    }
+
     //  Propagation
 
     //  Propagate adjoints
@@ -1014,6 +1326,9 @@ public:
 		Tape::iterator propagateFrom,
 		Tape::iterator propagateTo)
     {
+        //  Empty range, for instance nothing above mark
+        if (propagateFrom.atEnd() || propagateTo.atEnd()) return;
+
         auto it = propagateFrom;
         while (it != propagateTo)
         {
@@ -1031,17 +1346,13 @@ public:
         //  We start on this number's node
 		Tape::iterator propagateTo)
     {
+        //  Passive: nothing to propagate
+        if (!myNode) return;
+
         //  Set this adjoint to 1
         adjoint() = 1.0;
-        //  Find node on tape
-        auto it = tape->find(myNode);
-        //  Reverse and propagate until we hit the stop
-        while (it != propagateTo)
-        {
-            it->propagateOne();
-            --it;
-        }
-        it->propagateOne();
+        //  Find node on tape, reverse and propagate until we hit the stop
+        propagateAdjoints(tape->find(myNode), propagateTo);
     }
 
     //  These 2 set the adjoint to 1 on this node
@@ -1069,6 +1380,9 @@ public:
 		Tape::iterator propagateFrom,
 		Tape::iterator propagateTo)
     {
+        //  Empty range, for instance nothing above mark
+        if (propagateFrom.atEnd() || propagateTo.atEnd()) return;
+
         auto it = propagateFrom;
         while (it != propagateTo)
         {
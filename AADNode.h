@@ -23,9 +23,64 @@ As long as this comment is preserved at the top of the file
 
 //  Unchanged for AADET of chapter 15
 
+//  Compact layout: a node is a small header,
+//      immediately followed on tape by its n derivatives 
+//      and its n pointers to child adjoints,
+//      so the backward sweep reads the tape sequentially
+//  Nodes are linked backwards by their size, see Tape
+
 #include <exception>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+#include <utility>
 using namespace std;
 
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+//  Multi-dimensional adjoints (chapter 14) are stored in rows 
+//      of numAdj rounded up to a whole number of SIMD registers,
+//      aligned on the register size, the padding held at zero
+//  4 doubles = one AVX register
+constexpr size_t ADJPACK = 4;
+
+//  Kernels on rows of adjoints, S is the padded size
+
+//  y += a * x
+//  Multiply then add, no FMA, so results don't depend on the instruction set
+inline void adjAxpy(const double a, const double* x, double* y, const size_t S)
+{
+#ifdef __AVX__
+    const __m256d va = _mm256_set1_pd(a);
+    for (size_t j = 0; j < S; j += ADJPACK)
+    {
+        const __m256d vx = _mm256_load_pd(x + j);
+        const __m256d vy = _mm256_load_pd(y + j);
+        _mm256_store_pd(y + j, _mm256_add_pd(vy, _mm256_mul_pd(va, vx)));
+    }
+#else
+    for (size_t j = 0; j < S; ++j) y[j] += a * x[j];
+#endif
+}
+
+//  Are all adjoints zero? 
+//  AVX: or the bits together, then one comparison and one bitmask
+inline bool adjZero(const double* x, const size_t S)
+{
+#ifdef __AVX__
+    __m256d bits = _mm256_setzero_pd();
+    for (size_t j = 0; j < S; j += ADJPACK)
+    {
+        bits = _mm256_or_pd(bits, _mm256_load_pd(x + j));
+    }
+    return !_mm256_movemask_pd(_mm256_cmp_pd(bits, _mm256_setzero_pd(), _CMP_NEQ_UQ));
+#else
+    return all_of(x, x + S, [](const double& a) { return !a; });
+#endif
+}
+
 class Node 
 {
 	friend class Tape;
@@ -39,24 +94,70 @@ class Node
 	//	in multi case, held separately and accessed by pointer (chapter 14)
     double*         pAdjoints;  
 
-	//  Data lives in separate memory
+    //  Number of childs (arguments)
+    const uint32_t  n;
 
-    //  the n derivatives to arguments,
-    double*         pDerivatives;    
+    //  Link to previous node on tape:
+    //      distance in words (8 bytes) when contiguous
+    //      or index in the tape's jump table when flagged
+    uint32_t        myBack = 0;
 
-    //  the n pointers to the adjoints of arguments
-    double**        pAdjPtrs;
+    static constexpr uint32_t JUMP = uint32_t(1) << 31;
 
     //  Number of adjoints (results) to propagate, usually 1
     //  See chapter 14
     static size_t   numAdj;
+    //  Padded to a multiple of ADJPACK
+    static size_t   adjStride;
 
-    //  Number of childs (arguments)
-    const size_t    n;
+    static void setNumAdj(const size_t num)
+    {
+        numAdj = num;
+        adjStride = (num + ADJPACK - 1) / ADJPACK * ADJPACK;
+    }
+
+    //  Data lives inline, right after the header
+
+    //  the n derivatives to arguments,
+    double* derivatives()
+    {
+        return reinterpret_cast<double*>(this + 1);
+    }
+
+    //  the n pointers to the adjoints of arguments
+    double** adjPtrs()
+    {
+        return reinterpret_cast<double**>(derivatives() + n);
+    }
+
+    //  Size on tape, in words, header included
+    static constexpr size_t words(const size_t N)
+    {
+        return sizeof(Node) / sizeof(double) + 2 * N;
+    }
+    size_t words() const
+    {
+        return words(n);
+    }
+
+    //  Next and previous node on tape
+    //      jumps: last node in a block, first node in the next
+
+    Node* next()
+    {
+        return reinterpret_cast<Node*>(reinterpret_cast<double*>(this) + words());
+    }
+
+    Node* prev(const vector<pair<Node*, Node*>>& jumps)
+    {
+        return myBack & JUMP
+            ? jumps[myBack & ~JUMP].first
+            : reinterpret_cast<Node*>(reinterpret_cast<double*>(this) - myBack);
+    }
 
 public:
 
-    Node(const size_t N = 0) : n(N) {}
+    Node(const size_t N = 0) : n(uint32_t(N)) {}
 
     //  Access to adjoint(s)
 	//	single
@@ -75,29 +176,46 @@ public:
 		//  Nothing to propagate
 		if (!n || !mAdjoint) return;
 
+        const double* ders = derivatives();
+        double** ptrs = adjPtrs();
 		for (size_t i = 0; i < n; ++i)
         {
-			*(pAdjPtrs[i]) += pDerivatives[i] * mAdjoint;
+			*(ptrs[i]) += ders[i] * mAdjoint;
         }
     }
 
     //  Multi case, chapter 14
+    //  Explicit kernels for common sizes, unrolled at compile time
     void propagateAll()
 {
         //  No adjoint to propagate
-        if (!n || all_of(pAdjoints, pAdjoints + numAdj,
-            [](const double& x) { return !x; }))
-            return;
+        if (!n || adjZero(pAdjoints, adjStride)) return;
 
-        for (size_t i = 0; i < n; ++i)
+        switch (adjStride)
         {
-            double *adjPtrs = pAdjPtrs[i], ders = pDerivatives[i];
+        case 4:     propagateAll<4>();  break;
+        case 8:     propagateAll<8>();  break;
+        case 16:    propagateAll<16>(); break;
+        case 32:    propagateAll<32>(); break;
+        default:    propagateAll<0>();
+        }
+    }
+
+private:
 
-            //  Vectorized!
-            for (size_t j = 0; j < numAdj; ++j)
-            {
-                adjPtrs[j] += ders * pAdjoints[j];
-            }
+    //  S: padded number of adjoints, 0 = known at run time
+    template <size_t S>
+    void propagateAll()
+    {
+        const size_t stride = S ? S : adjStride;
+        const double* ders = derivatives();
+        double** ptrs = adjPtrs();
+        for (size_t i = 0; i < n; ++i)
+        {
+            adjAxpy(ders[i], pAdjoints, ptrs[i], stride);
         }
     }
-};
\ No newline at end of file
+};
+
+//  Header is a whole number of words so inline data stays aligned
+static_assert(sizeof(Node) % sizeof(double) == 0, "Node header must be word aligned");
@@ -62,13 +62,26 @@ class Number
 
     //	Convenient access to node data for friends
 
-    double& derivative() { return myNode->pDerivatives[0]; }
-    double& lDer() { return myNode->pDerivatives[0]; }
-    double& rDer() { return myNode->pDerivatives[1]; }
+    double& derivative() { return myNode->derivatives()[0]; }
+    double& lDer() { return myNode->derivatives()[0]; }
+    double& rDer() { return myNode->derivatives()[1]; }
 
-    double*& adjPtr() { return myNode->pAdjPtrs[0]; }
-    double*& leftAdj() { return myNode->pAdjPtrs[0]; }
-    double*& rightAdj() { return myNode->pAdjPtrs[1]; }
+    double*& adjPtr() { return myNode->adjPtrs()[0]; }
+    double*& leftAdj() { return myNode->adjPtrs()[0]; }
+    double*& rightAdj() { return myNode->adjPtrs()[1]; }
+
+	//  Pointer to my adjoint(s), for the nodes of dependents
+	double* adjoints() const
+	{
+		return Tape::multi ? myNode->pAdjoints : &myNode->mAdjoint;
+	}
+
+	//	N-ary node, N known at run time
+	Number(const double val, const size_t N) :
+		myValue(val)
+	{
+		myNode = tape->recordNode(N);
+	}
 
 	//	Private constructors for operator overloading
 	
@@ -78,7 +91,7 @@ class Number
     {
         createNode<1>();
 
-		myNode->pAdjPtrs[0] = Tape::multi
+		myNode->adjPtrs()[0] = Tape::multi
 			? arg.pAdjoints 
 			: &arg.mAdjoint;
     }
@@ -91,13 +104,13 @@ class Number
         
         if (Tape::multi)
 		{
-			myNode->pAdjPtrs[0] = lhs.pAdjoints;
-			myNode->pAdjPtrs[1] = rhs.pAdjoints;
+			myNode->adjPtrs()[0] = lhs.pAdjoints;
+			myNode->adjPtrs()[1] = rhs.pAdjoints;
 		}
 		else
     {
-			myNode->pAdjPtrs[0] = &lhs.mAdjoint;
-			myNode->pAdjPtrs[1] = &rhs.mAdjoint;
+			myNode->adjPtrs()[0] = &lhs.mAdjoint;
+			myNode->adjPtrs()[1] = &rhs.mAdjoint;
 		}
     }
 
@@ -172,6 +185,104 @@ public:
 		tape->resetAdjoints();
     }
 
+    //  N-ary sums and products
+    //  Recorded as one node with a child per input, 
+    //      where a chain of binary operations records a node per input
+
+    //  Sum of weights[i] * x[i]
+    template <class IT, class WIT>
+    static Number weightedSum(IT begin, IT end, WIT weights)
+    {
+        double value = 0.0;
+        WIT w = weights;
+        for (IT it = begin; it != end; ++it, ++w) value += it->myValue * *w;
+
+        Number result(value, size_t(distance(begin, end)));
+        size_t i = 0;
+        w = weights;
+        for (IT it = begin; it != end; ++it, ++w, ++i)
+        {
+            result.myNode->derivatives()[i] = *w;
+            result.myNode->adjPtrs()[i] = it->adjoints();
+        }
+
+        return result;
+    }
+
+    //  Sum of x[i]
+    template <class IT>
+    static Number sum(IT begin, IT end)
+    {
+        double value = 0.0;
+        for (IT it = begin; it != end; ++it) value += it->myValue;
+
+        Number result(value, size_t(distance(begin, end)));
+        size_t i = 0;
+        for (IT it = begin; it != end; ++it, ++i)
+        {
+            result.myNode->derivatives()[i] = 1.0;
+            result.myNode->adjPtrs()[i] = it->adjoints();
+        }
+
+        return result;
+    }
+
+    //  Product of x[i]
+    //  Derivatives are products of all other inputs, 
+    //      with prefix and suffix products so zeros are fine
+    //  Bidirectional iterators
+    template <class IT>
+    static Number product(IT begin, IT end)
+    {
+        const size_t n = distance(begin, end);
+        Number result(1.0, n);
+        double* ders = result.myNode->derivatives();
+
+        //  Prefix products, and value
+        size_t i = 0;
+        for (IT it = begin; it != end; ++it, ++i)
+        {
+            ders[i] = result.myValue;
+            result.myNode->adjPtrs()[i] = it->adjoints();
+            result.myValue *= it->myValue;
+        }
+
+        //  Times suffix products
+        double suffix = 1.0;
+        for (IT it = end; it != begin;)
+        {
+            --it;
+            ders[--i] *= suffix;
+            suffix *= it->myValue;
+        }
+
+        return result;
+    }
+
+    //  Number with a given value and given derivatives to x[i]
+    //      typically computed on another tape, see dupireCalib()
+    //  Inputs with zero derivatives are skipped
+    template <class IT, class DIT>
+    static Number fromDerivatives(const double value, IT begin, IT end, DIT derivs)
+    {
+        size_t n = 0;
+        DIT d = derivs;
+        for (IT it = begin; it != end; ++it, ++d) n += *d != 0.0;
+
+        Number result(value, n);
+        size_t i = 0;
+        d = derivs;
+        for (IT it = begin; it != end; ++it, ++d)
+        {
+            if (*d == 0.0) continue;
+            result.myNode->derivatives()[i] = *d;
+            result.myNode->adjPtrs()[i] = it->adjoints();
+            ++i;
+        }
+
+        return result;
+    }
+
 	//  Propagation
 
     //  Propagate adjoints
@@ -180,6 +291,9 @@ public:
         Tape::iterator propagateFrom,
         Tape::iterator propagateTo)
     {
+        //  Empty range, for instance nothing above mark
+        if (propagateFrom.atEnd() || propagateTo.atEnd()) return;
+
         auto it = propagateFrom;
         while (it != propagateTo)
         {
@@ -227,6 +341,9 @@ public:
 		Tape::iterator propagateFrom,
 		Tape::iterator propagateTo)
 	{
+		//  Empty range, for instance nothing above mark
+		if (propagateFrom.atEnd() || propagateTo.atEnd()) return;
+
 		auto it = propagateFrom;
 		while (it != propagateTo)
 		{
@@ -25,25 +25,68 @@ As long as this comment is preserved at the top of the file
 
 #include "blocklist.h"
 #include "AADNode.h"
+#include <memory>
+#include <stdexcept>
 
-constexpr size_t BLOCKSIZE  = 16384;		//	Number of nodes
-constexpr size_t ADJSIZE    = 32768;		//	Number of adjoints
-constexpr size_t DATASIZE   = 65536;		//	Data in bytes
+constexpr size_t BLOCKSIZE  = 131072;		//	Number of words (8 bytes) for nodes and their data
+constexpr size_t ADJSIZE    = 32768;		//	Number of adjoints, multiple of ADJPACK
+
+//  Memory of a tape, in bytes
+struct TapeStats
+{
+    size_t  nodes;
+    //  Nodes with their derivatives and child adjoint pointers
+    size_t  nodeBytes;
+    size_t  nodeHighWater;
+    //  Adjoints in the multi-dimensional case
+    size_t  adjointBytes;
+    size_t  adjointHighWater;
+    size_t  jumpBytes;
+    //  Held, and held on files, see setBudget()
+    size_t  capacity;
+    size_t  spilled;
+};
 
 class Tape
 {
 	//	Working with multiple results / adjoints?
 	static bool							multi;
 
+    //  Memory budget of new tapes, see setBudget()
+    static size_t                       defaultBudget;
+
+    //  Budget on the heap, shared by the blocklists, 
+    //      declared first so it outlives them
+    blockbudget                         myBudget;
+
 	//  Storage for adjoints in multi-dimensional case (chapter 14)
     blocklist<double, ADJSIZE>			myAdjointsMulti;
     
-	//  Storage for derivatives and child adjoint pointers
-	blocklist<double, DATASIZE>			myDers;
-	blocklist<double*, DATASIZE>		myArgPtrs;
+    //  Storage for the nodes, 
+    //      each one followed by its derivatives and child adjoint pointers
+	blocklist<double, BLOCKSIZE>	    myNodes;
+
+    //  First and last node, nullptr when empty
+    Node*                               myFirst = nullptr;
+    Node*                               myLast = nullptr;
+
+    //  Jumps across blocks, in order: 
+    //      last node in a block, first node in the next
+    vector<pair<Node*, Node*>>          myJumps;
+
+    //  Nodes larger than a block, allocated separately, in order
+    //  Linked to their neighbours by jumps
+    vector<unique_ptr<double[]>>        myLarge;
+    size_t                              myLargeWords = 0;
 
-    //  Storage for the nodes
-	blocklist<Node, BLOCKSIZE>		    myNodes;
+    //  Last node, number of jumps and large nodes on mark
+    Node*                               myMarkLast = nullptr;
+    size_t                              myMarkJumps = 0;
+    size_t                              myMarkLarge = 0;
+
+    //  Number of nodes, total and on mark
+    size_t                              myNumNodes = 0;
+    size_t                              myMarkNodes = 0;
 
 	//	Padding so tapes in a vector don't interfere
     char                                myPad[64];
@@ -52,34 +95,105 @@ class Tape
     friend struct numResultsResetterForAAD;
 	friend class Number;
 
+    //  Reset navigation
+    void forget()
+    {
+        myFirst = myLast = myMarkLast = nullptr;
+        myJumps.clear();
+        clearLarge(0);
+        myMarkJumps = myMarkLarge = 0;
+        myNumNodes = myMarkNodes = 0;
+    }
+
+    //  Free the large nodes after the first keep ones
+    void clearLarge(const size_t keep)
+    {
+        for (size_t i = keep; i < myLarge.size(); ++i)
+        {
+            myLargeWords -= Node::words(reinterpret_cast<Node*>(myLarge[i].get())->n);
+        }
+        myLarge.resize(keep);
+    }
+
+    //  Space for a node larger than a block
+    double* largeSpace(const size_t N)
+    {
+        //  The back link of the next node is a 31bit distance in words
+        if (Node::words(N) >= Node::JUMP)
+        {
+            throw runtime_error("Tape::recordNode() : too many arguments");
+        }
+        myLarge.emplace_back(new double[Node::words(N)]);
+        myLargeWords += Node::words(N);
+        return myLarge.back().get();
+    }
+
 public:
 
+    Tape()
+    {
+        myAdjointsMulti.set_budget(&myBudget);
+        myNodes.set_budget(&myBudget);
+        setBudget(defaultBudget);
+    }
+
     //  Build note in place and return a pointer
 	//	N : number of childs (arguments)
     template <size_t N>
     Node* recordNode()
     {
-        //  Construct the node in place on tape
-        Node* node = myNodes.emplace_back(N);
+        static_assert(Node::words(N) <= BLOCKSIZE, "Tape::recordNode() : node larger than a block");
+
+        //  Construct the node in place on tape, 
+        //      with room for derivatives and child adjoint pointers
+        return linkNode(myNodes.emplace_back_multi<Node::words(N)>(), N);
+    }
+
+    //  Same with N known at run time
+    //  Nodes larger than a block are allocated separately
+    Node* recordNode(const size_t N)
+    {
+        return linkNode(Node::words(N) <= BLOCKSIZE 
+            ? myNodes.emplace_back_multi(Node::words(N)) 
+            : largeSpace(N), N);
+    }
+
+private:
+
+    Node* linkNode(double* space, const size_t N)
+    {
+        Node* node = new (space) Node(N);
+        ++myNumNodes;
+
+        //  Link to previous node
+        if (!myLast)
+        {
+            myFirst = node;
+        }
+        else if (myLast->next() == node)
+        {
+            node->myBack = uint32_t(myLast->words());
+        }
+        else
+        {
+            node->myBack = Node::JUMP | uint32_t(myJumps.size());
+            myJumps.emplace_back(myLast, node);
+        }
+        myLast = node;
         
         //  Store and zero the adjoint(s)
         if (multi)
         {
-            node->pAdjoints = myAdjointsMulti.emplace_back_multi(Node::numAdj);
-            fill(node->pAdjoints, node->pAdjoints + Node::numAdj, 0.0);
+            //  Rows of adjStride are aligned since blocks are
+            node->pAdjoints = myAdjointsMulti.emplace_back_multi(Node::adjStride);
+            fill(node->pAdjoints, node->pAdjoints + Node::adjStride, 0.0);
         }
 
-		//	Store the derivatives and child adjoint pointers unless leaf
-		if constexpr(N)
-		{
-			node->pDerivatives = myDers.emplace_back_multi<N>();
-			node->pAdjPtrs = myArgPtrs.emplace_back_multi<N>();
-
-		}
-
         return node;
     }
 
+public:
+
     //  Reset all adjoints to 0
 	void resetAdjoints()
 	{
@@ -89,20 +203,93 @@ public:
 		}
 		else
 		{
-			for (Node& node : myNodes)
+            for (Node* node = myLast; node; node = node == myFirst ? nullptr : node->prev(myJumps))
 			{
-				node.mAdjoint = 0;
+				node->mAdjoint = 0;
 			}
 		}
 	}
 
     //  Clear
+    //  Memory is kept for the next use, subject to retention policy
     void clear()
     {
         myAdjointsMulti.clear();
-		myDers.clear();
-		myArgPtrs.clear();
         myNodes.clear();
+        forget();
+    }
+
+    //  Clear and give all memory back
+    void release()
+    {
+        myAdjointsMulti.release();
+        myNodes.release();
+        forget();
+        myJumps.shrink_to_fit();
+    }
+
+    //  Retention policy: maximum bytes kept on clear(), by storage
+    //  0: give memory back on clear()
+    //  Default: keep the high-water mark
+    void setRetention(const size_t bytes)
+    {
+        myAdjointsMulti.set_retention(bytes);
+        myNodes.set_retention(bytes);
+    }
+
+    //  Memory budget on the heap, in bytes, of nodes and adjoints together
+    //  Memory beyond is mapped on temporary files, 
+    //      so huge tapes are paged out to disk rather than exhaust memory,
+    //      and paged back in on access during back-propagation
+    //  Applies to memory allocated from now on
+    //  Default: unlimited, or the default budget when set before construction
+    void setBudget(const size_t bytes)
+    {
+        myBudget.max_heap = bytes;
+    }
+
+    static void setDefaultBudget(const size_t bytes)
+    {
+        defaultBudget = bytes;
+    }
+
+    static size_t getDefaultBudget()
+    {
+        return defaultBudget;
+    }
+
+    //  Statistics, high-water marks since the last clear()
+    TapeStats stats() const
+    {
+        TapeStats stats;
+        stats.nodes = myNumNodes;
+        stats.nodeBytes = myNodes.size() + myLargeWords * sizeof(double);
+        stats.nodeHighWater = myNodes.high_water();
+        stats.adjointBytes = multi ? myAdjointsMulti.size() : 0;
+        stats.adjointHighWater = multi ? myAdjointsMulti.high_water() : 0;
+        stats.jumpBytes = myJumps.size() * sizeof(pair<Node*, Node*>);
+        stats.capacity = capacity();
+        stats.spilled = myNodes.mapped() + myAdjointsMulti.mapped();
+        return stats;
+    }
+
+    //  Number of nodes, on tape and after mark
+    size_t numNodes() const
+    {
+        return myNumNodes;
+    }
+
+    size_t numNodesAfterMark() const
+    {
+        return myNumNodes - myMarkNodes;
+    }
+
+    //  Memory held, in bytes
+    size_t capacity() const
+    {
+        return myAdjointsMulti.capacity() + myNodes.capacity()
+            + myJumps.capacity() * sizeof(pair<Node*, Node*>)
+            + myLargeWords * sizeof(double);
     }
 
     //  Rewind
@@ -123,9 +310,11 @@ public:
 		{
 			myAdjointsMulti.rewind();
 		}
-		myDers.rewind();
-		myArgPtrs.rewind();
 		myNodes.rewind();
+        myFirst = myLast = nullptr;
+        myJumps.clear();
+        clearLarge(0);
+        myNumNodes = 0;
 
 #endif
 
@@ -138,9 +327,11 @@ public:
         {
             myAdjointsMulti.setmark();
         }
-		myDers.setmark();
-		myArgPtrs.setmark();
 		myNodes.setmark();
+        myMarkLast = myLast;
+        myMarkJumps = myJumps.size();
+        myMarkLarge = myLarge.size();
+        myMarkNodes = myNumNodes;
     }
 
     //  Rewind to mark
@@ -150,32 +341,140 @@ public:
         {
             myAdjointsMulti.rewind_to_mark();
         }
-		myDers.rewind_to_mark();
-		myArgPtrs.rewind_to_mark();
 		myNodes.rewind_to_mark();
+        myLast = myMarkLast;
+        if (!myLast) myFirst = nullptr;
+        myJumps.resize(myMarkJumps);
+        clearLarge(myMarkLarge);
+        myNumNodes = myMarkNodes;
     }
 
     //  Iterators
-    
-    using iterator = blocklist<Node, BLOCKSIZE>::iterator;
+    //  Bidirectional, backward is the fast direction
+    //  end() holds nullptr, and is before begin() as well as after the last node,
+    //      so backward sweeps stop there: --begin() == end()
+    //  Iterators keep the index of the next jump, 
+    //      so moving is O(1) in both directions
 
-    auto begin()
+    class iterator
     {
-        return myNodes.begin();
+        const vector<pair<Node*, Node*>>*   myJumps;
+        Node*                               myLast;
+        Node*                               myNode;
+        //  Index of the next jump from myNode or after
+        size_t                              myJump;
+
+    public:
+
+        //  iterator traits
+        using difference_type = ptrdiff_t;
+        using reference = Node&;
+        using pointer = Node*;
+        using value_type = Node;
+        using iterator_category = bidirectional_iterator_tag;
+
+        iterator() {}
+
+        iterator(const vector<pair<Node*, Node*>>* jumps, Node* last, Node* node, const size_t jump) :
+            myJumps(jumps), myLast(last), myNode(node), myJump(jump) {}
+
+        //	Pre-increment
+        iterator& operator++()
+        {
+            if (myNode == myLast)
+            {
+                myNode = nullptr;
+            }
+            else if (myJump < myJumps->size() && (*myJumps)[myJump].first == myNode)
+            {
+                myNode = (*myJumps)[myJump++].second;
+            }
+            else
+            {
+                myNode = myNode->next();
+            }
+            return *this;
+        }
+
+        //	Pre-decrement
+        //  The first node has no back link
+        iterator& operator--()
+        {
+            if (!myNode)
+            {
+                myNode = myLast;
+                myJump = myJumps->size();
+            }
+            else if (!myNode->myBack)
+            {
+                myNode = nullptr;
+                myJump = 0;
+            }
+            else
+            {
+                if (myNode->myBack & Node::JUMP) myJump = myNode->myBack & ~Node::JUMP;
+                myNode = myNode->prev(*myJumps);
+            }
+            return *this;
+        }
+
+        //  end()
+        bool atEnd() const
+        {
+            return !myNode;
+        }
+
+        //	Access to nodes
+        Node& operator*() const
+        {
+            return *myNode;
+        }
+        Node* operator->() const
+        {
+            return myNode;
+        }
+
+        //	Check equality
+        bool operator ==(const iterator& rhs) const
+        {
+            return myNode == rhs.myNode;
+        }
+        bool operator !=(const iterator& rhs) const
+        {
+            return myNode != rhs.myNode;
+        }
+    };
+
+    iterator begin()
+    {
+        return iterator(&myJumps, myLast, myFirst, 0);
     }
 
-    auto end()
+    iterator end()
     {
-        return myNodes.end();
+        return iterator(&myJumps, myLast, nullptr, myJumps.size());
     }
 
-    auto markIt()
+    //  First node after mark
+    iterator markIt()
     {
-        return myNodes.mark();
+        if (!myMarkLast) return begin();
+        if (myLast == myMarkLast) return end();
+        if (myJumps.size() > myMarkJumps && myJumps[myMarkJumps].first == myMarkLast)
+        {
+            return iterator(&myJumps, myLast, myJumps[myMarkJumps].second, myMarkJumps + 1);
+        }
+        return iterator(&myJumps, myLast, myMarkLast->next(), myMarkJumps);
     }
 
-    auto find(Node* node)
+    //  Find node, searching sequentially from the end
+    iterator find(Node* node)
     {
-        return myNodes.find(node);
+        for (iterator it = end(), b = begin(); it != b; )
+        {
+            --it;
+            if (&*it == node) return it;
+        }
+        return end();
     }
 };
\ No newline at end of file
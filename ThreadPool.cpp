@@ -13,8 +13,138 @@ Wiley, 2018
 As long as this comment is preserved at the top of the file
 */
 
-#include "ThreadPool.h"
+#include "threadPool.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 //  Statics
 ThreadPool ThreadPool::myInstance;
-thread_local size_t ThreadPool::myTLSNum = 0;
\ No newline at end of file
+thread_local size_t ThreadPool::myTLSNum = 0;
+//  Pinning and NUMA topology, see ThreadPool::start()
+
+#ifdef _WIN32
+
+//  Processors by node and processor group, within the process's affinity
+vector<pair<size_t, size_t>> ThreadPool::processorsByNode()
+{
+    vector<pair<size_t, size_t>> procs;
+
+    ULONG highest = 0;
+    if (GetNumaHighestNodeNumber(&highest))
+    {
+        for (USHORT node = 0; node <= highest; ++node)
+        {
+            GROUP_AFFINITY affinity;
+            if (!GetNumaNodeProcessorMaskEx(node, &affinity)) continue;
+            for (size_t bit = 0; bit < 64; ++bit)
+            {
+                if (affinity.Mask & (KAFFINITY(1) << bit))
+                {
+                    procs.emplace_back(size_t(affinity.Group) * 64 + bit, node);
+                }
+            }
+        }
+    }
+
+    if (procs.empty())
+    {
+        for (size_t i = 0; i < max(1u, thread::hardware_concurrency()); ++i) procs.emplace_back(i, 0);
+    }
+
+    return procs;
+}
+
+bool ThreadPool::pinCurrentThread(const size_t processor)
+{
+    GROUP_AFFINITY affinity = {};
+    affinity.Group = WORD(processor / 64);
+    affinity.Mask = KAFFINITY(1) << (processor % 64);
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+}
+
+#elif defined(__linux__)
+
+//  Processors by node from sysfs, within the process's affinity
+vector<pair<size_t, size_t>> ThreadPool::processorsByNode()
+{
+    vector<pair<size_t, size_t>> procs;
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    const bool hasAllowed = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    auto isAllowed = [&](const size_t cpu)
+    {
+        return !hasAllowed || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed));
+    };
+
+    //  Nodes are numbered from 0, possibly with gaps
+    for (size_t node = 0; node < 1024; ++node)
+    {
+        ifstream file("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+        if (!file) continue;
+
+        //  Format: 0-3,8-11
+        string list, range;
+        getline(file, list);
+        istringstream ranges(list);
+        while (getline(ranges, range, ','))
+        {
+            if (range.empty()) continue;
+            const size_t dash = range.find('-');
+            const size_t first = stoul(range.substr(0, dash));
+            const size_t last = dash == string::npos ? first : stoul(range.substr(dash + 1));
+            for (size_t cpu = first; cpu <= last; ++cpu)
+            {
+                if (isAllowed(cpu)) procs.emplace_back(cpu, node);
+            }
+        }
+    }
+
+    //  No sysfs: all allowed processors on node 0
+    if (procs.empty())
+    {
+        for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (hasAllowed && CPU_ISSET(cpu, &allowed)) procs.emplace_back(cpu, 0);
+        }
+    }
+    if (procs.empty()) procs.emplace_back(0, 0);
+
+    return procs;
+}
+
+bool ThreadPool::pinCurrentThread(const size_t processor)
+{
+    if (processor >= CPU_SETSIZE) return false;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(processor, &cpus);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+}
+
+#else
+
+//  No topology or affinity: one node, no pinning
+vector<pair<size_t, size_t>> ThreadPool::processorsByNode()
+{
+    vector<pair<size_t, size_t>> procs;
+    for (size_t i = 0; i < max(1u, thread::hardware_concurrency()); ++i) procs.emplace_back(i, 0);
+    return procs;
+}
+
+bool ThreadPool::pinCurrentThread(const size_t)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,173 @@
+/*
+Written by Antoine Savine in 2018
+
+This code is the strict IP of Antoine Savine
+
+License to use and alter this code for personal and commercial applications
+is freely granted to any person or company who purchased a copy of the book
+
+Modern Computational Finance: AAD and Parallel Simulations
+Antoine Savine
+Wiley, 2018
+
+As long as this comment is preserved at the top of the file
+*/
+
+#pragma once
+
+//  Lock-free work stealing deque,
+//  Used in the thread pool, one per worker thread
+
+//  Chase and Lev, Dynamic Circular Work-Stealing Deque, SPAA 2005
+//  With the memory orderings of Le, Pop, Cohen and Zappa Nardelli,
+//      Correct and Efficient Work-Stealing for Weak Memory Models, PPoPP 2013
+
+//  The owner thread pushes and pops at the bottom, LIFO
+//  Other threads steal from the top, FIFO
+//  T must be trivially copyable, typically a pointer
+
+#include <atomic>
+#include <vector>
+#include <memory>
+using namespace std;
+
+template <class T>
+class WorkStealingQueue
+{
+    //  Circular buffer, capacity is a power of 2
+    class Buffer
+    {
+        const long long         myMask;
+        unique_ptr<atomic<T>[]> myData;
+
+    public:
+
+        Buffer(const long long capacity) :
+            myMask(capacity - 1),
+            myData(new atomic<T>[capacity])
+        {}
+
+        long long capacity() const { return myMask + 1; }
+
+        T get(const long long i) const
+        {
+            return myData[i & myMask].load(memory_order_relaxed);
+        }
+
+        void put(const long long i, const T t)
+        {
+            myData[i & myMask].store(t, memory_order_relaxed);
+        }
+
+        //  Copy [top, bottom) into a buffer twice as large
+        Buffer* grow(const long long bottom, const long long top) const
+        {
+            Buffer* bigger = new Buffer(2 * capacity());
+            for (long long i = top; i < bottom; ++i) bigger->put(i, get(i));
+            return bigger;
+        }
+    };
+
+    //  Steal end and owner end
+    alignas(64) atomic<long long>   myTop;
+    alignas(64) atomic<long long>   myBottom;
+
+    //  Current buffer
+    alignas(64) atomic<Buffer*>     myBuffer;
+
+    //  Buffers replaced on growth,
+    //      kept alive because thieves may still read them
+    //  Only accessed by the owner thread
+    vector<unique_ptr<Buffer>>      myRetired;
+
+public:
+
+    WorkStealingQueue(const long long capacity = 1024) :
+        myTop(0), myBottom(0), myBuffer(new Buffer(capacity))
+    {}
+
+    ~WorkStealingQueue()
+    {
+        delete myBuffer.load(memory_order_relaxed);
+    }
+
+    //  Forbid copies etc
+    WorkStealingQueue(const WorkStealingQueue& rhs) = delete;
+    WorkStealingQueue& operator=(const WorkStealingQueue& rhs) = delete;
+
+    //  Approximate, no synchronization
+    bool empty() const
+    {
+        return myBottom.load(memory_order_relaxed)
+            <= myTop.load(memory_order_relaxed);
+    }
+
+    //  Owner only: push at the bottom
+    void push(const T t)
+    {
+        const long long b = myBottom.load(memory_order_relaxed);
+        const long long top = myTop.load(memory_order_acquire);
+        Buffer* buf = myBuffer.load(memory_order_relaxed);
+
+        //  Full: grow
+        if (b - top > buf->capacity() - 1)
+        {
+            Buffer* bigger = buf->grow(b, top);
+            myRetired.emplace_back(buf);
+            myBuffer.store(bigger, memory_order_release);
+            buf = bigger;
+        }
+
+        buf->put(b, t);
+        //  Publish to thieves
+        myBottom.store(b + 1, memory_order_release);
+    }
+
+    //  Owner only: pop at the bottom into argument
+    //  Return false if empty
+    bool tryPop(T& t)
+    {
+        const long long b = myBottom.load(memory_order_relaxed) - 1;
+        Buffer* buf = myBuffer.load(memory_order_relaxed);
+        myBottom.store(b, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        long long top = myTop.load(memory_order_relaxed);
+
+        //  Empty
+        if (top > b)
+        {
+            myBottom.store(b + 1, memory_order_relaxed);
+            return false;
+        }
+
+        t = buf->get(b);
+
+        //  Last element: race against thieves
+        if (top == b)
+        {
+            const bool won = myTop.compare_exchange_strong(
+                top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+            myBottom.store(b + 1, memory_order_relaxed);
+            return won;
+        }
+
+        return true;
+    }
+
+    //  Any thread: steal from the top into argument
+    //  Return false if empty or lost a race
+    bool trySteal(T& t)
+    {
+        long long top = myTop.load(memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        const long long b = myBottom.load(memory_order_acquire);
+
+        if (top >= b) return false;
+
+        Buffer* buf = myBuffer.load(memory_order_acquire);
+        t = buf->get(top);
+
+        return myTop.compare_exchange_strong(
+            top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+    }
+};
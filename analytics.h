@@ -90,6 +90,46 @@ inline T merton(
     return result;
 }
 
+//  Merton for a batch of strikes of the same maturity, untemplated
+//  The jump series is computed once for all strikes
+//  Same results as merton() strike by strike
+inline void mertonStrikes(
+    const double            spot,
+    const vector<double>&   strikes,
+    const double            vol,
+    const double            mat,
+    const double            intens,
+    const double            meanJmp,
+    const double            stdJmp,
+    //  Results, resized
+    vector<double>&         calls)
+{
+    const double varJmp = stdJmp * stdJmp;
+    const double mv2 = meanJmp + 0.5 * varJmp;
+    const double comp = intens * (exp(mv2) - 1);
+    const double var = vol * vol;
+    const double intensT = intens * mat;
+
+    const size_t nK = strikes.size();
+    calls.assign(nK, 0.0);
+
+    unsigned fact = 1;
+    double iT = 1.0;
+    const size_t cut = 10;
+    for (size_t n = 0; n < cut; ++n)
+    {
+        const double s = spot*exp(n*mv2 - comp*mat);
+        const double v = sqrt(var + n * varJmp / mat);
+        const double prob = exp(-intensT) * iT / fact;
+        for (size_t k = 0; k < nK; ++k)
+        {
+            calls[k] += prob * blackScholes(s, strikes[k], v, mat);
+        }
+        fact *= n + 1;
+        iT *= intensT;
+    }
+}
+
 //	Up and out call in Black-Scholes, untemplated
 
 inline double BlackScholesKO(
@@ -0,0 +1,313 @@
+/*
+Written by Antoine Savine in 2018
+
+This code is the strict IP of Antoine Savine
+
+License to use and alter this code for personal and commercial applications
+is freely granted to any person or company who purchased a copy of the book
+
+Modern Computational Finance: AAD and Parallel Simulations
+Antoine Savine
+Wiley, 2018
+
+As long as this comment is preserved at the top of the file
+*/
+
+#pragma once
+
+//  Asynchronous jobs, see the asynchronous Excel functions in xlExport.cpp
+
+//  Jobs run one after the other on a driver thread,
+//      their parallel simulations on the thread pool as usual
+//  The parallel simulators give the slot 0 of their per-thread workspaces
+//      to the calling thread, so only one thread outside the pool may run them at a time:
+//      the driver holds poolCallerMutex() while a job runs,
+//      and so must the other callers, like the synchronous Excel functions
+//  Identical requests in flight are coalesced: one job, several waiters
+//  A caller that submits a different request abandons its previous one,
+//      and a job left without waiters is cancelled
+//  Cancellation is cooperative: the RNG of the job checks the flag,
+//      see CancellableRng below and makeRng() in main.h
+
+#include "mcBase.h"
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <functional>
+
+//  Held by the thread outside the pool that runs parallel simulations
+inline mutex& poolCallerMutex()
+{
+    static mutex m;
+    return m;
+}
+
+//  Lock for a calculation on a thread outside the pool
+//  Parallel simulations need it, and so does AAD: 
+//      the tape of the threads outside the pool is global, see AAD.cpp
+//  Serial valuations in double run concurrently on their snapshots of the store
+inline unique_lock<mutex> lockPoolCaller(const bool needed = true)
+{
+    return needed ? unique_lock<mutex>(poolCallerMutex()) : unique_lock<mutex>();
+}
+
+//  RNG wrapper that throws once the job is cancelled
+//  The exception ends serial simulations on the spot
+//  Parallel tasks fail at their first draw and the pool drains quickly,
+//      the partial results are then discarded by the job
+class CancellableRng : public RNG
+{
+    unique_ptr<RNG>         myRng;
+    const atomic<bool>*     myCancel;
+
+    void check() const
+    {
+        if (myCancel->load(memory_order_relaxed))
+        {
+            throw runtime_error("CancellableRng : job cancelled");
+        }
+    }
+
+public:
+
+    CancellableRng(unique_ptr<RNG> rng, const atomic<bool>* cancel) :
+        myRng(move(rng)), myCancel(cancel) {}
+
+    CancellableRng(const CancellableRng& rhs) :
+        myRng(rhs.myRng->clone()), myCancel(rhs.myCancel) {}
+
+    //  Virtual copy constructor
+    unique_ptr<RNG> clone() const override
+    {
+        return make_unique<CancellableRng>(*this);
+    }
+
+    void init(const size_t simDim) override
+    {
+        myRng->init(simDim);
+    }
+
+    void nextU(vector<double>& uVec) override
+    {
+        check();
+        myRng->nextU(uVec);
+    }
+
+    void nextG(vector<double>& gaussVec) override
+    {
+        check();
+        myRng->nextG(gaussVec);
+    }
+
+    void nextUBlock(const size_t nPath, matrix<double>& uBlock) override
+    {
+        check();
+        myRng->nextUBlock(nPath, uBlock);
+    }
+
+    void nextGBlock(const size_t nPath, matrix<double>& gaussBlock) override
+    {
+        check();
+        myRng->nextGBlock(nPath, gaussBlock);
+    }
+
+    bool antithetic() const override
+    {
+        return myRng->antithetic();
+    }
+
+    void skipTo(const size_t b) override
+    {
+        check();
+        myRng->skipTo(b);
+    }
+};
+
+//  Jobs in flight, Waiter identifies where to return the results,
+//      for example an Excel async handle
+template <class Waiter, class Result>
+class AsyncJobs
+{
+    struct Job
+    {
+        string                          key;
+        atomic<bool>                    cancelled;
+        //  Caller and waiter
+        vector<pair<string, Waiter>>    waiters;
+        //  Calculation, Result(const atomic<bool>& cancelled), may throw
+        function<Result(const atomic<bool>&)>
+                                        run;
+
+        Job() : cancelled(false) {}
+    };
+
+    //  Delivery of the results to one waiter, nullptr if the job failed
+    function<void(const Waiter&, const Result*)>
+                                        myDeliver;
+
+    mutex                               myMutex;
+    condition_variable                  myCV;
+
+    //  Jobs in flight, running or queued, by request key
+    map<string, shared_ptr<Job>>        myJobs;
+    //  Queue, in order of submission
+    deque<shared_ptr<Job>>              myQueue;
+    //  Request key of the last submission by caller
+    map<string, string>                 myCallers;
+
+    //  Driver thread, started on the first submission
+    thread                              myDriver;
+    bool                                myStop = false;
+
+    //  Remove the waiters of a caller from its job,
+    //      cancel the job if no one waits for it any more
+    //  Caller must hold the mutex
+    void abandon(const string& caller)
+    {
+        auto cit = myCallers.find(caller);
+        if (cit == myCallers.end()) return;
+
+        auto jit = myJobs.find(cit->second);
+        myCallers.erase(cit);
+        if (jit == myJobs.end()) return;
+
+        auto& waiters = jit->second->waiters;
+        waiters.erase(remove_if(waiters.begin(), waiters.end(),
+            [&](const pair<string, Waiter>& w) { return w.first == caller; }),
+            waiters.end());
+
+        if (waiters.empty())
+        {
+            jit->second->cancelled = true;
+            myJobs.erase(jit);
+        }
+    }
+
+    //  The function that is executed on the driver thread
+    void driverFunc()
+    {
+        while (true)
+        {
+            //  Next job not cancelled
+            shared_ptr<Job> job;
+            {
+                unique_lock<mutex> lk(myMutex);
+                myCV.wait(lk, [this] { return myStop || !myQueue.empty(); });
+                if (myStop) return;
+                job = move(myQueue.front());
+                myQueue.pop_front();
+                if (job->cancelled) continue;
+            }
+
+            //  Run
+            Result result;
+            bool ok = true;
+            {
+                lock_guard<mutex> lk(poolCallerMutex());
+                try
+                {
+                    result = job->run(job->cancelled);
+                }
+                catch (const exception&)
+                {
+                    ok = false;
+                }
+            }
+
+            //  Done: take the waiters, unless cancelled
+            vector<pair<string, Waiter>> waiters;
+            {
+                lock_guard<mutex> lk(myMutex);
+                auto jit = myJobs.find(job->key);
+                if (jit != myJobs.end() && jit->second == job) myJobs.erase(jit);
+                if (!job->cancelled)
+                {
+                    waiters = move(job->waiters);
+                    for (const auto& w : waiters)
+                    {
+                        auto cit = myCallers.find(w.first);
+                        if (cit != myCallers.end() && cit->second == job->key) myCallers.erase(cit);
+                    }
+                }
+            }
+
+            for (const auto& w : waiters) myDeliver(w.second, ok ? &result : nullptr);
+        }
+    }
+
+public:
+
+    //  deliver: void(const Waiter&, const Result*), called on the driver thread, 
+    //      with nullptr if the job failed, 
+    //      not called for abandoned waiters or cancelled jobs
+    template <class Deliver>
+    AsyncJobs(Deliver deliver) : myDeliver(deliver) {}
+
+    ~AsyncJobs()
+    {
+        stop();
+    }
+
+    //  Submit a request
+    //  run: Result(const atomic<bool>& cancelled), may throw
+    template <class Run>
+    void submit(
+        const string&   key,
+        const string&   caller,
+        const Waiter&   waiter,
+        Run             run)
+    {
+        lock_guard<mutex> lk(myMutex);
+
+        //  A different request from the same caller makes the last one stale
+        auto cit = myCallers.find(caller);
+        if (cit != myCallers.end() && cit->second != key) abandon(caller);
+        myCallers[caller] = key;
+
+        //  Identical request in flight: wait for it
+        auto jit = myJobs.find(key);
+        if (jit != myJobs.end())
+        {
+            jit->second->waiters.emplace_back(caller, waiter);
+            return;
+        }
+
+        //  New job
+        auto job = make_shared<Job>();
+        job->key = key;
+        job->waiters.emplace_back(caller, waiter);
+        job->run = run;
+        myJobs[key] = job;
+        myQueue.push_back(job);
+
+        if (!myDriver.joinable())
+        {
+            myStop = false;
+            myDriver = thread(&AsyncJobs::driverFunc, this);
+        }
+        myCV.notify_one();
+    }
+
+    //  Cancel all the jobs in flight, nothing is delivered
+    void cancelAll()
+    {
+        lock_guard<mutex> lk(myMutex);
+        for (auto& job : myJobs) job.second->cancelled = true;
+        myJobs.clear();
+        myQueue.clear();
+        myCallers.clear();
+    }
+
+    //  Cancel all the jobs and stop the driver thread
+    void stop()
+    {
+        cancelAll();
+        {
+            lock_guard<mutex> lk(myMutex);
+            myStop = true;
+        }
+        myCV.notify_all();
+        if (myDriver.joinable()) myDriver.join();
+    }
+};
@@ -0,0 +1,514 @@
+/*
+Written by Antoine Savine in 2018
+
+This code is the strict IP of Antoine Savine
+
+License to use and alter this code for personal and commercial applications
+is freely granted to any person or company who purchased a copy of the book
+
+Modern Computational Finance: AAD and Parallel Simulations
+Antoine Savine
+Wiley, 2018
+
+As long as this comment is preserved at the top of the file
+*/
+
+//  Benchmarks of the simulation, AAD and calibration hot paths
+
+//  Standalone console application, see bench.vcxproj, on Linux:
+//      g++ -std=c++20 -O3 -march=native -pthread bench.cpp mcBase.cpp AAD.cpp ThreadPool.cpp sobol.cpp -o bench
+
+//  Usage:
+//      bench [--quick] [--paths n,n,...] [--threads n,n,...] [--grids n,n,...] [--reps n] [--pin] [--out file]
+//      bench --check
+//  check:      runs the self checks of checks.h instead, returns the number of failures
+//  paths:      numbers of paths of the simulations
+//  threads:    numbers of threads of the parallel simulations, main thread included
+//  pin:        pin the worker threads to processors by NUMA node, see threadPool.h
+//  grids:      numbers of local volatility spots per 100 of spot, times are scaled alike
+//  reps:       repetitions, the best time is reported
+
+//  Results are written in CSV, one line per measurement, to stdout or the out file:
+//      suite,case,model,paths,threads,grid,seconds,pathsPerSec,aadRatio,efficiency,tapeBytes,error
+//  aadRatio:   time of the AAD or forward mode simulation over the valuation with the same paths and threads
+//  efficiency: speed up of the parallel simulation over the serial one, per thread
+//  tapeBytes:  memory held by the tape after the serial AAD simulation
+//  error:      RMS error of the prices against closed form, maxDt in the grid column
+//  Measurements that don't apply are left empty
+
+#include "main.h"
+#include "trainingSet.h"
+#include "checks.h"
+#include "mrg32k3a.h"
+#include "sobol.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <sstream>
+using namespace std;
+
+namespace
+{
+    struct BenchParam
+    {
+        vector<size_t>  paths = { 10000, 100000 };
+        vector<size_t>  threads = { 2, 4, 8 };
+        vector<size_t>  grids = { 10, 20, 40 };
+        size_t          reps = 3;
+        bool            pin = false;
+    };
+
+    vector<size_t> parseList(const string& str)
+    {
+        vector<size_t> list;
+        size_t pos = 0;
+        while (pos < str.size())
+        {
+            size_t next = str.find(',', pos);
+            if (next == string::npos) next = str.size();
+            list.push_back(stoul(str.substr(pos, next - pos)));
+            pos = next + 1;
+        }
+        return list;
+    }
+
+    //  Best time of reps runs, in seconds
+    template <class F>
+    double timeIt(const size_t reps, F f)
+    {
+        double best = numeric_limits<double>::max();
+        for (size_t i = 0; i < reps; ++i)
+        {
+            const auto t0 = chrono::steady_clock::now();
+            f();
+            const auto t1 = chrono::steady_clock::now();
+            best = min(best, chrono::duration<double>(t1 - t0).count());
+        }
+        return best;
+    }
+
+    //  Measurement, 0 = doesn't apply
+    struct BenchResult
+    {
+        string  suite;
+        string  test;
+        string  model;
+        size_t  paths = 0;
+        size_t  threads = 0;
+        string  grid;
+        double  seconds = 0;
+        double  aadRatio = 0;
+        double  efficiency = 0;
+        size_t  tapeBytes = 0;
+        double  error = 0;
+    };
+
+    class BenchReport
+    {
+        ostream&    myOut;
+
+        template <class T>
+        void field(const T& x)
+        {
+            if (x) myOut << x;
+            myOut << ',';
+        }
+
+    public:
+
+        BenchReport(ostream& out) : myOut(out)
+        {
+            myOut << "suite,case,model,paths,threads,grid,seconds,pathsPerSec,aadRatio,efficiency,tapeBytes,error" << endl;
+        }
+
+        void operator()(const BenchResult& r)
+        {
+            myOut << r.suite << ',' << r.test << ',' << r.model << ',';
+            field(r.paths);
+            field(r.threads);
+            myOut << r.grid << ',' << r.seconds << ',';
+            field(r.paths && r.seconds > 0 ? r.paths / r.seconds : 0.0);
+            field(r.aadRatio);
+            field(r.efficiency);
+            field(r.tapeBytes);
+            if (r.error) myOut << r.error;
+            myOut << endl;
+
+            cerr << r.suite << " " << r.test << " " << r.model << " " << r.paths << " paths "
+                << r.threads << " threads " << r.grid << " : " << r.seconds << "s" << endl;
+        }
+    };
+
+    //  Pool with the given number of threads, main thread included
+    void restartPool(const size_t threads, const bool pin)
+    {
+        ThreadPool::getInstance()->stop();
+        ThreadPool::getInstance()->start(threads - 1, pin);
+    }
+
+    //  Spots and times of the local volatility grid n
+    void gridPoints(const size_t n, vector<double>& spots, double& maxDs, vector<Time>& times, double& maxDt)
+    {
+        spots = { 50.0, 100.0, 200.0 };
+        maxDs = 100.0 / n;
+        times = { 0.25, 0.5, 1.0 };
+        maxDt = 1.0 / n;
+    }
+
+    //  Random number generators
+    void benchRng(const BenchParam& param, BenchReport& report)
+    {
+        //  Dimension of a weekly path over a year
+        const size_t dim = 52;
+
+        vector<pair<string, unique_ptr<RNG>>> rngs;
+        rngs.emplace_back("mrg32k3a", make_unique<mrg32k3a>(12345, 12346, false));
+        rngs.emplace_back("sobol", make_unique<Sobol>());
+        rngs.emplace_back("sobolScrambled", make_unique<Sobol>(true, 12345));
+
+        for (auto& rng : rngs) for (const size_t nPath : param.paths)
+        {
+            rng.second->init(dim);
+            vector<double> gauss(dim);
+
+            BenchResult r;
+            r.suite = "rng";
+            r.model = rng.first;
+            r.paths = nPath;
+            r.threads = 1;
+            r.grid = to_string(dim);
+
+            r.test = "nextG";
+            r.seconds = timeIt(param.reps, [&]()
+            {
+                for (size_t i = 0; i < nPath; ++i) rng.second->nextG(gauss);
+            });
+            report(r);
+
+            matrix<double> block(dim, PATHBLOCK);
+            r.test = "nextGBlock";
+            r.seconds = timeIt(param.reps, [&]()
+            {
+                for (size_t i = 0; i < nPath; i += PATHBLOCK)
+                {
+                    rng.second->nextGBlock(min(PATHBLOCK, nPath - i), block);
+                }
+            });
+            report(r);
+        }
+    }
+
+    //  Simulations and AAD simulations of a barrier and a set of Europeans
+    void benchSimul(const BenchParam& param, BenchReport& report)
+    {
+        putBlackScholes(100, 0.2, false, 0.01, 0.0, "bs");
+        {
+            vector<double> spots, mats;
+            double maxDs, maxDt;
+            gridPoints(20, spots, maxDs, mats, maxDt);
+            const auto calib = dupireCalib(spots, maxDs, mats, maxDt, 100, 0.2);
+            putDupire(100, calib.spots, calib.times, calib.lVols, 0.02, "dupire");
+        }
+        putBarrier(100, 150, 1, 0.02, 0.01, "barrier");
+        putEuropeans({ 1, 1, 1, 1, 1 }, { 80, 90, 100, 110, 120 }, "europeans");
+
+        Sobol rng;
+
+        for (const string model : { "bs", "dupire" }) for (const size_t nPath : param.paths)
+        {
+            const auto mdl = getModel<double>(model);
+            const auto riskMdl = getModel<Number>(model);
+            const auto singleMdl = getModel<float>(model);
+            const auto prd = getProduct<double>("barrier");
+            const auto singlePrd = getProduct<float>("barrier");
+            const auto riskPrd = getProduct<Number>("barrier");
+            const auto multi = getProduct<double>("europeans");
+            const auto riskMulti = getProduct<Number>("europeans");
+            const auto tangentMdl = getModel<Dual>(model);
+            const auto tangentMulti = getProduct<Dual>("europeans");
+            const auto secondMdl = getModel<DualNumber>(model);
+            const auto secondPrd = getProduct<DualNumber>("barrier");
+
+            BenchResult r;
+            r.suite = "simul";
+            r.model = model;
+            r.paths = nPath;
+            r.threads = 1;
+
+            //  Serial
+            restartPool(1, param.pin);
+
+            r.test = "mcSimul";
+            const double tSimul = timeIt(param.reps, [&]() { mcSimul(*prd, *mdl, rng, nPath); });
+            r.seconds = tSimul;
+            report(r);
+
+            r.test = "mcSimulStats";
+            r.seconds = timeIt(param.reps, [&]() { mcSimulStats(*prd, *mdl, rng, nPath); });
+            report(r);
+
+            r.test = "mcSimulStatsFloat";
+            r.seconds = timeIt(param.reps, [&]() { mcSimulStats(*singlePrd, *singleMdl, rng, nPath); });
+            report(r);
+
+            r.suite = "aad";
+            r.test = "mcSimulAAD";
+            Number::tape->release();
+            r.seconds = timeIt(param.reps, [&]() { mcSimulAAD(*riskPrd, *riskMdl, rng, nPath); });
+            r.aadRatio = r.seconds / tSimul;
+            r.tapeBytes = Number::tape->capacity();
+            report(r);
+
+            r.test = "mcSimulAADMulti";
+            const double tMulti = timeIt(param.reps, [&]() { mcSimul(*multi, *mdl, rng, nPath); });
+            Number::tape->release();
+            r.seconds = timeIt(param.reps, [&]() { mcSimulAADMulti(*riskMulti, *riskMdl, rng, nPath); });
+            r.aadRatio = r.seconds / tMulti;
+            r.tapeBytes = Number::tape->capacity();
+            report(r);
+            r.tapeBytes = 0;
+
+            //  Forward mode, derivatives to the first parameter
+            r.test = "mcSimulTangent";
+            vector<double> direction(tangentMdl->parameterLabels().size(), 0.0);
+            direction[0] = 1.0;
+            r.seconds = timeIt(param.reps, [&]() { mcSimulTangent(*tangentMulti, *tangentMdl, rng, nPath, direction); });
+            r.aadRatio = r.seconds / tMulti;
+            report(r);
+
+            //  Second order, Hessian column of the first parameter
+            r.test = "mcSimulAAD2";
+            Number::tape->release();
+            r.seconds = timeIt(param.reps, [&]() { mcSimulAAD2(*secondPrd, *secondMdl, rng, nPath, direction); });
+            r.aadRatio = r.seconds / tSimul;
+            r.tapeBytes = Number::tape->capacity();
+            report(r);
+            r.tapeBytes = 0;
+
+            //  Parallel
+            for (const size_t threads : param.threads)
+            {
+                if (threads < 2) continue;
+                restartPool(threads, param.pin);
+                r.threads = threads;
+
+                r.suite = "simul";
+                r.test = "mcParallelSimul";
+                const double tParallel = timeIt(param.reps, [&]() { mcParallelSimul(*prd, *mdl, rng, nPath); });
+                r.seconds = tParallel;
+                r.aadRatio = 0;
+                r.efficiency = tSimul / tParallel / threads;
+                report(r);
+
+                r.suite = "aad";
+                r.test = "mcParallelSimulAAD";
+                r.seconds = timeIt(param.reps, [&]() { mcParallelSimulAAD(*riskPrd, *riskMdl, rng, nPath); });
+                r.aadRatio = r.seconds / tParallel;
+                r.efficiency = 0;
+                report(r);
+
+                //  Differential training set, one sample per path, spot state
+                //  The shards are dropped: we measure the generator, not the disk
+                //  With the model initialized on every sample, then once per thread
+                mrg32k3a stateRng(1234, 12345, false);
+                const vector<TrainingState> states = { { 0, 50.0, 150.0 } };
+                for (const bool pathwise : { false, true })
+                {
+                    r.test = pathwise ? "mcTrainingSetPathwise" : "mcTrainingSet";
+                    r.seconds = timeIt(param.reps, [&]()
+                    {
+                        mcTrainingSet(*riskPrd, *riskMdl, rng, stateRng, states, nPath, 4096,
+                            [](const TrainingShard&) {}, defaultAggregator, 0, true, pathwise);
+                    });
+                    r.aadRatio = r.seconds / tParallel;
+                    report(r);
+                }
+            }
+        }
+    }
+
+    //  Calibration and superbucket risk across local volatility grids
+    void benchDupire(const BenchParam& param, BenchReport& report)
+    {
+        restartPool(param.threads.empty() ? 1 : max<size_t>(1, param.threads.back()), param.pin);
+
+        putBarrier(100, 150, 1, 0.02, 0.01, "barrier");
+        const map<string, double> notionals =
+            { { getProduct<double>("barrier")->payoffLabels()[0], 1.0 } };
+
+        for (const size_t n : param.grids)
+        {
+            vector<double> spots, mats;
+            double maxDs, maxDt;
+            gridPoints(n, spots, maxDs, mats, maxDt);
+
+            BenchResult r;
+            r.suite = "dupire";
+            r.model = "dupire";
+            r.threads = 1;
+
+            r.test = "dupireCalib";
+            const auto calib = dupireCalib(spots, maxDs, mats, maxDt, 100, 0.2);
+            r.grid = to_string(calib.spots.size()) + "x" + to_string(calib.times.size());
+            r.seconds = timeIt(param.reps, [&]() { dupireCalib(spots, maxDs, mats, maxDt, 100, 0.2); });
+            report(r);
+
+            NumericalParam num;
+            num.useSobol = true;
+            num.parallel = ThreadPool::getInstance()->numThreads() > 0;
+            num.cache = false;
+            r.threads = ThreadPool::getInstance()->numThreads() + 1;
+
+            for (const size_t nPath : param.paths)
+            {
+                num.numPath = nPath;
+                r.paths = nPath;
+                r.test = "dupireSuperbucket";
+                r.seconds = timeIt(param.reps, [&]()
+                {
+                    dupireSuperbucket(100, 0.02, "barrier", notionals, spots, maxDs, mats, maxDt,
+                        { 80, 90, 100, 110, 120 }, { 0.25, 0.5, 1.0 }, 0.2, 0.0, 0.0, 0.0, num);
+                });
+                report(r);
+            }
+        }
+    }
+
+    //  Convergence of the Dupire time stepping schemes in maxDt
+    //  Europeans on the local vol calibrated to Merton, against Merton's closed form
+    void benchDupireSchemes(const BenchParam& param, BenchReport& report)
+    {
+        restartPool(1, param.pin);
+
+        const double spot = 100, vol = 0.15, lambda = 0.5, jumpAvg = -0.15, jumpStd = 0.10;
+        const auto calib = dupireCalib({ 50.0, 100.0, 200.0 }, 2.5, { 0.25, 0.5, 1.0, 2.0 }, 0.05,
+            spot, vol, lambda, jumpAvg, jumpStd);
+
+        vector<Time> maturities;
+        vector<double> strikes, closedForms;
+        for (const Time mat : { 1.0, 2.0 }) for (const double strike : { 70, 80, 90, 100, 110, 120, 130 })
+        {
+            maturities.push_back(mat);
+            strikes.push_back(strike);
+            closedForms.push_back(merton(spot, strike, vol, mat, lambda, jumpAvg, jumpStd));
+        }
+        putEuropeans(maturities, strikes, "schemeEuropeans");
+
+        NumericalParam num;
+        num.useSobol = true;
+        num.parallel = false;
+        num.cache = false;
+
+        const vector<pair<string, DupireScheme>> schemes =
+        {
+            { "euler", DupireScheme::euler },
+            { "predictorCorrector", DupireScheme::predictorCorrector },
+            { "midpoint", DupireScheme::midpoint }
+        };
+
+        for (const auto& scheme : schemes) for (const double maxDt : { 0.05, 0.1, 0.25, 0.5 })
+        {
+            putDupire(spot, calib.spots, calib.times, calib.lVols, maxDt, "schemeDupire", 0, scheme.second);
+
+            BenchResult r;
+            r.suite = "scheme";
+            r.test = scheme.first;
+            r.model = "dupire";
+            r.threads = 1;
+            ostringstream grid;
+            grid << maxDt;
+            r.grid = grid.str();
+
+            for (const size_t nPath : param.paths)
+            {
+                num.numPath = nPath;
+                r.paths = nPath;
+
+                vector<double> values;
+                r.seconds = timeIt(param.reps, [&]()
+                {
+                    values = value("schemeDupire", "schemeEuropeans", num).values;
+                });
+
+                double sse = 0;
+                for (size_t i = 0; i < closedForms.size(); ++i)
+                {
+                    sse += (values[i] - closedForms[i]) * (values[i] - closedForms[i]);
+                }
+                r.error = sqrt(sse / closedForms.size());
+                report(r);
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    BenchParam param;
+    string outFile;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--check")
+        {
+            size_t failures = 0;
+            try
+            {
+                failures = runChecks(cout);
+            }
+            catch (const exception& e)
+            {
+                cerr << "bench --check : " << e.what() << endl;
+                failures = 1;
+            }
+            ThreadPool::getInstance()->stop();
+            return int(failures);
+        }
+        else if (arg == "--quick")
+        {
+            param.paths = { 4096 };
+            param.threads = { 2 };
+            param.grids = { 10 };
+            param.reps = 1;
+        }
+        else if (arg == "--paths" && hasValue) param.paths = parseList(argv[++i]);
+        else if (arg == "--threads" && hasValue) param.threads = parseList(argv[++i]);
+        else if (arg == "--grids" && hasValue) param.grids = parseList(argv[++i]);
+        else if (arg == "--reps" && hasValue) param.reps = max<size_t>(1, stoul(argv[++i]));
+        else if (arg == "--pin") param.pin = true;
+        else if (arg == "--out" && hasValue) outFile = argv[++i];
+        else
+        {
+            cerr << "Usage: bench [--quick] [--paths n,n,...] [--threads n,n,...] "
+                << "[--grids n,n,...] [--reps n] [--pin] [--out file] | bench --check" << endl;
+            return 1;
+        }
+    }
+
+    ofstream file;
+    if (!outFile.empty()) file.open(outFile);
+    ostream& out = outFile.empty() ? cout : file;
+    out.precision(6);
+
+    try
+    {
+        BenchReport report(out);
+        benchRng(param, report);
+        benchSimul(param, report);
+        benchDupire(param, report);
+        benchDupireSchemes(param, report);
+    }
+    catch (const exception& e)
+    {
+        cerr << "bench : " << e.what() << endl;
+        ThreadPool::getInstance()->stop();
+        return 1;
+    }
+
+    ThreadPool::getInstance()->stop();
+
+    return 0;
+}
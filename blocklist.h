@@ -20,59 +20,153 @@ As long as this comment is preserved at the top of the file
 //  Blocklist data structure for AAD memory management
 //  See chapter 10, unchanged with expression templates of chapter 15
 
-#include <array>
-#include <list>
+//  The book's blocklist holds its blocks in a list<array<T, block_size>>:
+//      one heap allocation per block, all freed on clear()
+//  Here blocks are carved out of large chunks of memory (an arena)
+//      and indexed in a vector, 
+//      and clear() keeps memory for the next use up to a retention limit,
+//      by default everything, that is the high-water mark,
+//      so repeated runs don't allocate after warm-up
+
+//  Chunks are aligned on 2MB so the OS may back them with huge pages
+//  Memory is not written on allocation: pages are committed 
+//      by the first thread that writes, normally the thread owning the tape,
+//      so they are local to its NUMA node under first touch policies
+
+//  Blocklists may share a memory budget: chunks beyond are mapped 
+//      on temporary files, see spillMap() in AAD.cpp, so the OS pages 
+//      the cold blocks out to disk and back in on access, 
+//      instead of exhausting memory
+//  Addresses don't change, so pointers into blocks remain valid
+
+#include <vector>
+#include <new>
+#include <cstring>
+#include <limits>
 #include <iterator>
+#include <algorithm>
 using namespace std;
 
+//  Memory mapped on a temporary file, nullptr on failure, see AAD.cpp
+void* spillMap(const size_t bytes, void*& handle);
+void spillUnmap(void* memory, const size_t bytes, void* handle);
+
+//  Memory budget shared by blocklists, in bytes
+struct blockbudget
+{
+    //  Bytes allocated on the heap, and the maximum
+    size_t  heap = 0;
+    size_t  max_heap = numeric_limits<size_t>::max();
+};
+
 template <class T, size_t block_size>
 class blocklist
 {
-    //  Container = list of blocks
-    list<array<T, block_size>>  data;
+    static constexpr size_t block_bytes = block_size * sizeof(T);
+
+    //  Huge page size and alignment
+    static constexpr size_t huge_page = size_t(1) << 21;
+    //  Number of blocks in a chunk, after the first one
+    static constexpr size_t chunk_blocks = (huge_page + block_bytes - 1) / block_bytes;
+
+    //  Chunks of memory, with their alignment
+    //  Mapped chunks have no alignment and a file handle
+    struct chunk
+    {
+        T*      memory;
+        size_t  alignment;
+        size_t  bytes;
+        void*   handle;
+    };
+    vector<chunk>       chunks;
+
+    //  Budget, shared, nullptr = unlimited
+    blockbudget*        budget = nullptr;
 
-    using list_iter = decltype(data.begin());
-    using block_iter = decltype(data.back().begin());
+    //  High-water mark, in blocks
+    size_t              max_block = 0;
+
+    //  Blocks, in order, pointing into chunks
+    vector<T*>          data;
 
     //  Current block
-    list_iter           cur_block;
+    size_t              cur_block;
 
-	//  Last block
-	list_iter			last_block;
-	
-	//  Next free space in current block
-    block_iter          next_space;
+    //  Next free space in current block
+    T*                  next_space;
 
     //  Last free space (+1) in current block
-    block_iter          last_space;
+    T*                  last_space;
 
     //  Mark
-    list_iter           marked_block;
-    block_iter          marked_space;
+    size_t              marked_block;
+    T*                  marked_space;
+
+    //  Bytes kept on clear()
+    size_t              max_retained = numeric_limits<size_t>::max();
 
-    //  Create new array
-    void newblock()
+    //  Allocate a new chunk and its blocks
+    void newchunk()
     {
-        data.emplace_back();
-        cur_block = last_block = prev(data.end());
-        next_space = cur_block->begin();
-        last_space = cur_block->end();
+        //  The first chunk holds one block so small lists stay small
+        const size_t n = data.empty() ? 1 : chunk_blocks;
+        const size_t bytes = n * block_bytes;
+
+        //  Over budget: map on file
+        //  Otherwise, or if mapping fails, heap
+        if (budget && budget->heap + bytes > budget->max_heap && !data.empty())
+        {
+            void* handle = nullptr;
+            T* memory = static_cast<T*>(spillMap(bytes, handle));
+            if (memory)
+            {
+                chunks.push_back({ memory, 0, bytes, handle });
+                for (size_t i = 0; i < n; ++i) data.push_back(memory + i * block_size);
+                return;
+            }
+        }
+
+        const size_t alignment = data.empty() ? 64 : huge_page;
+        T* memory = static_cast<T*>(
+            ::operator new(bytes, align_val_t(alignment)));
+        chunks.push_back({ memory, alignment, bytes, nullptr });
+        if (budget) budget->heap += bytes;
+
+        for (size_t i = 0; i < n; ++i) data.push_back(memory + i * block_size);
     }
 
-    //  Move on to next array
-    void nextblock()
+    //  Free all chunks but the first keep ones
+    void freechunks(const size_t keep)
     {
-        //  This is the last array: create new
-        if (cur_block == last_block)
+        for (size_t i = keep; i < chunks.size(); ++i)
         {
-            newblock();
+            if (chunks[i].alignment)
+            {
+                ::operator delete(chunks[i].memory, align_val_t(chunks[i].alignment));
+                if (budget) budget->heap -= chunks[i].bytes;
+            }
+            else
+            {
+                spillUnmap(chunks[i].memory, chunks[i].bytes, chunks[i].handle);
+            }
         }
-        else
+        chunks.resize(keep);
+        data.resize(keep ? 1 + (keep - 1) * chunk_blocks : 0);
+    }
+
+    //  Move on to next block
+    void nextblock()
+    {
+        //  This is the last block: create new
+        if (cur_block + 1 == data.size())
         {
-            ++cur_block;
-            next_space = cur_block->begin();
-            last_space = cur_block->end();
+            newchunk();
         }
+
+        ++cur_block;
+        if (cur_block > max_block) max_block = cur_block;
+        next_space = data[cur_block];
+        last_space = next_space + block_size;
     }
 
 public:
@@ -80,30 +174,108 @@ public:
     //  Create first block on construction
     blocklist()
     {
-        newblock();
+        newchunk();
+        rewind();
+        setmark();
+    }
+
+    ~blocklist()
+    {
+        freechunks(0);
     }
 
-    //  Factory reset
+    //  Blocks are owned, no copies
+    blocklist(const blocklist&) = delete;
+    blocklist& operator=(const blocklist&) = delete;
+
+    //  Retention policy: bytes kept for the next use on clear()
+    //  0: give all memory back, as in the book
+    //  Default: keep everything (high-water mark)
+    void set_retention(const size_t bytes)
+    {
+        max_retained = bytes;
+    }
+
+    //  Share a memory budget, nullptr = unlimited
+    //  Applies to the chunks allocated from now on
+    void set_budget(blockbudget* b)
+    {
+        if (budget == b) return;
+        for (const auto& c : chunks) if (c.alignment)
+        {
+            if (budget) budget->heap -= c.bytes;
+            if (b) b->heap += c.bytes;
+        }
+        budget = b;
+    }
+
+    //  Memory held, in bytes
+    size_t capacity() const
+    {
+        return data.size() * block_bytes;
+    }
+
+    //  Memory held on files, in bytes
+    size_t mapped() const
+    {
+        size_t bytes = 0;
+        for (const auto& c : chunks) if (!c.alignment) bytes += c.bytes;
+        return bytes;
+    }
+
+    //  Memory used, in bytes, up to the next free space
+    size_t size() const
+    {
+        return cur_block * block_bytes + (next_space - data[cur_block]) * sizeof(T);
+    }
+
+    //  Memory used at most since the last clear(), in bytes, by whole blocks
+    size_t high_water() const
+    {
+        return (max(max_block, cur_block) + 1) * block_bytes;
+    }
+
+    //  Factory reset, keeps memory subject to retention policy
     void clear()
     {
-        data.clear();
-        newblock();
+        size_t keep = 1;
+        size_t kept = block_bytes;
+        while (keep < chunks.size() && kept + chunk_blocks * block_bytes <= max_retained)
+        {
+            kept += chunk_blocks * block_bytes;
+            ++keep;
+        }
+        freechunks(keep);
+        max_block = 0;
+
+        rewind();
+        setmark();
+    }
+
+    //  Factory reset, gives all memory back
+    void release()
+    {
+        freechunks(1);
+        max_block = 0;
+
+        rewind();
+        setmark();
     }
 
     //  Rewind but keep all blocks
     void rewind()
     {
-        cur_block = data.begin();
-        next_space = cur_block->begin();
-        last_space = cur_block->end();
+        cur_block = 0;
+        next_space = data[0];
+        last_space = next_space + block_size;
     }
 
 	//	Memset
 	void memset(unsigned char value = 0)
 	{
-		for (auto& arr : data)
+		for (T* block : data)
 		{
-			std::memset(&arr[0], value, block_size * sizeof(T));
+			std::memset(block, value, block_bytes);
 		}
 	}
 
@@ -119,7 +291,7 @@ public:
             nextblock();
         }
         //  Placement new, construct in memory pointed by next
-        T* emplaced = new (&*next_space)    //  memory pointed by next as T*
+        T* emplaced = new (next_space)      //  memory pointed by next as T*
             T(forward<Args>(args)...);      //  perfect forwarding of ctor arguments
 
         //  Advance next
@@ -145,7 +317,7 @@ public:
         ++next_space;
 
         //  Return
-        return &*old_next;
+        return old_next;
     }
 
 	//  Stores n default constructed elements 
@@ -168,7 +340,7 @@ public:
 		next_space += n;
 
 		//  Return
-		return &*old_next;
+		return old_next;
 	}
 
 	//	Version 2: n unknown at compile time
@@ -187,7 +359,7 @@ public:
 		next_space += n;
 
 		//  Return
-		return &*old_next;
+		return old_next;
 	}
 
 	//	Marks
@@ -204,18 +376,19 @@ public:
     {
         cur_block = marked_block;
         next_space = marked_space;
-		last_space = cur_block->end();
+		last_space = data[cur_block] + block_size;
     }
 
     //  Iterator
 
     class iterator 
     {
-        //  List and block
-        list_iter        cur_block;		//  current block
-        block_iter       cur_space;		//  current space
-        block_iter       first_space;	//  first space in block
-        block_iter       last_space;	//  last (+1) space in block
+        //  Blocks and current block
+        const vector<T*>*   blocks;
+        size_t              cur_block;      //  current block
+        T*                  cur_space;		//  current space
+        T*                  first_space;	//  first space in block
+        T*                  last_space;	    //  last (+1) space in block
 
     public:
 
@@ -230,18 +403,30 @@ public:
         iterator() {}
 
         //	Constructor 
-        iterator(list_iter cb, block_iter cs, block_iter fs, block_iter ls) :
-            cur_block(cb), cur_space(cs), first_space(fs), last_space(ls) {}
+        //  A position at the end of a block is represented
+        //      at the start of the next one, if any
+        iterator(const vector<T*>* bl, size_t cb, T* cs) :
+            blocks(bl), cur_block(cb), cur_space(cs) 
+        {
+            first_space = (*blocks)[cur_block];
+            last_space = first_space + block_size;
+            if (cur_space == last_space && cur_block + 1 < blocks->size())
+            {
+                ++cur_block;
+                first_space = cur_space = (*blocks)[cur_block];
+                last_space = first_space + block_size;
+            }
+        }
 
         //	Pre-increment (we do not provide post)
         iterator& operator++()
         {
             ++cur_space;
-            if (cur_space == last_space)
+            if (cur_space == last_space && cur_block + 1 < blocks->size())
             {
                 ++cur_block;
-                first_space = cur_block->begin();
-                last_space = cur_block->end();
+                first_space = (*blocks)[cur_block];
+                last_space = first_space + block_size;
 				cur_space = first_space;
             }
 
@@ -254,8 +439,8 @@ public:
             if (cur_space == first_space)
             {
                 --cur_block;
-                first_space = cur_block->begin();
-                last_space = cur_block->end();
+                first_space = (*blocks)[cur_block];
+                last_space = first_space + block_size;
 				cur_space = last_space;
             }
 
@@ -275,11 +460,11 @@ public:
         }
         T* operator->()
         {
-            return &*cur_space;
+            return cur_space;
         }
         const T* operator->() const
         {
-            return &*cur_space;
+            return cur_space;
         }
 
         //	Check equality
@@ -297,22 +482,18 @@ public:
 
     iterator begin()
     {
-        return iterator(data.begin(), data.begin()->begin(),
-            data.begin()->begin(), data.begin()->end());
+        return iterator(&data, 0, data[0]);
     }
 
     iterator end()
     {
-        auto last_block = prev(data.end());
-        return iterator(cur_block, next_space,
-            cur_block->begin(), cur_block->end());
+        return iterator(&data, cur_block, next_space);
     }
 
     //  Iterator on mark
     iterator mark()
     {
-        return iterator(marked_block, marked_space,
-            marked_block->begin(), marked_block->end());
+        return iterator(&data, marked_block, marked_space);
     }
 
     //  Find element, by pointer, searching sequentially from the end
@@ -332,4 +513,4 @@ public:
 
         return end();
     }
-};
\ No newline at end of file
+};
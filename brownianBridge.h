@@ -0,0 +1,229 @@
+/*
+Written by Antoine Savine in 2018
+
+This code is the strict IP of Antoine Savine
+
+License to use and alter this code for personal and commercial applications
+is freely granted to any person or company who purchased a copy of the book
+
+Modern Computational Finance: AAD and Parallel Simulations
+Antoine Savine
+Wiley, 2018
+
+As long as this comment is preserved at the top of the file
+*/
+
+#pragma once
+
+//  Brownian bridge construction of the Gaussian vectors of another RNG
+
+//  The underlying RNG, typically Sobol, draws Gaussians g[0..D-1]
+//  They are mapped, in this order, to the Brownian motion W on the points 1..D:
+//      g[0] to W(D), g[1] to the midpoint, then the quarters, etc.
+//  The resulting vectors are the increments W(i + 1) - W(i),
+//      independent standard Gaussians again, consumed by the models in time order
+//  So the first, best distributed dimensions of a low discrepancy sequence
+//      drive the global shape of the path, the last ones only fill in details,
+//      QMC sequences keep their convergence in high dimension
+//  The bridge is on the index of the Gaussians, not the simulation timeline:
+//      exact for regular steps, still correct in distribution otherwise
+//  Uniforms are passed through unchanged
+
+#include "mcBase.h"
+
+class BrownianBridge : public RNG
+{
+    //  Underlying RNG
+    unique_ptr<RNG>     myRng;
+
+    //  Dimension
+    size_t              myDim;
+
+    //  Bridge schedule, built on init
+    //  Gaussian i builds the point myBridge[i]
+    //      from the points myLeft[i] - 1 (0 = origin) and myRight[i]
+    vector<size_t>      myBridge;
+    vector<size_t>      myLeft;
+    vector<size_t>      myRight;
+    vector<double>      myLeftWeight;
+    vector<double>      myRightWeight;
+    vector<double>      myStdDev;
+
+    //  Workspace
+    vector<double>      myGaussians;
+    vector<double>      myPath;
+    matrix<double>      myPathBlock;
+
+    //  Build the bridge on the points 1..D
+    void buildSchedule()
+    {
+        myBridge.assign(myDim, 0);
+        myLeft.assign(myDim, 0);
+        myRight.assign(myDim, 0);
+        myLeftWeight.assign(myDim, 0.0);
+        myRightWeight.assign(myDim, 0.0);
+        myStdDev.assign(myDim, 0.0);
+        if (!myDim) return;
+
+        //  Points: t[i] = i + 1
+        auto t = [](const size_t i) { return double(i + 1); };
+
+        //  Points already built
+        vector<int> built(myDim, false);
+
+        //  First: the last point
+        built[myDim - 1] = true;
+        myBridge[0] = myDim - 1;
+        myStdDev[0] = sqrt(t(myDim - 1));
+
+        //  Then bisect the intervals, left to right, coarse to fine
+        for (size_t i = 1, j = 0; i < myDim; ++i)
+        {
+            //  Next interval [j, k] with unbuilt points
+            while (built[j]) ++j;
+            size_t k = j;
+            while (!built[k]) ++k;
+
+            //  Midpoint
+            const size_t l = j + ((k - 1 - j) >> 1);
+            built[l] = true;
+            myBridge[i] = l;
+            myLeft[i] = j;
+            myRight[i] = k;
+
+            //  Conditional distribution of W(t[l]) given W(t[j - 1]) and W(t[k])
+            const double tl = j ? t(j - 1) : 0.0;
+            myLeftWeight[i] = (t(k) - t(l)) / (t(k) - tl);
+            myRightWeight[i] = (t(l) - tl) / (t(k) - tl);
+            myStdDev[i] = sqrt((t(l) - tl) * (t(k) - t(l)) / (t(k) - tl));
+
+            j = k + 1;
+            if (j >= myDim) j = 0;
+        }
+    }
+
+    //  Gaussians to increments, path is a workspace
+    void transform(const vector<double>& gaussVec, vector<double>& path, vector<double>& incVec) const
+    {
+        path[myDim - 1] = myStdDev[0] * gaussVec[0];
+        for (size_t i = 1; i < myDim; ++i)
+        {
+            const size_t j = myLeft[i], k = myRight[i], l = myBridge[i];
+            path[l] = j
+                ? myLeftWeight[i] * path[j - 1] + myRightWeight[i] * path[k] + myStdDev[i] * gaussVec[i]
+                : myRightWeight[i] * path[k] + myStdDev[i] * gaussVec[i];
+        }
+
+        incVec[0] = path[0];
+        for (size_t i = 1; i < myDim; ++i) incVec[i] = path[i] - path[i - 1];
+    }
+
+public:
+
+    BrownianBridge(unique_ptr<RNG> rng) : myRng(move(rng)), myDim(0) {}
+
+    BrownianBridge(const BrownianBridge& rhs) :
+        myRng(rhs.myRng->clone()),
+        myDim(rhs.myDim),
+        myBridge(rhs.myBridge),
+        myLeft(rhs.myLeft),
+        myRight(rhs.myRight),
+        myLeftWeight(rhs.myLeftWeight),
+        myRightWeight(rhs.myRightWeight),
+        myStdDev(rhs.myStdDev),
+        myGaussians(rhs.myGaussians),
+        myPath(rhs.myPath),
+        myPathBlock(rhs.myPathBlock)
+    {}
+
+    //  Virtual copy constructor
+    unique_ptr<RNG> clone() const override
+    {
+        return make_unique<BrownianBridge>(*this);
+    }
+
+    //  Initializer
+    void init(const size_t simDim) override
+    {
+        myRng->init(simDim);
+        myDim = simDim;
+        buildSchedule();
+        myGaussians.resize(myDim);
+        myPath.resize(myDim);
+    }
+
+    void nextU(vector<double>& uVec) override
+    {
+        myRng->nextU(uVec);
+    }
+
+    void nextG(vector<double>& gaussVec) override
+    {
+        myRng->nextG(myGaussians);
+        transform(myGaussians, myPath, gaussVec);
+    }
+
+    void nextUBlock(const size_t nPath, matrix<double>& uBlock) override
+    {
+        myRng->nextUBlock(nPath, uBlock);
+    }
+
+    //  Same as nextG() with loops over paths innermost
+    //  Bridged in place, bit for bit the same as nPath calls to nextG()
+    void nextGBlock(const size_t nPath, matrix<double>& gaussBlock) override
+    {
+        myRng->nextGBlock(nPath, gaussBlock);
+        if (!myDim) return;
+
+        myPathBlock.resize(myDim, gaussBlock.cols());
+
+        {
+            const double sd = myStdDev[0];
+            const double* g = gaussBlock[0];
+            double* w = myPathBlock[myDim - 1];
+            for (size_t p = 0; p < nPath; ++p) w[p] = sd * g[p];
+        }
+        for (size_t i = 1; i < myDim; ++i)
+        {
+            const size_t j = myLeft[i], k = myRight[i], l = myBridge[i];
+            const double lw = myLeftWeight[i], rw = myRightWeight[i], sd = myStdDev[i];
+            const double* g = gaussBlock[i];
+            const double* wk = myPathBlock[k];
+            double* wl = myPathBlock[l];
+            if (j)
+            {
+                const double* wj = myPathBlock[j - 1];
+                for (size_t p = 0; p < nPath; ++p) wl[p] = lw * wj[p] + rw * wk[p] + sd * g[p];
+            }
+            else
+            {
+                for (size_t p = 0; p < nPath; ++p) wl[p] = rw * wk[p] + sd * g[p];
+            }
+        }
+
+        //  Increments
+        {
+            const double* w = myPathBlock[0];
+            double* inc = gaussBlock[0];
+            for (size_t p = 0; p < nPath; ++p) inc[p] = w[p];
+        }
+        for (size_t i = 1; i < myDim; ++i)
+        {
+            const double* w0 = myPathBlock[i - 1];
+            const double* w1 = myPathBlock[i];
+            double* inc = gaussBlock[i];
+            for (size_t p = 0; p < nPath; ++p) inc[p] = w1[p] - w0[p];
+        }
+    }
+
+    bool antithetic() const override
+    {
+        return myRng->antithetic();
+    }
+
+    //  Skip ahead, on the underlying RNG
+    void skipTo(const size_t b) override
+    {
+        myRng->skipTo(b);
+    }
+};
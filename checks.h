@@ -0,0 +1,624 @@
+/*
+Written by Antoine Savine in 2018
+
+This code is the strict IP of Antoine Savine
+
+License to use and alter this code for personal and commercial applications
+is freely granted to any person or company who purchased a copy of the book
+
+Modern Computational Finance: AAD and Parallel Simulations
+Antoine Savine
+Wiley, 2018
+
+As long as this comment is preserved at the top of the file
+*/
+
+#pragma once
+
+//  Self checks of the library, run with bench --check, see bench.cpp
+//  Each check reports one line: ok or FAILED with details
+//  bench --check returns the number of failures
+
+#include "main.h"
+#include "mrg32k3a.h"
+#include "sobol.h"
+#include "shard.h"
+#include <iostream>
+#include <sstream>
+using namespace std;
+
+struct CheckReport
+{
+    ostream&    out;
+    size_t      failures = 0;
+
+    CheckReport(ostream& ost) : out(ost) {}
+
+    void operator()(const string& name, const bool ok, const string& details = "")
+    {
+        out << (ok ? "ok       " : "FAILED   ") << name;
+        if (!ok && !details.empty()) out << " : " << details;
+        out << endl;
+        if (!ok) ++failures;
+    }
+};
+
+//  Draws of several paths
+inline vector<vector<double>> drawPaths(RNG& rng, const size_t nPath, const size_t dim, const bool gaussian)
+{
+    vector<vector<double>> draws(nPath, vector<double>(dim));
+    for (auto& draw : draws)
+    {
+        if (gaussian) rng.nextG(draw);
+        else rng.nextU(draw);
+    }
+    return draws;
+}
+
+//  mrg32k3a: skipTo() gives the same draws as sequential generation,
+//      in every substream, with and without antithetic paths,
+//      and reaches paths beyond 2^32
+inline void checkMrgSkip(CheckReport& report)
+{
+    const size_t dim = 7;
+    for (const bool anti : { false, true }) for (const unsigned long long stream : { 0ull, 1ull, 5ull })
+    {
+        for (const bool gaussian : { false, true })
+        {
+            mrg32k3a seq(12345, 12346, anti);
+            seq.setStream(stream);
+            seq.init(dim);
+            const auto all = drawPaths(seq, 1100, dim, gaussian);
+
+            bool ok = true;
+            ostringstream details;
+            for (const size_t offset : { 0, 1, 2, 3, 7, 64, 101, 1000 })
+            {
+                mrg32k3a rng(12345, 12346, anti);
+                rng.setStream(stream);
+                rng.init(dim);
+                rng.skipTo(offset);
+                const auto skipped = drawPaths(rng, 100, dim, gaussian);
+                for (size_t p = 0; p < skipped.size(); ++p)
+                {
+                    if (skipped[p] != all[offset + p])
+                    {
+                        ok = false;
+                        details << "offset " << offset << " path " << p << ' ';
+                        break;
+                    }
+                }
+            }
+
+            ostringstream name;
+            name << "mrg32k3a skipTo = sequential, stream " << stream
+                << (anti ? " antithetic" : "") << (gaussian ? " gaussians" : " uniforms");
+            report(name.str(), ok, details.str());
+        }
+    }
+
+    //  Substreams are different
+    {
+        mrg32k3a s0, s1;
+        s1.setStream(1);
+        s0.init(dim);
+        s1.init(dim);
+        report("mrg32k3a substreams differ", drawPaths(s0, 10, dim, false) != drawPaths(s1, 10, dim, false));
+    }
+
+    //  Beyond 2^32 paths: consistent with sequential draws from there,
+    //      and not truncated to 32bit
+    {
+        const size_t far = (size_t(1) << 32) + 3;
+        mrg32k3a base(12345, 12346, true), rng(12345, 12346, true), low(12345, 12346, true);
+        base.init(dim);
+        rng.init(dim);
+        low.init(dim);
+        base.skipTo(far - 3);
+        const auto all = drawPaths(base, 10, dim, true);
+        rng.skipTo(far);
+        const auto skipped = drawPaths(rng, 7, dim, true);
+        low.skipTo(3);
+        bool ok = true;
+        for (size_t p = 0; p < skipped.size(); ++p) ok = ok && skipped[p] == all[3 + p];
+        report("mrg32k3a skipTo beyond 2^32 paths", ok && skipped != drawPaths(low, 7, dim, true));
+    }
+}
+
+//  Sobol: skipTo() gives the same draws as sequential generation
+inline void checkSobolSkip(CheckReport& report)
+{
+    const size_t dim = 13;
+    for (const bool scramble : { false, true })
+    {
+        Sobol seq(scramble, 42);
+        seq.init(dim);
+        const auto all = drawPaths(seq, 1100, dim, false);
+
+        bool ok = true;
+        ostringstream details;
+        for (const size_t offset : { 0, 1, 2, 3, 7, 64, 101, 1000 })
+        {
+            Sobol rng(scramble, 42);
+            rng.init(dim);
+            rng.skipTo(offset);
+            if (drawPaths(rng, 100, dim, false) != vector<vector<double>>(all.begin() + offset, all.begin() + offset + 100))
+            {
+                ok = false;
+                details << "offset " << offset << ' ';
+            }
+        }
+        report(string("Sobol skipTo = sequential") + (scramble ? " scrambled" : ""), ok, details.str());
+    }
+}
+
+//  Sharded runs: shard results serialized and deserialized, then reduced
+//  Values are the same as value(), bit for bit, for any number of shards,
+//      with and without antithetic paths and control variates
+//  AAD risks are the same as AADriskAggregate() to rounding
+inline void checkShards(CheckReport& report)
+{
+    putBlackScholes(100, 0.2, false, 0.0, 0.0, "checkShardsBS");
+    putBarrier(100, 150, 1, 0.02, 0.01, "checkShardsBarrier");
+
+    NumericalParam num;
+    num.parallel = true;
+    num.useSobol = false;
+    num.numPath = 20000;
+    num.batchSize = 500;
+    num.cache = false;
+
+    //  Through a binary stream, as a transport would
+    auto transport = [](const auto& shard)
+    {
+        stringstream ss(ios::in | ios::out | ios::binary);
+        serialize(ss, shard);
+        auto result = shard;
+        deserialize(ss, result);
+        return result;
+    };
+
+    for (const bool anti : { false, true }) for (const bool control : { false, true })
+    {
+        num.antithetic = anti;
+        num.controlVariate = control;
+        const auto ref = value("checkShardsBS", "checkShardsBarrier", num);
+
+        bool ok = true;
+        ostringstream details;
+        for (const size_t nShard : { 1, 3, 7 })
+        {
+            vector<ValueShard> shards;
+            for (const auto& shard : shardPaths(num.numPath, nShard, num.batchSize))
+            {
+                shards.push_back(transport(valueShard("checkShardsBS", "checkShardsBarrier", num, shard)));
+            }
+            const auto results = reduceValueShards("checkShardsBarrier", move(shards));
+            if (results.values != ref.values || results.errors != ref.errors || results.numPath != ref.numPath)
+            {
+                ok = false;
+                details << nShard << " shards ";
+            }
+        }
+
+        ostringstream name;
+        name << "sharded value = value()" << (anti ? " antithetic" : "") << (control ? " control" : "");
+        report(name.str(), ok, details.str());
+    }
+
+    {
+        num.antithetic = true;
+        num.controlVariate = false;
+        const auto& labels = getProduct<double>("checkShardsBarrier")->payoffLabels();
+        const map<string, double> notionals = { { labels[0], 1.0 }, { labels[1], -0.5 } };
+        const auto ref = AADriskAggregate("checkShardsBS", "checkShardsBarrier", notionals, num);
+
+        auto close = [](const double x, const double y) 
+        { 
+            return fabs(x - y) <= 1.0e-10 * max(1.0, fabs(y)); 
+        };
+
+        bool ok = true;
+        ostringstream details;
+        details.precision(17);
+        for (const size_t nShard : { 1, 3, 7 })
+        {
+            vector<AADShard> shards;
+            for (const auto& shard : shardPaths(num.numPath, nShard, num.batchSize))
+            {
+                shards.push_back(transport(
+                    AADriskAggregateShard("checkShardsBS", "checkShardsBarrier", notionals, num, shard)));
+            }
+            const auto results = reduceAADShards("checkShardsBS", "checkShardsBarrier", move(shards));
+            bool same = close(results.riskPayoffValue, ref.riskPayoffValue)
+                && results.risks.size() == ref.risks.size();
+            for (size_t j = 0; same && j < ref.risks.size(); ++j) same = close(results.risks[j], ref.risks[j]);
+            for (size_t j = 0; same && j < ref.payoffValues.size(); ++j) 
+                same = close(results.payoffValues[j], ref.payoffValues[j]);
+            if (!same)
+            {
+                ok = false;
+                details << nShard << " shards " << results.riskPayoffValue << " vs " << ref.riskPayoffValue << ' ';
+            }
+        }
+        report("sharded AAD risks = AADriskAggregate() to rounding", ok, details.str());
+    }
+
+    //  Truncated results are rejected
+    {
+        const auto shard = valueShard("checkShardsBS", "checkShardsBarrier", num, { 0, 1000 });
+        stringstream ss(ios::in | ios::out | ios::binary);
+        serialize(ss, shard);
+        const string bytes = ss.str();
+        stringstream truncated(bytes.substr(0, bytes.size() / 2), ios::in | ios::binary);
+        bool threw = false;
+        try
+        {
+            ValueShard result;
+            deserialize(truncated, result);
+        }
+        catch (const runtime_error&)
+        {
+            threw = true;
+        }
+        report("truncated shard result rejected", threw);
+    }
+}
+
+//  Tape: iterators across blocks, nodes larger than a block
+//      and propagation with nothing above mark
+inline void checkTape(CheckReport& report)
+{
+    Tape& tape = *Number::tape;
+    tape.clear();
+
+    //  Many blocks: iterators forward and backward visit the same nodes
+    {
+        Number x(1.0);
+        x.putOnTape();
+        Number y = x;
+        for (size_t i = 0; i < 3 * BLOCKSIZE; ++i) y = y * 1.0000001 + x;
+
+        vector<Node*> forward, backward;
+        for (auto it = tape.begin(); it != tape.end(); ++it) forward.push_back(&*it);
+        for (auto it = prev(tape.end()); it != tape.end(); --it) backward.push_back(&*it);
+        reverse(backward.begin(), backward.end());
+        report("tape iterators across blocks", 
+            forward.size() == tape.numNodes() && forward == backward && --tape.begin() == tape.end());
+
+        //  Against finite differences
+        y.propagateToStart();
+        double yUp = 1.0 + 1.0e-6;
+        double xUp = yUp;
+        for (size_t i = 0; i < 3 * BLOCKSIZE; ++i) yUp = yUp * 1.0000001 + xUp;
+        const double fd = (yUp - y.value()) * 1.0e6;
+        report("tape propagation across blocks", fabs(x.adjoint() - fd) < 1.0e-4 * fabs(fd));
+    }
+    tape.clear();
+
+    //  A node larger than a block, above mark, rewound and recorded again
+    {
+        const size_t n = BLOCKSIZE;
+        vector<Number> xs(n);
+        vector<double> ws(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            xs[i] = Number(double(i));
+            xs[i].putOnTape();
+            ws[i] = 1.0 + double(i % 7);
+        }
+        tape.mark();
+
+        bool ok = true;
+        for (int rep = 0; rep < 2; ++rep)
+        {
+            tape.rewindToMark();
+            tape.resetAdjoints();
+            Number s = Number::weightedSum(xs.begin(), xs.end(), ws.begin());
+            Number y = s * 2.0 + xs[1];
+            y.propagateToMark();
+            Number::propagateMarkToStart();
+            for (size_t i = 0; i < n; ++i)
+            {
+                ok = ok && xs[i].adjoint() == 2.0 * ws[i] + (i == 1 ? 1.0 : 0.0);
+            }
+            //  The weighted sum and the expression of y
+            size_t count = 0;
+            for (auto it = tape.markIt(); it != tape.end(); ++it) ++count;
+            ok = ok && count == tape.numNodesAfterMark() && count == 2;
+        }
+        report("tape node larger than a block", ok);
+    }
+    tape.clear();
+
+    //  Nothing above mark, nothing below mark
+    {
+        tape.mark();
+        Number x(1.0);
+        x.putOnTape();
+        Number y = x * 3.0;
+        y.propagateToMark();
+        //  Nothing below mark: no propagation
+        Number::propagateMarkToStart();
+        const bool below = x.adjoint() == 3.0;
+
+        tape.mark();
+        tape.resetAdjoints();
+        //  Nothing above mark: no propagation
+        Number::propagateAdjoints(prev(tape.end()), tape.markIt());
+        report("tape propagation of empty ranges", below && x.adjoint() == 0.0 && y.adjoint() == 0.0);
+    }
+    tape.clear();
+}
+
+//  Bump risk: base and bumped models on the same Gaussians
+//  Serial: the same as value() in each bumped model, bit for bit
+//  Parallel: the same as serial to rounding
+inline void checkBumpRisk(CheckReport& report)
+{
+    putBlackScholes(100, 0.2, false, 0.02, 0.01, "checkBumpBS");
+    putBarrier(100, 150, 1, 0.02, 0.01, "checkBumpBarrier");
+
+    NumericalParam num;
+    num.parallel = false;
+    num.useSobol = true;
+    num.numPath = 4096;
+    num.cache = false;
+
+    const auto serial = bumpRisk("checkBumpBS", "checkBumpBarrier", num);
+
+    const auto model = getModel<double>("checkBumpBS");
+    const auto product = getProduct<double>("checkBumpBarrier");
+    const auto base = value(*model, *product, num);
+    bool ok = serial.values == base.values;
+    for (size_t i = 0; ok && i < serial.params.size(); ++i)
+    {
+        auto bumped = model->clone();
+        *bumped->parameters()[i] += 1.e-08;
+        const auto res = value(*bumped, *product, num);
+        for (size_t j = 0; j < serial.payoffs.size(); ++j)
+        {
+            ok = ok && serial.risks[i][j] == 1.0e+08 * (res.values[j] - base.values[j]);
+        }
+    }
+    report("serial bumpRisk = bumped value()", ok);
+
+    num.parallel = true;
+    num.batchSize = 256;
+    const auto parallel = bumpRisk("checkBumpBS", "checkBumpBarrier", num);
+    ok = true;
+    for (size_t i = 0; i < serial.params.size(); ++i) for (size_t j = 0; j < serial.payoffs.size(); ++j)
+    {
+        ok = ok && fabs(parallel.risks[i][j] - serial.risks[i][j]) <= 1.0e-5 * max(1.0, fabs(serial.risks[i][j]));
+    }
+    report("parallel bumpRisk = serial to rounding", ok);
+}
+
+//  Risk sessions are refreshed when any numerical parameter but the cancellation flag changes
+inline void checkSameNumericalParam(CheckReport& report)
+{
+    NumericalParam num;
+    num.parallel = true;
+    num.useSobol = false;
+    num.numPath = 1000;
+
+    vector<NumericalParam> changed(13, num);
+    changed[0].parallel = false;
+    changed[1].useSobol = true;
+    changed[2].scramble = true;
+    changed[3].numPath = 1001;
+    changed[4].seed1 = 1;
+    changed[5].seed2 = 1;
+    changed[6].batchSize = 64;
+    changed[7].brownianBridge = true;
+    changed[8].antithetic = false;
+    changed[9].controlVariate = true;
+    changed[10].targetError = 0.01;
+    changed[11].cache = false;
+    changed[12].singlePrecision = true;
+
+    bool ok = true;
+    ostringstream details;
+    for (size_t i = 0; i < changed.size(); ++i)
+    {
+        if (sameNumericalParam(num, changed[i]))
+        {
+            ok = false;
+            details << "field " << i << ' ';
+        }
+    }
+    atomic<bool> cancel(false);
+    NumericalParam cancellable = num;
+    cancellable.cancel = &cancel;
+    report("sameNumericalParam() compares all the fields", 
+        ok && sameNumericalParam(num, cancellable), details.str());
+}
+
+//  Nested portfolios: the same results as the flat portfolio of the same legs,
+//      with the block engine of value() and the path by path engine of AAD
+inline void checkNestedPortfolio(CheckReport& report)
+{
+    putBlackScholes(100, 0.2, false, 0.02, 0.01, "checkPfBS");
+    putEuropean(100, 1, 1, "checkPfCall");
+    putBarrier(100, 150, 1, 0.02, 0.01, "checkPfBarrier");
+    putEuropean(90, 2, 2, "checkPfCall2");
+    putPortfolio({ "checkPfCall", "checkPfBarrier" }, "checkPfInner");
+    putPortfolio({ "checkPfInner", "checkPfCall2" }, "checkPfOuter");
+    putPortfolio({ "checkPfCall", "checkPfBarrier", "checkPfCall2" }, "checkPfFlat");
+
+    NumericalParam num;
+    num.parallel = true;
+    num.useSobol = true;
+    num.numPath = 4096;
+    num.batchSize = 256;
+    num.cache = false;
+
+    const auto nested = value("checkPfBS", "checkPfOuter", num);
+    const auto flat = value("checkPfBS", "checkPfFlat", num);
+    report("nested portfolio value = flat", 
+        nested.values == flat.values && flat.values.size() == 4 && flat.values[0] > 0.0);
+
+    //  Path by path, in AAD
+    const auto& nestedLabels = getProduct<Number>("checkPfOuter")->payoffLabels();
+    const auto& flatLabels = getProduct<Number>("checkPfFlat")->payoffLabels();
+    bool ok = nestedLabels.size() == flatLabels.size();
+    for (size_t j = 0; ok && j < flatLabels.size(); ++j)
+    {
+        const auto nestedRisk = AADriskAggregate("checkPfBS", "checkPfOuter", { { nestedLabels[j], 1.0 } }, num);
+        const auto flatRisk = AADriskAggregate("checkPfBS", "checkPfFlat", { { flatLabels[j], 1.0 } }, num);
+        ok = nestedRisk.riskPayoffValue == flatRisk.riskPayoffValue 
+            && nestedRisk.risks == flatRisk.risks
+            && flatRisk.riskPayoffValue > 0.0 && flatRisk.risks[0] != 0.0;
+    }
+    report("nested portfolio AAD = flat", ok);
+
+    //  Path by path with mcSimul(), 
+    //      which also checks that payoffs() doesn't allocate in debug builds
+    mrg32k3a rng;
+    bool allocated = false;
+    vector<vector<double>> nestedPaths, flatPaths;
+    try
+    {
+        const Model<double>& mdl = *getModel<double>("checkPfBS");
+        nestedPaths = mcSimul(*getProduct<double>("checkPfOuter"), mdl, rng, 10);
+        flatPaths = mcSimul(*getProduct<double>("checkPfFlat"), mdl, rng, 10);
+    }
+    catch (const runtime_error&)
+    {
+        allocated = true;
+    }
+    report("nested portfolio mcSimul() = flat without allocation", 
+        !allocated && nestedPaths == flatPaths && flatPaths.size() == 10);
+}
+
+//  Dupire schemes converge to the model: 
+//      against a fine Euler reference, the errors decrease with maxDt, 
+//      up to the Monte-Carlo noise of the difference in Sobol dimensions,
+//      and the finest is close to the reference
+//  A scheme consistent with another SDE, like the predictor-corrector
+//      on the Ito drift, keeps a bias of about 1 on an ATM price of 18
+//  Local vol steep in time and in spot, so the discretization error dominates
+inline void checkDupireSchemes(CheckReport& report)
+{
+    const vector<double> spots = { 50, 75, 100, 125, 150, 200 };
+    const vector<Time> times = { 0.0, 0.5, 1.0, 1.5, 2.0 };
+    matrix<double> vols(spots.size(), times.size());
+    for (size_t i = 0; i < spots.size(); ++i) for (size_t j = 0; j < times.size(); ++j)
+    {
+        vols[i][j] = (0.10 + 0.20 * times[j]) * (1.0 + 0.5 * (100.0 / spots[i] - 1.0));
+    }
+    putEuropeans({ 2.0, 2.0, 2.0, 2.0, 2.0 }, { 70, 85, 100, 115, 130 }, "checkSchemeEuropeans");
+
+    NumericalParam num;
+    num.parallel = false;
+    num.useSobol = true;
+    num.numPath = 131072;
+    num.cache = false;
+
+    putDupire(100, spots, times, vols.view(), 0.005, "checkSchemeDupire");
+    const auto reference = value("checkSchemeDupire", "checkSchemeEuropeans", num).values;
+
+    //  RMS error over the strikes
+    auto error = [&](const DupireScheme scheme, const double maxDt)
+    {
+        putDupire(100, spots, times, vols.view(), maxDt, "checkSchemeDupire", 0, scheme);
+        const auto values = value("checkSchemeDupire", "checkSchemeEuropeans", num).values;
+        double sse = 0;
+        for (size_t i = 0; i < reference.size(); ++i)
+        {
+            sse += (values[i] - reference[i]) * (values[i] - reference[i]);
+        }
+        return sqrt(sse / reference.size());
+    };
+
+    const vector<double> maxDts = { 0.25, 0.1, 0.05 };
+    //  Monte-Carlo noise on the errors, and tolerance on the finest
+    const double noise = 0.05, tolerance = 0.25;
+
+    vector<double> eulerErrs;
+    for (const double maxDt : maxDts) eulerErrs.push_back(error(DupireScheme::euler, maxDt));
+
+    const pair<DupireScheme, string> schemes[] = {
+        { DupireScheme::euler, "Euler" },
+        { DupireScheme::predictorCorrector, "predictor-corrector" },
+        { DupireScheme::midpoint, "midpoint" } };
+
+    for (const auto& scheme : schemes)
+    {
+        vector<double> errs = eulerErrs;
+        if (scheme.first != DupireScheme::euler)
+        {
+            for (size_t k = 0; k < maxDts.size(); ++k) errs[k] = error(scheme.first, maxDts[k]);
+        }
+
+        ostringstream details;
+        details << "rms errors";
+        bool ok = errs.back() < tolerance;
+        for (size_t k = 0; k < maxDts.size(); ++k)
+        {
+            details << " maxDt " << maxDts[k] << ": " << errs[k];
+            if (k > 0) ok = ok && errs[k] < errs[k - 1] + noise;
+            //  Higher order schemes no worse than Euler
+            ok = ok && errs[k] < eulerErrs[k] + noise;
+        }
+        report("Dupire " + scheme.second + " converges", ok, details.str());
+    }
+}
+
+//  Sobol at the maximum dimension of the table of sobol.cpp:
+//      the last dimension is a net: the first 2^m points, 0 included, 
+//      one in each interval of size 2^-m,
+//      and one more dimension is rejected
+inline void checkSobolMaxDim(CheckReport& report)
+{
+    const size_t dim = getjkDim();
+    const size_t m = 10, n = size_t(1) << m;
+
+    //  The sequence starts after 0
+    Sobol rng;
+    rng.init(dim);
+    vector<double> u(dim);
+    vector<int> lastBins(n, 0), firstBins(n, 0);
+    ++firstBins[0];
+    ++lastBins[0];
+    for (size_t p = 1; p < n; ++p)
+    {
+        rng.nextU(u);
+        ++firstBins[size_t(u[0] * n)];
+        ++lastBins[size_t(u[dim - 1] * n)];
+    }
+    const vector<int> ones(n, 1);
+    report("Sobol net in the last dimension of the table", 
+        dim == 1101 && firstBins == ones && lastBins == ones);
+
+    bool threw = false;
+    try
+    {
+        Sobol beyond;
+        beyond.init(dim + 1);
+    }
+    catch (const runtime_error&)
+    {
+        threw = true;
+    }
+    report("Sobol beyond the dimension of the table rejected", threw);
+}
+
+//  All the checks
+inline size_t runChecks(ostream& out)
+{
+    CheckReport report(out);
+
+    checkMrgSkip(report);
+    checkSobolSkip(report);
+    checkSobolMaxDim(report);
+    checkShards(report);
+    checkTape(report);
+    checkBumpRisk(report);
+    checkSameNumericalParam(report);
+    checkNestedPortfolio(report);
+    checkDupireSchemes(report);
+
+    out << report.failures << " failures" << endl;
+    return report.failures;
+}
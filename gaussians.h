@@ -44,11 +44,10 @@ inline double normalCdf(const double x)
 //  Beasley-Springer-Moro algorithm
 //  Moro, The full Monte, Risk, 1995
 //  See Glasserman, Monte Carlo Methods in Financial Engineering, p 68
-inline double invNormalCdf(const double p)
-{
-    const bool sup = p > 0.5;
-    const double up = sup ? 1.0 - p : p;
 
+//  Central region |x| < 0.42, x = p - 0.5, rational approximation
+inline double invNormalCdfCentral(const double x)
+{
 	static constexpr double a0 = 2.50662823884;
 	static constexpr double a1 = -18.61500062529;
 	static constexpr double a2 = 41.39119773534;
@@ -59,6 +58,13 @@ inline double invNormalCdf(const double p)
 	static constexpr double b2 = -21.06224101826;
 	static constexpr double b3 = 3.13082909833;
 
+	const double r = x*x;
+	return x*(((a3*r + a2)*r + a1)*r + a0) / ((((b3*r + b2)*r + b1)*r + b0)*r + 1.0);
+}
+
+//  Tails, up = min(p, 1 - p), Chebyshev polynomial in log(-log(up))
+inline double invNormalCdfTail(const double up)
+{
 	static constexpr double c0 = 0.3374754822726147;
 	static constexpr double c1 = 0.9761690190917186;
 	static constexpr double c2 = 0.1607979714918209;
@@ -69,19 +75,50 @@ inline double invNormalCdf(const double p)
 	static constexpr double c7 = 0.0000002888167364;
 	static constexpr double c8 = 0.0000003960315187;
 
-	double x = up - 0.5;
-	double r;
+	const double r = log(-log(up));
+	return c0 + r*(c1 + r*(c2 + r*(c3 + r*(c4 + r*(c5 + r*(c6 + r*(c7 + r*c8)))))));
+}
+
+inline double invNormalCdf(const double p)
+{
+    const bool sup = p > 0.5;
+    const double up = sup ? 1.0 - p : p;
+
+	const double x = up - 0.5;
 
 	if (fabs(x)<0.42)
 	{
-		r = x*x;
-		r = x*(((a3*r + a2)*r + a1)*r + a0) / ((((b3*r + b2)*r + b1)*r + b0)*r + 1.0);
+		const double r = invNormalCdfCentral(x);
 		return sup ? -r: r;
 	}
 
-	r = up;
-	r = log(-log(r));
-	r = c0 + r*(c1 + r*(c2 + r*(c3 + r*(c4 + r*(c5 + r*(c6 + r*(c7 + r*c8)))))));
-
+	const double r = invNormalCdfTail(up);
 	return sup? r: -r;
 }
+
+//  Inverse CDF of n uniforms u into n Gaussians g, u and g must not overlap
+//  Same results as invNormalCdf() number by number
+//  The central region is evaluated for all numbers in a branch-free loop 
+//      that vectorizes, the tails, about 16% of the numbers, 
+//      are then corrected one by one
+inline void invNormalCdfBlock(const double* u, const size_t n, double* g)
+{
+    for (size_t k = 0; k < n; ++k)
+    {
+        const bool sup = u[k] > 0.5;
+        const double up = sup ? 1.0 - u[k] : u[k];
+        const double r = invNormalCdfCentral(up - 0.5);
+        g[k] = sup ? -r : r;
+    }
+
+    for (size_t k = 0; k < n; ++k)
+    {
+        const bool sup = u[k] > 0.5;
+        const double up = sup ? 1.0 - u[k] : u[k];
+        if (fabs(up - 0.5) >= 0.42)
+        {
+            const double r = invNormalCdfTail(up);
+            g[k] = sup ? r : -r;
+        }
+    }
+}
@@ -19,6 +19,9 @@ As long as this comment is preserved at the top of the file
 #include "mcBase.h"
 #include "matrix.h"
 #include "analytics.h"
+#include <unordered_map>
+#include <shared_mutex>
+#include <memory>
 
 //  Implied Volatility Surfaces and Risk Views,
 //  See chapter 13
@@ -46,7 +49,11 @@ public:
         myMats(mats), 
         mySpreads(strikes.size(), mats.size())
     {
-        for (auto& spr : mySpreads) spr = T(0.0);
+        for (auto& spr : mySpreads)
+        {
+            spr = T(0.0);
+            putOnTape(spr);
+        }
     }
 
     //  Get spread
@@ -78,6 +85,58 @@ public:
     {
         mySpreads[i][j] += bumpBy;
     }
+
+    //  Does a bump on maturity j move spreads for maturities in [matLow, matHigh]?
+    //  Interpolation in maturity only involves the surrounding knots,
+    //      so a bump on j only moves spreads strictly between mats j - 1 and j + 1
+    bool touches(const size_t j, const Time matLow, const Time matHigh) const
+    {
+        if (j > 0 && matHigh <= myMats[j - 1]) return false;
+        if (j + 1 < myMats.size() && matLow >= myMats[j + 1]) return false;
+        return true;
+    }
+};
+
+//  Cache of implied vols keyed on (strike, maturity)
+//  Thread safe, lookups share the lock
+class IVCache
+{
+    struct Hash
+    {
+        size_t operator()(const pair<double, Time>& key) const
+        {
+            const size_t h1 = hash<double>()(key.first);
+            const size_t h2 = hash<double>()(key.second);
+            return h1 ^ (h2 + 0x9e3779b97f4a7c15ull + (h1 << 6) + (h1 >> 2));
+        }
+    };
+
+    mutable shared_mutex                                myMutex;
+    unordered_map<pair<double, Time>, double, Hash>     myVols;
+
+public:
+
+    //  Return false if not cached
+    bool find(const double strike, const Time mat, double& vol) const
+    {
+        shared_lock<shared_mutex> lk(myMutex);
+        auto it = myVols.find(make_pair(strike, mat));
+        if (it == myVols.end()) return false;
+        vol = it->second;
+        return true;
+    }
+
+    void insert(const double strike, const Time mat, const double vol)
+    {
+        unique_lock<shared_mutex> lk(myMutex);
+        myVols.emplace(make_pair(strike, mat), vol);
+    }
+
+    size_t size() const
+    {
+        shared_lock<shared_mutex> lk(myMutex);
+        return myVols.size();
+    }
 };
 
 //  Base IVS
@@ -86,9 +145,12 @@ class IVS
     //  To avoid reference to a linear market
     double mySpot;
 
+    //  Raw implied vols calculated so far, shared by copies
+    shared_ptr<IVCache> myCache;
+
 public:
 
-    IVS(const double spot) : mySpot(spot) {}
+    IVS(const double spot) : mySpot(spot), myCache(make_shared<IVCache>()) {}
 
     //  Read access to spot
     double spot() const
@@ -99,6 +161,55 @@ public:
     //  Raw implied vol
     virtual double impliedVol(const double strike, const Time mat) const = 0;
 
+    //  Raw implied vols for a batch of strikes of the same maturity
+    //  Default: strike by strike
+    //  Concrete IVS override to share calculations across strikes
+    virtual void impliedVols(
+        const vector<double>&   strikes, 
+        const Time              mat, 
+        //  Results, resized
+        vector<double>&         vols) const
+    {
+        vols.resize(strikes.size());
+        for (size_t k = 0; k < strikes.size(); ++k) vols[k] = impliedVol(strikes[k], mat);
+    }
+
+    //  Raw implied vol through the cache
+    double cachedVol(const double strike, const Time mat) const
+    {
+        double vol;
+        if (myCache->find(strike, mat, vol)) return vol;
+        vol = impliedVol(strike, mat);
+        myCache->insert(strike, mat, vol);
+        return vol;
+    }
+
+    //  Calculate in batch and cache the implied vols of all strikes for all maturities
+    //  Skips those already in the cache
+    void prefill(const vector<double>& strikes, const vector<Time>& mats) const
+    {
+        vector<double> missing, vols;
+        for (const Time mat : mats)
+        {
+            missing.clear();
+            for (const double strike : strikes)
+            {
+                double vol;
+                if (!myCache->find(strike, mat, vol)) missing.push_back(strike);
+            }
+            if (missing.empty()) continue;
+
+            impliedVols(missing, mat, vols);
+            for (size_t k = 0; k < missing.size(); ++k) myCache->insert(missing[k], mat, vols[k]);
+        }
+    }
+
+    //  Number of implied vols in the cache
+    size_t cacheSize() const
+    {
+        return myCache->size();
+    }
+
     //  Call price
     template<class T = double>
     T call(
@@ -110,7 +221,7 @@ public:
         return blackScholes<T>(
             mySpot,
             strike,
-            impliedVol(strike, mat) 
+            cachedVol(strike, mat) 
                 + (risk ? risk->spread(strike, mat) : T(0.0)),
             mat);
     }
@@ -176,4 +287,36 @@ public:
         //  Implied volatility from price, also in analytics.h
         return blackScholesIvol(spot(), strike, call, mat);
     }
+
+    //  Batch: the jump series is computed once for all strikes
+    void impliedVols(
+        const vector<double>&   strikes, 
+        const Time              mat, 
+        vector<double>&         vols) const override
+    {
+        vector<double> calls;
+        mertonStrikes(
+            spot(),
+            strikes,
+            myVol,
+            mat,
+            myIntensity,
+            myAverageJmp,
+            myJmpStd,
+            calls);
+
+        vols.resize(strikes.size());
+        for (size_t k = 0; k < strikes.size(); ++k)
+        {
+            vols[k] = blackScholesIvol(spot(), strikes[k], calls[k], mat);
+        }
+    }
+
+    //  Same parameters?
+    bool same(const double spot, const double vol, 
+        const double intens, const double aveJmp, const double stdJmp) const
+    {
+        return spot == this->spot() && vol == myVol && intens == myIntensity
+            && aveJmp == myAverageJmp && stdJmp == myJmpStd;
+    }
 };
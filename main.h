@@ -21,10 +21,15 @@ As long as this comment is preserved at the top of the file
 #include "mcBase.h"
 #include "mcMdl.h"
 #include "mcPrd.h"
+#include "mcKernels.h"
 #include "mrg32k3a.h"
 #include "sobol.h"
+#include "brownianBridge.h"
+#include "asyncJobs.h"
+#include "resultCache.h"
 #include <numeric>
 #include <fstream>
+#include <mutex>
 using namespace std;
 
 #include "store.h"
@@ -33,87 +38,482 @@ struct NumericalParam
 {
     bool              parallel;
     bool              useSobol;
+    //  Digital shift of Sobol's sequence, from seed1, see Sobol in sobol.h
+    bool              scramble = false;
     int               numPath;
     int               seed1 = 12345;
     int               seed2 = 1234;
+    //  Paths per parallel task, 0 = automatic, see batchSize() in mcBase.h
+    int               batchSize = 0;
+    //  Brownian bridge construction of the Gaussians, see brownianBridge.h
+    bool              brownianBridge = false;
+    //  Antithetic paths, mrg32k3a only
+    bool              antithetic = true;
+    //  Analytic control variate where known, see analyticControl()
+    bool              controlVariate = false;
+    //  Target standard error, 0 = none
+    //  When set, value() simulates until all payoffs reach it, 
+    //      numPath is then the maximum number of paths
+    double            targetError = 0.0;
+    //  Cancellation flag of an asynchronous job, see asyncJobs.h, nullptr = none
+    const atomic<bool>* cancel = nullptr;
+    //  Use the result cache, see resultKey() below
+    bool              cache = true;
+    //  Paths and payoffs in float, statistics in double, see SimulBlockT in mcBase.h
+    //  For valuations of double models, value(), valueModels() and valueScenarios()
+    //  Twice the vector width and half the memory traffic, 
+    //      with errors of the order of 1e-7 of the values
+    bool              singlePrecision = false;
 };
 
-//  Price product in model
-inline auto value(
-    const Model<double>&    model,
-    const Product<double>&  product,
-    //  numerical parameters
-    const NumericalParam&   num)
+//  Same numerical parameters, for the cached sessions below
+//  All but the cancellation flag, which belongs to the call
+inline bool sameNumericalParam(const NumericalParam& lhs, const NumericalParam& rhs)
 {
-    //  Random Number Generator
+    return lhs.parallel == rhs.parallel && lhs.useSobol == rhs.useSobol && lhs.scramble == rhs.scramble
+        && lhs.numPath == rhs.numPath
+        && lhs.seed1 == rhs.seed1 && lhs.seed2 == rhs.seed2 && lhs.batchSize == rhs.batchSize
+        && lhs.brownianBridge == rhs.brownianBridge && lhs.antithetic == rhs.antithetic
+        && lhs.controlVariate == rhs.controlVariate && lhs.targetError == rhs.targetError
+        && lhs.cache == rhs.cache && lhs.singlePrecision == rhs.singlePrecision;
+}
+
+//  The RNG selected in the numerical parameters
+//  All the simulations below start here, so we also check the parameters
+inline unique_ptr<RNG> makeRng(const NumericalParam& num)
+{
+    if (num.numPath < 0)
+    {
+        throw runtime_error("makeRng() : negative number of paths");
+    }
+    //  Otherwise converted to a huge size_t
+    if (num.batchSize < 0)
+    {
+        throw runtime_error("makeRng() : negative batch size, 0 = automatic");
+    }
+
     unique_ptr<RNG> rng;
-    if (num.useSobol) rng = make_unique<Sobol>();
-    else rng = make_unique<mrg32k3a>(num.seed1, num.seed2);
+    if (num.useSobol) rng = make_unique<Sobol>(num.scramble, unsigned(num.seed1));
+    else rng = make_unique<mrg32k3a>(num.seed1, num.seed2, num.antithetic);
+    if (num.brownianBridge) rng = make_unique<BrownianBridge>(move(rng));
+    if (num.cancel) rng = make_unique<CancellableRng>(move(rng), num.cancel);
+    return rng;
+}
 
-    //  Simulate
-    const auto resultMat = num.parallel
-        ? mcParallelSimul(product, model, *rng, num.numPath)
-        : mcSimul(product, model, *rng, num.numPath);
+//  Results of value(): 
+//      the payoff identifiers, their values and standard errors
+//  and the number of paths simulated
+//  with the statistics of the run that computed them, see profiler.h
+struct ValueResults
+{
+    vector<string> identifiers;
+    vector<double> values;
+    vector<double> errors;
+    size_t         numPath;
+    RunStats       runStats;
+};
 
-    //  We return 2 vectors : the payoff identifiers and their values
-    struct
+//  Results of AAD risk, one payoff or aggregate: 
+//  -   The payoff identifiers and their values
+//  -   The value of the aggreagte payoff
+//  -   The parameter idenitifiers 
+//  -   The sensititivities of the aggregate to parameters
+//  -   The statistics of the run, see profiler.h
+struct AADRiskResults
+{
+    vector<string>  payoffIds;
+    vector<double>  payoffValues;
+    double          riskPayoffValue;
+    vector<string>  paramIds;
+    vector<double>  risks;
+    RunStats        runStats;
+};
+
+//  Cache of the results of the functions below by content, see resultCache.h
+//  64MB, see xSetCacheSize() in xlExport.cpp
+ResultCache resultCache(size_t(64) << 20);
+
+//  Key of a call: content of model and product, numerical parameters and other arguments
+//  Empty when the call is not cached: 
+//      unknown content, cache disabled or not used in the numerical parameters
+//  Hashes of the model and product snapshots used in the calculation, see store.h
+inline string resultKey(
+    const string&           function,
+    const size_t            mdlHash,
+    const size_t            prdHash,
+    const NumericalParam&   num,
+    const string&           args = "")
+{
+    if (!mdlHash || !prdHash || !num.cache || !resultCache.enabled()) return "";
+
+    ostringstream ost;
+    ost.precision(17);
+    ost << function << '\n' << mdlHash << ' ' << prdHash << '\n'
+        << num.parallel << ' ' << num.useSobol << ' ' << num.scramble << ' ' << num.numPath << ' '
+        << num.seed1 << ' ' << num.seed2 << ' ' << num.batchSize << ' '
+        << num.brownianBridge << ' ' << num.antithetic << ' ' 
+        << num.controlVariate << ' ' << num.targetError << ' ' << num.singlePrecision;
+    //  Parallel results depend on the task granularity, hence the number of threads
+    if (num.parallel) ost << ' ' << ThreadPool::getInstance()->numThreads();
+    ost << '\n' << args;
+
+    return ost.str();
+}
+
+//  Approximate memory footprint of results
+inline size_t resultBytes(const vector<string>& v)
+{
+    size_t bytes = v.size() * sizeof(string);
+    for (const auto& str : v) bytes += str.size();
+    return bytes;
+}
+
+inline size_t resultBytes(const vector<double>& v)
+{
+    return v.size() * sizeof(double);
+}
+
+inline size_t resultBytes(const ValueResults& results)
+{
+    return sizeof(results) + resultBytes(results.identifiers) 
+        + resultBytes(results.values) + resultBytes(results.errors);
+}
+
+inline size_t resultBytes(const AADRiskResults& results)
+{
+    return sizeof(results) + resultBytes(results.payoffIds) + resultBytes(results.payoffValues)
+        + resultBytes(results.paramIds) + resultBytes(results.risks);
+}
+
+//  Look up results, false if not cached
+template <class T>
+inline bool findResult(const string& key, T& results)
+{
+    return !key.empty() && resultCache.find(key, results);
+}
+
+//  Cache results, unless the calculation was cancelled
+template <class T>
+inline void cacheResult(const string& key, const NumericalParam& num, const T& results)
+{
+    if (key.empty() || (num.cancel && *num.cancel)) return;
+    resultCache.insert(key, results, resultBytes(results));
+}
+
+//  Notionals as a key argument
+inline string notionalsKey(const map<string, double>& notionals)
+{
+    ostringstream ost;
+    ost.precision(17);
+    for (const auto& notional : notionals) ost << notional.first << '\n' << notional.second << '\n';
+    return ost.str();
+}
+
+//  Control variates with closed forms
+//  In Black-Scholes, the European payoff of a European or a barrier option
+//      is the control of the other payoffs
+//  Returns false when we know no control for the model and product
+template <class T>
+inline bool analyticControl(
+    const Model<T>&         model,
+    const Product<T>&       product,
+    VarReduction&           varRed)
+{
+    const auto* bs = dynamic_cast<const BlackScholes<T>*>(&model);
+    if (!bs) return false;
+
+    //  Call paid on settlement, fixed on exercise
+    auto call = [bs](const double strike, const Time exercise, const Time settlement)
     {
-        vector<string> identifiers;
-        vector<double> values;
-    } results;
+        const Time te = exercise - systemTime, ts = settlement - systemTime;
+        const double fwd = bs->spot() * exp((bs->rate() - bs->div()) * ts);
+        return exp(-bs->rate() * ts) * blackScholes(fwd, strike, bs->vol(), te);
+    };
 
-    const size_t nPayoffs = product.payoffLabels().size();
-    results.identifiers = product.payoffLabels();
-    results.values.resize(nPayoffs);
-    for (size_t i = 0; i < nPayoffs; ++i)
+    if (const auto* uoc = dynamic_cast<const UOC<T>*>(&product))
     {
-        results.values[i] = accumulate(resultMat.begin(), resultMat.end(), 0.0,
-            [i](const double acc, const vector<double>& v) { return acc + v[i]; }
-        ) / num.numPath;
+        varRed.control = 1;
+        varRed.controlValue = call(uoc->strike(), uoc->maturity(), uoc->maturity());
+        return true;
     }
+    if (const auto* eur = dynamic_cast<const European<T>*>(&product))
+    {
+        varRed.control = 0;
+        varRed.controlValue = call(eur->strike(), eur->exerciseDate(), eur->settlementDate());
+        return true;
+    }
+
+    return false;
+}
+
+//  Price product in model, in double or float
+template <class T>
+inline ValueResults value(
+    const Model<T>&         model,
+    const Product<T>&       product,
+    //  numerical parameters
+    const NumericalParam&   num,
+    //  model already allocated and initialized for the product
+    const bool              initialized = false)
+{
+    ProfileRun run;
+
+    //  Random Number Generator
+    auto rng = makeRng(num);
+
+    //  Variance reduction
+    VarReduction varRed;
+    varRed.antithetic = rng->antithetic();
+    if (num.controlVariate) analyticControl(model, product, varRed);
+
+    //  Simulate, streaming: no storage of pathwise payoffs
+    const auto stats = num.targetError > 0.0
+        ? mcSimulStatsTarget(product, model, *rng, num.numPath, num.targetError, 
+            num.parallel, num.batchSize, initialized, varRed)
+        : num.parallel
+        ? mcParallelSimulStats(
+            product, model, *rng, num.numPath, num.batchSize, initialized, varRed)
+        : mcSimulStats(product, model, *rng, num.numPath, initialized, varRed);
+
+    ValueResults results;
+    results.identifiers = product.payoffLabels();
+    results.values = stats.values();
+    results.errors = stats.stdErrs();
+    results.numPath = stats.numPath;
+    results.runStats = run.stats();
 
     return results;
 }
 
 //  Overload that picks product and model by name in the store
-inline auto value(
+//  Results are cached, see resultKey()
+inline ValueResults value(
     const string&           modelId,
     const string&           productId,
     //  numerical parameters
     const NumericalParam&   num)
 {
     //  Get model and product
-    const Model<double>* model = getModel<double>(modelId);
-    const Product<double>* product = getProduct<double>(productId);
+    const auto model = getModel<double>(modelId);
+    const auto product = getProduct<double>(productId);
 
     if (!model || !product)
     {
         throw runtime_error("value() : Could not retrieve model and product");
     }
 
-    return value(*model, *product, num);
+    const string key = resultKey("value", model.hash(), product.hash(), num);
+    ValueResults results;
+    if (findResult(key, results)) return results;
+
+    //  Single precision: the float objects of the same snapshots
+    results = num.singlePrecision
+        ? value(*model.template as<float>(), *product.template as<float>(), num)
+        : value(*model, *product, num);
+    cacheResult(key, num, results);
+
+    return results;
+}
+
+//  Batch valuation of one product in several models
+//  Common random numbers: same paths for all models,
+//      Gaussians drawn once for all the models of the same dimension
+//  Results are the same as value() model by model,
+//      without target error or control variate
+//  Same result format for lists of models and grids of scenarios
+struct BatchResults
+{
+    vector<string>          identifiers;
+    //  model x payoff
+    matrix<double>          values;
+    matrix<double>          errors;
+};
+
+template <class T>
+inline BatchResults valueModels(
+    //  allocated and initialized for the product
+    const vector<const Model<T>*>&      models,
+    const Product<T>&                   product,
+    const NumericalParam&               num)
+{
+    //  Random Number Generator
+    auto rng = makeRng(num);
+
+    //  Variance reduction
+    VarReduction varRed;
+    varRed.antithetic = rng->antithetic();
+
+    //  Simulate, streaming
+    const auto stats = num.parallel
+        ? mcParallelSimulStatsModels(
+            product, models, *rng, num.numPath, num.batchSize, varRed)
+        : mcSimulStatsModels(product, models, *rng, num.numPath, varRed);
+
+    BatchResults results;
+    results.identifiers = product.payoffLabels();
+    const size_t nPay = results.identifiers.size();
+    results.values.resize(models.size(), nPay);
+    results.errors.resize(models.size(), nPay);
+    for (size_t i = 0; i < models.size(); ++i)
+    {
+        const auto values = stats[i].values();
+        const auto errors = stats[i].stdErrs();
+        copy(values.begin(), values.end(), results.values[i]);
+        copy(errors.begin(), errors.end(), results.errors[i]);
+    }
+
+    return results;
+}
+
+//  Overload that picks the models and product by name in the store, in precision T
+template <class T>
+inline BatchResults valueModelsIn(
+    const vector<string>&   modelIds,
+    const string&           productId,
+    const NumericalParam&   num)
+{
+    const auto product = getProduct<T>(productId);
+    if (!product)
+    {
+        throw runtime_error("valueModels() : Could not retrieve product");
+    }
+
+    //  Copies, allocated and initialized for the product
+    vector<unique_ptr<Model<T>>> models;
+    vector<const Model<T>*> mdlPtrs;
+    for (const auto& modelId : modelIds)
+    {
+        const auto model = getModel<T>(modelId);
+        if (!model)
+        {
+            throw runtime_error("valueModels() : Could not retrieve model " + modelId);
+        }
+        models.push_back(model->clone());
+        models.back()->allocate(product->timeline(), product->defline());
+        models.back()->init(product->timeline(), product->defline());
+        mdlPtrs.push_back(models.back().get());
+    }
+
+    return valueModels(mdlPtrs, *product, num);
+}
+
+inline BatchResults valueModels(
+    const vector<string>&   modelIds,
+    const string&           productId,
+    const NumericalParam&   num)
+{
+    return num.singlePrecision 
+        ? valueModelsIn<float>(modelIds, productId, num)
+        : valueModelsIn<double>(modelIds, productId, num);
+}
+
+//  Grid of scenarios on the parameters of a model in the store
+//  Each scenario sets some parameters, by label, see parameterLabels(),
+//      the others keep the values of the model in the store
+template <class T>
+inline BatchResults valueScenariosIn(
+    const string&                       modelId,
+    const string&                       productId,
+    const vector<map<string, double>>&  scenarios,
+    const NumericalParam&               num)
+{
+    const auto orig = getModel<T>(modelId);
+    const auto product = getProduct<T>(productId);
+
+    if (!orig || !product)
+    {
+        throw runtime_error("valueScenarios() : Could not retrieve model and product");
+    }
+
+    const vector<string>& labels = orig->parameterLabels();
+
+    vector<unique_ptr<Model<T>>> models;
+    vector<const Model<T>*> mdlPtrs;
+    for (const auto& scenario : scenarios)
+    {
+        models.push_back(orig->clone());
+        Model<T>& model = *models.back();
+        const vector<T*> parameters = model.parameters();
+        for (const auto& param : scenario)
+        {
+            auto it = find(labels.begin(), labels.end(), param.first);
+            if (it == labels.end())
+            {
+                throw runtime_error("valueScenarios() : Unknown parameter " + param.first);
+            }
+            *parameters[it - labels.begin()] = param.second;
+        }
+        model.allocate(product->timeline(), product->defline());
+        model.init(product->timeline(), product->defline());
+        mdlPtrs.push_back(&model);
+    }
+
+    return valueModels(mdlPtrs, *product, num);
+}
+
+inline BatchResults valueScenarios(
+    const string&                       modelId,
+    const string&                       productId,
+    const vector<map<string, double>>&  scenarios,
+    const NumericalParam&               num)
+{
+    return num.singlePrecision 
+        ? valueScenariosIn<float>(modelId, productId, scenarios, num)
+        : valueScenariosIn<double>(modelId, productId, scenarios, num);
+}
+
+//  Persistent workspace of parallel AAD simulations, see mcBase.h
+//  Repeated risks of the same model and product
+//      reuse the model clones, pre-calculations on tape and paths of the last call
+//  Note the workspace is cleared as soon as the model or product is changed in the store
+AADWorkspace aadWorkspace;
+mutex aadWorkspaceMutex;
+
+//  Workspace for the model and product, caller must hold the mutex
+inline AADWorkspace& aadWorkspaceFor(
+    const string&               modelId,
+    const string&               productId,
+    const ModelRef<Number>&     model,
+    const ProductRef<Number>&   product)
+{
+    //  Versions of the snapshots in the store, see store.h
+    const string key = modelId + '\n' + productId + '\n'
+        + to_string(model.version()) + '\n' + to_string(product.version());
+
+    if (aadWorkspace.key != key)
+    {
+        aadWorkspace.reset();
+        aadWorkspace.key = key;
+    }
+
+    return aadWorkspace;
 }
 
 //  AAD risk, one payoff
-inline auto AADriskOne(
+inline AADRiskResults AADriskOne(
     const string&           modelId,
     const string&           productId,
     const NumericalParam&   num,
     const string&           riskPayoff = "")
 {
     //  Get model and product
-    const Model<Number>* model = getModel<Number>(modelId);
-    const Product<Number>* product = getProduct<Number>(productId);
+    const auto model = getModel<Number>(modelId);
+    const auto product = getProduct<Number>(productId);
 
     if (!model || !product)
     {
         throw runtime_error("AADrisk() : Could not retrieve model and product");
     }
 
+    //  Cached?
+    const string key = resultKey("AADriskOne", model.hash(), product.hash(), num, riskPayoff);
+    AADRiskResults results;
+    if (findResult(key, results)) return results;
+
+    ProfileRun run;
+
     //  Random Number Generator
-    unique_ptr<RNG> rng;
-    if (num.useSobol) rng = make_unique<Sobol>();
-    else rng = make_unique<mrg32k3a>(num.seed1, num.seed2);
+    auto rng = makeRng(num);
 
     //  Find the payoff for risk
     size_t riskPayoffIdx = 0;
@@ -128,26 +528,20 @@ inline auto AADriskOne(
         riskPayoffIdx = distance(allPayoffs.begin(), it);
     }
 
+    //  Persistent workspace, unless in use by a concurrent call
+    unique_lock<mutex> lk(aadWorkspaceMutex, defer_lock);
+    AADWorkspace* workspace = num.parallel && lk.try_lock()
+        ? &aadWorkspaceFor(modelId, productId, model, product)
+        : nullptr;
+
     //  Simulate
     const auto simulResults = num.parallel
         ? mcParallelSimulAAD(*product, *model, *rng, num.numPath,
-            [riskPayoffIdx](const vector<Number>& v) {return v[riskPayoffIdx]; })
+            [riskPayoffIdx](const vector<Number>& v) {return v[riskPayoffIdx]; },
+            num.batchSize, workspace)
         : mcSimulAAD(*product, *model, *rng, num.numPath,
             [riskPayoffIdx](const vector<Number>& v) {return v[riskPayoffIdx]; });
 
-    //  We return: a number and 2 vectors : 
-    //  -   The payoff identifiers and their values
-    //  -   The value of the aggreagte payoff
-    //  -   The parameter idenitifiers 
-    //  -   The sensititivities of the aggregate to parameters
-    struct
-    {
-        vector<string>  payoffIds;
-        vector<double>  payoffValues;
-        double          riskPayoffValue;
-        vector<string>  paramIds;
-        vector<double>  risks;
-    } results;
 
     const size_t nPayoffs = product->payoffLabels().size();
     results.payoffIds = product->payoffLabels();
@@ -167,30 +561,38 @@ inline auto AADriskOne(
         0.0) / num.numPath;
     results.paramIds = model->parameterLabels();
     results.risks = move (simulResults.risks);
+    results.runStats = run.stats();
+
+    cacheResult(key, num, results);
 
     return results;
 }
 
 //  AAD risk, aggregate portfolio
-inline auto AADriskAggregate(
+inline AADRiskResults AADriskAggregate(
     const string&           modelId,
     const string&           productId,
     const map<string, double>&   notionals,
     const NumericalParam&   num)
 {
     //  Get model and product
-    const Model<Number>* model = getModel<Number>(modelId);
-    const Product<Number>* product = getProduct<Number>(productId);
+    const auto model = getModel<Number>(modelId);
+    const auto product = getProduct<Number>(productId);
 
     if (!model || !product)
     {
         throw runtime_error("AADriskAggregate() : Could not retrieve model and product");
     }
 
+    //  Cached?
+    const string key = resultKey("AADriskAggregate", model.hash(), product.hash(), num, notionalsKey(notionals));
+    AADRiskResults results;
+    if (findResult(key, results)) return results;
+
+    ProfileRun run;
+
     //  Random Number Generator
-    unique_ptr<RNG> rng;
-    if (num.useSobol) rng = make_unique<Sobol>();
-    else rng = make_unique<mrg32k3a>(num.seed1, num.seed2);
+    auto rng = makeRng(num);
 
     //  Vector of notionals
     const vector<string>& allPayoffs = product->payoffLabels();
@@ -208,27 +610,21 @@ inline auto AADriskAggregate(
     //  Aggregator
     auto aggregator = [&vnots](const vector<Number>& payoffs)
     {
-        return inner_product(payoffs.begin(), payoffs.end(), vnots.begin(), Number(0.0));
+        return Number::weightedSum(payoffs.begin(), payoffs.end(), vnots.begin());
     };
 
+    //  Persistent workspace, unless in use by a concurrent call
+    unique_lock<mutex> lk(aadWorkspaceMutex, defer_lock);
+    AADWorkspace* workspace = num.parallel && lk.try_lock()
+        ? &aadWorkspaceFor(modelId, productId, model, product)
+        : nullptr;
+
     //  Simulate
     const auto simulResults = num.parallel
-        ? mcParallelSimulAAD(*product, *model, *rng, num.numPath, aggregator)
+        ? mcParallelSimulAAD(*product, *model, *rng, num.numPath, aggregator, 
+            num.batchSize, workspace)
         : mcSimulAAD(*product, *model, *rng, num.numPath, aggregator);
 
-    //  We return: a number and 2 vectors : 
-    //  -   The payoff identifiers and their values
-    //  -   The value of the aggreagte payoff
-    //  -   The parameter idenitifiers 
-    //  -   The sensititivities of the aggregate to parameters
-    struct
-    {
-        vector<string>  payoffIds;
-        vector<double>  payoffValues;
-        double          riskPayoffValue;
-        vector<string>  paramIds;
-        vector<double>  risks;
-    } results;
 
     const size_t nPayoffs = product->payoffLabels().size();
     results.payoffIds = product->payoffLabels();
@@ -248,6 +644,180 @@ inline auto AADriskAggregate(
         0.0) / num.numPath;
     results.paramIds = model->parameterLabels();
     results.risks = move(simulResults.risks);
+    results.runStats = run.stats();
+
+    cacheResult(key, num, results);
+
+    return results;
+}
+
+//  Forward mode risk: values of all the payoffs 
+//      and their derivatives in one direction in the model parameters
+//  The direction is given by weights of parameters, missing parameters have weight 0
+//  One forward pass with no tape: cheaper than AAD for one input or one scenario
+
+struct DirectionalRiskResults
+{
+    vector<string>  payoffIds;
+    vector<double>  payoffValues;
+    vector<double>  derivatives;
+    RunStats        runStats;
+};
+
+inline size_t resultBytes(const DirectionalRiskResults& results)
+{
+    return sizeof(results) + resultBytes(results.payoffIds) 
+        + resultBytes(results.payoffValues) + resultBytes(results.derivatives);
+}
+
+inline DirectionalRiskResults directionalRisk(
+    const string&               modelId,
+    const string&               productId,
+    //  parameter labels and weights
+    const map<string, double>&  direction,
+    const NumericalParam&       num)
+{
+    //  Get model and product
+    const auto model = getModel<Dual>(modelId);
+    const auto product = getProduct<Dual>(productId);
+
+    if (!model || !product)
+    {
+        throw runtime_error("directionalRisk() : Could not retrieve model and product");
+    }
+
+    //  Cached?
+    const string key = resultKey("directionalRisk", model.hash(), product.hash(), num, notionalsKey(direction));
+    DirectionalRiskResults results;
+    if (findResult(key, results)) return results;
+
+    ProfileRun run;
+
+    //  Random Number Generator
+    auto rng = makeRng(num);
+
+    //  Vector of weights
+    const vector<string>& allParams = model->parameterLabels();
+    vector<double> vdir(allParams.size(), 0.0);
+    for (const auto& weight : direction)
+    {
+        auto it = find(allParams.begin(), allParams.end(), weight.first);
+        if (it == allParams.end())
+        {
+            throw runtime_error("directionalRisk() : parameter not found");
+        }
+        vdir[distance(allParams.begin(), it)] = weight.second;
+    }
+
+    //  Simulate
+    auto simulResults = num.parallel
+        ? mcParallelSimulTangent(*product, *model, *rng, num.numPath, vdir, num.batchSize)
+        : mcSimulTangent(*product, *model, *rng, num.numPath, vdir);
+
+    results.payoffIds = product->payoffLabels();
+    results.payoffValues = move(simulResults.values);
+    results.derivatives = move(simulResults.derivatives);
+    results.runStats = run.stats();
+
+    cacheResult(key, num, results);
+
+    return results;
+}
+
+//  Second order AAD risk, one payoff: 
+//      the value and first order risks of the payoff, as AADriskOne(),
+//      and its Hessian times a direction in the parameters,
+//      given by weights of parameters as directionalRisk()
+//  For one parameter with weight 1: its gamma and all its cross gammas
+//  Derivatives are pathwise: payoffs with kinks or discontinuities 
+//      must be smoothed, see the smoothing factors of the products
+
+struct AAD2RiskResults
+{
+    vector<string>  payoffIds;
+    vector<double>  payoffValues;
+    double          riskPayoffValue;
+    vector<string>  paramIds;
+    vector<double>  risks;
+    vector<double>  secondRisks;
+    RunStats        runStats;
+};
+
+inline size_t resultBytes(const AAD2RiskResults& results)
+{
+    return sizeof(results) + resultBytes(results.payoffIds) + resultBytes(results.payoffValues)
+        + resultBytes(results.paramIds) + resultBytes(results.risks) + resultBytes(results.secondRisks);
+}
+
+inline AAD2RiskResults AADrisk2(
+    const string&               modelId,
+    const string&               productId,
+    //  parameter labels and weights
+    const map<string, double>&  direction,
+    const NumericalParam&       num,
+    const string&               riskPayoff = "")
+{
+    //  Get model and product
+    const auto model = getModel<DualNumber>(modelId);
+    const auto product = getProduct<DualNumber>(productId);
+
+    if (!model || !product)
+    {
+        throw runtime_error("AADrisk2() : Could not retrieve model and product");
+    }
+
+    //  Cached?
+    const string key = resultKey("AADrisk2", model.hash(), product.hash(), num, 
+        riskPayoff + '\n' + notionalsKey(direction));
+    AAD2RiskResults results;
+    if (findResult(key, results)) return results;
+
+    ProfileRun run;
+
+    //  Random Number Generator
+    auto rng = makeRng(num);
+
+    //  Find the payoff for risk
+    size_t riskPayoffIdx = 0;
+    if (!riskPayoff.empty())
+    {
+        const vector<string>& allPayoffs = product->payoffLabels();
+        auto it = find(allPayoffs.begin(), allPayoffs.end(), riskPayoff);
+        if (it == allPayoffs.end())
+        {
+            throw runtime_error("AADrisk2() : payoff not found");
+        }
+        riskPayoffIdx = distance(allPayoffs.begin(), it);
+    }
+
+    //  Vector of weights
+    const vector<string>& allParams = model->parameterLabels();
+    vector<double> vdir(allParams.size(), 0.0);
+    for (const auto& weight : direction)
+    {
+        auto it = find(allParams.begin(), allParams.end(), weight.first);
+        if (it == allParams.end())
+        {
+            throw runtime_error("AADrisk2() : parameter not found");
+        }
+        vdir[distance(allParams.begin(), it)] = weight.second;
+    }
+
+    //  Simulate
+    auto aggregator = [riskPayoffIdx](const vector<DualNumber>& v) {return v[riskPayoffIdx]; };
+    auto simulResults = num.parallel
+        ? mcParallelSimulAAD2(*product, *model, *rng, num.numPath, vdir, aggregator, num.batchSize)
+        : mcSimulAAD2(*product, *model, *rng, num.numPath, vdir, aggregator);
+
+    results.payoffIds = product->payoffLabels();
+    results.payoffValues = move(simulResults.payoffs);
+    results.riskPayoffValue = simulResults.aggregated;
+    results.paramIds = allParams;
+    results.risks = move(simulResults.risks);
+    results.secondRisks = move(simulResults.secondRisks);
+    results.runStats = run.stats();
+
+    cacheResult(key, num, results);
 
     return results;
 }
@@ -262,32 +832,42 @@ struct RiskReports
     vector<string> params;
     vector<double> values;
     matrix<double> risks;
+    RunStats       runStats;
 };
 
+inline size_t resultBytes(const RiskReports& results)
+{
+    return sizeof(results) + resultBytes(results.payoffs) + resultBytes(results.params)
+        + resultBytes(results.values) + results.risks.rows() * results.risks.cols() * sizeof(double);
+}
+
 //  Itemized AAD risk, one per payoff
 inline RiskReports AADriskMulti(
     const string&           modelId,
     const string&           productId,
     const NumericalParam&   num)
 {
-    const Model<Number>* model = getModel<Number>(modelId);
-    const Product<Number>* product = getProduct<Number>(productId);
+    const auto model = getModel<Number>(modelId);
+    const auto product = getProduct<Number>(productId);
 
     if (!model || !product)
     {
         throw runtime_error("AADrisk() : Could not retrieve model and product");
     }
 
+    //  Cached?
+    const string key = resultKey("AADriskMulti", model.hash(), product.hash(), num);
     RiskReports results;
+    if (findResult(key, results)) return results;
+
+    ProfileRun run;
 
     //  Random Number Generator
-    unique_ptr<RNG> rng;
-    if (num.useSobol) rng = make_unique<Sobol>();
-    else rng = make_unique<mrg32k3a>(num.seed1, num.seed2);
+    auto rng = makeRng(num);
 
     //  Simulate
     const auto simulResults = num.parallel
-		? mcParallelSimulAADMulti(*product, *model, *rng, num.numPath)
+		? mcParallelSimulAADMulti(*product, *model, *rng, num.numPath, num.batchSize)
         : mcSimulAADMulti(*product, *model, *rng, num.numPath);
 
     results.params = model->parameterLabels();
@@ -306,6 +886,153 @@ inline RiskReports AADriskMulti(
 			[i](const double acc, const vector<double>& v) { return acc + v[i]; }
 		) / num.numPath;
 	}
+    results.runStats = run.stats();
+
+    cacheResult(key, num, results);
+
+    return results;
+}
+
+//  Cached AAD risk sessions
+
+//  Risks are linear in notionals: 
+//      the risks of an aggregate are the notional weighted sums
+//      of the itemized risks of the payoffs
+//  A risk session keeps the itemized values and risks of all the payoffs
+//      of a product in a model, by store ids
+//  A change of notionals on the same model, product and numerical parameters 
+//      is then a matrix product, without simulation
+struct RiskSession
+{
+    //  Store ids and versions, see store.h
+    string          modelId;
+    string          productId;
+    size_t          modelVersion = 0;
+    size_t          productVersion = 0;
+    NumericalParam  num;
+    RiskReports     reports;
+    //  For the eviction of the least recently used session
+    size_t          lastUse = 0;
+};
+
+//  Sessions by model and product ids, guarded by riskSessionsMutex
+//  Sessions of a model or product replaced in the store are dropped,
+//      and at most MAXRISKSESSIONS are kept, the least recently used is dropped
+unordered_map<string, RiskSession> riskSessions;
+size_t riskSessionsLastUse = 0;
+mutex riskSessionsMutex;
+constexpr size_t MAXRISKSESSIONS = 16;
+
+//  Drop stale sessions, then the least recently used beyond the bound, 
+//      caller must hold the mutex
+inline void evictRiskSessions()
+{
+    for (auto it = riskSessions.begin(); it != riskSessions.end();)
+    {
+        const RiskSession& session = it->second;
+        if (modelVersion(session.modelId) != session.modelVersion
+            || productVersion(session.productId) != session.productVersion)
+        {
+            it = riskSessions.erase(it);
+        }
+        else ++it;
+    }
+
+    while (riskSessions.size() > MAXRISKSESSIONS)
+    {
+        auto lru = min_element(riskSessions.begin(), riskSessions.end(),
+            [](const auto& lhs, const auto& rhs) { return lhs.second.lastUse < rhs.second.lastUse; });
+        riskSessions.erase(lru);
+    }
+}
+
+//  Same as AADriskAggregate(), through the risk session of model and product
+//  The first call, or a call after the model, product or numerical parameters changed, 
+//      simulates the itemized risks with AADriskMulti(), 
+//      and reports the statistics of that run
+//  Other calls reuse them, with empty run statistics
+//  Note risks are the same as AADriskAggregate() up to rounding
+//      and the number of simulations is the same for all the payoffs
+//  Thread safe, concurrent calls wait for one another
+inline AADRiskResults AADriskAggregateCached(
+    const string&           modelId,
+    const string&           productId,
+    const map<string, double>&   notionals,
+    const NumericalParam&   num)
+{
+    const auto model = getModel<Number>(modelId);
+    const auto product = getProduct<Number>(productId);
+
+    if (!model || !product)
+    {
+        throw runtime_error("AADriskAggregateCached() : Could not retrieve model and product");
+    }
+
+    //  Checkpointed models don't support itemized risks: no session
+    if (model->checkpointed())
+    {
+        return AADriskAggregate(modelId, productId, notionals, num);
+    }
+
+    //  Same results as AADriskAggregate()
+    AADRiskResults results;
+
+    lock_guard<mutex> lk(riskSessionsMutex);
+
+    //  Find or refresh session
+    const string key = modelId + "\n" + productId;
+    auto it = riskSessions.find(key);
+    const size_t mv = model.version(), pv = product.version();
+    if (it == riskSessions.end()
+        || it->second.modelVersion != mv 
+        || it->second.productVersion != pv
+        || !sameNumericalParam(it->second.num, num))
+    {
+        //  Simulate first, so a failed simulation leaves no session
+        RiskReports reports = AADriskMulti(modelId, productId, num);
+        results.runStats = reports.runStats;
+
+        it = riskSessions.insert_or_assign(key, RiskSession()).first;
+        RiskSession& fresh = it->second;
+        fresh.modelId = modelId;
+        fresh.productId = productId;
+        fresh.modelVersion = mv;
+        fresh.productVersion = pv;
+        fresh.num = num;
+        fresh.reports = move(reports);
+    }
+    RiskSession& session = it->second;
+    session.lastUse = ++riskSessionsLastUse;
+    const RiskReports& reports = session.reports;
+
+    //  Vector of notionals
+    const vector<string>& allPayoffs = reports.payoffs;
+    vector<double> vnots(allPayoffs.size(), 0.0);
+    for (const auto& notional : notionals)
+    {
+        auto it = find(allPayoffs.begin(), allPayoffs.end(), notional.first);
+        if (it == allPayoffs.end())
+        {
+            throw runtime_error("AADriskAggregateCached() : payoff not found");
+        }
+        vnots[distance(allPayoffs.begin(), it)] = notional.second;
+    }
+
+    results.payoffIds = reports.payoffs;
+    results.payoffValues = reports.values;
+    results.riskPayoffValue = inner_product(
+        vnots.begin(), vnots.end(), reports.values.begin(), 0.0);
+    results.paramIds = reports.params;
+    const size_t nParam = reports.params.size();
+    results.risks.resize(nParam);
+    for (size_t i = 0; i < nParam; ++i)
+    {
+        results.risks[i] = inner_product(
+            vnots.begin(), vnots.end(), reports.risks[i], 0.0);
+    }
+
+    //  Last, the session is not used after
+    evictRiskSessions();
 
     return results;
 }
@@ -317,42 +1044,69 @@ inline RiskReports bumpRisk(
     const string&           productId,
     const NumericalParam&   num)
 {
-    auto* orig = getModel<double>(modelId);
-    const Product<double>* product = getProduct<double>(productId);
+    const auto orig = getModel<double>(modelId);
+    const auto product = getProduct<double>(productId);
 
     if (!orig || !product)
     {
         throw runtime_error("bumpRisk() : Could not retrieve model and product");
     }
 
+    //  Cached?
+    const string key = resultKey("bumpRisk", orig.hash(), product.hash(), num);
     RiskReports results;
+    if (findResult(key, results)) return results;
 
-    //  base values
-    auto baseRes = value(*orig, *product, num);
-    results.payoffs = baseRes.identifiers;
-	results.values = baseRes.values;
+    ProfileRun run;
 
     //  make copy so we don't modify the model in memory
     auto model = orig->clone();
     
+    results.payoffs = product->payoffLabels();
     results.params = model->parameterLabels();
-    const vector<double*> parameters = model->parameters();
-    const size_t n = parameters.size(), m = results.payoffs.size();
+    const size_t n = model->parameters().size(), m = results.payoffs.size();
     results.risks.resize(n, m);
 
-    //  bumps
+    //  initialize once, 
+    //      then only update the pre-calculations affected by each bump
+    const vector<Time>& timeline = product->timeline();
+    const vector<SampleDef>& defline = product->defline();
+    model->allocate(timeline, defline);
+    model->init(timeline, defline);
+
+    //  One bumped model per parameter, all valued together with the base model
+    //      on common random numbers: each block of Gaussians is drawn once
+    //      and fed to the base and bumped models, see SimulBlock::simulateModels()
+    //  Parallel: one parallel job of (model group x batch) tasks
+    vector<unique_ptr<Model<double>>> bumped(n);
+    vector<const Model<double>*> models(n + 1);
+    models[0] = model.get();
     for (size_t i = 0; i < n; ++i)
     {
-        *parameters[i] += 1.e-08;
-        auto bumpRes = value(*model, *product, num);
-        *parameters[i] -= 1.e-08;
+        bumped[i] = model->clone();
+        *bumped[i]->parameters()[i] += 1.e-08;
+        bumped[i]->initParam(i, timeline, defline);
+        models[i + 1] = bumped[i].get();
+    }
+
+    auto rng = makeRng(num);
 
+    const auto stats = num.parallel
+        ? mcParallelSimulStatsModels(*product, models, *rng, num.numPath, num.batchSize)
+        : mcSimulStatsModels(*product, models, *rng, num.numPath);
+
+    results.values = stats[0].means;
+    for (size_t i = 0; i < n; ++i)
+    {
         for (size_t j = 0; j < m; ++j)
         {
             results.risks[i][j] = 1.0e+08 *
-                (bumpRes.values[j] - baseRes.values[j]);
+                (stats[i + 1].means[j] - results.values[j]);
         }
     }
+    results.runStats = run.stats();
+
+    cacheResult(key, num, results);
 
     return results;
 }
@@ -370,12 +1124,12 @@ inline auto dupireAADRisk(
     const NumericalParam&   num)
 {
     //  Check that the model is a Dupire
-    const Model<Number>* model = getModel<Number>(modelId);
+    const auto model = getModel<Number>(modelId);
     if (!model)
     {
         throw runtime_error("dupireAADRisk() : Model not found");
     }
-    const Dupire<Number>* dupire = dynamic_cast<const Dupire<Number>*>(model);
+    const Dupire<Number>* dupire = dynamic_cast<const Dupire<Number>*>(model.get());
     if (!dupire)
     {
         throw runtime_error("dupireAADRisk() : Model not a Dupire");
@@ -409,6 +1163,30 @@ inline auto dupireAADRisk(
     return results;
 }
 
+//  Merton IVS
+//  The last one is kept, along with its cache of implied vols,
+//      so recalibrations to the same IVS reuse them,
+//      e.g. dupireSuperbucket() then dupireSuperbucketBump()
+inline MertonIVS mertonIVS(
+    const double spot,
+    const double vol,
+    const double jmpIntens,
+    const double jmpAverage,
+    const double jmpStd)
+{
+    static mutex lastMutex;
+    static unique_ptr<MertonIVS> last;
+
+    lock_guard<mutex> lk(lastMutex);
+    if (!last || !last->same(spot, vol, jmpIntens, jmpAverage, jmpStd))
+    {
+        last = make_unique<MertonIVS>(spot, vol, jmpIntens, jmpAverage, jmpStd);
+    }
+
+    //  Copies share the cache
+    return *last;
+}
+
 //  Returns spots, times and lVols in a struct
 inline auto
 dupireCalib(
@@ -430,7 +1208,7 @@ dupireCalib(
     const double jmpStd = 0.0)
 {
     //  Create IVS
-    MertonIVS ivs(spot, vol, jmpIntens, jmpAverage, jmpStd);
+    MertonIVS ivs = mertonIVS(spot, vol, jmpIntens, jmpAverage, jmpStd);
 
     //  Go
     return dupireCalib(ivs, inclSpots, maxDs, inclTimes, maxDt);
@@ -520,7 +1298,7 @@ inline auto
     //  Convert market inputs to numbers, put on tape
             
     //  Create IVS
-    MertonIVS ivs(spot, vol, jmpIntens, jmpAverage, jmpStd);
+    MertonIVS ivs = mertonIVS(spot, vol, jmpIntens, jmpAverage, jmpStd);
     
     //  Risk view --> that is the AAD input
     //  Note: that puts the view on tape
@@ -619,16 +1397,17 @@ inline auto
     const matrix<double>& lvols = params.lVols;
 
     //  Create model
-    Dupire<double> model(spot, spots, times, lvols, maxDt);
+    Dupire<double> model(spot, spots, times, lvols.view(), maxDt);
     
     //  Get product
-    const Product<double>* product = getProduct<double>(productId);
-
-    //  Base price
-    auto baseVals = value(model, *product, num);
+    const auto product = getProduct<double>(productId);
+    if (!product)
+    {
+        throw runtime_error("dupireSuperbucketBump() : product not found");
+    }
 
     //  Vector of notionals
-    const vector<string>& allPayoffs = baseVals.identifiers;
+    const vector<string>& allPayoffs = product->payoffLabels();
     vector<double> vnots(allPayoffs.size(), 0.0);
     for (const auto& notional : notionals)
     {
@@ -640,50 +1419,138 @@ inline auto
         vnots[distance(allPayoffs.begin(), it)] = notional.second;
     }
 
-    //  Base book value
-    results.value = inner_product(vnots.begin(), vnots.end(), baseVals.values.begin(), 0.0);
-
     //  Create IVS
-    MertonIVS ivs(spot, vol, jmpIntens, jmpAverage, jmpStd);
+    MertonIVS ivs = mertonIVS(spot, vol, jmpIntens, jmpAverage, jmpStd);
 
     //  Create risk view 
-    RiskView<double> riskView(strikes, mats);
+    const RiskView<double> riskView(strikes, mats);
+
+    //  Random Number Generator
+    auto rng = makeRng(num);
+
+    //  Bumps, one task per cell of the risk view, and one for delta, 
+    //      in parallel if requested
+
+    //  Per-thread models, initialized on the product, workspaces and RNGs
+    ThreadPool* pool = ThreadPool::getInstance();
+    const size_t nThread = num.parallel ? pool->numThreads() : 0;
+    vector<unique_ptr<Model<double>>> models(nThread + 1);
+    vector<SimulBlock> blocks(nThread + 1);
+    vector<unique_ptr<RNG>> rngs(nThread + 1);
+    //  Note we don't use vector<bool>
+    //      because vector<bool> is not thread safe
+    vector<int> mdlInit(nThread + 1, false);
+
+    const vector<Time>& timeline = product->timeline();
+    const vector<SampleDef>& defline = product->defline();
+    const size_t nSpots = spots.size(), nTimes = times.size();
+
+    //  Book value in a model with some parameters bumped, on thread threadNum
+    //  Same paths for all bumps
+    auto bookValue = [&](
+        const size_t                    threadNum, 
+        const vector<size_t>&           params, 
+        const vector<double>&           values)
+    {
+        auto& bumpedModel = models[threadNum];
+        if (!mdlInit[threadNum])
+        {
+            bumpedModel = model.clone();
+            bumpedModel->allocate(timeline, defline);
+            blocks[threadNum].allocate(*product, *bumpedModel);
+            rngs[threadNum] = rng->clone();
+            rngs[threadNum]->init(bumpedModel->simDim());
+            mdlInit[threadNum] = true;
+        }
+
+        //  Bump
+        const vector<double*>& parameters = bumpedModel->parameters();
+        vector<double> base(params.size());
+        for (size_t k = 0; k < params.size(); ++k)
+        {
+            base[k] = *parameters[params[k]];
+            *parameters[params[k]] = values[k];
+        }
+        bumpedModel->init(timeline, defline);
 
-    //  Bumps
+        //  Reprice
+        SimulStats stats(allPayoffs.size());
+        rngs[threadNum]->skipTo(0);
+        blocks[threadNum].simulate(*product, *bumpedModel, *rngs[threadNum], num.numPath, stats);
 
-    //  bump, recalibrate, reset model, reprice, pick value, unbump
+        //  Unbump, the next bump initializes
+        for (size_t k = 0; k < params.size(); ++k) *parameters[params[k]] = base[k];
 
-    //  Delta
+        return inner_product(vnots.begin(), vnots.end(), stats.means.begin(), 0.0);
+    };
 
-    //  Recreate model
-    Dupire<double> bumpedModel(spot + 1.0e-08, spots, times, lvols, maxDt);
-    //  Reprice
-    auto bumpedVals = value(bumpedModel, *product, num);
-    //  Pick results and differentiate
-    results.delta = (
-        inner_product(vnots.begin(), vnots.end(), bumpedVals.values.begin(), 0.0)
-        - results.value) * 1.0e+08;
+    //  Base book value
+    results.value = bookValue(0, {}, {});
 
     //  Vega
 
     const size_t n = riskView.rows(), m = riskView.cols();
     results.vega.resize(n, m);
-    for (size_t i = 0; i < n; ++i) for (size_t j = 0; j < m; ++j)
+
+    auto bumpCell = [&](const size_t threadNum, const size_t i, const size_t j)
     {
         //  Bump
-        riskView.bump(i, j, 1.0e-05);
-        //  Recalibrate
-        auto bumpedCalib = dupireCalib(ivs, inclSpots, maxDs, inclTimes, maxDtVol, riskView);
-        //  Recreate model
-        Dupire<double> bumpedModel(spot, bumpedCalib.spots, bumpedCalib.times, bumpedCalib.lVols, maxDt);
-        //  Reprice
-        auto bumpedVals = value(bumpedModel, *product, num);
-        //  Pick results and differentiate
-        results.vega[i][j] = (
-            inner_product(vnots.begin(), vnots.end(), bumpedVals.values.begin(), 0.0)
-            - results.value) * 1.0e+05;
-        //  Unbump
-        riskView.bump(i, j, -1.0e-05);
+        RiskView<double> bumpedView = riskView;
+        bumpedView.bump(i, j, 1.0e-05);
+
+        //  Recalibrate the maturities that the bump moves,
+        //      including the finite differences of IVS::localVol()
+        vector<size_t> params;
+        vector<double> values;
+        vector<double> lVols(nSpots);
+        for (size_t t = 0; t < nTimes; ++t)
+        {
+            if (!riskView.touches(j, times[t] - 1.0e-04, times[t] + 1.0e-04)) continue;
+
+            dupireCalibMaturity(ivs, times[t], spots.begin(), spots.end(), lVols.begin(), bumpedView); 
+            for (size_t s = 0; s < nSpots; ++s)
+            {
+                //  Parameters of Dupire: spot, then local vols spot major
+                params.push_back(1 + s * nTimes + t);
+                values.push_back(lVols[s]);
+            }
+        }
+
+        //  Reprice, pick results and differentiate
+        results.vega[i][j] = (bookValue(threadNum, params, values) - results.value) * 1.0e+05;
+    };
+
+    //  Delta, parameter 0
+    auto bumpSpot = [&](const size_t threadNum)
+    {
+        results.delta = (bookValue(threadNum, { 0 }, { spot + 1.0e-08 }) - results.value) * 1.0e+08;
+    };
+
+    if (num.parallel)
+    {
+        vector<TaskHandle> futures;
+        futures.reserve(n * m + 1);
+
+        futures.push_back(pool->spawnTask([&]()
+        {
+            bumpSpot(pool->threadNum());
+            return true;
+        }));
+        for (size_t i = 0; i < n; ++i) for (size_t j = 0; j < m; ++j)
+        {
+            futures.push_back(pool->spawnTask([&, i, j]()
+            {
+                bumpCell(pool->threadNum(), i, j);
+                return true;
+            }));
+        }
+
+        for (auto& future : futures) pool->activeWait(future);
+    }
+    else
+    {
+        bumpSpot(0);
+        for (size_t i = 0; i < n; ++i) for (size_t j = 0; j < m; ++j) bumpCell(0, i, j);
     }
 
     //  Copy results and strikes
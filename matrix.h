@@ -1,17 +1,123 @@
 #pragma once
 
 #include <vector>
+#include <new>
+#include <algorithm>
 using namespace std;
 
+//  Allocator of storage aligned on cache lines, 
+//      so that rows of multiples of 64 bytes start on a line and vectorize aligned
+template <class T, size_t A = 64>
+struct alignedAllocator
+{
+    typedef T value_type;
+
+    static constexpr size_t alignment = A > alignof(T) ? A : alignof(T);
+
+    template <class U>
+    struct rebind
+    {
+        typedef alignedAllocator<U, A> other;
+    };
+
+    alignedAllocator() = default;
+    template <class U>
+    alignedAllocator(const alignedAllocator<U, A>&) {}
+
+    T* allocate(const size_t n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T), align_val_t(alignment)));
+    }
+
+    void deallocate(T* p, const size_t)
+    {
+        ::operator delete(p, align_val_t(alignment));
+    }
+
+    template <class U>
+    bool operator==(const alignedAllocator<U, A>&) const { return true; }
+    template <class U>
+    bool operator!=(const alignedAllocator<U, A>&) const { return false; }
+};
+
+//  Non-owning view of a vector with a stride, for example a column of a matrix
+template <class T>
+class stridedView
+{
+    T*          myData;
+    size_t      mySize;
+    size_t      myStride;
+
+public:
+
+    stridedView(T* data, const size_t size, const size_t stride = 1) 
+        : myData(data), mySize(size), myStride(stride) {}
+
+    size_t size() const { return mySize; }
+    size_t stride() const { return myStride; }
+    T& operator[] (const size_t i) const { return myData[i * myStride]; }
+};
+
+//  Non-owning view of a matrix, element (i, j) at data[i * rowStride + j * colStride]
+//  Views of the transpose swap the strides: no allocation, no copy
+//  Row pointers with [] only when columns are contiguous, colStride = 1
+template <class T>
+class matrixView
+{
+    T*          myData;
+    size_t      myRows;
+    size_t      myCols;
+    size_t      myRowStride;
+    size_t      myColStride;
+
+public:
+
+    matrixView(T* data, const size_t rows, const size_t cols, 
+        const size_t rowStride, const size_t colStride = 1) 
+        : myData(data), myRows(rows), myCols(cols), myRowStride(rowStride), myColStride(colStride) {}
+
+    //  Const view of a non-const view
+    operator matrixView<const T>() const
+    {
+        return matrixView<const T>(myData, myRows, myCols, myRowStride, myColStride);
+    }
+
+    size_t rows() const { return myRows; }
+    size_t cols() const { return myCols; }
+    bool contiguousRows() const { return myColStride == 1; }
+
+    T& operator() (const size_t i, const size_t j) const 
+    { 
+        return myData[i * myRowStride + j * myColStride]; 
+    }
+    T* operator[] (const size_t row) const { return myData + row * myRowStride; }
+
+    stridedView<T> row(const size_t i) const
+    {
+        return stridedView<T>(myData + i * myRowStride, myCols, myColStride);
+    }
+    stridedView<T> col(const size_t j) const
+    {
+        return stridedView<T>(myData + j * myColStride, myRows, myRowStride);
+    }
+
+    matrixView transposed() const
+    {
+        return matrixView(myData, myCols, myRows, myColStride, myRowStride);
+    }
+};
+
 //  Simple matrix class that wraps a vector,
 //  See chapters 1 and 2
+//  Storage is aligned on cache lines
 
 template <class T>
 class matrix
 {
     size_t      myRows;
     size_t      myCols;
-    vector<T>   myVector;
+    vector<T, alignedAllocator<T>>
+                myVector;
 
 public:
 
@@ -46,6 +152,20 @@ public:
         return *this;
     }
 
+    //  Copy of a view, for example transposed
+    template <class U>
+    explicit matrix(const matrixView<U>& rhs)
+        : myRows(rhs.rows()), myCols(rhs.cols()), myVector(rhs.rows() * rhs.cols())
+    {
+        for (size_t i = 0; i < myRows; ++i)
+        {
+            for (size_t j = 0; j < myCols; ++j)
+            {
+                myVector[i * myCols + j] = rhs(i, j);
+            }
+        }
+    }
+
     //  Move, move assign
     matrix(matrix&& rhs) : myRows(rhs.myRows), myCols(rhs.myCols), myVector(move(rhs.myVector)) {}
     matrix& operator=(matrix&& rhs)
@@ -69,7 +189,14 @@ public:
     {
         myRows = rows;
         myCols = cols;
-        if (myVector.size() < rows*cols) myVector = vector<T>(rows*cols);
+        if (myVector.size() < rows*cols) myVector = vector<T, alignedAllocator<T>>(rows*cols);
+    }
+
+    //  Same elements, shape rows x cols of the same size
+    void reshape(const size_t rows, const size_t cols)
+    {
+        myRows = rows;
+        myCols = cols;
     }
 
     //  Access
@@ -80,9 +207,15 @@ public:
     const T* operator[] (const size_t row) const { return &myVector[row*myCols]; }
     bool empty() const { return myVector.empty(); }
 
+    //  Views, valid until the matrix is resized or destroyed
+    matrixView<T> view() { return matrixView<T>(myVector.data(), myRows, myCols, myCols); }
+    matrixView<const T> view() const { return matrixView<const T>(myVector.data(), myRows, myCols, myCols); }
+    matrixView<T> transposedView() { return view().transposed(); }
+    matrixView<const T> transposedView() const { return view().transposed(); }
+
     //  Iterators
-    typedef typename vector<T>::iterator iterator;
-    typedef typename vector<T>::const_iterator const_iterator;
+    typedef typename vector<T, alignedAllocator<T>>::iterator iterator;
+    typedef typename vector<T, alignedAllocator<T>>::const_iterator const_iterator;
     iterator begin() { return myVector.begin(); }
     iterator end() { return myVector.end(); }
     const_iterator begin() const { return myVector.begin(); }
@@ -92,14 +225,48 @@ public:
 template <class T>
 inline matrix<T> transpose(const matrix<T>& mat)
 {
-    matrix<T> res(mat.cols(), mat.rows());
-    for (size_t i = 0; i < res.rows(); ++i)
+    return matrix<T>(mat.transposedView());
+}
+
+//  Transpose in place, without a copy of the matrix
+//  Square: swaps across the diagonal
+//  Rectangular: follows the cycles of the permutation, 
+//      one bit of bookkeeping per element
+template <class T>
+inline void transposeInPlace(matrix<T>& mat)
+{
+    const size_t rows = mat.rows(), cols = mat.cols();
+
+    if (rows == cols)
     {
-        for (size_t j = 0; j < res.cols(); ++j)
+        for (size_t i = 0; i < rows; ++i)
         {
-            res[i][j] = mat[j][i];
+            for (size_t j = i + 1; j < cols; ++j)
+            {
+                ::swap(mat[i][j], mat[j][i]);
+            }
         }
+        return;
+    }
+
+    //  Element k = i * cols + j moves to j * rows + i = k * rows mod (size - 1)
+    const size_t size = rows * cols;
+    T* data = size ? mat[0] : nullptr;
+    vector<bool> moved(size, false);
+    for (size_t start = 1; start + 1 < size; ++start)
+    {
+        if (moved[start]) continue;
+
+        T carried = move(data[start]);
+        size_t k = start;
+        do
+        {
+            const size_t next = k * rows % (size - 1);
+            ::swap(data[next], carried);
+            moved[next] = true;
+            k = next;
+        } while (k != start);
     }
 
-    return res;
+    mat.reshape(cols, rows);
 }
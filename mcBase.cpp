@@ -17,4 +17,39 @@ As long as this comment is preserved at the top of the file
 #include "mcBase.h"
 
 //  Static
-Time systemTime = 0.0;
\ No newline at end of file
+Time systemTime = 0.0;
+
+#ifdef _DEBUG
+
+//  Count heap allocations by thread, debug builds only
+//  See allocCount() in mcBase.h
+
+#include <cstdlib>
+#include <new>
+
+static thread_local size_t allocCounter = 0;
+
+size_t allocCount()
+{
+    return allocCounter;
+}
+
+void* operator new(size_t size)
+{
+    ++allocCounter;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+#endif
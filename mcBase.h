@@ -23,16 +23,20 @@ As long as this comment is preserved at the top of the file
 #include "AAD.h"
 
 #include <vector>
+#include <span>
+#include <array>
 #include <memory>
 #include <algorithm>
 #include <numeric>
 #include <sstream>
 #include <iomanip>
+#include <map>
+#include <typeindex>
 
 using namespace std;
 
 #include "matrix.h"
-#include "ThreadPool.h"
+#include "threadPool.h"
 
 using Time = double;
 extern Time systemTime;
@@ -65,21 +69,15 @@ struct SampleDef
 
 //  Sample = simulated value
 //      of data on a given event date
+//  The forwards, discounts and libors are views 
+//      into the single buffer of the scenario, see below
 template <class T>
 struct Sample
 {
     T           numeraire;
-    vector<T>   forwards;
-    vector<T>   discounts;
-    vector<T>   libors;
-
-    //  Allocate given SampleDef
-    void allocate(const SampleDef& data)
-    {
-        forwards.resize(data.forwardMats.size());
-        discounts.resize(data.discountMats.size());
-        libors.resize(data.liborDefs.size());
-    }
+    span<T>     forwards;
+    span<T>     discounts;
+    span<T>     libors;
 
     //  Initialize defaults
     void initialize()
@@ -91,17 +89,87 @@ struct Sample
     }
 };
 
+//  Scenario = path, one sample per event date
+//  The forwards, discounts and libors of all the samples
+//      live in one buffer, event by event,
+//      so that path generation and payoffs stream through contiguous memory
+//      and a path is 2 heap blocks whatever the number of events
 template <class T>
-using Scenario = vector<Sample<T>>;
+class Scenario : public vector<Sample<T>>
+{
+    vector<T>   myBuffer;
+
+    //  Point the samples to the buffer at the offsets of rhs
+    void rebind(const Scenario& rhs)
+    {
+        const T* rhsData = rhs.myBuffer.data();
+        for (size_t i = 0; i < this->size(); ++i)
+        {
+            auto& smp = (*this)[i];
+            const auto& rhsSmp = rhs[i];
+            smp.forwards = span<T>(myBuffer.data() + (rhsSmp.forwards.data() - rhsData), 
+                rhsSmp.forwards.size());
+            smp.discounts = span<T>(myBuffer.data() + (rhsSmp.discounts.data() - rhsData), 
+                rhsSmp.discounts.size());
+            smp.libors = span<T>(myBuffer.data() + (rhsSmp.libors.data() - rhsData), 
+                rhsSmp.libors.size());
+        }
+    }
+
+public:
+
+    Scenario() {}
+
+    //  Copies point to their own buffer
+    //  Moves keep the buffer, hence views remain valid
+    Scenario(const Scenario& rhs) : vector<Sample<T>>(rhs), myBuffer(rhs.myBuffer)
+    {
+        rebind(rhs);
+    }
+    Scenario& operator=(const Scenario& rhs)
+    {
+        if (this == &rhs) return *this;
+        vector<Sample<T>>::operator=(rhs);
+        myBuffer = rhs.myBuffer;
+        rebind(rhs);
+        return *this;
+    }
+    Scenario(Scenario&& rhs) = default;
+    Scenario& operator=(Scenario&& rhs) = default;
+
+    //  Allocate given the number of forwards, discounts and libors on every event
+    void allocate(const vector<array<size_t, 3>>& sizes)
+    {
+        //  Offset table
+        this->resize(sizes.size());
+        size_t total = 0;
+        for (const auto& sz : sizes) total += sz[0] + sz[1] + sz[2];
+        myBuffer.resize(total);
+
+        T* data = myBuffer.data();
+        for (size_t i = 0; i < sizes.size(); ++i)
+        {
+            auto& smp = (*this)[i];
+            smp.forwards = span<T>(data, sizes[i][0]);
+            data += sizes[i][0];
+            smp.discounts = span<T>(data, sizes[i][1]);
+            data += sizes[i][1];
+            smp.libors = span<T>(data, sizes[i][2]);
+            data += sizes[i][2];
+        }
+    }
+};
 
 template <class T>
 inline void allocatePath(const vector<SampleDef>& defline, Scenario<T>& path)
 {
-    path.resize(defline.size());
+    vector<array<size_t, 3>> sizes(defline.size());
     for (size_t i = 0; i < defline.size(); ++i)
     {
-        path[i].allocate(defline[i]);
+        sizes[i] = { defline[i].forwardMats.size(), 
+            defline[i].discountMats.size(), defline[i].liborDefs.size() };
     }
+    path.allocate(sizes);
 }
 
 template <class T>
@@ -110,260 +178,1661 @@ inline void initializePath(Scenario<T>& path)
     for (auto& scen : path) scen.initialize();
 }
 
+//  Blocks of scenarios
+//  ===================
+
+//  The batch engine generates and evaluates a block of paths at a time
+//      in a structure of arrays, path index innermost,
+//      so that loops over paths are contiguous and vectorize
+
+//  Number of paths in a block
+constexpr size_t PATHBLOCK = 64;
+
+//  SampleBlock = simulated values 
+//      of data on a given event date for a block of paths
+//  numeraires[path], forwards[i][path], discounts[i][path], libors[i][path]
+template <class T>
+struct SampleBlock
+{
+    vector<T>           numeraires;
+    vector<vector<T>>   forwards;
+    vector<vector<T>>   discounts;
+    vector<vector<T>>   libors;
+
+    //  Allocate given SampleDef and number of paths
+    void allocate(const SampleDef& data, const size_t nPath)
+    {
+        numeraires.resize(nPath);
+        forwards.resize(data.forwardMats.size());
+        for (auto& fwd : forwards) fwd.resize(nPath);
+        discounts.resize(data.discountMats.size());
+        for (auto& df : discounts) df.resize(nPath);
+        libors.resize(data.liborDefs.size());
+        for (auto& libor : libors) libor.resize(nPath);
+    }
+
+    //  Initialize defaults
+    void initialize()
+    {
+        fill(numeraires.begin(), numeraires.end(), T(1.0));
+        for (auto& fwd : forwards) fill(fwd.begin(), fwd.end(), T(100.0));
+        for (auto& df : discounts) fill(df.begin(), df.end(), T(1.0));
+        for (auto& libor : libors) fill(libor.begin(), libor.end(), T(0.0));
+    }
+};
+
+template <class T>
+using ScenarioBlock = vector<SampleBlock<T>>;
+
+template <class T>
+inline void allocatePathBlock(
+    const vector<SampleDef>&    defline, 
+    const size_t                nPath, 
+    ScenarioBlock<T>&           block)
+{
+    block.resize(defline.size());
+    for (size_t i = 0; i < defline.size(); ++i)
+    {
+        block[i].allocate(defline[i], nPath);
+    }
+}
+
+template <class T>
+inline void initializePathBlock(ScenarioBlock<T>& block)
+{
+    for (auto& scen : block) scen.initialize();
+}
+
+//  Allocate a single path with the layout of a block
+template <class T>
+inline void allocatePath(const ScenarioBlock<T>& block, Scenario<T>& path)
+{
+    vector<array<size_t, 3>> sizes(block.size());
+    for (size_t i = 0; i < block.size(); ++i)
+    {
+        sizes[i] = { block[i].forwards.size(), 
+            block[i].discounts.size(), block[i].libors.size() };
+    }
+    path.allocate(sizes);
+}
+
+//  Read path number p from a block
+template <class T>
+inline void getPath(const ScenarioBlock<T>& block, const size_t p, Scenario<T>& path)
+{
+    for (size_t i = 0; i < block.size(); ++i)
+    {
+        path[i].numeraire = block[i].numeraires[p];
+        for (size_t j = 0; j < block[i].forwards.size(); ++j)
+            path[i].forwards[j] = block[i].forwards[j][p];
+        for (size_t j = 0; j < block[i].discounts.size(); ++j)
+            path[i].discounts[j] = block[i].discounts[j][p];
+        for (size_t j = 0; j < block[i].libors.size(); ++j)
+            path[i].libors[j] = block[i].libors[j][p];
+    }
+}
+
+//  Write path number p into a block
+template <class T>
+inline void setPath(const Scenario<T>& path, const size_t p, ScenarioBlock<T>& block)
+{
+    for (size_t i = 0; i < block.size(); ++i)
+    {
+        block[i].numeraires[p] = path[i].numeraire;
+        for (size_t j = 0; j < block[i].forwards.size(); ++j)
+            block[i].forwards[j][p] = path[i].forwards[j];
+        for (size_t j = 0; j < block[i].discounts.size(); ++j)
+            block[i].discounts[j][p] = path[i].discounts[j];
+        for (size_t j = 0; j < block[i].libors.size(); ++j)
+            block[i].libors[j][p] = path[i].libors[j];
+    }
+}
+
 //  Products
 //  ========
 
-template <class T>
-class Product
-{
-public:
+template <class T>
+class Product;
+
+//  Scratch memory for the payoffs of a block of paths, see payoffBlock()
+//  Allocated once by the simulator, one per thread,
+//      so that payoff evaluation allocates nothing in the hot loop
+template <class T>
+struct PayoffScratch
+{
+    //  Product temporaries, scratchSize() rows, one column per path 
+    matrix<T>       block;
+    //  Path and payoffs for the default, path by path payoffBlock()
+    Scenario<T>     path;
+    vector<T>       pays;
+
+    //  Paths, payoffs and scratches of sub-products, see Portfolio in mcPrd.h
+    vector<ScenarioBlock<T>>    legPaths;
+    vector<matrix<T>>           legPayoffs;
+    vector<PayoffScratch<T>>    legs;
+    //  Same, path by path
+    vector<Scenario<T>>         legPath;
+    vector<vector<T>>           legPays;
+
+    void allocate(const Product<T>& prd, const size_t nPath)
+    {
+        block.resize(prd.scratchSize(), nPath);
+        allocatePath(prd.defline(), path);
+        pays.resize(prd.payoffLabels().size());
+        prd.allocateScratch(*this, nPath);
+    }
+};
+
+#ifdef _DEBUG
+
+//  Number of heap allocations on the calling thread, debug builds only
+//  Used to check that payoffs are evaluated without allocations, see mcBase.cpp
+size_t allocCount();
+
+#endif
+
+template <class T>
+class Product
+{
+public:
+
+    //  Access to the product timeline
+    //      along with the sample definitions (defline)
+    virtual const vector<Time>& timeline() const = 0;
+    virtual const vector<SampleDef>& defline() const = 0;
+
+    //  Labels of all payoffs in the product
+    virtual const vector<string>& payoffLabels() const = 0;
+
+    //  Compute payoffs given a path (on the product timeline)
+    //  Must not allocate memory, checked in debug builds
+    virtual void payoffs(
+        //  path, one entry per time step (on the product timeline)
+        const Scenario<T>&          path,     
+        //  pre-allocated space for resulting payoffs
+        vector<T>&                  payoffs)       
+            const = 0;
+
+    //  Same with a pre-allocated scratch, see PayoffScratch
+    //  Default ignores the scratch, products with sub-products override
+    //  The simulators call this one, with a scratch allocated once per thread
+    virtual void payoffs(
+        const Scenario<T>&          path,     
+        vector<T>&                  payoffs,
+        PayoffScratch<T>&           scratch)       
+            const
+    {
+        this->payoffs(path, payoffs);
+    }
+
+    //  Number of rows of temporaries payoffBlock() needs
+    //      in scratch.block, one entry per path
+    virtual size_t scratchSize() const
+    {
+        return 0;
+    }
+
+    //  Allocate any additional scratch, for example of sub-products
+    virtual void allocateScratch(PayoffScratch<T>& scratch, const size_t nPath) const {}
+
+    //  Compute payoffs given a block of paths
+    //  Default implementation goes path by path through payoffs() above
+    //  Concrete products override with loops over paths
+    //  Must not allocate memory either, temporaries go to the scratch
+    virtual void payoffBlock(
+        //  block of paths, one entry per time step
+        const ScenarioBlock<T>&     paths,
+        //  number of paths in the block
+        const size_t                nPath,
+        //  pre-allocated space for resulting payoffs
+        //  payoffs[payoff][path], nPath <= payoffs.cols()
+        matrix<T>&                  payoffs,
+        //  pre-allocated scratch, nPath <= scratch.block.cols()
+        PayoffScratch<T>&           scratch)
+            const
+    {
+        Scenario<T>& path = scratch.path;
+        vector<T>& pays = scratch.pays;
+
+        for (size_t p = 0; p < nPath; ++p)
+        {
+            getPath(paths, p, path);
+            this->payoffs(path, pays);
+            for (size_t j = 0; j < pays.size(); ++j) payoffs[j][p] = pays[j];
+        }
+    }
+
+    virtual unique_ptr<Product<T>> clone() const = 0;
+
+    virtual ~Product() {}
+};
+
+//  Models
+//  ======
+
+//  Gaussians of the block simulations, in the precision of the paths:
+//      float for single precision, see NumericalParam::singlePrecision in main.h,
+//      double otherwise
+template <class T>
+using GaussT = conditional_t<is_same_v<T, float>, float, double>;
+
+template <class T>
+class Model
+{
+public:
+
+    //  Initialize with product timeline
+    virtual void allocate(
+        const vector<Time>&         prdTimeline, 
+        const vector<SampleDef>&    prdDefline) 
+            = 0;
+    virtual void init(
+        const vector<Time>&         prdTimeline, 
+        const vector<SampleDef>&    prdDefline) 
+            = 0;
+
+    //  Incremental initialization after parameter i (in parameters()) moved
+    //  The model must be allocated and initialized with the same product
+    //  Updates only the pre-calculations that depend on the parameter,
+    //      see bumpRisk() in main.h
+    //  Default: full initialization
+    virtual void initParam(
+        const size_t                i,
+        const vector<Time>&         prdTimeline, 
+        const vector<SampleDef>&    prdDefline)
+    {
+        init(prdTimeline, prdDefline);
+    }
+
+    //  Access to the MC dimension
+    virtual size_t simDim() const = 0;
+
+    //  Generate a path consuming a vector[simDim()] of independent Gaussians
+    //  return results in a pre-allocated scenario
+    virtual void generatePath(
+        const vector<double>&       gaussVec, 
+        Scenario<T>&                path) 
+            const = 0;
+
+    //  Generate a block of paths consuming a matrix[simDim()][nPath] 
+    //      of independent Gaussians, gaussBlock[dim][path]
+    //  return results in a pre-allocated block of scenarios
+    //  Default implementation goes path by path through generatePath() above
+    //  Concrete models override with loops over paths
+    virtual void generatePathBlock(
+        const matrix<GaussT<T>>&    gaussBlock,
+        const size_t                nPath,
+        ScenarioBlock<T>&           paths)
+            const
+    {
+        Scenario<T> path;
+        allocatePath(paths, path);
+        initializePath(path);
+        vector<double> gaussVec(gaussBlock.rows());
+
+        for (size_t p = 0; p < nPath; ++p)
+        {
+            for (size_t i = 0; i < gaussVec.size(); ++i) gaussVec[i] = gaussBlock[i][p];
+            generatePath(gaussVec, path);
+            setPath(path, p, paths);
+        }
+    }
+
+    //  Checkpointed AAD (T = Number only)
+    //  A checkpointed model generates paths cheaply, 
+    //      with samples on tape as leaves
+    //  After the adjoints of the payoff are propagated to mark,
+    //      propagatePath() re-records the path in segments
+    //      and propagates the adjoints of the samples to the parameters
+    //  Default: no checkpointing, nothing to do
+    virtual bool checkpointed() const
+    {
+        return false;
+    }
+
+    virtual void propagatePath(
+        const vector<double>&       gaussVec,
+        Scenario<T>&                path)
+            const
+    {}
+
+    virtual unique_ptr<Model<T>> clone() const = 0;
+
+    virtual ~Model() {}
+
+    //  Access to all the model parameters and what they mean
+    virtual const vector<T*>& parameters() = 0;
+    virtual const vector<string>& parameterLabels() const = 0;
+
+    //  Number of parameters
+    size_t numParams() const
+    {
+        return const_cast<Model*>(this)->parameters().size();
+    }
+
+    //  Put parameters on tape, only valid for T = Number
+    //      and the values of DualNumber, see AADDual.h
+    //  Otherwise : do nothing
+    void putParametersOnTape()
+    {
+        if constexpr (is_same_v<T, Number>)
+        {
+            for (Number* param : parameters()) param->putOnTape();
+        }
+        else if constexpr (is_same_v<T, DualNumber>)
+        {
+            for (DualNumber* param : parameters()) param->value().putOnTape();
+        }
+    }
+};
+
+//  Random number generators
+//  ========================
+
+class RNG
+{
+public:
+    
+    //  Initialise with dimension simDim
+    virtual void init(const size_t simDim) = 0;
+
+    //  Compute the next vector[simDim] of independent Uniforms or Gaussians
+    //  The vector is filled by the function and must be pre-allocated
+	virtual void nextU(vector<double>& uVec) = 0;
+	virtual void nextG(vector<double>& gaussVec) = 0;
+
+    //  Compute the next nPath vectors of Uniforms or Gaussians in a block
+    //      block[dim][path], so nPath <= block.cols(), pre-allocated
+    //  The numbers are the same, bit for bit, 
+    //      as nPath successive calls to nextU() or nextG()
+    //  Default implementation does exactly that
+    //  Concrete RNGs override with loops that vectorize
+    virtual void nextUBlock(const size_t nPath, matrix<double>& uBlock)
+    {
+        vector<double> uVec(uBlock.rows());
+        for (size_t p = 0; p < nPath; ++p)
+        {
+            nextU(uVec);
+            for (size_t i = 0; i < uVec.size(); ++i) uBlock[i][p] = uVec[i];
+        }
+    }
+    virtual void nextGBlock(const size_t nPath, matrix<double>& gaussBlock)
+    {
+        vector<double> gaussVec(gaussBlock.rows());
+        for (size_t p = 0; p < nPath; ++p)
+        {
+            nextG(gaussVec);
+            for (size_t i = 0; i < gaussVec.size(); ++i) gaussBlock[i][p] = gaussVec[i];
+        }
+    }
+
+    virtual unique_ptr<RNG> clone() const = 0;
+
+    virtual ~RNG() {}
+
+    //  Are paths 2k and 2k + 1 antithetic?
+    //  Then simulators keep pairs together, see SimulStats
+    virtual bool antithetic() const
+    {
+        return false;
+    }
+
+    //  Skip ahead to path b, the position of the next path, 
+    //      so the draws are the same as the b first paths drawn in sequence
+    //  64bit: simulations may run beyond 2^32 paths, for example sharded
+    virtual void skipTo(const size_t b) = 0;
+};
+
+//  Template algorithms
+//  ===================
+
+//  Serial valuation, chapter 6
+
+//	MC simulator: free function that conducts simulations 
+//      and returns a matrix (as vector of vectors) of payoffs 
+//          (0..nPath-1 , 0..nPay-1) 
+inline vector<vector<double>> mcSimul(
+    const Product<double>&      prd,
+    const Model<double>&        mdl,
+    const RNG&                  rng,			            
+    const size_t                nPath)                      
+{
+    //  Work with copies of the model and RNG
+    //      which are modified when we set up the simulation
+    //  Copies are OK at high level
+    auto cMdl = mdl.clone();
+    auto cRng = rng.clone();
+
+    //	Allocate results
+    const size_t nPay = prd.payoffLabels().size();
+    vector<vector<double>> results(nPath, vector<double>(nPay));
+    //  Init the simulation timeline
+    cMdl->allocate(prd.timeline(), prd.defline());
+    cMdl->init(prd.timeline(), prd.defline());              
+    //  Init the RNG
+    cRng->init(cMdl->simDim());                        
+    //  Allocate Gaussian vector
+    vector<double> gaussVec(cMdl->simDim());           
+    //  Allocate path
+    Scenario<double> path;
+    allocatePath(prd.defline(), path);
+    initializePath(path);
+    //  Allocate payoff scratch
+    PayoffScratch<double> scratch;
+    scratch.allocate(prd, 1);
+
+    //	Iterate through paths	
+    for (size_t i = 0; i<nPath; i++)
+    {
+        //  Next Gaussian vector, dimension D
+        PROFILE(rng, cRng->nextG(gaussVec));
+        //  Generate path, consume Gaussian vector
+        PROFILE(path, cMdl->generatePath(gaussVec, path));
+        //	Compute result
+#ifdef _DEBUG
+        const size_t allocs = allocCount();
+#endif
+        PROFILE(payoff, prd.payoffs(path, results[i], scratch));
+#ifdef _DEBUG
+        if (allocCount() != allocs)
+        {
+            throw runtime_error("mcSimul() : payoffs() allocated memory");
+        }
+#endif
+    }
+
+    return results;	//	C++11: move
+}
+
+//  Parallel valuation, chapter 7
+
+//  Task granularity
+
+//  The book uses a fixed batch of 64 paths per task, 
+//      too small for products with few steps, where tasks drown in overhead,
+//      too large for products with many steps, where load balance suffers
+//  We size batches so every task carries a minimum amount of work,
+//      measured in time steps + payoffs per path,
+//      and every thread gets a minimum number of tasks to balance the load
+
+//  Minimum work per task, in (time steps + payoffs) x paths
+constexpr size_t MINTASKWORK = 8192;
+//  We don't create more than this number of tasks per thread
+constexpr size_t MAXTASKSPERTHREAD = 64;
+
+inline size_t batchSize(
+    const size_t                nPath,
+    const size_t                simDim,
+    const size_t                nPay,
+    //  number of worker threads
+    const size_t                nThread,
+    //  override, 0 = automatic
+    const size_t                requested = 0)
+{
+    if (requested > 0) return requested;
+
+    //  Enough work per task to amortize overhead
+    const size_t minBatch = (MINTASKWORK + simDim + nPay - 1) / (simDim + nPay);
+    //  But no more tasks than we need to balance the load
+    const size_t maxTasks = MAXTASKSPERTHREAD * (nThread + 1);
+    const size_t balanced = (nPath + maxTasks - 1) / maxTasks;
+
+    return max<size_t>(1, max(minBatch, balanced));
+}
+
+//  Accumulation slots
+
+//  Results accumulated by task and merged in task order don't depend on scheduling, 
+//      but with a small batch size, one accumulator per task grows with the number of paths
+//  So consecutive tasks are grouped in at most MAXSLOTS slots:
+//      the tasks of a slot run one after the other in one parallel task,
+//      accumulate on the slot's results, and slots are merged in order
+//  The grouping depends on the number of paths and the batch size,
+//      not on the number of threads
+
+constexpr size_t MAXSLOTS = 4096;
+
+struct TaskSlots
+{
+    size_t  nPath;
+    //  Paths per task
+    size_t  batchSz;
+    size_t  nTask;
+    size_t  tasksPerSlot;
+    size_t  nSlot;
+
+    //  tasksPerSlot = 0: automatic, at most MAXSLOTS slots
+    //  Set for a range of the paths of a larger simulation, see shard.h
+    TaskSlots(const size_t paths, const size_t batch, const size_t slotTasks = 0)
+        : nPath(paths), batchSz(batch)
+    {
+        if (batchSz == 0)
+        {
+            throw runtime_error("TaskSlots() : batch size must be positive");
+        }
+        nTask = (nPath + batchSz - 1) / batchSz;
+        tasksPerSlot = slotTasks ? slotTasks : max<size_t>(1, (nTask + MAXSLOTS - 1) / MAXSLOTS);
+        nSlot = (nTask + tasksPerSlot - 1) / tasksPerSlot;
+    }
+
+    size_t pathsPerSlot() const { return tasksPerSlot * batchSz; }
+};
+
+//  Spawns one parallel task per slot on the thread pool, 
+//      their futures are added to futures, the caller waits on them
+//  f(slot, taskFirst, pathsInTask) runs the tasks of the slot, in order,
+//      the first path is relative to the range of the slots
+template <class F>
+inline void spawnSlots(const TaskSlots& slots, F f, vector<TaskHandle>& futures)
+{
+    ThreadPool *pool = ThreadPool::getInstance();
+    for (size_t slot = 0; slot < slots.nSlot; ++slot)
+    {
+        const size_t firstTask = slot * slots.tasksPerSlot;
+        const size_t lastTask = min(slots.nTask, firstTask + slots.tasksPerSlot);
+        const size_t nPath = slots.nPath, batchSz = slots.batchSz;
+
+        futures.push_back(pool->spawnTask([f, slot, firstTask, lastTask, nPath, batchSz]()
+        {
+            for (size_t task = firstTask; task < lastTask; ++task)
+            {
+                const size_t taskFirst = task * batchSz;
+                f(slot, taskFirst, min(batchSz, nPath - taskFirst));
+            }
+            return true;
+        }));
+    }
+}
+
+//	Parallel equivalent of mcSimul()
+inline vector<vector<double>> mcParallelSimul(
+    const Product<double>&      prd,
+    const Model<double>&        mdl,
+    const RNG&                  rng,
+    const size_t                nPath,
+    //  Paths per task, 0 = automatic
+    const size_t                batch = 0)
+{
+    auto cMdl = mdl.clone();
+
+    const size_t nPay = prd.payoffLabels().size();
+    vector<vector<double>> results(nPath, vector<double>(nPay));
+
+    cMdl->allocate(prd.timeline(), prd.defline());
+    cMdl->init(prd.timeline(), prd.defline());
+
+    //  Space for Gaussian vectors, paths and RNGs, 
+    //      one for each thread, +1 for main
+    //  Allocated by each thread in its first task,
+    //      so the memory is on the thread's NUMA node, see threadPool.h
+    ThreadPool *pool = ThreadPool::getInstance();
+    const size_t nThread = pool->numThreads();
+    vector<vector<double>> gaussVecs(nThread+1);
+    vector<Scenario<double>> paths(nThread+1);
+    vector<PayoffScratch<double>> scratches(nThread + 1);
+    vector<unique_ptr<RNG>> rngs(nThread + 1);
+    //  Note we don't use vector<bool>
+    //      because vector<bool> is not thread safe
+    vector<int> threadInit(nThread + 1, false);
+
+    //  Task granularity
+    const size_t batchSz = batchSize(nPath, cMdl->simDim(), nPay, nThread, batch);
+
+    //  Reserve memory for futures
+    vector<TaskHandle> futures;
+    futures.reserve(nPath / batchSz + 1); 
+
+    //  Start
+    //  Same as mcSimul() except we send tasks to the pool 
+    //  instead of executing them
+
+    size_t firstPath = 0;
+    size_t pathsLeft = nPath;
+    while (pathsLeft > 0)
+    {
+        size_t pathsInTask = min<size_t>(pathsLeft, batchSz);
+
+        futures.push_back( pool->spawnTask ( [&, firstPath, pathsInTask]()
+        {
+            //  Inside the parallel task, 
+            //      pick the right vectors, allocated on first use
+            const size_t threadNum = pool->threadNum();
+            if (!threadInit[threadNum])
+            {
+                gaussVecs[threadNum].resize(cMdl->simDim());
+                allocatePath(prd.defline(), paths[threadNum]);
+                initializePath(paths[threadNum]);
+                scratches[threadNum].allocate(prd, 1);
+                rngs[threadNum] = rng.clone();
+                rngs[threadNum]->init(cMdl->simDim());
+                threadInit[threadNum] = true;
+            }
+            vector<double>& gaussVec = gaussVecs[threadNum];
+            Scenario<double>& path = paths[threadNum];
+            PayoffScratch<double>& scratch = scratches[threadNum];
+
+            //  Get a RNG and position it correctly
+            auto& random = rngs[threadNum];
+            random->skipTo(firstPath);
+
+            //  And conduct the simulations, exactly same as sequential
+            for (size_t i = 0; i < pathsInTask; i++)
+            {
+                //  Next Gaussian vector, dimension D
+                PROFILE(rng, random->nextG(gaussVec));
+                //  Path
+                PROFILE(path, cMdl->generatePath(gaussVec, path));
+                //  Payoff
+                PROFILE(payoff, prd.payoffs(path, results[firstPath + i], scratch));
+            }
+
+            //  Remember tasks must return bool
+            return true;
+        }));
+
+        pathsLeft -= pathsInTask;
+        firstPath += pathsInTask;
+    }
+
+    //  Wait and help
+    for (auto& future : futures) pool->activeWait(future);
+
+    return results;	//	C++11: move
+}
+
+//  Streaming valuation
+
+//  The simulators above return the complete matrix of payoffs,
+//      which is useful for diagnostics but takes nPath x nPay storage
+//  The streaming simulators below keep running statistics instead 
+//      and return the mean and standard error of every payoff
+
+//  Variance reduction in the statistics of a simulation
+struct VarReduction
+{
+    //  Paths 2k and 2k + 1 are antithetic, see RNG::antithetic()
+    bool        antithetic = false;
+
+    //  Control variate: index of a payoff with known expectation, -1 = none
+    //  The other payoffs are regressed against it
+    size_t      control = size_t(-1);
+    double      controlValue = 0.0;
+
+    bool active() const
+    {
+        return antithetic || control != size_t(-1);
+    }
+};
+
+//  Kahan's compensated sums in double of single precision payoffs, see SimulStats::addBlock()
+//  Precise floating point so the compensation is not optimized away under /fp:fast
+#ifdef _MSC_VER
+#pragma float_control(precise, on, push)
+#endif
+
+//  Sum of x[0..n-1]
+inline double kahanSum(const float* x, const size_t n)
+{
+    double sum = 0.0, comp = 0.0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const double y = double(x[i]) - comp;
+        const double t = sum + y;
+        comp = (t - sum) - y;
+        sum = t;
+    }
+    return sum;
+}
+
+//  Sum of (x[0..n-1] - mean)^2
+inline double kahanSqDevs(const float* x, const size_t n, const double mean)
+{
+    double sum = 0.0, comp = 0.0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const double dev = double(x[i]) - mean;
+        const double y = dev * dev - comp;
+        const double t = sum + y;
+        comp = (t - sum) - y;
+        sum = t;
+    }
+    return sum;
+}
+
+#ifdef _MSC_VER
+#pragma float_control(pop)
+#endif
+
+//  Running mean and variance of a vector of payoffs, Welford's algorithm
+struct SimulStats
+{
+    SimulStats(const size_t nPay = 0, const VarReduction& varRed = VarReduction()) :
+        numPath(0),
+        means(nPay, 0.0),
+        sqDevs(nPay, 0.0),
+        varReduction(varRed),
+        numObs(0),
+        hasPending(false)
+    {
+        if (varReduction.active())
+        {
+            obsMeans.resize(nPay, 0.0);
+            obsSqDevs.resize(nPay, 0.0);
+            obsCoDevs.resize(nPay, 0.0);
+            pending.resize(nPay);
+        }
+    }
+
+    //  Number of paths accumulated so far
+    size_t          numPath;
+
+    //  vector(0..nPay - 1) of running means
+    vector<double>  means;
+
+    //  vector(0..nPay - 1) of running sums of squared deviations to mean
+    vector<double>  sqDevs;
+
+    //  Variance reduction
+
+    VarReduction    varReduction;
+
+    //  Statistics of the observations: 
+    //      averages of antithetic pairs, or paths if not antithetic
+    //  Only accumulated when variance reduction is active
+    size_t          numObs;
+    vector<double>  obsMeans;
+    vector<double>  obsSqDevs;
+    //  Sums of co-deviations with the control
+    vector<double>  obsCoDevs;
+
+    //  First path of an incomplete antithetic pair
+    bool            hasPending;
+    vector<double>  pending;
+
+private:
+
+    //  Accumulate one observation
+    void addObs(const double* obs)
+    {
+        ++numObs;
+        const double w = 1.0 / numObs;
+        const size_t nPay = obsMeans.size();
+        const size_t c = varReduction.control;
+
+        //  Deviation of the control to its updated mean
+        const double devCtrl = c < nPay 
+            ? obs[c] - (obsMeans[c] + (obs[c] - obsMeans[c]) * w)
+            : 0.0;
+
+        for (size_t j = 0; j < nPay; ++j)
+        {
+            const double dev = obs[j] - obsMeans[j];
+            obsMeans[j] += dev * w;
+            obsSqDevs[j] += dev * (obs[j] - obsMeans[j]);
+            obsCoDevs[j] += dev * devCtrl;
+        }
+    }
+
+    //  Accumulate the payoffs of one path into the observations
+    //  pay(j) = payoff j of the path
+    template <class P>
+    void addPathObs(const P& pay)
+    {
+        const size_t nPay = obsMeans.size();
+        if (!varReduction.antithetic)
+        {
+            for (size_t j = 0; j < nPay; ++j) pending[j] = pay(j);
+            addObs(pending.data());
+        }
+        else if (!hasPending)
+        {
+            for (size_t j = 0; j < nPay; ++j) pending[j] = pay(j);
+            hasPending = true;
+        }
+        else
+        {
+            for (size_t j = 0; j < nPay; ++j) pending[j] = 0.5 * (pending[j] + pay(j));
+            addObs(pending.data());
+            hasPending = false;
+        }
+    }
+
+    //  Merge observations accumulated over a different set of paths
+    void mergeObs(const SimulStats& rhs)
+    {
+        //  Incomplete pairs make an observation
+        if (rhs.hasPending)
+        {
+            if (hasPending)
+            {
+                for (size_t j = 0; j < pending.size(); ++j) 
+                    pending[j] = 0.5 * (pending[j] + rhs.pending[j]);
+                addObs(pending.data());
+                hasPending = false;
+            }
+            else
+            {
+                pending = rhs.pending;
+                hasPending = true;
+            }
+        }
+
+        if (!rhs.numObs) return;
+        if (!numObs)
+        {
+            numObs = rhs.numObs;
+            obsMeans = rhs.obsMeans;
+            obsSqDevs = rhs.obsSqDevs;
+            obsCoDevs = rhs.obsCoDevs;
+            return;
+        }
+
+        const size_t n = numObs + rhs.numObs;
+        const double wr = double(rhs.numObs) / n;
+        const double w = double(numObs) * wr;
+        const size_t nPay = obsMeans.size();
+        const size_t c = varReduction.control;
+        const double devCtrl = c < nPay ? rhs.obsMeans[c] - obsMeans[c] : 0.0;
+        for (size_t j = 0; j < nPay; ++j)
+        {
+            const double dev = rhs.obsMeans[j] - obsMeans[j];
+            obsSqDevs[j] += rhs.obsSqDevs[j] + dev * dev * w;
+            obsCoDevs[j] += rhs.obsCoDevs[j] + dev * devCtrl * w;
+        }
+        for (size_t j = 0; j < nPay; ++j)
+        {
+            obsMeans[j] += (rhs.obsMeans[j] - obsMeans[j]) * wr;
+        }
+        numObs = n;
+    }
+
+public:
+
+    //  Accumulate the payoffs of one path
+    void add(const vector<double>& payoffs)
+    {
+        ++numPath;
+        const double w = 1.0 / numPath;
+        const size_t nPay = means.size();
+        for (size_t j = 0; j < nPay; ++j)
+        {
+            const double dev = payoffs[j] - means[j];
+            means[j] += dev * w;
+            sqDevs[j] += dev * (payoffs[j] - means[j]);
+        }
+
+        if (varReduction.active())
+        {
+            addPathObs([&payoffs](const size_t j) { return payoffs[j]; });
+        }
+    }
+
+    //  Accumulate the payoffs of a block of paths, payoffs[payoff][path]
+    //  Same results as add() path by path
+    void addBlock(const matrix<double>& payoffs, const size_t nPath)
+    {
+        const size_t nPay = means.size();
+        for (size_t j = 0; j < nPay; ++j)
+        {
+            const double* pays = payoffs[j];
+            double mean = means[j], sqDev = sqDevs[j];
+            for (size_t p = 0; p < nPath; ++p)
+            {
+                const double dev = pays[p] - mean;
+                mean += dev * (1.0 / (numPath + p + 1));
+                sqDev += dev * (pays[p] - mean);
+            }
+            means[j] = mean;
+            sqDevs[j] = sqDev;
+        }
+        numPath += nPath;
+
+        if (varReduction.active())
+        {
+            for (size_t p = 0; p < nPath; ++p)
+            {
+                addPathObs([&payoffs, p](const size_t j) { return payoffs[j][p]; });
+            }
+        }
+    }
+
+    //  Accumulate a block of single precision payoffs
+    //  The mean and squared deviations of the block are summed in double,
+    //      with Kahan's compensation, and merged with the formula of merge() below
+    //  Not the same, bit for bit, as path by path
+    void addBlock(const matrix<float>& payoffs, const size_t nPath)
+    {
+        if (!nPath) return;
+
+        const size_t n = numPath + nPath;
+        const double wr = double(nPath) / n;
+        const double w = double(numPath) * wr;
+        const size_t nPay = means.size();
+        for (size_t j = 0; j < nPay; ++j)
+        {
+            const double mean = kahanSum(payoffs[j], nPath) / nPath;
+            const double dev = mean - means[j];
+            means[j] += dev * wr;
+            sqDevs[j] += kahanSqDevs(payoffs[j], nPath, mean) + dev * dev * w;
+        }
+        numPath = n;
+
+        if (varReduction.active())
+        {
+            for (size_t p = 0; p < nPath; ++p)
+            {
+                addPathObs([&payoffs, p](const size_t j) { return double(payoffs[j][p]); });
+            }
+        }
+    }
+
+    //  Merge statistics accumulated over a different set of paths
+    //  Chan, Golub and LeVeque's pairwise formula
+    //  With antithetic variance reduction, 
+    //      the paths of rhs must follow the paths of this 
+    //      and pairs must not straddle, except the last one
+    void merge(const SimulStats& rhs)
+    {
+        if (!rhs.numPath) return;
+        if (!numPath)
+        {
+            *this = rhs;
+            return;
+        }
+
+        const size_t n = numPath + rhs.numPath;
+        const double wr = double(rhs.numPath) / n;
+        const double w = double(numPath) * wr;
+        const size_t nPay = means.size();
+        for (size_t j = 0; j < nPay; ++j)
+        {
+            const double dev = rhs.means[j] - means[j];
+            means[j] += dev * wr;
+            sqDevs[j] += rhs.sqDevs[j] + dev * dev * w;
+        }
+        numPath = n;
+
+        if (varReduction.active()) mergeObs(rhs);
+    }
+
+    //  Estimates of the expectations of the payoffs
+    //  The means of the paths, corrected by the control variate if any
+    vector<double> values() const
+    {
+        vector<double> vals = means;
+        const size_t c = varReduction.control;
+        if (c < means.size())
+        {
+            const SimulStats s = complete();
+            if (s.numObs > 1 && s.obsSqDevs[c] > 0.0)
+            {
+                for (size_t j = 0; j < means.size(); ++j)
+                {
+                    const double beta = s.obsCoDevs[j] / s.obsSqDevs[c];
+                    vals[j] -= beta * (means[c] - varReduction.controlValue);
+                }
+            }
+            vals[c] = varReduction.controlValue;
+        }
+        return vals;
+    }
+
+    //  Standard errors of the values
+    //  From the independent observations: pairs if antithetic, paths otherwise,
+    //      net of the variance explained by the control
+    vector<double> stdErrs() const
+    {
+        if (!varReduction.active())
+        {
+            vector<double> errs(means.size(), 0.0);
+            if (numPath > 1)
+            {
+                const double norm = 1.0 / (double(numPath) * (numPath - 1));
+                transform(sqDevs.begin(), sqDevs.end(), errs.begin(),
+                    [norm](const double sqDev) { return sqrt(sqDev * norm); });
+            }
+            return errs;
+        }
+
+        const SimulStats s = complete();
+        vector<double> errs(means.size(), 0.0);
+        if (s.numObs > 1)
+        {
+            const double norm = 1.0 / (double(s.numObs) * (s.numObs - 1));
+            const size_t c = varReduction.control;
+            for (size_t j = 0; j < means.size(); ++j)
+            {
+                double sqDev = s.obsSqDevs[j];
+                if (c < means.size() && s.obsSqDevs[c] > 0.0)
+                {
+                    sqDev -= s.obsCoDevs[j] * s.obsCoDevs[j] / s.obsSqDevs[c];
+                }
+                errs[j] = sqrt(max(sqDev, 0.0) * norm);
+            }
+        }
+        return errs;
+    }
+
+private:
+
+    //  Copy with the incomplete pair, if any, as an observation
+    SimulStats complete() const
+    {
+        SimulStats s = *this;
+        if (s.hasPending)
+        {
+            s.addObs(s.pending.data());
+            s.hasPending = false;
+        }
+        return s;
+    }
+};
+
+//  Fused simulation kernels
+
+//  A kernel simulates a block of paths, given the Gaussians, 
+//      for one pair of concrete model and product,
+//      with direct, inlined calls to the model's generatePathBlock() 
+//      and the product's payoffBlock() in place of virtual calls
+//  Kernels are registered by type, see mcKernels.h,
+//      and selected by SimulBlock for the model and product it simulates
+//  Unregistered pairs go through the virtual interface
+
+//  The batch engine runs in double, or in float for single precision, 
+//      see NumericalParam::singlePrecision in main.h
+
+template <class T>
+struct SimulBlockT;
+
+template <class T>
+using SimulKernelT = void (*)(
+    SimulBlockT<T>&, 
+    const Product<T>&, 
+    const Model<T>&, 
+    const size_t, 
+    SimulStats&);
+
+using SimulKernel = SimulKernelT<double>;
+
+//  Registry of kernels by (product type, model type)
+//  Filled on static initialization, read only afterwards
+template <class T>
+inline map<pair<type_index, type_index>, SimulKernelT<T>>& simulKernels()
+{
+    static map<pair<type_index, type_index>, SimulKernelT<T>> kernels;
+    return kernels;
+}
+
+//  Kernel for the concrete types of product and model, nullptr if not registered
+template <class T>
+inline SimulKernelT<T> findSimulKernel(const Product<T>& prd, const Model<T>& mdl)
+{
+    const auto& kernels = simulKernels<T>();
+    auto it = kernels.find(make_pair(type_index(typeid(prd)), type_index(typeid(mdl))));
+    return it == kernels.end() ? nullptr : it->second;
+}
+
+//  Workspace of the batch engine: 
+//      Gaussians, paths and payoffs for a block of paths
+template <class T>
+struct SimulBlockT
+{
+    matrix<GaussT<T>>       gaussBlock;
+    ScenarioBlock<T>        paths;
+    matrix<T>               payoffs;
+    PayoffScratch<T>        scratch;
+    //  Type of the last model that generated the paths
+    //  Models only write the data they simulate, see initializePathBlock(),
+    //      so the paths are initialized again when the type changes
+    const type_info*        pathModel = nullptr;
+    //  Gaussians in double from the RNG, rounded into gaussBlock, single precision only
+    matrix<double>          rngBlock;
+
+    void allocate(const Product<T>& prd, const Model<T>& mdl)
+    {
+        gaussBlock.resize(mdl.simDim(), PATHBLOCK);
+        if constexpr (!is_same_v<GaussT<T>, double>) rngBlock.resize(mdl.simDim(), PATHBLOCK);
+        allocatePathBlock(prd.defline(), PATHBLOCK, paths);
+        initializePathBlock(paths);
+        pathModel = nullptr;
+        payoffs.resize(prd.payoffLabels().size(), PATHBLOCK);
+        scratch.allocate(prd, PATHBLOCK);
+    }
+
+    //  Next Gaussians, dimension D x n
+    void nextGaussians(RNG& rng, const size_t n)
+    {
+        if constexpr (is_same_v<GaussT<T>, double>) rng.nextGBlock(n, gaussBlock);
+        else
+        {
+            rng.nextGBlock(n, rngBlock);
+            for (size_t i = 0; i < gaussBlock.rows(); ++i)
+            {
+                const double* src = rngBlock[i];
+                GaussT<T>* dst = gaussBlock[i];
+                for (size_t p = 0; p < n; ++p) dst[p] = GaussT<T>(src[p]);
+            }
+        }
+    }
+
+    //  Simulate nPath paths, block by block, accumulate into stats
+    void simulate(
+        const Product<T>&       prd,
+        const Model<T>&         mdl,
+        RNG&                    rng,
+        const size_t            nPath,
+        SimulStats&             stats)
+    {
+        //  Fused kernel for the model and product, nullptr = virtual calls
+        const SimulKernelT<T> kernel = findSimulKernel(prd, mdl);
+
+        size_t pathsLeft = nPath;
+        while (pathsLeft > 0)
+        {
+            const size_t n = min(pathsLeft, PATHBLOCK);
+            //  Next Gaussians, dimension D x n
+            PROFILE(rng, nextGaussians(rng, n));
+            //  Paths, payoffs and statistics
+            if (kernel) kernel(*this, prd, mdl, n, stats);
+            else step(prd, mdl, n, stats);
+
+            pathsLeft -= n;
+        }
+    }
+
+    //  Simulate nPath paths in several models, all of the same dimension,
+    //      on the same Gaussians, drawn once per block
+    //  Accumulate into stats[0..mdls.size() - 1]
+    void simulateModels(
+        const Product<T>&                   prd,
+        const vector<const Model<T>*>&      mdls,
+        RNG&                                rng,
+        const size_t                        nPath,
+        SimulStats*                         stats)
+    {
+        if (mdls.empty()) return;
+        gaussBlock.resize(mdls[0]->simDim(), PATHBLOCK);
+        if constexpr (!is_same_v<GaussT<T>, double>) rngBlock.resize(mdls[0]->simDim(), PATHBLOCK);
+
+        vector<SimulKernelT<T>> kernels(mdls.size());
+        for (size_t m = 0; m < mdls.size(); ++m) kernels[m] = findSimulKernel(prd, *mdls[m]);
+
+        size_t pathsLeft = nPath;
+        while (pathsLeft > 0)
+        {
+            const size_t n = min(pathsLeft, PATHBLOCK);
+            //  Next Gaussians, common to all models
+            PROFILE(rng, nextGaussians(rng, n));
+            for (size_t m = 0; m < mdls.size(); ++m)
+            {
+                if (kernels[m]) kernels[m](*this, prd, *mdls[m], n, stats[m]);
+                else step(prd, *mdls[m], n, stats[m]);
+            }
+
+            pathsLeft -= n;
+        }
+    }
+
+    //  One block of n paths from the Gaussians in gaussBlock
+    //  With static types of product and model:
+    //      calls are direct and inlined for final classes, virtual for the base classes
+    template <class P, class M>
+    void step(
+        const P&                prd,
+        const M&                mdl,
+        const size_t            n,
+        SimulStats&             stats)
+    {
+        //  Paths, consume Gaussians
+        if (pathModel && *pathModel != typeid(mdl)) initializePathBlock(paths);
+        pathModel = &typeid(mdl);
+        PROFILE(path, mdl.generatePathBlock(gaussBlock, n, paths));
+        //  Payoffs
+#ifdef _DEBUG
+        const size_t allocs = allocCount();
+#endif
+        PROFILE(payoff, prd.payoffBlock(paths, n, payoffs, scratch));
+#ifdef _DEBUG
+        if (allocCount() != allocs)
+        {
+            throw runtime_error("SimulBlock::step() : payoffBlock() allocated memory");
+        }
+#endif
+        //  Accumulate
+        stats.addBlock(payoffs, n);
+    }
+};
+
+using SimulBlock = SimulBlockT<double>;
+
+//  Kernel for concrete, final, model and product classes
+template <class T, class M, class P>
+inline void fusedSimulKernel(
+    SimulBlockT<T>&         block,
+    const Product<T>&       prd,
+    const Model<T>&         mdl,
+    const size_t            n,
+    SimulStats&             stats)
+{
+    block.step(static_cast<const P&>(prd), static_cast<const M&>(mdl), n, stats);
+}
+
+//  Register the kernel of a pair of concrete model and product in T
+template <class T, class M, class P>
+inline bool registerSimulKernel()
+{
+    simulKernels<T>()[make_pair(type_index(typeid(P)), type_index(typeid(M)))] 
+        = &fusedSimulKernel<T, M, P>;
+    return true;
+}
+
+//  Serial streaming valuation, same as mcSimul() without payoff storage
+//  Paths are generated and evaluated in blocks, see ScenarioBlock
+//  initialized: the model is already allocated and initialized for the product
+//      and used as is, without a copy, see bumpRisk() in main.h
+template <class T>
+inline SimulStats mcSimulStats(
+    const Product<T>&           prd,
+    const Model<T>&             mdl,
+    const RNG&                  rng,
+    const size_t                nPath,
+    const bool                  initialized = false,
+    //  Variance reduction
+    const VarReduction&         varRed = VarReduction())
+{
+    unique_ptr<Model<T>> cMdl;
+    if (!initialized)
+    {
+        cMdl = mdl.clone();
+        cMdl->allocate(prd.timeline(), prd.defline());
+        cMdl->init(prd.timeline(), prd.defline());
+    }
+    const Model<T>&      model = initialized ? mdl : *cMdl;
+
+    auto cRng = rng.clone();
+
+    const size_t nPay = prd.payoffLabels().size();
+    cRng->init(model.simDim());
+
+    //  Workspace for a block of paths
+    SimulBlockT<T> block;
+    block.allocate(prd, model);
+
+    //  Results
+    SimulStats stats(nPay, varRed);
+    block.simulate(prd, model, *cRng, nPath, stats);
+
+    return stats;
+}
+
+//  Parallel streaming valuation of paths [firstPath, firstPath + nPath)
+//  Returns one set of statistics per slot of tasks, in order, see TaskSlots
+//  Tasks are batches of batchSz paths, the last one may be shorter
+//  Used below and for sharding, see shard.h
+template <class T>
+inline vector<SimulStats> mcParallelSimulTaskStats(
+    const Product<T>&           prd,
+    const Model<T>&             mdl,
+    const RNG&                  rng,
+    const size_t                firstPath,
+    const size_t                nPath,
+    //  Paths per task, must be > 0, and even with antithetic paths
+    const size_t                batchSz,
+    //  Model already allocated and initialized, see mcSimulStats()
+    const bool                  initialized = false,
+    //  Variance reduction
+    const VarReduction&         varRed = VarReduction(),
+    //  Tasks per slot, 0 = automatic
+    const size_t                tasksPerSlot = 0)
+{
+    unique_ptr<Model<T>> cMdl;
+    if (!initialized)
+    {
+        cMdl = mdl.clone();
+        cMdl->allocate(prd.timeline(), prd.defline());
+        cMdl->init(prd.timeline(), prd.defline());
+    }
+    const Model<T>&      model = initialized ? mdl : *cMdl;
+
+    const size_t nPay = prd.payoffLabels().size();
+
+    //  One block workspace and RNG per thread, +1 for main
+    //  Allocated by each thread in its first task, on its NUMA node
+    ThreadPool *pool = ThreadPool::getInstance();
+    const size_t nThread = pool->numThreads();
+    vector<SimulBlockT<T>> blocks(nThread + 1);
+    vector<unique_ptr<RNG>> rngs(nThread + 1);
+    vector<int> threadInit(nThread + 1, false);
+
+    //  One set of statistics per slot
+    const TaskSlots slots(nPath, batchSz, tasksPerSlot);
+    vector<SimulStats> slotStats(slots.nSlot, SimulStats(nPay, varRed));
 
-    //  Access to the product timeline
-    //      along with the sample definitions (defline)
-    virtual const vector<Time>& timeline() const = 0;
-    virtual const vector<SampleDef>& defline() const = 0;
+    vector<TaskHandle> futures;
+    futures.reserve(slots.nSlot);
 
-    //  Labels of all payoffs in the product
-    virtual const vector<string>& payoffLabels() const = 0;
+    spawnSlots(slots, [&](const size_t slot, const size_t taskFirst, const size_t pathsInTask)
+    {
+        const size_t threadNum = pool->threadNum();
+        if (!threadInit[threadNum])
+        {
+            blocks[threadNum].allocate(prd, model);
+            rngs[threadNum] = rng.clone();
+            rngs[threadNum]->init(model.simDim());
+            threadInit[threadNum] = true;
+        }
 
-    //  Compute payoffs given a path (on the product timeline)
-    virtual void payoffs(
-        //  path, one entry per time step (on the product timeline)
-        const Scenario<T>&          path,     
-        //  pre-allocated space for resulting payoffs
-        vector<T>&                  payoffs)       
-            const = 0;
+        auto& random = rngs[threadNum];
+        random->skipTo(firstPath + taskFirst);
 
-    virtual unique_ptr<Product<T>> clone() const = 0;
+        //  Accumulate on this slot's statistics
+        blocks[threadNum].simulate(
+            prd, model, *random, pathsInTask, slotStats[slot]);
+    }, futures);
 
-    virtual ~Product() {}
-};
+    for (auto& future : futures) pool->activeWait(future);
 
-//  Models
-//  ======
+    return slotStats;
+}
 
+//  Parallel streaming valuation, same as mcParallelSimul() 
+//      with one set of statistics per task, 
+//      merged in task order so results don't depend on scheduling
 template <class T>
-class Model
+inline SimulStats mcParallelSimulStats(
+    const Product<T>&           prd,
+    const Model<T>&             mdl,
+    const RNG&                  rng,
+    const size_t                nPath,
+    //  Paths per task, 0 = automatic
+    const size_t                batch = 0,
+    //  Model already allocated and initialized, see mcSimulStats()
+    const bool                  initialized = false,
+    //  Variance reduction
+    const VarReduction&         varRed = VarReduction())
 {
-public:
+    //  Allocate and initialize once, here, 
+    //      the simulations share the model
+    unique_ptr<Model<T>> cMdl;
+    if (!initialized)
+    {
+        cMdl = mdl.clone();
+        cMdl->allocate(prd.timeline(), prd.defline());
+        cMdl->init(prd.timeline(), prd.defline());
+    }
+    const Model<T>&      model = initialized ? mdl : *cMdl;
 
-    //  Initialize with product timeline
-    virtual void allocate(
-        const vector<Time>&         prdTimeline, 
-        const vector<SampleDef>&    prdDefline) 
-            = 0;
-    virtual void init(
-        const vector<Time>&         prdTimeline, 
-        const vector<SampleDef>&    prdDefline) 
-            = 0;
+    //  Task granularity, the number of accumulators is bounded, see TaskSlots
+    const size_t nThread = ThreadPool::getInstance()->numThreads();
+    size_t batchSz = batchSize(
+        nPath, model.simDim(), prd.payoffLabels().size(), nThread, batch);
+    //  Antithetic pairs don't straddle tasks
+    if (varRed.antithetic && batchSz % 2) ++batchSz;
 
-    //  Access to the MC dimension
-    virtual size_t simDim() const = 0;
+    const auto taskStats = mcParallelSimulTaskStats(
+        prd, model, rng, 0, nPath, batchSz, true, varRed);
 
-    //  Generate a path consuming a vector[simDim()] of independent Gaussians
-    //  return results in a pre-allocated scenario
-    virtual void generatePath(
-        const vector<double>&       gaussVec, 
-        Scenario<T>&                path) 
-            const = 0;
+    //  Reduce
+    SimulStats stats(prd.payoffLabels().size(), varRed);
+    for (const auto& ts : taskStats) stats.merge(ts);
 
-    virtual unique_ptr<Model<T>> clone() const = 0;
+    return stats;
+}
 
-    virtual ~Model() {}
+//  Streaming valuation to a target standard error
 
-    //  Access to all the model parameters and what they mean
-    virtual const vector<T*>& parameters() = 0;
-    virtual const vector<string>& parameterLabels() const = 0;
+//  Paths are simulated in rounds until the standard errors of all payoffs
+//      are below the target, or maxPath paths were simulated
+//  The first round has enough paths for a reliable estimate of the errors,
+//      the following rounds are sized from the errors so far, 
+//      assuming they decrease in 1 / sqrt(paths)
+//  Rounds are consecutive sequences of paths, positioned with skipTo() in parallel,
+//      so results are the same as a fixed simulation with the paths used,
+//      and the number of paths is deterministic given the RNG and seeds
 
-    //  Number of parameters
-    size_t numParams() const
-    {
-        return const_cast<Model*>(this)->parameters().size();
-    }
+//  Minimum number of paths in the first round
+constexpr size_t MINTARGETPATHS = 1024;
 
-    //  Put parameters on tape, only valid for T = Number
-    void putParametersOnTape()
+template <class T>
+inline SimulStats mcSimulStatsTarget(
+    const Product<T>&           prd,
+    const Model<T>&             mdl,
+    const RNG&                  rng,
+    //  Maximum number of paths
+    const size_t                maxPath,
+    //  Target standard error, all payoffs
+    const double                targetErr,
+    const bool                  parallel,
+    //  Paths per task, 0 = automatic
+    const size_t                batch = 0,
+    //  Model already allocated and initialized, see mcSimulStats()
+    const bool                  initialized = false,
+    //  Variance reduction
+    const VarReduction&         varRed = VarReduction())
+{
+    unique_ptr<Model<T>> cMdl;
+    if (!initialized)
     {
-        putParametersOnTapeT<T>();
+        cMdl = mdl.clone();
+        cMdl->allocate(prd.timeline(), prd.defline());
+        cMdl->init(prd.timeline(), prd.defline());
     }
+    const Model<T>&      model = initialized ? mdl : *cMdl;
 
-private:
+    const size_t nPay = prd.payoffLabels().size();
 
-    //  If T not Number : do nothing
-    template<class U> 
-    void putParametersOnTapeT()
+    //  Serial: one RNG and workspace, simulating on
+    auto cRng = rng.clone();
+    SimulBlockT<T> block;
+    if (!parallel)
     {
-
+        cRng->init(model.simDim());
+        block.allocate(prd, model);
     }
 
-    //  If T = Number : put on tape
-    template <>
-    void putParametersOnTapeT<Number>()
+    //  Parallel: fixed task granularity, 
+    //      rounds are made of whole tasks
+    const size_t nThread = ThreadPool::getInstance()->numThreads();
+    size_t firstRound = max(MINTARGETPATHS, PATHBLOCK * (nThread + 1));
+    size_t batchSz = 1;
+    if (parallel)
     {
-        for (Number* param : parameters()) param->putOnTape();
+        batchSz = batchSize(firstRound, model.simDim(), nPay, nThread, batch);
+        if (varRed.antithetic && batchSz % 2) ++batchSz;
+        firstRound = (firstRound + batchSz - 1) / batchSz * batchSz;
     }
-};
 
-//  Random number generators
-//  ========================
+    SimulStats stats(nPay, varRed);
+    size_t nextRound = min(firstRound, maxPath);
+    while (nextRound > 0)
+    {
+        //  Simulate the round
+        if (parallel)
+        {
+            const auto taskStats = mcParallelSimulTaskStats(
+                prd, model, rng, stats.numPath, nextRound, batchSz, true, varRed);
+            for (const auto& ts : taskStats) stats.merge(ts);
+        }
+        else
+        {
+            block.simulate(prd, model, *cRng, nextRound, stats);
+        }
 
-class RNG
-{
-public:
-    
-    //  Initialise with dimension simDim
-    virtual void init(const size_t simDim) = 0;
+        //  Worst ratio of error to target
+        const auto errs = stats.stdErrs();
+        double ratio = 0.0;
+        for (const double err : errs) ratio = max(ratio, err / targetErr);
+        if (ratio <= 1.0 || stats.numPath >= maxPath) break;
+
+        //  Paths needed, with a margin, at least a quarter more
+        const double needed = 1.1 * ratio * ratio * stats.numPath;
+        size_t more = needed < double(maxPath) 
+            ? size_t(needed) - min(size_t(needed), stats.numPath) 
+            : maxPath;
+        more = max(more, stats.numPath / 4);
+        more = (more + batchSz - 1) / batchSz * batchSz;
+        nextRound = min(more, maxPath - stats.numPath);
+    }
 
-    //  Compute the next vector[simDim] of independent Uniforms or Gaussians
-    //  The vector is filled by the function and must be pre-allocated
-	virtual void nextU(vector<double>& uVec) = 0;
-	virtual void nextG(vector<double>& gaussVec) = 0;
+    return stats;
+}
 
-    virtual unique_ptr<RNG> clone() const = 0;
+//  Streaming valuation of one product in several models
+//      all allocated and initialized for the product, 
+//      typically the same model with different parameters, 
+//      see bumpRisk() and valueModels() in main.h
+//  Common random numbers: same paths and Gaussians for all models
+//      results are the same as mcSimulStats() / mcParallelSimulStats() model by model
+//  Models of the same dimension share the draws: 
+//      each block of Gaussians is drawn once and fed to all of them
 
-    virtual ~RNG() {}
+//  Indices of the models by simulation dimension
+template <class T>
+inline map<size_t, vector<size_t>> modelsBySimDim(const vector<const Model<T>*>& mdls)
+{
+    map<size_t, vector<size_t>> groups;
+    for (size_t m = 0; m < mdls.size(); ++m) groups[mdls[m]->simDim()].push_back(m);
+    return groups;
+}
 
-    //  Skip ahead
-    virtual void skipTo(const unsigned b) = 0;
-};
+//  Serial
+template <class T>
+inline vector<SimulStats> mcSimulStatsModels(
+    const Product<T>&                   prd,
+    const vector<const Model<T>*>&      mdls,
+    const RNG&                          rng,
+    const size_t                        nPath,
+    //  Variance reduction
+    const VarReduction&                 varRed = VarReduction())
+{
+    const size_t nPay = prd.payoffLabels().size();
+    vector<SimulStats> stats(mdls.size(), SimulStats(nPay, varRed));
+    if (mdls.empty()) return stats;
 
-//  Template algorithms
-//  ===================
+    //  Workspace for a block of paths
+    SimulBlockT<T> block;
+    block.allocate(prd, *mdls[0]);
 
-//  Serial valuation, chapter 6
+    for (const auto& group : modelsBySimDim(mdls))
+    {
+        vector<const Model<T>*> groupMdls;
+        for (const size_t m : group.second) groupMdls.push_back(mdls[m]);
+        vector<SimulStats> groupStats(groupMdls.size(), SimulStats(nPay, varRed));
 
-//	MC simulator: free function that conducts simulations 
-//      and returns a matrix (as vector of vectors) of payoffs 
-//          (0..nPath-1 , 0..nPay-1) 
-inline vector<vector<double>> mcSimul(
-    const Product<double>&      prd,
-    const Model<double>&        mdl,
-    const RNG&                  rng,			            
-    const size_t                nPath)                      
-{
-    //  Work with copies of the model and RNG
-    //      which are modified when we set up the simulation
-    //  Copies are OK at high level
-    auto cMdl = mdl.clone();
-    auto cRng = rng.clone();
+        auto cRng = rng.clone();
+        cRng->init(group.first);
 
-    //	Allocate results
-    const size_t nPay = prd.payoffLabels().size();
-    vector<vector<double>> results(nPath, vector<double>(nPay));
-    //  Init the simulation timeline
-    cMdl->allocate(prd.timeline(), prd.defline());
-    cMdl->init(prd.timeline(), prd.defline());              
-    //  Init the RNG
-    cRng->init(cMdl->simDim());                        
-    //  Allocate Gaussian vector
-    vector<double> gaussVec(cMdl->simDim());           
-    //  Allocate path
-    Scenario<double> path;
-    allocatePath(prd.defline(), path);
-    initializePath(path);
+        block.simulateModels(prd, groupMdls, *cRng, nPath, groupStats.data());
 
-    //	Iterate through paths	
-    for (size_t i = 0; i<nPath; i++)
-    {
-        //  Next Gaussian vector, dimension D
-        cRng->nextG(gaussVec);                        
-        //  Generate path, consume Gaussian vector
-        cMdl->generatePath(gaussVec, path);     
-        //	Compute result
-        prd.payoffs(path, results[i]);
+        for (size_t k = 0; k < group.second.size(); ++k) stats[group.second[k]] = groupStats[k];
     }
 
-    return results;	//	C++11: move
+    return stats;
 }
 
-//  Parallel valuation, chapter 7
-
-#define BATCHSIZE 64
-//	Parallel equivalent of mcSimul()
-inline vector<vector<double>> mcParallelSimul(
-    const Product<double>&      prd,
-    const Model<double>&        mdl,
-    const RNG&                  rng,
-    const size_t                nPath)
+//  Parallel
+//  One parallel job of (group x batch) tasks, 
+//      with the block workspaces and RNGs of the threads reused across tasks
+template <class T>
+inline vector<SimulStats> mcParallelSimulStatsModels(
+    const Product<T>&                   prd,
+    const vector<const Model<T>*>&      mdls,
+    const RNG&                          rng,
+    const size_t                        nPath,
+    //  Paths per task, 0 = automatic
+    const size_t                        batch = 0,
+    //  Variance reduction
+    const VarReduction&                 varRed = VarReduction())
 {
-    auto cMdl = mdl.clone();
-
+    const size_t nMdl = mdls.size();
     const size_t nPay = prd.payoffLabels().size();
-    vector<vector<double>> results(nPath, vector<double>(nPay));
+    if (!nMdl) return vector<SimulStats>();
 
-    cMdl->allocate(prd.timeline(), prd.defline());
-    cMdl->init(prd.timeline(), prd.defline());
-
-    //  Allocate space for Gaussian vectors and paths, 
-    //      one for each thread
     ThreadPool *pool = ThreadPool::getInstance();
     const size_t nThread = pool->numThreads();
-    vector<vector<double>> gaussVecs(nThread+1);    //  +1 for main
-    vector<Scenario<double>> paths(nThread+1);
-    for (auto& vec : gaussVecs) vec.resize(cMdl->simDim());
-    for (auto& path : paths)
+
+    //  Groups of models that share the Gaussians
+    //  Same task granularity as mcParallelSimulStats() in each group
+    const auto groups = modelsBySimDim(mdls);
+    const size_t nGroup = groups.size();
+    vector<vector<size_t>> groupIdx;
+    vector<vector<const Model<T>*>> groupMdls;
+    vector<size_t> groupDim;
+    vector<TaskSlots> slots;
+    for (const auto& group : groups)
     {
-        allocatePath(prd.defline(), path);
-        initializePath(path);
+        groupDim.push_back(group.first);
+        groupIdx.push_back(group.second);
+        groupMdls.emplace_back();
+        for (const size_t m : group.second) groupMdls.back().push_back(mdls[m]);
+
+        size_t groupBatch = batchSize(nPath, group.first, nPay, nThread, batch);
+        if (varRed.antithetic && groupBatch % 2) ++groupBatch;
+        slots.emplace_back(nPath, groupBatch);
     }
-    
-    //  One RNG per thread
-    vector<unique_ptr<RNG>> rngs(nThread + 1);
-    for (auto& random : rngs)
+
+    //  One block workspace per thread, and one RNG per (group, thread), +1 for main
+    //  Allocated by each thread on first use, on its NUMA node
+    vector<SimulBlockT<T>> blocks(nThread + 1);
+    vector<int> blockInit(nThread + 1, false);
+
+    vector<vector<unique_ptr<RNG>>> rngs(nGroup);
+    for (auto& groupRngs : rngs) groupRngs.resize(nThread + 1);
+
+    //  One set of statistics per (group, slot, model in group), see TaskSlots
+    vector<vector<SimulStats>> slotStats(nGroup);
+    size_t nSlot = 0;
+    for (size_t g = 0; g < nGroup; ++g)
     {
-        random = rng.clone();
-        random->init(cMdl->simDim());
+        slotStats[g].resize(slots[g].nSlot * groupIdx[g].size(), SimulStats(nPay, varRed));
+        nSlot += slots[g].nSlot;
     }
 
-    //  Reserve memory for futures
     vector<TaskHandle> futures;
-    futures.reserve(nPath / BATCHSIZE + 1); 
-
-    //  Start
-    //  Same as mcSimul() except we send tasks to the pool 
-    //  instead of executing them
+    futures.reserve(nSlot);
 
-    size_t firstPath = 0;
-    size_t pathsLeft = nPath;
-    while (pathsLeft > 0)
+    for (size_t g = 0; g < nGroup; ++g)
     {
-        size_t pathsInTask = min<size_t>(pathsLeft, BATCHSIZE);
-
-        futures.push_back( pool->spawnTask ( [&, firstPath, pathsInTask]()
+        spawnSlots(slots[g], [&, g](const size_t slot, const size_t taskFirst, const size_t pathsInTask)
         {
-            //  Inside the parallel task, 
-            //      pick the right pre-allocated vectors
             const size_t threadNum = pool->threadNum();
-            vector<double>& gaussVec = gaussVecs[threadNum];
-            Scenario<double>& path = paths[threadNum];
-
-            //  Get a RNG and position it correctly
-            auto& random = rngs[threadNum];
-            random->skipTo(firstPath);
-
-            //  And conduct the simulations, exactly same as sequential
-            for (size_t i = 0; i < pathsInTask; i++)
+            if (!blockInit[threadNum])
             {
-                //  Next Gaussian vector, dimension D
-                random->nextG(gaussVec);
-                //  Path
-                cMdl->generatePath(gaussVec, path);       
-                //  Payoff
-                prd.payoffs(path, results[firstPath + i]);
+                blocks[threadNum].allocate(prd, *mdls[0]);
+                blockInit[threadNum] = true;
             }
 
-            //  Remember tasks must return bool
-            return true;
-        }));
+            auto& random = rngs[g][threadNum];
+            if (!random)
+            {
+                random = rng.clone();
+                random->init(groupDim[g]);
+            }
+            random->skipTo(taskFirst);
 
-        pathsLeft -= pathsInTask;
-        firstPath += pathsInTask;
+            blocks[threadNum].simulateModels(
+                prd, groupMdls[g], *random, pathsInTask, 
+                &slotStats[g][slot * groupIdx[g].size()]);
+        }, futures);
     }
 
-    //  Wait and help
     for (auto& future : futures) pool->activeWait(future);
 
-    return results;	//	C++11: move
+    //  Reduce in slot order, by model
+    vector<SimulStats> stats(nMdl, SimulStats(nPay, varRed));
+    for (size_t g = 0; g < nGroup; ++g)
+    {
+        const size_t nInGroup = groupIdx[g].size();
+        for (size_t slot = 0; slot < slots[g].nSlot; ++slot)
+        {
+            for (size_t k = 0; k < nInGroup; ++k)
+            {
+                stats[groupIdx[g][k]].merge(slotStats[g][slot * nInGroup + k]);
+            }
+        }
+    }
+
+    return stats;
 }
 
 //  AAD instrumentation of mcSimul(), chapter 12
@@ -431,6 +1900,9 @@ mcSimulAAD(
     cMdl->init(prd.timeline(), prd.defline());
     //  Initialize path
     initializePath(path);
+    //  Allocate payoff scratch
+    PayoffScratch<Number> scratch;
+    scratch.allocate(prd, 1);
     //  Mark the tape straight after initialization
     tape.mark();
     //
@@ -456,17 +1928,20 @@ mcSimulAAD(
         //
 
         //  Next Gaussian vector, dimension D
-        cRng->nextG(gaussVec);
+        PROFILE(rng, cRng->nextG(gaussVec));
         //  Generate path, consume Gaussian vector
-        cMdl->generatePath(gaussVec, path);     
+        PROFILE(path, cMdl->generatePath(gaussVec, path));
         //	Compute result
-        prd.payoffs(path, nPayoffs);
+        PROFILE(payoff, prd.payoffs(path, nPayoffs, scratch));
         //  Aggregate
         Number result = aggFun(nPayoffs);
 
         //  AAD - 3
         //  Propagate adjoints
-        result.propagateToMark();
+        PROFILE_COUNT(tapeNodes, tape.numNodesAfterMark());
+        PROFILE(backward, result.propagateToMark());
+        //  Checkpointed models propagate the path
+        PROFILE(backward, cMdl->propagatePath(gaussVec, path));
         //  Store results for the path
         results.aggregated[i] = double(result);
         convertCollection(
@@ -480,7 +1955,8 @@ mcSimulAAD(
     //  Mark = limit between pre-calculations and path-wise operations
     //  Operations above mark have been propagated and accumulated
     //  We conduct one propagation mark to start
-    Number::propagateMarkToStart();
+    PROFILE_COUNT(tapeNodes, tape.numNodes());
+    PROFILE(backward, Number::propagateMarkToStart());
     //
 
     //  Pick sensitivities, summed over paths, and normalize
@@ -525,6 +2001,115 @@ inline void initModel4ParallelAAD(
     //
 }
 
+//  End of the parallel AAD simulations
+
+//  Propagation over the pre-calculations, mark to start, 
+//      on the tapes of all the threads that were initialized
+//  tapes[i]: tape of thread i, 0 = main
+//  Every sweep is sent back to the thread that recorded the tape, 
+//      which holds it in cache and memory, see ThreadPool::spawnTaskTo()
+//  The main thread sweeps its own tape, then helps
+template <class P>
+inline void propagateTapesMarkToStart(
+    const vector<Tape*>&    tapes,
+    const vector<int>&      init,
+    //  Propagation on Number::tape
+    const P&                propagate)
+{
+    ThreadPool* pool = ThreadPool::getInstance();
+
+    auto sweep = [&tapes, &propagate](const size_t i)
+    {
+        Tape* const previous = Number::tape;
+        Number::tape = tapes[i];
+        PROFILE_COUNT(tapeNodes, Number::tape->numNodes());
+        PROFILE(backward, propagate());
+        Number::tape = previous;
+    };
+
+    vector<TaskHandle> futures;
+    futures.reserve(tapes.size());
+    for (size_t i = 1; i < tapes.size(); ++i)
+    {
+        if (!init[i]) continue;
+        futures.push_back(pool->spawnTaskTo(i, [&sweep, i]()
+        {
+            sweep(i);
+            return true;
+        }));
+    }
+
+    if (init[0]) sweep(0);
+
+    for (auto& future : futures) pool->activeWait(future);
+}
+
+//  Sum of the adjoints of the parameters over the threads
+//  sumParam(j) sums the adjoints of parameter j over threads and stores the result
+//  Parameters are summed in chunks in parallel,
+//      each one over threads in order, as in a serial loop,
+//      so results don't depend on the chunks or the scheduling
+template <class S>
+inline void parallelSumParams(const size_t nParam, const S& sumParam)
+{
+    ThreadPool* pool = ThreadPool::getInstance();
+    const size_t nThread = pool->numThreads();
+
+    //  A few chunks per thread, of a minimum size
+    constexpr size_t MINCHUNK = 64;
+    const size_t nChunk = 4 * (nThread + 1);
+    const size_t chunk = max(MINCHUNK, (nParam + nChunk - 1) / nChunk);
+
+    //  Serial when small
+    if (!nThread || nParam <= chunk)
+    {
+        for (size_t j = 0; j < nParam; ++j) sumParam(j);
+        return;
+    }
+
+    vector<TaskHandle> futures;
+    futures.reserve(nParam / chunk + 1);
+    for (size_t first = 0; first < nParam; first += chunk)
+    {
+        const size_t last = min(nParam, first + chunk);
+        futures.push_back(pool->spawnTask([&sumParam, first, last]()
+        {
+            for (size_t j = first; j < last; ++j) sumParam(j);
+            return true;
+        }));
+    }
+
+    for (auto& future : futures) pool->activeWait(future);
+}
+
+//  Workspace of mcParallelSimulAAD(), one entry per thread, 0 = main
+//  May persist between simulations of the same model and product:
+//      the model clones keep their pre-calculations, 
+//      recorded on the tapes below the mark, and their allocated paths
+//      so simulations start right away, see main.h
+struct AADWorkspace
+{
+    //  Identifies the model and product, managed by the caller
+    string                              key;
+
+    vector<unique_ptr<Model<Number>>>   models;
+    vector<Scenario<Number>>            paths;
+    vector<Tape>                        tapes;
+    //  Model initialized on the thread's tape?
+    //  Note we don't use vector<bool>
+    //      because vector<bool> is not thread safe
+    vector<int>                         mdlInit;
+
+    void reset()
+    {
+        key.clear();
+        models.clear();
+        paths.clear();
+        tapes.clear();
+        mdlInit.clear();
+    }
+};
+
 //  Parallel version of mcSimulAAD()
 template<class F = decltype(defaultAggregator)>
 inline AADSimulResults
@@ -533,7 +2118,13 @@ mcParallelSimulAAD(
     const Model<Number>&    mdl,
     const RNG& rng,
     const size_t            nPath,
-    const F&                aggFun = defaultAggregator)
+    const F&                aggFun = defaultAggregator,
+    //  Paths per task, 0 = automatic
+    const size_t            batch = 0,
+    //  Persistent workspace for the model and product, nullptr = none
+    AADWorkspace*           workspace = nullptr,
+    //  First path, for a range of the paths of a larger simulation, see shard.h
+    const size_t            firstPath = 0)
 {
     const size_t nPay = prd.payoffLabels().size();
     const size_t nParam = mdl.numParams();
@@ -552,92 +2143,109 @@ mcParallelSimulAAD(
     ThreadPool *pool = ThreadPool::getInstance();
     const size_t nThread = pool->numThreads();
 
-    //  Allocate workspace
-
-    //  One model clone per thread
-    vector<unique_ptr<Model<Number>>> models(nThread + 1);
-    for (auto& model : models)
+    //  Allocate workspace, unless persisted from a previous call
+    AADWorkspace localWorkspace;
+    AADWorkspace& work = workspace ? *workspace : localWorkspace;
+    if (work.models.size() != nThread + 1)
     {
-        model = mdl.clone();
-        model->allocate(prd.timeline(), prd.defline());
+        //  One model clone, scenario and tape per thread, main thread included
+        //  The clones and scenarios are allocated on the threads, 
+        //      in their first task, so their memory, like the tapes', 
+        //      is on the thread's NUMA node, see threadPool.h
+        work.models.clear();
+        work.models.resize(nThread + 1);
+        work.paths.assign(nThread + 1, Scenario<Number>());
+        work.tapes = vector<Tape>(nThread + 1);
+        work.mdlInit.assign(nThread + 1, false);
     }
-
-    //  One scenario per thread
-    vector<Scenario<Number>> paths(nThread + 1);
-    for (auto& path : paths)
+    else
     {
-        allocatePath(prd.defline(), path);
+        //  Pre-calculations are on tape, reset their adjoints
+        for (size_t i = 0; i <= nThread; ++i)
+        {
+            if (!work.mdlInit[i]) continue;
+            work.tapes[i].rewindToMark();
+            work.tapes[i].resetAdjoints();
+        }
     }
+    vector<unique_ptr<Model<Number>>>& models = work.models;
+    vector<Scenario<Number>>& paths = work.paths;
+    vector<Tape>& tapes = work.tapes;
+    vector<int>& mdlInit = work.mdlInit;
 
     //  One vector of payoffs per thread
     vector<vector<Number>> payoffs(nThread + 1, vector<Number>(nPay));
 
-    //  ~workspace
+    //  ~workspace
+
+    //  The main thread also works on the tape of the workspace
+    Tape* mainThreadPtr = Number::tape;
+    Number::tape = &tapes[0];
+
+    //  One RNG, one Gaussian vector and one payoff scratch per thread
+    //  Also allocated on the threads
+    vector<unique_ptr<RNG>> rngs(nThread + 1);
+    vector<vector<double>> gaussVecs(nThread + 1);
+    vector<PayoffScratch<Number>> scratches(nThread + 1);
 
-    //  Tapes for the worker threads
-    //  The main thread has one of its own
-    vector<Tape> tapes(nThread);
+    //  Allocate and initialize thread threadNum, once
+    auto initThread = [&](const size_t threadNum)
+    {
+        //  Model and path, unless persisted in the workspace
+        if (!mdlInit[threadNum])
+        {
+            models[threadNum] = mdl.clone();
+            models[threadNum]->allocate(prd.timeline(), prd.defline());
+            allocatePath(prd.defline(), paths[threadNum]);
 
-    //  Model initialized?
-    //  Note we don't use vector<bool>
-    //      because vector<bool> is not thread safe
-    vector<int> mdlInit(nThread + 1, false);
+            //  Initialize
+            initModel4ParallelAAD(prd, *models[threadNum], paths[threadNum]);
 
-    //  Initialize main thread
-    initModel4ParallelAAD(prd, *models[0], paths[0]);
+            //  Mark as initialized
+            mdlInit[threadNum] = true;
+        }
 
-    //  Mark main thread as initialized
-    mdlInit[0] = true;
+        const size_t simDim = models[threadNum]->simDim();
+        rngs[threadNum] = rng.clone();
+        rngs[threadNum]->init(simDim);
+        gaussVecs[threadNum].resize(simDim);
+        scratches[threadNum].allocate(prd, 1);
+    };
 
-    //  Init the RNGs, one pet thread
-    //  One RNG per thread
-    vector<unique_ptr<RNG>> rngs(nThread + 1);
-    for (auto& random : rngs)
-    {
-        random = rng.clone();
-        random->init(models[0]->simDim());
-    }
+    //  Initialize main thread
+    initThread(0);
 
-    //  One Gaussian vector per thread
-    vector<vector<double>> gaussVecs
-        (nThread + 1, vector<double>(models[0]->simDim()));
+    //  Task granularity
+    const size_t batchSz = batchSize(nPath, models[0]->simDim(), nPay, nThread, batch);
 
     //  Reserve memory for futures
     vector<TaskHandle> futures;
-    futures.reserve(nPath / BATCHSIZE + 1);
+    futures.reserve(nPath / batchSz + 1);
 
     //  Start
     //  Same as mcSimul() except we send tasks to the pool 
     //  instead of executing them
 
-    size_t firstPath = 0;
+    size_t taskFirst = 0;
     size_t pathsLeft = nPath;
     while (pathsLeft > 0)
     {
-        size_t pathsInTask = min<size_t>(pathsLeft, BATCHSIZE);
+        size_t pathsInTask = min<size_t>(pathsLeft, batchSz);
 
-        futures.push_back(pool->spawnTask([&, firstPath, pathsInTask]()
+        futures.push_back(pool->spawnTask([&, taskFirst, pathsInTask]()
         {
             const size_t threadNum = pool->threadNum();
 
             //  Use this thread's tape
             //  Thread local magic: each thread its own pointer
-            //  Note main thread = 0 is not reset
-            if (threadNum > 0) Number::tape = &tapes[threadNum - 1];
+            Number::tape = &tapes[threadNum];
 
             //  Initialize once on each thread
-            if (!mdlInit[threadNum])
-            {
-                //  Initialize
-                initModel4ParallelAAD(prd, *models[threadNum], paths[threadNum]);
-
-                //  Mark as initialized
-                mdlInit[threadNum] = true;
-            }
+            if (!rngs[threadNum]) initThread(threadNum);
 
             //  Get a RNG and position it correctly
             auto& random = rngs[threadNum];
-            random->skipTo(firstPath);
+            random->skipTo(firstPath + taskFirst);
 
             //  And conduct the simulations, exactly same as sequential
             for (size_t i = 0; i < pathsInTask; i++)
@@ -647,23 +2255,27 @@ mcParallelSimulAAD(
 
                 Number::tape->rewindToMark();
                 //  Next Gaussian vector, dimension D
-                random->nextG(gaussVecs[threadNum]);
+                PROFILE(rng, random->nextG(gaussVecs[threadNum]));
                 //  Path
-                models[threadNum]->generatePath(
+                PROFILE(path, models[threadNum]->generatePath(
                     gaussVecs[threadNum], 
-                    paths[threadNum]);
+                    paths[threadNum]));
                 //  Payoff
-                prd.payoffs(paths[threadNum], payoffs[threadNum]);
+                PROFILE(payoff, prd.payoffs(paths[threadNum], payoffs[threadNum], scratches[threadNum]));
 
                 //  Propagate adjoints
                 Number result = aggFun(payoffs[threadNum]);
-                result.propagateToMark();
+                PROFILE_COUNT(tapeNodes, Number::tape->numNodesAfterMark());
+                PROFILE(backward, result.propagateToMark());
+                PROFILE(backward, models[threadNum]->propagatePath(
+                    gaussVecs[threadNum], 
+                    paths[threadNum]));
                 //  Store results for the path
-                results.aggregated[firstPath + i] = double(result);
+                results.aggregated[taskFirst + i] = double(result);
                 convertCollection(
                     payoffs[threadNum].begin(), 
                     payoffs[threadNum].end(),
-                    results.payoffs[firstPath + i].begin());
+                    results.payoffs[taskFirst + i].begin());
             }
 
             //  Remember tasks must return bool
@@ -671,7 +2283,7 @@ mcParallelSimulAAD(
         }));
 
         pathsLeft -= pathsInTask;
-        firstPath += pathsInTask;
+        taskFirst += pathsInTask;
     }
 
     //  Wait and help
@@ -680,37 +2292,26 @@ mcParallelSimulAAD(
     //  Mark = limit between pre-calculations and path-wise operations
     //  Operations above mark have been propagated and accumulated
     //  We conduct one propagation mark to start
-    //  On the main thread's tape
-    Number::propagateMarkToStart();
-    //  And on the worker thread's tapes
-    Tape* mainThreadPtr = Number::tape;
-    for (size_t i = 0; i < nThread; ++i)
-    {
-        if (mdlInit[i + 1])
-        {
-            //  Set tape pointer
-            Number::tape = &tapes[i];
-            //  On that tape, propagate
-            Number::propagateMarkToStart();
-        }
-    }
+    //  On each thread's tape, main thread's included, in parallel
+    vector<Tape*> tapePtrs(nThread + 1);
+    for (size_t i = 0; i <= nThread; ++i) tapePtrs[i] = &tapes[i];
+    propagateTapesMarkToStart(tapePtrs, mdlInit, []() { Number::propagateMarkToStart(); });
     //  Reset tape to main thread's
     Number::tape = mainThreadPtr;
 
-    //  Sum sensitivities over threads
-    for (size_t j = 0; j < nParam; ++j)
+    //  Sum sensitivities over threads, in parallel
+    parallelSumParams(nParam, [&](const size_t j)
     {
-        results.risks[j] = 0.0;
+        double risk = 0.0;
         for (size_t i = 0; i < models.size(); ++i)
         {
-            if (mdlInit[i]) results.risks[j] += models[i]->parameters()[j]->adjoint();
+            if (mdlInit[i]) risk += models[i]->parameters()[j]->adjoint();
         }
-        results.risks[j] /= nPath;
-    }
+        results.risks[j] = risk / nPath;
+    });
 
-	//  Clear the main thread's tape
-    //  The other tapes are cleared on the destruction of the vector of tapes
-    Number::tape->clear();
+    //  The tapes are cleared on the destruction of the workspace
+    //  Persistent workspaces keep them, with the pre-calculations below the mark
 
     return results;
 }
@@ -742,6 +2343,11 @@ mcSimulAADMulti(
 	const RNG&              rng,
 	const size_t            nPath)
 {
+    if (mdl.checkpointed())
+    {
+        throw runtime_error("mcSimulAADMulti() : checkpointed models only support one result");
+    }
+
 	auto cMdl = mdl.clone();
 	auto cRng = rng.clone();
 
@@ -763,6 +2369,8 @@ mcSimulAADMulti(
     cMdl->putParametersOnTape();
 	cMdl->init(prd.timeline(), prd.defline());
 	initializePath(path);
+	PayoffScratch<Number> scratch;
+	scratch.allocate(prd, 1);
 	tape.mark();
 
 	cRng->init(cMdl->simDim());
@@ -778,9 +2386,9 @@ mcSimulAADMulti(
 	{
 		tape.rewindToMark();
 
-		cRng->nextG(gaussVec);
-		cMdl->generatePath(gaussVec, path);
-		prd.payoffs(path, nPayoffs);
+		PROFILE(rng, cRng->nextG(gaussVec));
+		PROFILE(path, cMdl->generatePath(gaussVec, path));
+		PROFILE(payoff, prd.payoffs(path, nPayoffs, scratch));
 
         //  Multi-dimensional propagation
         //      client code seeds the tape with the correct boundary conditions 
@@ -789,7 +2397,8 @@ mcSimulAADMulti(
 			nPayoffs[j].adjoint(j) = 1.0;
 		}
         //      multi-dimensional propagation over simulation, end to mark
-		Number::propagateAdjointsMulti(prev(tape.end()), tape.markIt());
+		PROFILE_COUNT(tapeNodes, tape.numNodesAfterMark());
+		PROFILE(backward, Number::propagateAdjointsMulti(prev(tape.end()), tape.markIt()));
 
 		convertCollection(
             nPayoffs.begin(), 
@@ -798,7 +2407,10 @@ mcSimulAADMulti(
 	}
 
     //  Multi-dimensional propagation over initialization, mark to start
-	Number::propagateAdjointsMulti(tape.markIt(), tape.begin());
+    //  Note: propagation starts at mark - 1, as propagateMarkToStart()
+    //      the node after mark, on the last path, is already propagated
+	PROFILE_COUNT(tapeNodes, tape.numNodes());
+	PROFILE(backward, Number::propagateAdjointsMulti(prev(tape.markIt()), tape.begin()));
 
     //  Pack results 
 	for (size_t i = 0; i < nParam; ++i)
@@ -821,8 +2433,15 @@ mcParallelSimulAADMulti(
 	const Product<Number>&  prd,
 	const Model<Number>&    mdl,
 	const RNG& rng,
-	const size_t            nPath)
+	const size_t            nPath,
+	//  Paths per task, 0 = automatic
+	const size_t            batch = 0)
 {
+    if (mdl.checkpointed())
+    {
+        throw runtime_error("mcParallelSimulAADMulti() : checkpointed models only support one result");
+    }
+
 	const size_t nPay = prd.payoffLabels().size();
 	const size_t nParam = mdl.numParams();
 
@@ -832,18 +2451,9 @@ mcParallelSimulAADMulti(
 	ThreadPool *pool = ThreadPool::getInstance();
 	const size_t nThread = pool->numThreads();
 
+	//	Per-thread state, allocated on each thread's first task, on its NUMA node
 	vector<unique_ptr<Model<Number>>> models(nThread + 1);
-	for (auto& model : models)
-	{
-		model = mdl.clone();
-		model->allocate(prd.timeline(), prd.defline());
-	}
-
 	vector<Scenario<Number>> paths(nThread + 1);
-	for (auto& path : paths)
-	{
-		allocatePath(prd.defline(), path);
-	}
 
 	vector<vector<Number>> payoffs(nThread + 1, vector<Number>(nPay));
 
@@ -851,30 +2461,41 @@ mcParallelSimulAADMulti(
 
 	vector<int> mdlInit(nThread + 1, false);
 
-	initModel4ParallelAAD(prd, *models[0], paths[0]);
-
-	mdlInit[0] = true;
-
 	vector<unique_ptr<RNG>> rngs(nThread + 1);
-	for (auto& random : rngs)
+	vector<vector<double>> gaussVecs(nThread + 1);
+	vector<PayoffScratch<Number>> scratches(nThread + 1);
+
+	auto initThread = [&](const size_t threadNum)
 	{
-		random = rng.clone();
-		random->init(models[0]->simDim());
-	}
+		models[threadNum] = mdl.clone();
+		models[threadNum]->allocate(prd.timeline(), prd.defline());
+		allocatePath(prd.defline(), paths[threadNum]);
+
+		initModel4ParallelAAD(prd, *models[threadNum], paths[threadNum]);
+
+		const size_t simDim = models[threadNum]->simDim();
+		rngs[threadNum] = rng.clone();
+		rngs[threadNum]->init(simDim);
+		gaussVecs[threadNum].resize(simDim);
+		scratches[threadNum].allocate(prd, 1);
 
-	vector<vector<double>> gaussVecs
-	(nThread + 1, vector<double>(models[0]->simDim()));
+		mdlInit[threadNum] = true;
+	};
+
+	initThread(0);
 
 	AADMultiSimulResults results(nPath, nPay, nParam);
 
+	const size_t batchSz = batchSize(nPath, models[0]->simDim(), nPay, nThread, batch);
+
 	vector<TaskHandle> futures;
-	futures.reserve(nPath / BATCHSIZE + 1);
+	futures.reserve(nPath / batchSz + 1);
 
 	size_t firstPath = 0;
 	size_t pathsLeft = nPath;
 	while (pathsLeft > 0)
 	{
-		size_t pathsInTask = min<size_t>(pathsLeft, BATCHSIZE);
+		size_t pathsInTask = min<size_t>(pathsLeft, batchSz);
 
 		futures.push_back(pool->spawnTask([&, firstPath, pathsInTask]()
 		{
@@ -882,11 +2503,7 @@ mcParallelSimulAADMulti(
 
 			if (threadNum > 0) Number::tape = &tapes[threadNum - 1];
 
-			if (!mdlInit[threadNum])
-			{
-				initModel4ParallelAAD(prd, *models[threadNum], paths[threadNum]);
-				mdlInit[threadNum] = true;
-			}
+			if (!mdlInit[threadNum]) initThread(threadNum);
 
 			auto& random = rngs[threadNum];
 			random->skipTo(firstPath);
@@ -895,18 +2512,19 @@ mcParallelSimulAADMulti(
 			{
 
 				Number::tape->rewindToMark();
-				random->nextG(gaussVecs[threadNum]);
-				models[threadNum]->generatePath(
+				PROFILE(rng, random->nextG(gaussVecs[threadNum]));
+				PROFILE(path, models[threadNum]->generatePath(
 					gaussVecs[threadNum],
-					paths[threadNum]);
-				prd.payoffs(paths[threadNum], payoffs[threadNum]);
+					paths[threadNum]));
+				PROFILE(payoff, prd.payoffs(paths[threadNum], payoffs[threadNum], scratches[threadNum]));
 
 				const size_t n = payoffs[threadNum].size();
 				for (size_t j = 0; j < n; ++j)
 				{
 					payoffs[threadNum][j].adjoint(j) = 1.0;
 				}
-				Number::propagateAdjointsMulti(prev(Number::tape->end()), Number::tape->markIt());
+				PROFILE_COUNT(tapeNodes, Number::tape->numNodesAfterMark());
+				PROFILE(backward, Number::propagateAdjointsMulti(prev(Number::tape->end()), Number::tape->markIt()));
 
 				convertCollection(
 					payoffs[threadNum].begin(),
@@ -923,26 +2541,486 @@ mcParallelSimulAADMulti(
 
 	for (auto& future : futures) pool->activeWait(future);
 
-	Number::propagateAdjointsMulti(Number::tape->markIt(), Number::tape->begin());
-	for (size_t i = 0; i < nThread; ++i)
+    //  Note: propagation starts at mark - 1, see mcSimulAADMulti()
+    //  On each thread's tape, main thread's included, in parallel
+	vector<Tape*> tapePtrs(nThread + 1, Number::tape);
+	for (size_t i = 0; i < nThread; ++i) tapePtrs[i + 1] = &tapes[i];
+	propagateTapesMarkToStart(tapePtrs, mdlInit, []()
 	{
-		if (mdlInit[i + 1])
-		{
-			Number::propagateAdjointsMulti(tapes[i].markIt(), tapes[i].begin());
-		}
-	}
+		Number::propagateAdjointsMulti(prev(Number::tape->markIt()), Number::tape->begin());
+	});
 
-	for (size_t j = 0; j < nParam; ++j) for (size_t k = 0; k < nPay; ++k)
+	parallelSumParams(nParam, [&](const size_t j)
 	{
-		results.risks[j][k] = 0.0;
-		for (size_t i = 0; i < models.size(); ++i)
+		for (size_t k = 0; k < nPay; ++k)
 		{
-			if (mdlInit[i]) results.risks[j][k] += models[i]->parameters()[j]->adjoint(k);
+			double risk = 0.0;
+			for (size_t i = 0; i < models.size(); ++i)
+			{
+				if (mdlInit[i]) risk += models[i]->parameters()[j]->adjoint(k);
+			}
+			results.risks[j][k] = risk / nPath;
 		}
-		results.risks[j][k] /= nPath;
-	}
+	});
 
 	Number::tape->clear();
 
 	return results;
 }
+
+//  Forward mode (tangent) simulations, see AADDual.h
+
+//  Values and derivatives of all the payoffs 
+//      in one direction in the model parameters, in one forward pass
+//  Cheaper than AAD for one input or one direction: no tape
+
+//  returns the following results:
+struct TangentSimulResults
+{
+    TangentSimulResults(const size_t nPay) :
+        values(nPay),
+        derivatives(nPay)
+    {}
+
+    //  vector(0..nPay - 1) of payoffs, averaged over paths
+    vector<double>  values;
+
+    //  vector(0..nPay - 1) of derivatives of the payoffs
+    //      in the direction, averaged over paths
+    vector<double>  derivatives;
+};
+
+//  Seed the parameters of a cloned model with the direction
+//  T = Dual or DualNumber
+template <class T>
+inline void seedTangents(
+    Model<T>&                   mdl,
+    const vector<double>&       direction)
+{
+    const vector<T*>& params = mdl.parameters();
+    if (direction.size() != params.size())
+    {
+        throw runtime_error("seedTangents() : direction doesn't match the model parameters");
+    }
+    for (size_t j = 0; j < params.size(); ++j) params[j]->tangent() = direction[j];
+}
+
+inline TangentSimulResults mcSimulTangent(
+    const Product<Dual>&        prd,
+    const Model<Dual>&          mdl,
+    const RNG&                  rng,
+    const size_t                nPath,
+    //  vector(0..nParam - 1) of the direction in the parameters
+    //      for instance a unit vector for the derivative to one parameter
+    const vector<double>&       direction)
+{
+    //  Work with copies of the model and RNG
+    auto cMdl = mdl.clone();
+    auto cRng = rng.clone();
+
+    //  Seed the tangents of the parameters, 
+    //      then init the simulation timeline, which carries them
+    cMdl->allocate(prd.timeline(), prd.defline());
+    seedTangents(*cMdl, direction);
+    cMdl->init(prd.timeline(), prd.defline());
+
+    cRng->init(cMdl->simDim());
+    vector<double> gaussVec(cMdl->simDim());
+    Scenario<Dual> path;
+    allocatePath(prd.defline(), path);
+    initializePath(path);
+    PayoffScratch<Dual> scratch;
+    scratch.allocate(prd, 1);
+
+    const size_t nPay = prd.payoffLabels().size();
+    vector<Dual> payoffs(nPay);
+    TangentSimulResults results(nPay);
+
+    for (size_t i = 0; i < nPath; i++)
+    {
+        PROFILE(rng, cRng->nextG(gaussVec));
+        PROFILE(path, cMdl->generatePath(gaussVec, path));
+        PROFILE(payoff, prd.payoffs(path, payoffs, scratch));
+        for (size_t k = 0; k < nPay; ++k)
+        {
+            results.values[k] += payoffs[k].value();
+            results.derivatives[k] += payoffs[k].tangent();
+        }
+    }
+
+    for (size_t k = 0; k < nPay; ++k)
+    {
+        results.values[k] /= nPath;
+        results.derivatives[k] /= nPath;
+    }
+
+    return results;
+}
+
+//  Parallel equivalent of mcSimulTangent()
+//  Slots of tasks sum their paths separately, sums are added in slot order,
+//      so results don't depend on scheduling
+inline TangentSimulResults mcParallelSimulTangent(
+    const Product<Dual>&        prd,
+    const Model<Dual>&          mdl,
+    const RNG&                  rng,
+    const size_t                nPath,
+    const vector<double>&       direction,
+    //  Paths per task, 0 = automatic
+    const size_t                batch = 0)
+{
+    //  Seeded and initialized once, 
+    //      the model is const in the simulations
+    auto cMdl = mdl.clone();
+    cMdl->allocate(prd.timeline(), prd.defline());
+    seedTangents(*cMdl, direction);
+    cMdl->init(prd.timeline(), prd.defline());
+
+    const size_t nPay = prd.payoffLabels().size();
+
+    //  Workspace, one for each thread, allocated in its first task
+    ThreadPool* pool = ThreadPool::getInstance();
+    const size_t nThread = pool->numThreads();
+    vector<vector<double>> gaussVecs(nThread + 1);
+    vector<Scenario<Dual>> paths(nThread + 1);
+    vector<vector<Dual>> payoffs(nThread + 1);
+    vector<PayoffScratch<Dual>> scratches(nThread + 1);
+    vector<unique_ptr<RNG>> rngs(nThread + 1);
+    vector<int> threadInit(nThread + 1, false);
+
+    //  Sums of values and derivatives, by slot of tasks, see TaskSlots
+    const TaskSlots slots(nPath, batchSize(nPath, cMdl->simDim(), nPay, nThread, batch));
+    vector<TangentSimulResults> sums(slots.nSlot, TangentSimulResults(nPay));
+
+    vector<TaskHandle> futures;
+    futures.reserve(slots.nSlot);
+
+    spawnSlots(slots, [&](const size_t slot, const size_t firstPath, const size_t pathsInTask)
+    {
+        const size_t threadNum = pool->threadNum();
+        if (!threadInit[threadNum])
+        {
+            gaussVecs[threadNum].resize(cMdl->simDim());
+            allocatePath(prd.defline(), paths[threadNum]);
+            initializePath(paths[threadNum]);
+            payoffs[threadNum].resize(nPay);
+            scratches[threadNum].allocate(prd, 1);
+            rngs[threadNum] = rng.clone();
+            rngs[threadNum]->init(cMdl->simDim());
+            threadInit[threadNum] = true;
+        }
+        vector<double>& gaussVec = gaussVecs[threadNum];
+        Scenario<Dual>& path = paths[threadNum];
+        vector<Dual>& pays = payoffs[threadNum];
+        PayoffScratch<Dual>& scratch = scratches[threadNum];
+        TangentSimulResults& sum = sums[slot];
+
+        auto& random = rngs[threadNum];
+        random->skipTo(firstPath);
+
+        for (size_t i = 0; i < pathsInTask; i++)
+        {
+            PROFILE(rng, random->nextG(gaussVec));
+            PROFILE(path, cMdl->generatePath(gaussVec, path));
+            PROFILE(payoff, prd.payoffs(path, pays, scratch));
+            for (size_t k = 0; k < nPay; ++k)
+            {
+                sum.values[k] += pays[k].value();
+                sum.derivatives[k] += pays[k].tangent();
+            }
+        }
+    }, futures);
+
+    for (auto& future : futures) pool->activeWait(future);
+
+    TangentSimulResults results(nPay);
+    for (const auto& sum : sums) for (size_t k = 0; k < nPay; ++k)
+    {
+        results.values[k] += sum.values[k];
+        results.derivatives[k] += sum.derivatives[k];
+    }
+    for (size_t k = 0; k < nPay; ++k)
+    {
+        results.values[k] /= nPath;
+        results.derivatives[k] /= nPath;
+    }
+
+    return results;
+}
+
+//  Second order AAD, forward over reverse, see AADDual.h
+
+//  The simulation runs on DualNumbers:
+//      values and tangents in a direction of the parameters, all on tape
+//  The aggregate payoff and the derivative of the aggregate in the direction
+//      are propagated together, as 2 adjoints of a multi-dimensional tape, so
+//      adjoint 0 of the parameters are the first order risks, as mcSimulAAD()
+//      adjoint 1 are the Hessian of the aggregate times the direction
+//  For a unit direction, the column of the Hessian:
+//      the gamma and all the cross gammas of one parameter in one simulation
+
+//  returns the following results:
+struct AAD2SimulResults
+{
+    AAD2SimulResults(const size_t nPay, const size_t nParam) :
+        payoffs(nPay),
+        aggregated(0.0),
+        risks(nParam),
+        secondRisks(nParam)
+    {}
+
+    //  vector(0..nPay - 1) of payoffs, averaged over paths
+    vector<double>  payoffs;
+
+    //  Aggregated payoff, averaged over paths
+    double          aggregated;
+
+    //  vector(0..nParam - 1) of risk sensitivities
+    //  of aggregated payoff, averaged over paths
+    vector<double>  risks;
+
+    //  vector(0..nParam - 1) of the Hessian of aggregated payoff
+    //      times the direction, averaged over paths
+    vector<double>  secondRisks;
+};
+
+//  Default aggregator = 1st payoff = payoff[0]
+const auto defaultAggregator2 = [](const vector<DualNumber>& v) {return v[0]; };
+
+//  Init model and path on tape, with the tangents of the direction
+inline void initModel4AAD2(
+    const Product<DualNumber>&  prd,
+    //  Cloned model, allocated prior
+    Model<DualNumber>&          clonedMdl,
+    //  Path, also allocated prior
+    Scenario<DualNumber>&       path,
+    const vector<double>&       direction)
+{
+    Tape& tape = *Number::tape;
+    tape.rewind();
+    //  Values on tape, tangents seeded with the direction
+    clonedMdl.putParametersOnTape();
+    seedTangents(clonedMdl, direction);
+    //  Init the simulation timeline, on tape
+    clonedMdl.init(prd.timeline(), prd.defline());
+    initializePath(path);
+    tape.mark();
+}
+
+//  Propagate aggregate and its tangent from the end of the tape to mark
+inline void propagateAAD2(DualNumber& result)
+{
+    result.value().adjoint(0) = 1.0;
+    result.tangent().adjoint(1) = 1.0;
+    Number::propagateAdjointsMulti(prev(Number::tape->end()), Number::tape->markIt());
+}
+
+//  Serial
+
+template<class F = decltype(defaultAggregator2)>
+inline AAD2SimulResults
+mcSimulAAD2(
+    const Product<DualNumber>&  prd,
+    const Model<DualNumber>&    mdl,
+    const RNG&                  rng,
+    const size_t                nPath,
+    //  vector(0..nParam - 1) of the direction in the parameters
+    const vector<double>&       direction,
+    const F&                    aggFun = defaultAggregator2)
+{
+    auto cMdl = mdl.clone();
+    auto cRng = rng.clone();
+
+    Scenario<DualNumber> path;
+    allocatePath(prd.defline(), path);
+    cMdl->allocate(prd.timeline(), prd.defline());
+
+    const size_t nPay = prd.payoffLabels().size();
+    const vector<DualNumber*>& params = cMdl->parameters();
+    const size_t nParam = params.size();
+
+    Number::tape->clear();
+
+    //  Two adjoints: aggregate and tangent
+    auto resetter = setNumResultsForAAD(true, 2);
+
+    initModel4AAD2(prd, *cMdl, path, direction);
+
+    cRng->init(cMdl->simDim());
+
+    vector<DualNumber> payoffs(nPay);
+    PayoffScratch<DualNumber> scratch;
+    scratch.allocate(prd, 1);
+    vector<double> gaussVec(cMdl->simDim());
+
+    AAD2SimulResults results(nPay, nParam);
+
+    for (size_t i = 0; i < nPath; i++)
+    {
+        Number::tape->rewindToMark();
+
+        PROFILE(rng, cRng->nextG(gaussVec));
+        PROFILE(path, cMdl->generatePath(gaussVec, path));
+        PROFILE(payoff, prd.payoffs(path, payoffs, scratch));
+        DualNumber result = aggFun(payoffs);
+
+        PROFILE_COUNT(tapeNodes, Number::tape->numNodesAfterMark());
+        PROFILE(backward, propagateAAD2(result));
+
+        for (size_t k = 0; k < nPay; ++k) results.payoffs[k] += double(payoffs[k]);
+        results.aggregated += double(result);
+    }
+
+    //  Note: propagation starts at mark - 1, see mcSimulAADMulti()
+    PROFILE_COUNT(tapeNodes, Number::tape->numNodes());
+    PROFILE(backward, Number::propagateAdjointsMulti(prev(Number::tape->markIt()), Number::tape->begin()));
+
+    for (size_t k = 0; k < nPay; ++k) results.payoffs[k] /= nPath;
+    results.aggregated /= nPath;
+    for (size_t j = 0; j < nParam; ++j)
+    {
+        results.risks[j] = params[j]->value().adjoint(0) / nPath;
+        results.secondRisks[j] = params[j]->value().adjoint(1) / nPath;
+    }
+
+    Number::tape->clear();
+
+    return results;
+}
+
+//  Parallel
+
+//  As mcParallelSimulAADMulti(), one model and tape per thread, 
+//      values summed by task in task order
+template<class F = decltype(defaultAggregator2)>
+inline AAD2SimulResults
+mcParallelSimulAAD2(
+    const Product<DualNumber>&  prd,
+    const Model<DualNumber>&    mdl,
+    const RNG&                  rng,
+    const size_t                nPath,
+    const vector<double>&       direction,
+    const F&                    aggFun = defaultAggregator2,
+    //  Paths per task, 0 = automatic
+    const size_t                batch = 0)
+{
+    const size_t nPay = prd.payoffLabels().size();
+    const size_t nParam = mdl.numParams();
+
+    Number::tape->clear();
+    auto resetter = setNumResultsForAAD(true, 2);
+
+    ThreadPool* pool = ThreadPool::getInstance();
+    const size_t nThread = pool->numThreads();
+
+    //  Per-thread state, allocated on each thread's first task, on its NUMA node
+    vector<unique_ptr<Model<DualNumber>>> models(nThread + 1);
+    vector<Scenario<DualNumber>> paths(nThread + 1);
+
+    vector<vector<DualNumber>> payoffs(nThread + 1, vector<DualNumber>(nPay));
+
+    vector<Tape> tapes(nThread);
+
+    //  Note we don't use vector<bool>
+    //      because vector<bool> is not thread safe
+    vector<int> mdlInit(nThread + 1, false);
+
+    vector<unique_ptr<RNG>> rngs(nThread + 1);
+    vector<vector<double>> gaussVecs(nThread + 1);
+    vector<PayoffScratch<DualNumber>> scratches(nThread + 1);
+
+    auto initThread = [&](const size_t threadNum)
+    {
+        models[threadNum] = mdl.clone();
+        models[threadNum]->allocate(prd.timeline(), prd.defline());
+        allocatePath(prd.defline(), paths[threadNum]);
+
+        initModel4AAD2(prd, *models[threadNum], paths[threadNum], direction);
+
+        const size_t simDim = models[threadNum]->simDim();
+        rngs[threadNum] = rng.clone();
+        rngs[threadNum]->init(simDim);
+        gaussVecs[threadNum].resize(simDim);
+        scratches[threadNum].allocate(prd, 1);
+
+        mdlInit[threadNum] = true;
+    };
+
+    //  Main thread's model on main thread's tape, also throws on a bad direction
+    initThread(0);
+
+    //  Sums of payoffs, then aggregate, by slot of tasks, see TaskSlots
+    const TaskSlots slots(nPath, batchSize(nPath, models[0]->simDim(), nPay, nThread, batch));
+    vector<vector<double>> sums(slots.nSlot, vector<double>(nPay + 1, 0.0));
+
+    vector<TaskHandle> futures;
+    futures.reserve(slots.nSlot);
+
+    spawnSlots(slots, [&](const size_t slot, const size_t firstPath, const size_t pathsInTask)
+    {
+        const size_t threadNum = pool->threadNum();
+
+        if (threadNum > 0) Number::tape = &tapes[threadNum - 1];
+
+        if (!mdlInit[threadNum]) initThread(threadNum);
+
+        auto& random = rngs[threadNum];
+        random->skipTo(firstPath);
+
+        vector<DualNumber>& pays = payoffs[threadNum];
+        vector<double>& sum = sums[slot];
+
+        for (size_t i = 0; i < pathsInTask; i++)
+        {
+            Number::tape->rewindToMark();
+
+            PROFILE(rng, random->nextG(gaussVecs[threadNum]));
+            PROFILE(path, models[threadNum]->generatePath(gaussVecs[threadNum], paths[threadNum]));
+            PROFILE(payoff, prd.payoffs(paths[threadNum], pays, scratches[threadNum]));
+            DualNumber result = aggFun(pays);
+
+            PROFILE_COUNT(tapeNodes, Number::tape->numNodesAfterMark());
+            PROFILE(backward, propagateAAD2(result));
+
+            for (size_t k = 0; k < nPay; ++k) sum[k] += double(pays[k]);
+            sum[nPay] += double(result);
+        }
+    }, futures);
+
+    for (auto& future : futures) pool->activeWait(future);
+
+    //  Note: propagation starts at mark - 1, see mcSimulAADMulti()
+    //  On each thread's tape, main thread's included, in parallel
+    vector<Tape*> tapePtrs(nThread + 1, Number::tape);
+    for (size_t i = 0; i < nThread; ++i) tapePtrs[i + 1] = &tapes[i];
+    propagateTapesMarkToStart(tapePtrs, mdlInit, []()
+    {
+        Number::propagateAdjointsMulti(prev(Number::tape->markIt()), Number::tape->begin());
+    });
+
+    AAD2SimulResults results(nPay, nParam);
+    for (const auto& sum : sums)
+    {
+        for (size_t k = 0; k < nPay; ++k) results.payoffs[k] += sum[k];
+        results.aggregated += sum[nPay];
+    }
+    for (size_t k = 0; k < nPay; ++k) results.payoffs[k] /= nPath;
+    results.aggregated /= nPath;
+
+    parallelSumParams(nParam, [&](const size_t j)
+    {
+        double risk = 0.0, secondRisk = 0.0;
+        for (size_t i = 0; i < models.size(); ++i)
+        {
+            if (!mdlInit[i]) continue;
+            risk += models[i]->parameters()[j]->value().adjoint(0);
+            secondRisk += models[i]->parameters()[j]->value().adjoint(1);
+        }
+        results.risks[j] = risk / nPath;
+        results.secondRisks[j] = secondRisk / nPath;
+    });
+
+    Number::tape->clear();
+
+    return results;
+}
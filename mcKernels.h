@@ -0,0 +1,42 @@
+/*
+Written by Antoine Savine in 2018
+
+This code is the strict IP of Antoine Savine
+
+License to use and alter this code for personal and commercial applications
+is freely granted to any person or company who purchased a copy of the book
+
+Modern Computational Finance: AAD and Parallel Simulations
+Antoine Savine
+Wiley, 2018
+
+As long as this comment is preserved at the top of the file
+*/
+
+#pragma once
+
+//  Fused simulation kernels for the known pairs of models and products
+//  See SimulBlock in mcBase.h
+
+//  Registered once on static initialization
+//  New models and products must be final classes
+//      and registered here to simulate without virtual calls
+
+#include "mcMdl.h"
+#include "mcPrd.h"
+
+//  Kernels in double and in single precision, see SimulBlockT in mcBase.h
+template <class T, template <class> class M>
+inline bool registerSimulKernels()
+{
+    return registerSimulKernel<T, M<T>, European<T>>()
+        && registerSimulKernel<T, M<T>, UOC<T>>()
+        && registerSimulKernel<T, M<T>, Europeans<T>>()
+        && registerSimulKernel<T, M<T>, ContingentBond<T>>();
+}
+
+inline const bool simulKernelsRegistered = 
+    registerSimulKernels<double, BlackScholes>()
+    && registerSimulKernels<double, Dupire>()
+    && registerSimulKernels<float, BlackScholes>()
+    && registerSimulKernels<float, Dupire>();
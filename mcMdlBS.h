@@ -19,7 +19,7 @@ As long as this comment is preserved at the top of the file
 #pragma once
 
 template <class T>
-class BlackScholes : public Model<T>
+class BlackScholes final : public Model<T>
 {
     //  Model parameters
 
@@ -200,6 +200,57 @@ public:
             override
     {
         //  Pre-compute the standard devs and drifts over simulation timeline        
+        initSteps();
+
+        //  Pre-compute the numeraires, discount and forward factors 
+        //      on event dates
+        initNumeraires(productTimeline, defline);
+        initDiscounts(productTimeline, defline);
+        initForwards(productTimeline, defline);
+        initLibors(defline);
+    }
+
+    //  Incremental initialization
+    //      spot: numeraires (spot measure)
+    //      vol: standard devs and drifts
+    //      rate: drifts, numeraires (risk neutral), discounts, forwards and libors
+    //      div: drifts, numeraires (spot measure) and forwards
+    void initParam(
+        const size_t                i,
+        const vector<Time>&         productTimeline, 
+        const vector<SampleDef>&    defline) 
+            override
+    {
+        switch (i)
+        {
+        case 0:
+            if (mySpotMeasure) initNumeraires(productTimeline, defline);
+            break;
+        case 1:
+            initSteps();
+            break;
+        case 2:
+            initSteps();
+            if (!mySpotMeasure) initNumeraires(productTimeline, defline);
+            initDiscounts(productTimeline, defline);
+            initForwards(productTimeline, defline);
+            initLibors(defline);
+            break;
+        case 3:
+            initSteps();
+            if (mySpotMeasure) initNumeraires(productTimeline, defline);
+            initForwards(productTimeline, defline);
+            break;
+        default:
+            init(productTimeline, defline);
+        }
+    }
+
+private:
+
+    //  Standard devs and drifts over simulation timeline
+    void initSteps()
+    {
         const T mu = myRate - myDiv;
         const size_t n = myTimeline.size() - 1;
 
@@ -223,14 +274,17 @@ public:
                 myDrifts[i] = (mu - 0.5*myVol*myVol)*dt;
             }
         }
+    }
 
-        //  Pre-compute the numeraires, discount and forward factors 
-        //      on event dates
+    //  Numeraires on event dates
+    void initNumeraires(
+        const vector<Time>&         productTimeline, 
+        const vector<SampleDef>&    defline)
+    {
         const size_t m = productTimeline.size();
 
 		for (size_t i = 0; i < m; ++i)
 		{
-			//  Numeraire
 			if (defline[i].numeraire)
 			{
 				if (mySpotMeasure)
@@ -248,24 +302,53 @@ public:
                     myNumeraires[i] = exp(myRate * productTimeline[i]);
 				}
 			}
+		}
+    }
 
-			//  Discount factors
+    //  Discount factors on event dates
+    void initDiscounts(
+        const vector<Time>&         productTimeline, 
+        const vector<SampleDef>&    defline)
+    {
+        const size_t m = productTimeline.size();
+
+		for (size_t i = 0; i < m; ++i)
+		{
 			const size_t pDF = defline[i].discountMats.size();
 			for (size_t j = 0; j < pDF; ++j)
 			{
 				myDiscounts[i][j] =
 					exp(-myRate * (defline[i].discountMats[j] - productTimeline[i]));
 			}
+		}
+    }
+
+    //  Forward factors on event dates
+    void initForwards(
+        const vector<Time>&         productTimeline, 
+        const vector<SampleDef>&    defline)
+    {
+        const T mu = myRate - myDiv;
+        const size_t m = productTimeline.size();
 
-			//  Forward factors
+		for (size_t i = 0; i < m; ++i)
+		{
 			const size_t pFF = defline[i].forwardMats.size();
 			for (size_t j = 0; j < pFF; ++j)
 			{
 				myForwardFactors[i][j] =
 					exp(mu * (defline[i].forwardMats[j] - productTimeline[i]));
 			}
+		}
+    }
+
+    //  Libors on event dates
+    void initLibors(const vector<SampleDef>& defline)
+    {
+        const size_t m = defline.size();
 
-			//  Libors
+		for (size_t i = 0; i < m; ++i)
+		{
 			const size_t pL = defline[i].liborDefs.size();
 			for (size_t j = 0; j < pL; ++j)
 			{
@@ -273,8 +356,10 @@ public:
 					= defline[i].liborDefs[j].end - defline[i].liborDefs[j].start;
 				myLibors[i][j] = (exp(myRate*dt) - 1.0) / dt;
 			}
-		}   //  loop on event dates
-	}
+		}
+    }
+
+public:
 
     //  MC Dimension
     size_t simDim() const override
@@ -348,4 +433,85 @@ public:
             ++idx;
         }
     }
+
+private:
+
+    //  Helper function, fills a SampleBlock given the spots
+    inline void fillScenBlock(
+        const size_t        idx,    //  index on product timeline
+        const vector<T>&    spots,  //  spots by path
+        const size_t        nPath,
+        SampleBlock<T>&     scen,   //  SampleBlock to fill
+        const SampleDef&    def)    //  and its definition
+            const
+    {
+        if (def.numeraire)
+        {
+            const T num = myNumeraires[idx];
+            if (mySpotMeasure)
+            {
+                for (size_t p = 0; p < nPath; ++p) scen.numeraires[p] = num * spots[p];
+            }
+            else
+            {
+                fill(scen.numeraires.begin(), scen.numeraires.begin() + nPath, num);
+            }
+        }
+
+        for (size_t j = 0; j < myForwardFactors[idx].size(); ++j)
+        {
+            const T ff = myForwardFactors[idx][j];
+            T* fwds = scen.forwards[j].data();
+            for (size_t p = 0; p < nPath; ++p) fwds[p] = spots[p] * ff;
+        }
+
+        for (size_t j = 0; j < myDiscounts[idx].size(); ++j)
+        {
+            fill(scen.discounts[j].begin(), scen.discounts[j].begin() + nPath, 
+                myDiscounts[idx][j]);
+        }
+
+        for (size_t j = 0; j < myLibors[idx].size(); ++j)
+        {
+            fill(scen.libors[j].begin(), scen.libors[j].begin() + nPath, 
+                myLibors[idx][j]);
+        }
+    }
+
+public:
+
+    //  Generate a block of paths, same scheme as generatePath()
+    //  Loops over paths innermost, so they vectorize
+    void generatePathBlock(
+        const matrix<GaussT<T>>&    gaussBlock,
+        const size_t                nPath,
+        ScenarioBlock<T>&           paths)
+            const override
+    {
+        //  The starting spots
+        vector<T> spots(nPath, mySpot);
+        //  Next index to fill on the product timeline
+        size_t idx = 0;
+        //  Is today on the product timeline?
+        if (myTodayOnTimeline)
+        {
+            fillScenBlock(idx, spots, nPath, paths[idx], (*myDefline)[idx]);
+            ++idx;
+        }
+
+        //  Iterate through timeline, apply sampling scheme
+        const size_t n = myTimeline.size() - 1;
+        for (size_t i = 0; i < n; ++i)
+        {
+            const T drift = myDrifts[i], std = myStds[i];
+            const GaussT<T>* gauss = gaussBlock[i];
+            for (size_t p = 0; p < nPath; ++p)
+            {
+                spots[p] = spots[p] * exp(drift + std * gauss[p]);
+            }
+            //  Store on the path
+            fillScenBlock(idx, spots, nPath, paths[idx], (*myDefline)[idx]);
+            ++idx;
+        }
+    }
 };
\ No newline at end of file
@@ -25,8 +25,33 @@ As long as this comment is preserved at the top of the file
 
 #define HALF_DAY 0.00136986301369863
 
+//  Time stepping schemes, see Dupire::step()
+//  Log spot x, local vol v(t, x) * sqrt(dt) and Gaussian g on every step
+enum class DupireScheme
+{
+    //  Log-Euler, vol frozen at the start of the step:
+    //      x += v(t, x) * (-0.5 * v(t, x) + g)
+    euler,
+    //  Predictor-corrector (Heun) on the Stratonovich drift a = -0.5 * v * (v + dv/dx),
+    //      dv/dx the slope of the vol in log spot:
+    //      Euler predictor xp = x + a(t, x) + v(t, x) * g,
+    //      then corrector with the drift and vol averaged between the start of the step
+    //      and its end in the predicted spot, with the same Gaussian:
+    //      x += 0.5 * (a(t, x) + a(t + dt, xp)) + 0.5 * (v(t, x) + v(t + dt, xp)) * g
+    //  The Ito drift -0.5 * v * v would converge to the Stratonovich SDE instead,
+    //      since the vol at the predicted spot depends on g
+    predictorCorrector,
+    //  Midpoint: half Euler step xm = x + 0.5 * (a(t, x) + v(t, x) * g),
+    //      then full step with the drift and vol in the middle of the step:
+    //      x += a(t + dt / 2, xm) + v(t + dt / 2, xm) * g
+    //  Since the vol is taken away from the start,
+    //      the drift is the Stratonovich a = -0.5 * v * (v + dv/dx),
+    //      dv/dx the slope of the vol in log spot
+    midpoint
+};
+
 template <class T>
-class Dupire : public Model<T>
+class Dupire final : public Model<T>
 {
     //  Model parameters
 
@@ -37,6 +62,9 @@ class Dupire : public Model<T>
     const vector<double>    mySpots;
     //  We keep log spots to interpolate in log space
     vector<double>          myLogSpots;
+    //  Uniform log spot grid: O(1) lookup of the bracketing index
+    bool                    myUniform;
+    double                  myInvDx;
     const vector<Time>      myTimes;
     //  Local vols
     //  Spot major: sigma(spot i, time j) = myVols[i][j]
@@ -47,6 +75,10 @@ class Dupire : public Model<T>
     //  Maximum space between time steps
     const Time              myMaxDt;
 
+    //  Time stepping scheme
+    //  Higher order schemes reach the bias of Euler with larger maxDt
+    const DupireScheme      myScheme;
+
     //  Similuation timeline
     vector<Time>            myTimeline;
     //  true (1) if the time step is an event date
@@ -63,6 +95,33 @@ class Dupire : public Model<T>
     matrix<T>               myInterpVols;
     //  volatilities as stored are multiplied by sqrt(dt) 
     //  so there is no need to do that during paths generation
+    //  slopes in log spot, padded with zeros on both ends for flat extrapolation:
+    //      slope(time i, left of spot 0) = myInterpSlopes[i][0] = 0
+    //      slope(time i, between spots j-1 and j) = myInterpSlopes[i][j]
+    //      slope(time i, right of spot m-1) = myInterpSlopes[i][m] = 0
+    //  so the interpolation is one multiply-add, see localVol()
+    matrix<T>               myInterpSlopes;
+
+    //  Same for the corrector of higher order schemes, empty with Euler:
+    //      pre-interpolated in the end of the step (predictor-corrector)
+    //      or in its middle (midpoint), multiplied by sqrt(dt)
+    matrix<T>               myCorrVols;
+    matrix<T>               myCorrSlopes;
+
+    //  AAD checkpointing, see propagatePath()
+
+    //  Number of time steps between checkpoints, 0 = no checkpointing
+    const size_t            myCheckpointSteps;
+    //  Values of the pre-interpolated vols and slopes for the forward pass
+    matrix<double>          myInterpVolValues;
+    matrix<double>          myInterpSlopeValues;
+    matrix<double>          myCorrVolValues;
+    matrix<double>          myCorrSlopeValues;
+    //  Index of the next sample on the product timeline, by checkpoint
+    vector<size_t>          myCheckpointIdx;
+    //  Workspace: log spots by checkpoint and adjoints of the samples
+    mutable vector<double>  myCheckpoints;
+    mutable vector<double>  mySampleAdjoints;
 
     //  Exported parameters
     vector<T*>              myParameters;
@@ -74,16 +133,27 @@ public:
     
     template <class U>
     Dupire(const U              spot,
-        const vector<double>    spots,
-        const vector<Time>      times,
-        const matrix<U>         vols,
-        const Time maxDt =      0.25)
+        const vector<double>&   spots,
+        const vector<Time>&     times,
+        //  Any spot major storage, copied once into myVols,
+        //      like an Excel array read in place, see xPutDupire()
+        const matrixView<const U>&  vols,
+        const Time maxDt =      0.25,
+        //  AAD only: number of time steps between checkpoints
+        //  0 = record the whole path
+        const size_t checkpointSteps = 0,
+        //  Time stepping scheme
+        const DupireScheme scheme = DupireScheme::euler)
         : mySpot(spot),
         mySpots(spots),
         myLogSpots(mySpots.size()),
+        myUniform(false),
+        myInvDx(0.0),
         myTimes(times),
         myVols(vols),
         myMaxDt(maxDt),
+        myScheme(scheme),
+        myCheckpointSteps(checkpointSteps),
         myParameters(myVols.rows() * myVols.cols() + 1),
         myParameterLabels(myVols.rows() * myVols.cols() + 1)
     {
@@ -91,6 +161,19 @@ public:
 		transform(mySpots.begin(), mySpots.end(), myLogSpots.begin(), 
             [](const double s) {return log(s); });
 
+        //  Uniform log spots?
+        const size_t m = myLogSpots.size();
+        if (m > 1)
+        {
+            const double dx = (myLogSpots[m - 1] - myLogSpots[0]) / (m - 1);
+            myUniform = dx > 0.0;
+            for (size_t j = 1; j < m && myUniform; ++j)
+            {
+                myUniform = fabs(myLogSpots[j] - myLogSpots[j - 1] - dx) < 1.0e-12 * dx;
+            }
+            if (myUniform) myInvDx = 1.0 / dx;
+        }
+
         //  Set parameter labels once 
         myParameterLabels[0] = "spot";
 
@@ -138,11 +221,21 @@ public:
         return myTimes;
     }
 
-    const vector<T>& vols() const
+    const matrix<T>& vols() const
     {
         return myVols;
     }
 
+    size_t checkpointSteps() const
+    {
+        return myCheckpointSteps;
+    }
+
+    DupireScheme scheme() const
+    {
+        return myScheme;
+    }
+
     //  Access to all the model parameters
     const vector<T*>& parameters() override
     {
@@ -190,6 +283,36 @@ public:
         //  Allocate the local volatilities
         //      pre-interpolated in time over simulation timeline
         myInterpVols.resize(myTimeline.size() - 1, mySpots.size());
+        myInterpSlopes.resize(myTimeline.size() - 1, mySpots.size() + 1);
+        if (corrected())
+        {
+            myCorrVols.resize(myTimeline.size() - 1, mySpots.size());
+            myCorrSlopes.resize(myTimeline.size() - 1, mySpots.size() + 1);
+        }
+
+        //  Checkpoints
+        if (checkpointed())
+        {
+            myInterpVolValues.resize(myTimeline.size() - 1, mySpots.size());
+            myInterpSlopeValues.resize(myTimeline.size() - 1, mySpots.size() + 1);
+            if (corrected())
+            {
+                myCorrVolValues.resize(myTimeline.size() - 1, mySpots.size());
+                myCorrSlopeValues.resize(myTimeline.size() - 1, mySpots.size() + 1);
+            }
+
+            const size_t n = myTimeline.size() - 1;
+            myCheckpoints.resize((n + myCheckpointSteps - 1) / myCheckpointSteps);
+            myCheckpointIdx.resize(myCheckpoints.size());
+            size_t idx = myCommonSteps[0];
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (i % myCheckpointSteps == 0) myCheckpointIdx[i / myCheckpointSteps] = idx;
+                idx += myCommonSteps[i + 1];
+            }
+
+            mySampleAdjoints.resize(productTimeline.size());
+        }
     }
 
     void init(
@@ -199,23 +322,126 @@ public:
     {
         //  Compute the local volatilities
         //      pre-interpolated in time and multiplied by sqrt(dt)
+        const size_t n = myTimeline.size() - 1, m = myLogSpots.size();
+
+        //  Spot by spot: reads the spot major local vols row by row, 
+        //      writes the time major pre-interpolated vols column by column
+        //  On tape, the nodes fed by a vol come in the same order as time major,
+        //      so adjoints accumulate in the same order
+        for (size_t j = 0; j < m; ++j)
+        {
+            for (size_t i = 0; i < n; ++i) initVol(i, j);
+        }
+
+        //  Slopes in log spot, zero on extrapolation
+        for (size_t i = 0; i < n; ++i)
+        {
+            myInterpSlopes[i][0] = myInterpSlopes[i][m] = 0.0;
+            if (corrected()) myCorrSlopes[i][0] = myCorrSlopes[i][m] = 0.0;
+            for (size_t j = 1; j < m; ++j) initSlope(i, j);
+        }
+
+        //  Values for the forward pass of checkpointed AAD
+        if (checkpointed())
+        {
+            transform(myInterpVols.begin(), myInterpVols.end(), myInterpVolValues.begin(),
+                [](const T& vol) { return double(vol); });
+            transform(myInterpSlopes.begin(), myInterpSlopes.end(), myInterpSlopeValues.begin(),
+                [](const T& slope) { return double(slope); });
+            transform(myCorrVols.begin(), myCorrVols.end(), myCorrVolValues.begin(),
+                [](const T& vol) { return double(vol); });
+            transform(myCorrSlopes.begin(), myCorrSlopes.end(), myCorrSlopeValues.begin(),
+                [](const T& slope) { return double(slope); });
+        }
+    }
+
+    //  Incremental initialization
+    //      the spot is not used in pre-calculations
+    //      the local vol of spot j only affects the pre-interpolated vols of spot j 
+    //          and the slopes on both sides
+    void initParam(
+        const size_t                p,
+        const vector<Time>&         productTimeline, 
+        const vector<SampleDef>&    defline) 
+            override
+    {
+        if (p == 0) return;
+
+        const size_t j = (p - 1) / myVols.cols();
         const size_t n = myTimeline.size() - 1;
+        const size_t m = myLogSpots.size();
         for (size_t i = 0; i < n; ++i)
         {
-            const double sqrtdt = sqrt(myTimeline[i + 1] - myTimeline[i]);
-            const size_t m = myLogSpots.size();
-            for (size_t j = 0; j < m; ++j)
+            initVol(i, j);
+            if (j > 0) initSlope(i, j);
+            if (j + 1 < m) initSlope(i, j + 1);
+
+            if (checkpointed())
             {
-                myInterpVols[i][j] = sqrtdt * interp(
-                    myTimes.begin(),
-                    myTimes.end(),
-                    myVols[j],
-                    myVols[j] + myTimes.size(),
-                    myTimeline[i]);
+                myInterpVolValues[i][j] = double(myInterpVols[i][j]);
+                myInterpSlopeValues[i][j] = double(myInterpSlopes[i][j]);
+                myInterpSlopeValues[i][j + 1] = double(myInterpSlopes[i][j + 1]);
+                if (corrected())
+                {
+                    myCorrVolValues[i][j] = double(myCorrVols[i][j]);
+                    myCorrSlopeValues[i][j] = double(myCorrSlopes[i][j]);
+                    myCorrSlopeValues[i][j + 1] = double(myCorrSlopes[i][j + 1]);
+                }
             }
         }
     }
 
+    //  Pre-interpolated vol of time step i and spot j
+    void initVol(const size_t i, const size_t j)
+    {
+        const double sqrtdt = sqrt(myTimeline[i + 1] - myTimeline[i]);
+        myInterpVols[i][j] = sqrtdt * interp(
+            myTimes.begin(),
+            myTimes.end(),
+            myVols[j],
+            myVols[j] + myTimes.size(),
+            myTimeline[i]);
+
+        //  Corrector: end or middle of the step
+        if (corrected())
+        {
+            const Time t = myScheme == DupireScheme::predictorCorrector
+                ? myTimeline[i + 1]
+                : 0.5 * (myTimeline[i] + myTimeline[i + 1]);
+            myCorrVols[i][j] = sqrtdt * interp(
+                myTimes.begin(),
+                myTimes.end(),
+                myVols[j],
+                myVols[j] + myTimes.size(),
+                t);
+        }
+    }
+
+    //  Slope of time step i between spots j - 1 and j
+    void initSlope(const size_t i, const size_t j)
+    {
+        myInterpSlopes[i][j] = (myInterpVols[i][j] - myInterpVols[i][j - 1])
+            / (myLogSpots[j] - myLogSpots[j - 1]);
+
+        if (corrected())
+        {
+            myCorrSlopes[i][j] = (myCorrVols[i][j] - myCorrVols[i][j - 1])
+                / (myLogSpots[j] - myLogSpots[j - 1]);
+        }
+    }
+
+    //  Higher order scheme, with a corrector
+    bool corrected() const
+    {
+        return myScheme != DupireScheme::euler;
+    }
+
+    //  Checkpointed AAD
+    bool checkpointed() const override
+    {
+        return is_same_v<T, Number> && myCheckpointSteps > 0;
+    }
+
     //  MC Dimension
     size_t simDim() const override
     {
@@ -230,6 +456,130 @@ private:
         fill(scen.forwards.begin(), scen.forwards.end(), spot);
     }
 
+    //  Number of log spots no greater than x, in [0, m], as upper_bound
+    //  O(1) on a uniform grid, otherwise starts from the hint,
+    //      the index of the previous step, almost always right or next to it
+    size_t locate(const double x, const size_t hint) const
+    {
+        const size_t m = myLogSpots.size();
+
+        if (myUniform)
+        {
+            const double t = (x - myLogSpots[0]) * myInvDx;
+            return t < 0.0 ? 0 : t >= m - 1 ? m : size_t(t) + 1;
+        }
+
+        size_t k = min(hint, m);
+        if (k < m && myLogSpots[k] <= x)
+        {
+            ++k;
+            if (k < m && myLogSpots[k] <= x) ++k;
+            else return k;
+        }
+        else if (k > 0 && myLogSpots[k - 1] > x)
+        {
+            --k;
+            if (k > 0 && myLogSpots[k - 1] > x) --k;
+            else return k;
+        }
+        else return k;
+
+        //  Moved more than one knot: binary search
+        return distance(myLogSpots.begin(), 
+            upper_bound(myLogSpots.begin(), myLogSpots.end(), x));
+    }
+
+    //  Local vol of time step i in log spot x, linear in x with flat extrapolation
+    //      same as interp(), with one multiply-add on the pre-computed slopes
+    //  hint: bracketing index of the previous step, updated
+    template <class V, class U>
+    V localVol(
+        const matrix<V>&    vols,
+        const matrix<V>&    slopes,
+        const size_t        i,
+        const U&            x,
+        size_t&             hint)
+            const
+    {
+        const size_t k = hint = locate(double(x), hint);
+        const size_t b = k ? k - 1 : 0;
+
+        return vols[i][b] + slopes[i][k] * (x - myLogSpots[b]);
+    }
+
+    //  Same with the slope in log spot, 0 on extrapolation
+    template <class V, class U>
+    V localVol(
+        const matrix<V>&    vols,
+        const matrix<V>&    slopes,
+        const size_t        i,
+        const U&            x,
+        size_t&             hint,
+        V&                  slope)
+            const
+    {
+        const size_t k = hint = locate(double(x), hint);
+        const size_t b = k ? k - 1 : 0;
+
+        slope = slopes[i][k];
+        return vols[i][b] + slope * (x - myLogSpots[b]);
+    }
+
+    //  Time step i of log spot x with Gaussian g, in the scheme of the model
+    //  Vols and slopes: the tables of the model, or their values off tape, 
+    //      pre-interpolated at the start of the step, then for the corrector
+    //  hint: bracketing index of the previous step, updated
+    template <class V, class U, class G>
+    void step(
+        const matrix<V>&    vols,
+        const matrix<V>&    slopes,
+        const matrix<V>&    corrVols,
+        const matrix<V>&    corrSlopes,
+        const size_t        i,
+        U&                  x,
+        const G             g,
+        size_t&             hint)
+            const
+    {
+        if (myScheme == DupireScheme::euler)
+        {
+            //  Interpolate volatility in spot
+            const U vol = localVol(vols, slopes, i, x, hint);
+            //  vol comes out * sqrt(dt)
+
+            //  Apply Euler's scheme
+            x += vol * (-0.5 * vol + g);
+            return;
+        }
+
+        size_t corrHint = hint;
+        V slope, corrSlope;
+
+        if (myScheme == DupireScheme::predictorCorrector)
+        {
+            //  Euler predictor with the Stratonovich drift
+            const U vol = localVol(vols, slopes, i, x, hint, slope);
+            const U drift = -0.5 * vol * (vol + slope);
+            const U pred = x + drift + vol * g;
+
+            //  Corrector: drift and vol averaged with the end of the step in the predicted spot
+            const U corr = localVol(corrVols, corrSlopes, i, pred, corrHint, corrSlope);
+            const U corrDrift = -0.5 * corr * (corr + corrSlope);
+
+            x += 0.5 * (drift + corrDrift) + 0.5 * (vol + corr) * g;
+        }
+        else
+        {
+            //  Half Euler step with the Stratonovich drift
+            const U vol = localVol(vols, slopes, i, x, hint, slope);
+            const U mid = x + 0.5 * (-0.5 * vol * (vol + slope) + vol * g);
+
+            //  Full step with drift and vol in the middle
+            const U corr = localVol(corrVols, corrSlopes, i, mid, corrHint, corrSlope);
+            x += -0.5 * corr * (corr + corrSlope) + corr * g;
+        }
+    }
+
 public:
 
     //  Generate one path, consume Gaussian vector
@@ -240,6 +590,13 @@ public:
         Scenario<T>& path) 
             const override
     {
+        //  Checkpointed AAD: forward pass off tape
+        if (checkpointed())
+        {
+            checkpointPath(gaussVec, path);
+            return;
+        }
+
         //  The starting spot
         //  We know that today is on the timeline
         T logspot = log(mySpot);
@@ -255,20 +612,12 @@ public:
 
         //  Iterate through timeline
         const size_t n = myTimeline.size() - 1;
-        const size_t m = myLogSpots.size();
+        size_t hint = locate(double(logspot), 0);
         for (size_t i = 0; i < n; ++i)
         {
-            //  Interpolate volatility in spot
-            T vol = interp(
-                myLogSpots.begin(),
-                myLogSpots.end(),
-                myInterpVols[i],
-                myInterpVols[i] + m,
-                logspot);
-            //  vol comes out * sqrt(dt)
-
-            //  Apply Euler's scheme
-            logspot += vol * (- 0.5 * vol + gaussVec[i]);
+            //  Apply the scheme
+            step(myInterpVols, myInterpSlopes, myCorrVols, myCorrSlopes, 
+                i, logspot, gaussVec[i], hint);
 
             //  Store on the path?
             if (myCommonSteps[i + 1])
@@ -278,28 +627,221 @@ public:
             }
         }
     }
+
+    //  Checkpointed AAD: backward pass
+    //  Called once the adjoints of the payoff are propagated to mark,
+    //      so the samples' adjoints are known
+    //  Re-records the path on tape one segment at a time, from last to first,
+    //      from the log spot stored at its checkpoint,
+    //      and propagates the segment to mark, 
+    //      with the adjoints of its samples and of its final log spot
+    //  The parameters' adjoints accumulate above the mark as usual
+    //  Peak tape memory is one segment of checkpointSteps steps
+    //      in exchange for one extra pass in doubles over the path
+    void propagatePath(
+        const vector<double>& gaussVec,
+        Scenario<T>& path)
+            const override
+    {
+        if constexpr (is_same_v<T, Number>)
+        {
+            if (!myCheckpointSteps) return;
+
+            //  Adjoints of the samples, forwards share the spot's node
+            for (size_t idx = 0; idx < path.size(); ++idx)
+            {
+                mySampleAdjoints[idx] = path[idx].forwards.empty()
+                    ? 0.0 : path[idx].forwards[0].adjoint();
+            }
+
+            Tape& tape = *Number::tape;
+            const size_t n = myTimeline.size() - 1;
+
+            //  Adjoint of the log spot at the end of the segment
+            double carry = 0.0;
+
+            //  Segments backwards
+            for (size_t s = myCheckpoints.size(); s-- > 0;)
+            {
+                tape.rewindToMark();
+
+                //  The first segment starts from the spot, 
+                //      the others from a leaf at the checkpoint
+                Number start = s ? Number(myCheckpoints[s]) : Number(log(mySpot));
+                if (s) start.putOnTape();
+                Number logspot = start;
+                size_t idx = myCheckpointIdx[s];
+                size_t hint = locate(double(logspot), 0);
+
+                //  Same scheme as generatePath()
+                const size_t last = min(n, (s + 1) * myCheckpointSteps);
+                for (size_t i = s * myCheckpointSteps; i < last; ++i)
+                {
+                    step(myInterpVols, myInterpSlopes, myCorrVols, myCorrSlopes, 
+                        i, logspot, gaussVec[i], hint);
+
+                    //  Seed sample with its adjoint from the payoff
+                    if (myCommonSteps[i + 1])
+                    {
+                        Number spot = exp(logspot);
+                        spot.adjoint() = mySampleAdjoints[idx];
+                        ++idx;
+                    }
+                }
+
+                //  Seed final log spot with the adjoint of the next segment
+                logspot.adjoint() += carry;
+
+                //  Propagate the segment
+                Number::propagateAdjoints(prev(tape.end()), tape.markIt());
+                carry = start.adjoint();
+            }
+
+            tape.rewindToMark();
+        }
+    }
+
+private:
+
+    //  Checkpointed AAD: forward pass
+    //  Generates the path in doubles, off tape, 
+    //      and stores the log spot on checkpoints
+    //  Samples go on tape as leaves, propagatePath() computes their derivatives
+    void checkpointPath(
+        const vector<double>& gaussVec,
+        Scenario<T>& path)
+            const
+    {
+        //  Today's sample, if any, is recorded as usual
+        size_t idx = 0;
+        if (myCommonSteps[idx])
+        {
+            fillScen(exp(log(mySpot)), path[idx]);
+            ++idx;
+        }
+
+        double logspot = log(double(mySpot));
+
+        const size_t n = myTimeline.size() - 1;
+        size_t hint = locate(logspot, 0);
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (i % myCheckpointSteps == 0) myCheckpoints[i / myCheckpointSteps] = logspot;
+
+            step(myInterpVolValues, myInterpSlopeValues, myCorrVolValues, myCorrSlopeValues,
+                i, logspot, gaussVec[i], hint);
+
+            if (myCommonSteps[i + 1])
+            {
+                T spot(exp(logspot));
+                putOnTape(spot);
+                fillScen(spot, path[idx]);
+                ++idx;
+            }
+        }
+    }
+
+    //  Helper function, fills a SampleBlock given the log spots
+    inline static void fillScenBlock(
+        const vector<T>&    logspots, 
+        const size_t        nPath, 
+        SampleBlock<T>&     scen)
+    {
+        if (scen.forwards.empty()) return;
+
+        T* spots = scen.forwards[0].data();
+        for (size_t p = 0; p < nPath; ++p) spots[p] = exp(logspots[p]);
+        for (size_t j = 1; j < scen.forwards.size(); ++j)
+        {
+            copy(spots, spots + nPath, scen.forwards[j].begin());
+        }
+    }
+
+public:
+
+    //  Generate a block of paths, same scheme as generatePath()
+    //  The interpolation of local vols, a lookup from the hint of the path, 
+    //      remains path by path
+    //  The Euler step and the exp() loop over paths innermost 
+    //      so they vectorize
+    void generatePathBlock(
+        const matrix<GaussT<T>>&    gaussBlock,
+        const size_t                nPath,
+        ScenarioBlock<T>&           paths)
+            const override
+    {
+        //  Log spots and local vols by path
+        vector<T> logspots(nPath, log(mySpot));
+        vector<T> vols(nPath);
+        //  Bracketing index by path
+        vector<size_t> hints(nPath, locate(log(double(mySpot)), 0));
+
+        //  Next index to fill on the product timeline
+        size_t idx = 0;
+        //  Is today on the product timeline?
+        if (myCommonSteps[idx])
+        {
+            fillScenBlock(logspots, nPath, paths[idx]);
+            ++idx;
+        }
+
+        //  Iterate through timeline
+        const size_t n = myTimeline.size() - 1;
+        for (size_t i = 0; i < n; ++i)
+        {
+            const GaussT<T>* gauss = gaussBlock[i];
+
+            //  Higher order schemes: path by path
+            if (corrected())
+            {
+                for (size_t p = 0; p < nPath; ++p)
+                {
+                    step(myInterpVols, myInterpSlopes, myCorrVols, myCorrSlopes,
+                        i, logspots[p], gauss[p], hints[p]);
+                }
+            }
+            else
+            {
+                //  Interpolate volatility in spot
+                for (size_t p = 0; p < nPath; ++p)
+                {
+                    vols[p] = localVol(myInterpVols, myInterpSlopes, i, logspots[p], hints[p]);
+                }
+                //  vols come out * sqrt(dt)
+
+                //  Apply Euler's scheme
+                for (size_t p = 0; p < nPath; ++p)
+                {
+                    logspots[p] += vols[p] * (T(-0.5) * vols[p] + gauss[p]);
+                }
+            }
+
+            //  Store on the path?
+            if (myCommonSteps[i + 1])
+            {
+                fillScenBlock(logspots, nPath, paths[idx]);
+                ++idx;
+            }
+        }
+    }
 };
 
 //  Calibration
 
 #include "ivs.h"
 
-//  Calibrates one maturity
-//  Main calibration function below
-template <class IT, class OT, class T = double>
-inline void dupireCalibMaturity(
+//  Range of spots calibrated at a maturity
+//  We cut the grid 2.5 stdevs away from ATM to avoid instabilities
+//  Local vols outside [first, second] are extrapolated flat
+template <class IT>
+inline pair<int, int> dupireCalibRange(
     //  IVS we calibrate to
     const IVS& ivs,
     //  Maturity to calibrate
     const Time maturity,
     //  Spots for local vol
     IT spotsBegin,
-    IT spotsEnd,
-    //  Results, by spot
-    //  With (random access) iterator, STL style
-    OT  lVolsBegin,
-    //  Risk view
-    const RiskView<T>& riskView = RiskView<double>())
+    IT spotsEnd)
 {
     //  Number of spots
     IT spots = spotsBegin;
@@ -316,6 +858,34 @@ inline void dupireCalibMaturity(
     int ih = nSpots - 1;
     while (ih >= 0 && spots[ih] > ivs.spot() + 2.5 * std) --ih;
 
+    return make_pair(il, ih);
+}
+
+//  Calibrates one maturity
+//  Main calibration function below
+template <class IT, class OT, class T = double>
+inline void dupireCalibMaturity(
+    //  IVS we calibrate to
+    const IVS& ivs,
+    //  Maturity to calibrate
+    const Time maturity,
+    //  Spots for local vol
+    IT spotsBegin,
+    IT spotsEnd,
+    //  Results, by spot
+    //  With (random access) iterator, STL style
+    OT  lVolsBegin,
+    //  Risk view
+    const RiskView<T>& riskView = RiskView<double>())
+{
+    //  Number of spots
+    IT spots = spotsBegin;
+    const size_t nSpots = distance(spotsBegin, spotsEnd);
+
+    //  Calibrated range
+    const auto range = dupireCalibRange(ivs, maturity, spotsBegin, spotsEnd);
+    const int il = range.first, ih = range.second;
+
     //  Loop on spots
     for (int i = il; i <= ih; ++i)
     {
@@ -333,6 +903,15 @@ inline void dupireCalibMaturity(
 #define ONE_HOUR 0.000114469
 
 //  Returns a struct with spots, times and lVols
+//  In parallel over maturities and spots, 
+//      same results as dupireCalibMaturity() maturity by maturity
+//  With a Number risk view, every local vol is recorded 
+//      on the tape of its thread, against a copy of the risk view, 
+//      and propagated there to the risk view
+//  The local vols are then merged on the caller's tape, 
+//      one node for each with its derivatives to the risk view
+//  Raw implied vols are calculated in batch and cached in the IVS,
+//      so recalibrations of the same IVS with different risk views reuse them
 template<class T = double>
 inline auto dupireCalib(
         //  The IVS we calibrate to
@@ -364,25 +943,160 @@ inline auto dupireCalib(
         ONE_HOUR,               //  min space = 1 hour
         &maxDt, &maxDt + 1      //  dirty trick to include maxDt
     );
+    const vector<double>& spots = results.spots;
+    const vector<Time>& times = results.times;
 
-    //  Allocate local vols, transposed maturity first
-    matrix<T> lVolsT(results.times.size(), results.spots.size());
+    //  Allocate local vols, spot major, 
+    //      filled maturity first through a transposed view
+    const size_t n = times.size(), m = spots.size();
+    results.lVols.resize(m, n);
+    const matrixView<T> lVolsT = results.lVols.transposedView();
 
-    //  Maturity by maturity
-    const size_t n = results.times.size();
-    for (size_t j = 0; j < n; ++j)
+    //  Tasks run in groups, so calibrations may run inside parallel tasks,
+    //      like bumps or superbuckets, see TaskGroup in threadPool.h
+    ThreadPool* pool = ThreadPool::getInstance();
+
+    //  Calibrated ranges, by maturity
+    vector<pair<int, int>> ranges(n);
     {
-        dupireCalibMaturity(
-            ivs, 
-            results.times[j], 
-            results.spots.begin(),
-            results.spots.end(),
-            lVolsT[j], 
-            riskView);
+        TaskGroup group;
+        for (size_t j = 0; j < n; ++j)
+        {
+            group.spawn([&, j]()
+            {
+                ranges[j] = dupireCalibRange(ivs, times[j], spots.begin(), spots.end());
+                return true;
+            });
+        }
+        group.wait();
     }
 
-    //  transpose is defined in matrix.h
-    results.lVols = transpose(lVolsT);
+    //  Implied vols for Dupire's formula, see IVS::localVol(),
+    //      in batch by maturity, into the cache of the IVS
+    {
+        TaskGroup group;
+        for (size_t j = 0; j < n; ++j)
+        {
+            group.spawn([&, j]()
+            {
+                const Time mat = times[j];
+                vector<double> strikes, strikes3;
+                for (int i = ranges[j].first; i <= ranges[j].second; ++i)
+                {
+                    strikes.push_back(spots[i]);
+                    strikes3.push_back(spots[i] - 1.0e-04);
+                    strikes3.push_back(spots[i]);
+                    strikes3.push_back(spots[i] + 1.0e-04);
+                }
+                ivs.prefill(strikes3, { mat });
+                ivs.prefill(strikes, { mat - 1.0e-04, mat + 1.0e-04 });
+                return true;
+            });
+        }
+        group.wait();
+    }
+
+    //  Dupire's formula, by maturity and spot
+    if constexpr (is_same_v<T, Number>)
+    {
+        //  Tapes and copies of the risk view on them, by thread
+        const size_t nThread = pool->numThreads();
+        vector<Tape> tapes(nThread + 1);
+        vector<RiskView<Number>> views(nThread + 1);
+        //  Note we don't use vector<bool>
+        //      because vector<bool> is not thread safe
+        vector<int> viewInit(nThread + 1, false);
+
+        //  Values and derivatives to the risk view, by maturity and spot
+        const size_t nRisk = riskView.rows() * riskView.cols();
+        matrix<double> values(n, m);
+        vector<vector<double>> derivs(n * m);
+
+        TaskGroup group;
+        for (size_t j = 0; j < n; ++j)
+        {
+            for (int i = ranges[j].first; i <= ranges[j].second; ++i)
+            {
+                group.spawn([&, j, i]()
+                {
+                    const size_t threadNum = pool->threadNum();
+
+                    //  Use this thread's tape, main thread included
+                    //  Restored after the task, the thread may be waiting
+                    //      inside a task of its own, on its own tape
+                    Tape* callerTape = Number::tape;
+                    Number::tape = &tapes[threadNum];
+                    Tape& tape = *Number::tape;
+
+                    //  Copy the risk view on the tape once on each thread
+                    if (!viewInit[threadNum])
+                    {
+                        views[threadNum] = riskView;
+                        for (auto& spr : views[threadNum]) spr.putOnTape();
+                        tape.mark();
+                        viewInit[threadNum] = true;
+                    }
+                    RiskView<Number>& view = views[threadNum];
+
+                    //  Record and propagate
+                    tape.rewindToMark();
+                    Number lVol = ivs.localVol(spots[i], times[j], &view);
+                    values[j][i] = lVol.value();
+                    lVol.propagateToMark();
+
+                    //  Pick derivatives and reset
+                    vector<double>& ders = derivs[j * m + i];
+                    ders.resize(nRisk);
+                    transform(view.begin(), view.end(), ders.begin(), [](Number& spr)
+                    {
+                        const double der = spr.adjoint();
+                        spr.adjoint() = 0.0;
+                        return der;
+                    });
+
+                    Number::tape = callerTape;
+                    return true;
+                });
+            }
+        }
+        group.wait();
+
+        //  Merge on the caller's tape
+        for (size_t j = 0; j < n; ++j)
+        {
+            for (int i = ranges[j].first; i <= ranges[j].second; ++i)
+            {
+                lVolsT(j, i) = Number::fromDerivatives(
+                    values[j][i], riskView.begin(), riskView.end(), derivs[j * m + i].begin());
+            }
+        }
+    }
+    else
+    {
+        TaskGroup group;
+        for (size_t j = 0; j < n; ++j)
+        {
+            for (int i = ranges[j].first; i <= ranges[j].second; ++i)
+            {
+                group.spawn([&, j, i]()
+                {
+                    lVolsT(j, i) = ivs.localVol(spots[i], times[j], &riskView);
+                    return true;
+                });
+            }
+        }
+        group.wait();
+    }
+
+    //  Extrapolate flat outside std
+    for (size_t j = 0; j < n; ++j)
+    {
+        const int il = ranges[j].first, ih = ranges[j].second;
+        for (int i = 0; i < il; ++i)
+            lVolsT(j, i) = lVolsT(j, il);
+        for (int i = ih + 1; i < int(m); ++i)
+            lVolsT(j, i) = lVolsT(j, ih);
+    }
 
     return results;
 }
@@ -27,7 +27,7 @@ As long as this comment is preserved at the top of the file
 #define ONE_DAY 0.003773585
 
 template <class T>
-class European : public Product<T>
+class European final : public Product<T>
 {
     double              myStrike;
     Time                myExerciseDate;
@@ -89,6 +89,22 @@ public:
         return make_unique<European<T>>(*this);
     }
 
+    //  Accessors
+    double strike() const
+    {
+        return myStrike;
+    }
+
+    Time exerciseDate() const
+    {
+        return myExerciseDate;
+    }
+
+    Time settlementDate() const
+    {
+        return mySettlementDate;
+    }
+
     //  Timeline
     const vector<Time>& timeline() const override
     {
@@ -119,10 +135,30 @@ public:
             * path[0].discounts[0]
             / path[0].numeraire; 
     }
+
+    //  Payoffs for a block of paths
+    void payoffBlock(
+        const ScenarioBlock<T>&     paths,
+        const size_t                nPath,
+        matrix<T>&                  payoffs,
+        PayoffScratch<T>&           scratch)
+            const override
+    {
+        const T* fwds = paths[0].forwards[0].data();
+        const T* dfs = paths[0].discounts[0].data();
+        const T* nums = paths[0].numeraires.data();
+        T* pays = payoffs[0];
+        for (size_t p = 0; p < nPath; ++p)
+        {
+            pays[p] = max(fwds[p] - myStrike, 0.0)
+                * dfs[p]
+                / nums[p];
+        }
+    }
 };
 
 template <class T>
-class UOC : public Product<T>
+class UOC final : public Product<T>
 {
     double              myStrike;
     double              myBarrier;
@@ -205,6 +241,22 @@ public:
         return make_unique<UOC<T>>(*this);
     }
 
+    //  Accessors
+    double strike() const
+    {
+        return myStrike;
+    }
+
+    double barrier() const
+    {
+        return myBarrier;
+    }
+
+    Time maturity() const
+    {
+        return myMaturity;
+    }
+
     //  Timeline
     const vector<Time>& timeline() const override
     {
@@ -265,10 +317,68 @@ public:
                         / path.back().numeraire;
         payoffs[0] = alive * payoffs[1];
     }
+
+    //  Scratch: smoothing factors and alive status by path
+    size_t scratchSize() const override
+    {
+        return 2;
+    }
+
+    //  Payoffs for a block of paths, same as above with paths innermost
+    void payoffBlock(
+        const ScenarioBlock<T>&     paths,
+        const size_t                nPath,
+        matrix<T>&                  payoffs,
+        PayoffScratch<T>&           scratch)
+            const override
+    {
+        //  Smoothing factors by path, untemplated
+        T* smooth = scratch.block[0];
+        const T* spots = paths[0].forwards[0].data();
+        for (size_t p = 0; p < nPath; ++p) smooth[p] = double(spots[p] * mySmooth);
+
+        //  We start alive
+        T* alive = scratch.block[1];
+        fill(alive, alive + nPath, T(1.0));
+
+        //  Go through paths, update alive status
+        //  Once breached, alive stays at 0
+        for (const auto& sample : paths)
+        {
+            const T* fwds = sample.forwards[0].data();
+            for (size_t p = 0; p < nPath; ++p)
+            {
+                const double sm = double(smooth[p]);
+                const double barSmooth = myBarrier + sm;
+
+                //  Breached
+                if (fwds[p] > barSmooth)
+                {
+                    alive[p] = T(0.0);
+                }
+                //  Semi-breached: apply smoothing
+                else if (fwds[p] > myBarrier - sm)
+                {
+                    alive[p] *= (barSmooth - fwds[p]) / (2 * sm);
+                }
+            }
+        }
+
+        //  Payoffs
+        const T* fwds = paths.back().forwards[0].data();
+        const T* nums = paths.back().numeraires.data();
+        T* pays0 = payoffs[0];
+        T* pays1 = payoffs[1];
+        for (size_t p = 0; p < nPath; ++p)
+        {
+            pays1[p] = max(fwds[p] - myStrike, 0.0) / nums[p];
+            pays0[p] = alive[p] * pays1[p];
+        }
+    }
 };
 
 template <class T>
-class Europeans : public Product<T>
+class Europeans final : public Product<T>
 {
 	//	Timeline
 	vector<Time>            myMaturities;
@@ -376,12 +486,38 @@ public:
 			payoffIt += myStrikes[i].size();
 		}
 	}
+
+	//  Payoffs for a block of paths, maturity major
+	void payoffBlock(
+		const ScenarioBlock<T>&     paths,
+		const size_t                nPath,
+		matrix<T>&                  payoffs,
+		PayoffScratch<T>&           scratch)
+		const override
+	{
+		const size_t numT = myMaturities.size();
+
+		size_t row = 0;
+		for (size_t i = 0; i < numT; ++i)
+		{
+			const T* spots = paths[i].forwards[0].data();
+			const T* nums = paths[i].numeraires.data();
+			for (const double k : myStrikes[i])
+			{
+				T* pays = payoffs[row++];
+				for (size_t p = 0; p < nPath; ++p)
+				{
+					pays[p] = max(spots[p] - k, 0.0) / nums[p];
+				}
+			}
+		}
+	}
 };
 
 //  Payoff = sum { (libor(Ti, Ti+1) + cpn) 
 //      * coverage(Ti, Ti+1) only if Si+1 >= Si }
 template <class T>
-class ContingentBond : public Product<T>
+class ContingentBond final : public Product<T>
 {
     Time                myMaturity;
     double              myCpn;
@@ -550,4 +686,371 @@ public:
         }
         payoffs[0] += 1.0 / path.back().numeraire;  //  redemption at maturity
     }
+
+    //  Scratch: smoothing factors by path
+    size_t scratchSize() const override
+    {
+        return 1;
+    }
+
+    //  Payoffs for a block of paths, same as above with paths innermost
+    void payoffBlock(
+        const ScenarioBlock<T>&     paths,
+        const size_t                nPath,
+        matrix<T>&                  payoffs,
+        PayoffScratch<T>&           scratch)
+        const override
+    {
+        //  Smoothing factors by path, untemplated
+        T* smooth = scratch.block[0];
+        const T* spots = paths[0].forwards[0].data();
+        for (size_t p = 0; p < nPath; ++p) smooth[p] = double(spots[p] * mySmooth);
+
+        //  Period by period
+        const size_t n = paths.size() - 1;
+        T* pays = payoffs[0];
+        fill(pays, pays + nPath, T(0.0));
+        for (size_t i = 0; i < n; ++i)
+        {
+            const T* s0 = paths[i].forwards[0].data();
+            const T* s1 = paths[i + 1].forwards[0].data();
+            const T* libors = paths[i].libors[0].data();
+            const T* nums = paths[i + 1].numeraires.data();
+
+            for (size_t p = 0; p < nPath; ++p)
+            {
+                //  Smoothed digital, see payoffs()
+                const double sm = double(smooth[p]);
+                T digital;
+                if (s1[p] - s0[p] > sm)
+                {
+                    digital = T(1.0);
+                }
+                else if (s1[p] - s0[p] < -sm)
+                {
+                    digital = T(0.0);
+                }
+                else
+                {
+                    digital = (s1[p] - s0[p] + sm) / (2 * sm);
+                }
+
+                pays[p] +=
+                    digital
+                    * (libors[p] + myCpn)
+                    * myDt[i]
+                    / nums[p];
+            }
+        }
+
+        const T* nums = paths.back().numeraires.data();
+        for (size_t p = 0; p < nPath; ++p) pays[p] += 1.0 / nums[p];
+    }
+};
+
+//  Portfolio of products, simulated together in a single pass
+//  The timeline and deflines are the unions of those of the legs,
+//      without duplicate event dates, forward and discount maturities or libors,
+//      so that the model generates every path once for the whole portfolio,
+//      and each leg evaluates its payoffs on its slice of the path
+//  Payoffs are those of all the legs, labelled "legId: label"
+//      book level values and risks follow from notionals,
+//      see AADriskAggregate() in main.h
+template <class T>
+class Portfolio final : public Product<T>
+{
+    vector<unique_ptr<Product<T>>>  myLegs;
+
+    vector<Time>                    myTimeline;
+    vector<SampleDef>               myDefline;
+    vector<string>                  myLabels;
+
+    //  Index of the data of a leg sample in the corresponding portfolio sample
+    struct SampleMap
+    {
+        vector<size_t>  forwards;
+        vector<size_t>  discounts;
+        vector<size_t>  libors;
+    };
+
+    //  By leg: portfolio event of each leg event, and map of each leg sample
+    vector<vector<size_t>>          myEvents;
+    vector<vector<SampleMap>>       myMaps;
+    //  By leg: index of the first payoff of the leg in the portfolio payoffs
+    vector<size_t>                  myFirstPayoff;
+
+    //  Slice of a path for a leg
+    void legPath(const Scenario<T>& path, const size_t leg, Scenario<T>& lPath) const
+    {
+        const auto& events = myEvents[leg];
+        for (size_t i = 0; i < events.size(); ++i)
+        {
+            const Sample<T>& smp = path[events[i]];
+            Sample<T>& lSmp = lPath[i];
+            const SampleMap& map = myMaps[leg][i];
+
+            lSmp.numeraire = smp.numeraire;
+            for (size_t j = 0; j < map.forwards.size(); ++j)
+                lSmp.forwards[j] = smp.forwards[map.forwards[j]];
+            for (size_t j = 0; j < map.discounts.size(); ++j)
+                lSmp.discounts[j] = smp.discounts[map.discounts[j]];
+            for (size_t j = 0; j < map.libors.size(); ++j)
+                lSmp.libors[j] = smp.libors[map.libors[j]];
+        }
+    }
+
+    //  Slice of a block of paths for a leg
+    void legPathBlock(
+        const ScenarioBlock<T>& paths, 
+        const size_t            nPath, 
+        const size_t            leg, 
+        ScenarioBlock<T>&       lPaths) const
+    {
+        const auto& events = myEvents[leg];
+        for (size_t i = 0; i < events.size(); ++i)
+        {
+            const SampleBlock<T>& smp = paths[events[i]];
+            SampleBlock<T>& lSmp = lPaths[i];
+            const SampleMap& map = myMaps[leg][i];
+
+            copy_n(smp.numeraires.begin(), nPath, lSmp.numeraires.begin());
+            for (size_t j = 0; j < map.forwards.size(); ++j)
+                copy_n(smp.forwards[map.forwards[j]].begin(), nPath, lSmp.forwards[j].begin());
+            for (size_t j = 0; j < map.discounts.size(); ++j)
+                copy_n(smp.discounts[map.discounts[j]].begin(), nPath, lSmp.discounts[j].begin());
+            for (size_t j = 0; j < map.libors.size(); ++j)
+                copy_n(smp.libors[map.libors[j]].begin(), nPath, lSmp.libors[j].begin());
+        }
+    }
+
+public:
+
+    //  Constructor: copy the legs and merge timelines and deflines
+    Portfolio(const vector<const Product<T>*>& legs, const vector<string>& legIds) 
+    {
+        const size_t nLeg = legs.size();
+
+        for (const auto* leg : legs) myLegs.push_back(leg->clone());
+
+        //  Union timeline
+        for (const auto* leg : legs)
+        {
+            myTimeline.insert(myTimeline.end(), leg->timeline().begin(), leg->timeline().end());
+        }
+        sort(myTimeline.begin(), myTimeline.end());
+        myTimeline.erase(unique(myTimeline.begin(), myTimeline.end()), myTimeline.end());
+
+        //  Union defline
+        auto eventOf = [&](const Time t)
+        {
+            return size_t(lower_bound(myTimeline.begin(), myTimeline.end(), t) - myTimeline.begin());
+        };
+        myDefline.resize(myTimeline.size());
+        for (auto& def : myDefline) def.numeraire = false;
+        for (const auto* leg : legs)
+        {
+            const auto& timeline = leg->timeline();
+            const auto& defline = leg->defline();
+            for (size_t i = 0; i < timeline.size(); ++i)
+            {
+                SampleDef& def = myDefline[eventOf(timeline[i])];
+                def.numeraire = def.numeraire || defline[i].numeraire;
+                def.forwardMats.insert(def.forwardMats.end(), 
+                    defline[i].forwardMats.begin(), defline[i].forwardMats.end());
+                def.discountMats.insert(def.discountMats.end(), 
+                    defline[i].discountMats.begin(), defline[i].discountMats.end());
+                for (const auto& libor : defline[i].liborDefs)
+                {
+                    auto same = [&](const SampleDef::RateDef& rd)
+                    {
+                        return rd.start == libor.start && rd.end == libor.end && rd.curve == libor.curve;
+                    };
+                    if (find_if(def.liborDefs.begin(), def.liborDefs.end(), same) == def.liborDefs.end())
+                    {
+                        def.liborDefs.push_back(libor);
+                    }
+                }
+            }
+        }
+        for (auto& def : myDefline)
+        {
+            sort(def.forwardMats.begin(), def.forwardMats.end());
+            def.forwardMats.erase(unique(def.forwardMats.begin(), def.forwardMats.end()), 
+                def.forwardMats.end());
+            sort(def.discountMats.begin(), def.discountMats.end());
+            def.discountMats.erase(unique(def.discountMats.begin(), def.discountMats.end()), 
+                def.discountMats.end());
+        }
+
+        //  Maps from the legs to the portfolio
+        myEvents.resize(nLeg);
+        myMaps.resize(nLeg);
+        for (size_t l = 0; l < nLeg; ++l)
+        {
+            const auto& timeline = legs[l]->timeline();
+            const auto& defline = legs[l]->defline();
+            myMaps[l].resize(timeline.size());
+            for (size_t i = 0; i < timeline.size(); ++i)
+            {
+                const size_t evt = eventOf(timeline[i]);
+                myEvents[l].push_back(evt);
+                const SampleDef& def = myDefline[evt];
+                SampleMap& map = myMaps[l][i];
+
+                for (const Time mat : defline[i].forwardMats)
+                {
+                    map.forwards.push_back(
+                        lower_bound(def.forwardMats.begin(), def.forwardMats.end(), mat) 
+                        - def.forwardMats.begin());
+                }
+                for (const Time mat : defline[i].discountMats)
+                {
+                    map.discounts.push_back(
+                        lower_bound(def.discountMats.begin(), def.discountMats.end(), mat) 
+                        - def.discountMats.begin());
+                }
+                for (const auto& libor : defline[i].liborDefs)
+                {
+                    auto same = [&](const SampleDef::RateDef& rd)
+                    {
+                        return rd.start == libor.start && rd.end == libor.end && rd.curve == libor.curve;
+                    };
+                    map.libors.push_back(
+                        find_if(def.liborDefs.begin(), def.liborDefs.end(), same) 
+                        - def.liborDefs.begin());
+                }
+            }
+        }
+
+        //  Identify the payoffs
+        for (size_t l = 0; l < nLeg; ++l)
+        {
+            myFirstPayoff.push_back(myLabels.size());
+            for (const auto& label : legs[l]->payoffLabels())
+            {
+                myLabels.push_back(legIds[l] + ": " + label);
+            }
+        }
+    }
+
+    //  Deep copy
+    Portfolio(const Portfolio& rhs) :
+        myTimeline(rhs.myTimeline),
+        myDefline(rhs.myDefline),
+        myLabels(rhs.myLabels),
+        myEvents(rhs.myEvents),
+        myMaps(rhs.myMaps),
+        myFirstPayoff(rhs.myFirstPayoff)
+    {
+        for (const auto& leg : rhs.myLegs) myLegs.push_back(leg->clone());
+    }
+
+    //  Access to the legs
+    size_t numLegs() const
+    {
+        return myLegs.size();
+    }
+
+    const Product<T>& leg(const size_t l) const
+    {
+        return *myLegs[l];
+    }
+
+    //  Virtual copy constructor
+    unique_ptr<Product<T>> clone() const override
+    {
+        return make_unique<Portfolio<T>>(*this);
+    }
+
+    //  Timeline
+    const vector<Time>& timeline() const override
+    {
+        return myTimeline;
+    }
+
+    //  Defline
+    const vector<SampleDef>& defline() const override
+    {
+        return myDefline;
+    }
+
+    //  Labels
+    const vector<string>& payoffLabels() const override
+    {
+        return myLabels;
+    }
+
+    //  Payoffs, leg by leg, with a temporary scratch
+    //  Allocates memory, the simulators call the overload below
+    //      with a scratch allocated once per thread
+    void payoffs(
+        //  path, one entry per time step 
+        const Scenario<T>&          path,
+        //  pre-allocated space for resulting payoffs
+        vector<T>&                  payoffs)
+        const override
+    {
+        PayoffScratch<T> scratch;
+        scratch.allocate(*this, 1);
+        this->payoffs(path, payoffs, scratch);
+    }
+
+    //  Payoffs, leg by leg, in the leg paths and payoffs of the scratch
+    void payoffs(
+        const Scenario<T>&          path,
+        vector<T>&                  payoffs,
+        PayoffScratch<T>&           scratch)
+        const override
+    {
+        for (size_t l = 0; l < myLegs.size(); ++l)
+        {
+            legPath(path, l, scratch.legPath[l]);
+            myLegs[l]->payoffs(scratch.legPath[l], scratch.legPays[l], scratch.legs[l]);
+            copy(scratch.legPays[l].begin(), scratch.legPays[l].end(), payoffs.begin() + myFirstPayoff[l]);
+        }
+    }
+
+public:
+
+    //  Leg paths, payoffs and scratches
+    void allocateScratch(PayoffScratch<T>& scratch, const size_t nPath) const override
+    {
+        const size_t nLeg = myLegs.size();
+        scratch.legPaths.resize(nLeg);
+        scratch.legPayoffs.resize(nLeg);
+        scratch.legs.resize(nLeg);
+        scratch.legPath.resize(nLeg);
+        scratch.legPays.resize(nLeg);
+        for (size_t l = 0; l < nLeg; ++l)
+        {
+            allocatePathBlock(myLegs[l]->defline(), nPath, scratch.legPaths[l]);
+            initializePathBlock(scratch.legPaths[l]);
+            scratch.legPayoffs[l].resize(myLegs[l]->payoffLabels().size(), nPath);
+            allocatePath(myLegs[l]->defline(), scratch.legPath[l]);
+            initializePath(scratch.legPath[l]);
+            scratch.legPays[l].resize(myLegs[l]->payoffLabels().size());
+            scratch.legs[l].allocate(*myLegs[l], nPath);
+        }
+    }
+
+    //  Payoffs for a block of paths, leg by leg
+    void payoffBlock(
+        const ScenarioBlock<T>&     paths,
+        const size_t                nPath,
+        matrix<T>&                  payoffs,
+        PayoffScratch<T>&           scratch)
+        const override
+    {
+        for (size_t l = 0; l < myLegs.size(); ++l)
+        {
+            legPathBlock(paths, nPath, l, scratch.legPaths[l]);
+            myLegs[l]->payoffBlock(scratch.legPaths[l], nPath, scratch.legPayoffs[l], scratch.legs[l]);
+            
+            const matrix<T>& legPays = scratch.legPayoffs[l];
+            for (size_t j = 0; j < legPays.rows(); ++j)
+            {
+                copy_n(legPays[j], nPath, payoffs[myFirstPayoff[l] + j]);
+            }
+        }
+    }
 };
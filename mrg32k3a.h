@@ -27,6 +27,9 @@ class mrg32k3a : public RNG
 
 	//	Seed
 	const double	myA, myB;
+
+	//	Start state of the current stream, see setStream()
+	double			myStreamX[3], myStreamY[3];
 	
 	//  Dimension
     size_t			myDim;
@@ -34,12 +37,18 @@ class mrg32k3a : public RNG
 	//  State
     double			myXn, myXn1, myXn2, myYn, myYn1, myYn2;
 
+	//	Antithetic sampling: every other path negates the previous one
+	bool			myAntithetic;
 	//	Antithetic
 	bool			myAnti;
 	//	false: generate new, true: negate cached
 	vector<double>	myCachedUniforms;
 	vector<double>	myCachedGaussians;
 
+	//	Workspace for blocks
+	matrix<double>	myUniforms;
+	vector<double>	myGaussians;
+
     //  Constants
     static constexpr  double	m1 = 4294967087;
 	static constexpr  double	m2 = 4294944443;
@@ -83,29 +92,66 @@ class mrg32k3a : public RNG
 public:
 
     //  Constructor with seed
-    mrg32k3a(const unsigned a = 12345, const unsigned b = 12346) :
-        myA(a), myB(b)
+    mrg32k3a(const unsigned a = 12345, const unsigned b = 12346, const bool antithetic = true) :
+        myA(a), myB(b), myAntithetic(antithetic)
     {
-        reset();
+		setStream(0);
     }
 
-	//	Reset state to 0 (seed)
+	//	Reset state to 0 (start of the current stream)
     void reset()
     {
 		//	Reset state
-        myXn = myXn1 = myXn2 = myA;
-        myYn = myYn1 = myYn2 = myB;
+		myXn = myStreamX[0];
+		myXn1 = myStreamX[1];
+		myXn2 = myStreamX[2];
+		myYn = myStreamY[0];
+		myYn1 = myStreamY[1];
+		myYn2 = myStreamY[2];
 		
 		//	Anti = false: generate next
 		myAnti = false;
     }
 
+	//	Independent substreams
+	//	Stream s starts 2^64 numbers after the start of stream s - 1,
+	//		more than a simulation can ever consume,
+	//		so different streams never overlap
+	//	Stream 0 starts at the seed
+	//	When set, reset() and skipTo() operate within the stream
+	//	so threads, processes or machines may each get their own stream
+	//		and position themselves with skipTo() without replaying
+	void setStream(const unsigned long long stream)
+	{
+		//	Start from the seed
+		myXn = myXn1 = myXn2 = myA;
+		myYn = myYn1 = myYn2 = myB;
+
+		//	Jump by stream x 2^64
+		skipNumbers(stream, 64);
+
+		//	Remember
+		myStreamX[0] = myXn;
+		myStreamX[1] = myXn1;
+		myStreamX[2] = myXn2;
+		myStreamY[0] = myYn;
+		myStreamY[1] = myYn1;
+		myStreamY[2] = myYn2;
+
+		reset();
+	}
+
     //  Virtual copy constructor
     unique_ptr<RNG> clone() const override
     {
         return make_unique<mrg32k3a>(*this);
     }
 
+	bool antithetic() const override
+	{
+		return myAntithetic;
+	}
+
     //  Initializer 
     void init(const size_t simDim) override      
     {
@@ -142,8 +188,8 @@ public:
 				myCachedUniforms.end(),
 				uVec.begin());
 			
-			//	Do not generate next
-			myAnti = true;
+			//	Do not generate next, if antithetic
+			myAnti = myAntithetic;
 		}
 	}
 
@@ -178,8 +224,85 @@ public:
 				myCachedGaussians.end(),
 				gaussVec.begin());
 
-			//	Do not generate next
-			myAnti = true;
+			//	Do not generate next, if antithetic
+			myAnti = myAntithetic;
+		}
+	}
+
+	//	Blocks, same numbers as nextU() / nextG() path by path
+	//	The recursion is inherently sequential 
+	//		but only fresh paths go through it, 
+	//		antithetic paths negate the previous one,
+	//		and the inverse CDF runs over contiguous uniforms
+
+	void nextUBlock(const size_t nPath, matrix<double>& uBlock) override
+	{
+		for (size_t p = 0; p < nPath; ++p)
+		{
+			if (myAnti)
+			{
+				for (size_t i = 0; i < myDim; ++i) uBlock[i][p] = 1.0 - myCachedUniforms[i];
+				myAnti = false;
+			}
+			else
+			{
+				for (size_t i = 0; i < myDim; ++i)
+				{
+					myCachedUniforms[i] = nextNumber();
+					uBlock[i][p] = myCachedUniforms[i];
+				}
+				myAnti = myAntithetic;
+			}
+		}
+	}
+
+	void nextGBlock(const size_t nPath, matrix<double>& gaussBlock) override
+	{
+		//	Paths that need fresh numbers
+		//	All other paths are antithetic to the previous one
+		const size_t stride = myAntithetic ? 2 : 1;
+		const size_t first = myAnti ? 1 : 0;
+		const size_t nFresh = nPath > first ? (nPath - first + stride - 1) / stride : 0;
+
+		//	Fresh uniforms, fresh path by fresh path
+		myUniforms.resize(myDim, gaussBlock.cols());
+		for (size_t f = 0; f < nFresh; ++f)
+		{
+			for (size_t i = 0; i < myDim; ++i) myUniforms[i][f] = nextNumber();
+		}
+
+		//	Fresh Gaussians, dimension by dimension, 
+		//		in the fresh columns first + stride x f of the block
+		//	Go through a contiguous buffer, then scatter
+		myGaussians.resize(nFresh);
+		for (size_t i = 0; i < myDim; ++i)
+		{
+			invNormalCdfBlock(myUniforms[i], nFresh, myGaussians.data());
+
+			double* gauss = gaussBlock[i];
+			//	Antithetic to cached Gaussians from the previous call
+			if (first && nPath) gauss[0] = -myCachedGaussians[i];
+			for (size_t f = 0; f < nFresh; ++f)
+			{
+				const size_t p = first + stride * f;
+				gauss[p] = myGaussians[f];
+				if (myAntithetic && p + 1 < nPath) gauss[p + 1] = -myGaussians[f];
+			}
+		}
+
+		//	Update antithetic state, as in nextG()
+		if (nFresh)
+		{
+			//	Cache the last fresh path
+			const size_t last = first + stride * (nFresh - 1);
+			for (size_t i = 0; i < myDim; ++i) myCachedGaussians[i] = gaussBlock[i][last];
+			//	Did the block end on a fresh path?
+			myAnti = myAntithetic && last == nPath - 1;
+		}
+		else if (nPath)
+		{
+			//	Single antithetic path
+			myAnti = false;
 		}
 	}
 
@@ -188,33 +311,43 @@ public:
 	//	To avoid overflow, we nest mods in innermost results
 	//		and use 64bit unsigned long long for storage
 
+	//	The state (Xn, Xn-1, Xn-2) after k numbers is A^k (X0, X-1, X-2) mod m1
+	//		and the same for Y with B and m2
+	//	We pre-compute A^(2^i) and B^(2^i) once by repeated squaring,
+	//		then skipping k numbers takes one matrix by vector product
+	//		per bit set in k: at most 64, against k recursions
+
 	//  Skip ahead
-	void skipTo(const unsigned b) override
+	//	Cost is O(log(b x simDim))
+	//	Same state as b paths drawn with nextU() or nextG() 
+	//		from the start of the current stream, antithetic pairs included
+	void skipTo(const size_t b) override
 	{
 		//	First reset to 0
 		reset();
 
 		//	How many numbers to skip
-		unsigned skipnums = b * myDim;
-		bool odd = false;
-
-		//	Antithetic: skip only half
-		if (skipnums & 1)
+		//	64bit: b x dim overflows 32bit for large simulations
+		//	Within a stream of 2^64 numbers, see setStream()
+		if (myDim && (unsigned long long)(b) > ~0ull / myDim)
 		{
-			//	Odd
-			odd = true;
-			skipnums = (skipnums - 1) / 2;
+			throw runtime_error("mrg32k3a::skipTo() : skip beyond the stream");
 		}
-		else
+
+		//	Not antithetic: skip all
+		if (!myAntithetic)
 		{
-			//	Even
-			skipnums /= 2;
+			skipNumbers((unsigned long long)(b) * myDim);
+			myAnti = false;
+			return;
 		}
 
-		//	Skip state
-		skipNumbers(skipnums);
+		//	Antithetic: skip only the fresh paths, half of them
+		//	Odd: path b is antithetic to path b - 1
+		const bool odd = b & 1;
+		skipNumbers((unsigned long long)(b / 2) * myDim);
 
-		//	If odd, pre-generate for antithetic
+		//	If odd, pre-generate path b - 1 for antithetic
 		if (odd)
 		{
 			myAnti = true;
@@ -225,11 +358,12 @@ public:
 				myCachedUniforms.end(),
 				[this]() { return nextNumber(); });
 
-			//	Gaussians
-			generate(
+			//	Gaussians, from the same numbers, as in nextG()
+			transform(
+				myCachedUniforms.begin(),
+				myCachedUniforms.end(),
 				myCachedGaussians.begin(),
-				myCachedGaussians.end(),
-				[this]() { return invNormalCdf(nextNumber()); });
+				[](const double u) { return invNormalCdf(u); });
 		}
 		else
 		{
@@ -303,93 +437,104 @@ private:
 		}
 	}
 
-	void skipNumbers(const unsigned b) 
-    {
-        if ( b <= 0) return;
-        unsigned skip = b;
-
-		static constexpr unsigned long long
-			m1l = unsigned long long(m1);
-		static constexpr unsigned long long
-			m2l = unsigned long long(m2);
-
-		unsigned long long Ab[3][3] = {
-            { 1, 0 ,0 },        
-            { 0, 1, 0 },
-            { 0, 0, 1 }
-        },
-            Bb[3][3] = {
-                { 1, 0 ,0 },    
-                { 0, 1, 0 },
-                { 0, 0, 1 }
-        },
-            Ai[3][3] = {        //  A0 = A
-                { 
-					0, 
-					unsigned long long (a12) , 
-					unsigned long long (m1 - a13) 
-					//	m1 - a13 instead of -a13
-					//	so results are always positive
-					//	and we can use unsigned long longs
-					//	after modulus, we get the same results
-				},
-                { 1, 0, 0 },
-                { 0, 1, 0 }
-        },
-            Bi[3][3] = {        //  B0 = B
-                { 
-					unsigned long long (a21), 
-					0 , 
-					unsigned long long (m2 - a23) 
-					//	same logic: m2 - a32
+	static constexpr unsigned long long m1l = static_cast<unsigned long long>(m1);
+	static constexpr unsigned long long m2l = static_cast<unsigned long long>(m2);
+
+	//	Number of pre-computed powers A^(2^i), i = 0..JUMPS-1
+	//	Enough for a 64bit skip within a 64bit stream
+	static constexpr size_t JUMPS = 128;
+
+	struct JumpTable
+	{
+		unsigned long long A[JUMPS][3][3];
+		unsigned long long B[JUMPS][3][3];
+
+		JumpTable()
+		{
+			const unsigned long long 
+				A0[3][3] = {
+					{ 
+						0, 
+						static_cast<unsigned long long>(a12), 
+						static_cast<unsigned long long>(m1 - a13)
+						//	m1 - a13 instead of -a13
+						//	so results are always positive
+						//	and we can use unsigned long longs
+						//	after modulus, we get the same results
+					},
+					{ 1, 0, 0 },
+					{ 0, 1, 0 }
 				},
-                { 1, 0, 0 },
-                { 0, 1, 0 }
-        };
-
-        while (skip>0) 
-        {
-            if (skip & 1)   //  i.e. ai == 1
-            {
-                //  accumulate Ab and Bb
-                mPrd(Ab, Ai, m1l, Ab);
-                mPrd(Bb, Bi, m2l, Bb);
-            }
-
-            //  Recursion on Ai and Bi 
-            mPrd(Ai, Ai, m1l, Ai);
-            mPrd(Bi, Bi, m2l, Bi);
-
-            skip >>= 1;
-        }
-
-        //  Final result
-		unsigned long long X0[3] =
-        {
-			unsigned long long (myXn),
-			unsigned long long (myXn1),
-			unsigned long long (myXn2)
-        },
-            Y0[3] =
-        {
-			unsigned long long (myYn),
-			unsigned long long (myYn1),
-			unsigned long long (myYn2)
-        },
-            temp[3];
-        
-		//	From initial to final state
-        vPrd(Ab, X0, m1l, temp);
-        
-		//	Convert back to doubles
-		myXn = double(temp[0]);
-        myXn1 = double(temp[1]);
-        myXn2 = double(temp[2]);
+				B0[3][3] = {
+					{ 
+						static_cast<unsigned long long>(a21), 
+						0, 
+						static_cast<unsigned long long>(m2 - a23)
+						//	same logic: m2 - a23
+					},
+					{ 1, 0, 0 },
+					{ 0, 1, 0 }
+				};
+
+			memcpy(A[0], A0, sizeof(A0));
+			memcpy(B[0], B0, sizeof(B0));
+
+			//	Repeated squaring
+			for (size_t i = 1; i < JUMPS; ++i)
+			{
+				mPrd(A[i - 1], A[i - 1], m1l, A[i]);
+				mPrd(B[i - 1], B[i - 1], m2l, B[i]);
+			}
+		}
+	};
 
-		//	Same for Y
-        vPrd(Bb, Y0, m2l, temp);
-        myYn = double(temp[0]);
-        myYn1 = double(temp[1]);
-        myYn2 = double(temp[2]);
-    }
+	//	Computed on first use, thread safe in C++11
+	static const JumpTable& jumpTable()
+	{
+		static const JumpTable table;
+		return table;
+	}
+
+	//	Skip n x 2^shift numbers from the current state
+	void skipNumbers(unsigned long long n, const size_t shift = 0)
+	{
+		if (!n) return;
+
+		const JumpTable& table = jumpTable();
+
+		unsigned long long X[3] =
+		{
+			static_cast<unsigned long long>(myXn),
+			static_cast<unsigned long long>(myXn1),
+			static_cast<unsigned long long>(myXn2)
+		},
+			Y[3] =
+		{
+			static_cast<unsigned long long>(myYn),
+			static_cast<unsigned long long>(myYn1),
+			static_cast<unsigned long long>(myYn2)
+		},
+			temp[3];
+
+		//	One matrix by vector product per bit set in n
+		//	A^(2^i) commute so the order doesn't matter
+		for (size_t i = shift; n; n >>= 1, ++i)
+		{
+			if (n & 1)
+			{
+				vPrd(table.A[i], X, m1l, temp);
+				memcpy(X, temp, sizeof(X));
+				vPrd(table.B[i], Y, m2l, temp);
+				memcpy(Y, temp, sizeof(Y));
+			}
+		}
+
+		//	Convert back to doubles
+		myXn = double(X[0]);
+		myXn1 = double(X[1]);
+		myXn2 = double(X[2]);
+		myYn = double(Y[0]);
+		myYn1 = double(Y[1]);
+		myYn2 = double(Y[2]);
+	}
 };
\ No newline at end of file
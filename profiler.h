@@ -0,0 +1,315 @@
+/*
+Written by Antoine Savine in 2018
+
+This code is the strict IP of Antoine Savine
+
+License to use and alter this code for personal and commercial applications
+is freely granted to any person or company who purchased a copy of the book
+
+Modern Computational Finance: AAD and Parallel Simulations
+Antoine Savine
+Wiley, 2018
+
+As long as this comment is preserved at the top of the file
+*/
+
+#pragma once
+
+//  Instrumentation of the hot paths of the simulations and the thread pool
+
+//  Compiled out unless MCPROFILE is true:
+//      the macros below expand to their statements alone
+//  When on, every thread cumulates, in its own slot:
+//      cycles per phase: random numbers, paths, payoffs, backward sweeps,
+//          waits in activeWait() and idle time of the workers,
+//      the numbers of tasks run and stolen and of the nodes swept on tape
+//  Runs are profiled with ProfileRun, see value() and the risk functions in main.h,
+//      the statistics are returned in a RunStats with the results
+//  The counters are global: the statistics of concurrent runs mix
+
+#define MCPROFILE   false
+
+#include <atomic>
+#include <array>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+
+#if MCPROFILE
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+using namespace std;
+
+enum class ProfilePhase : size_t
+{
+    rng,
+    path,
+    payoff,
+    backward,
+    wait,
+    idle,
+    count
+};
+
+enum class ProfileCount : size_t
+{
+    tasks,
+    steals,
+    tapeNodes,
+    count
+};
+
+constexpr size_t numProfilePhases = size_t(ProfilePhase::count);
+constexpr size_t numProfileCounts = size_t(ProfileCount::count);
+
+//  Statistics of a run
+struct RunStats
+{
+    //  Wall clock time of the run, measured whether profiling is on or off
+    double                                          seconds = 0;
+
+    //  By thread, 0 = caller, then the workers of the pool
+    vector<array<uint64_t, numProfilePhases>>       cycles;
+    vector<array<uint64_t, numProfileCounts>>       counts;
+
+    uint64_t totalCycles(const ProfilePhase phase) const
+    {
+        uint64_t total = 0;
+        for (const auto& c : cycles) total += c[size_t(phase)];
+        return total;
+    }
+
+    uint64_t totalCount(const ProfileCount count) const
+    {
+        uint64_t total = 0;
+        for (const auto& c : counts) total += c[size_t(count)];
+        return total;
+    }
+
+    static const vector<string>& phaseLabels()
+    {
+        static const vector<string> labels = { "rng", "path", "payoff", "backward", "wait", "idle" };
+        return labels;
+    }
+
+    static const vector<string>& countLabels()
+    {
+        static const vector<string> labels = { "tasks", "steals", "tapeNodes" };
+        return labels;
+    }
+};
+
+//  Time stamp, in cycles where available
+inline uint64_t profileClock()
+{
+#if MCPROFILE && (defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__))
+    return __rdtsc();
+#else
+    return uint64_t(chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+class Profiler
+{
+    //  Threads beyond share the last slot
+    static constexpr size_t maxThreads = 256;
+
+    //  Counters of a thread, on its own cache line
+    struct alignas(64) Slot
+    {
+        array<atomic<uint64_t>, numProfilePhases>   cycles;
+        array<atomic<uint64_t>, numProfileCounts>   counts;
+    };
+
+    Slot                    mySlots[maxThreads];
+
+    //  Number of slots in use
+    atomic<size_t>          myThreads;
+
+    //  Nesting of runs, only the outermost collects
+    atomic<size_t>          myDepth;
+
+    //  Last run, for diagnostics
+    mutex                   myMutex;
+    RunStats                myLast;
+
+    static size_t& threadSlot()
+    {
+        static thread_local size_t slot = 0;
+        return slot;
+    }
+
+    Slot& slot()
+    {
+        return mySlots[threadSlot()];
+    }
+
+    Profiler() : myThreads(1), myDepth(0)
+    {
+        reset();
+    }
+
+public:
+
+    static Profiler& instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    //  Slot of the calling thread, called by the workers of the pool
+    void setThread(const size_t num)
+    {
+        const size_t s = min(num, maxThreads - 1);
+        threadSlot() = s;
+        size_t n = myThreads.load();
+        while (n < s + 1 && !myThreads.compare_exchange_weak(n, s + 1)) {}
+    }
+
+    void add(const ProfilePhase phase, const uint64_t cycles)
+    {
+        slot().cycles[size_t(phase)].fetch_add(cycles, memory_order_relaxed);
+    }
+
+    void add(const ProfileCount count, const uint64_t n)
+    {
+        slot().counts[size_t(count)].fetch_add(n, memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        for (auto& s : mySlots)
+        {
+            for (auto& c : s.cycles) c.store(0, memory_order_relaxed);
+            for (auto& c : s.counts) c.store(0, memory_order_relaxed);
+        }
+    }
+
+    RunStats collect() const
+    {
+        RunStats stats;
+        const size_t n = myThreads.load();
+        stats.cycles.resize(n);
+        stats.counts.resize(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            for (size_t j = 0; j < numProfilePhases; ++j)
+            {
+                stats.cycles[i][j] = mySlots[i].cycles[j].load(memory_order_relaxed);
+            }
+            for (size_t j = 0; j < numProfileCounts; ++j)
+            {
+                stats.counts[i][j] = mySlots[i].counts[j].load(memory_order_relaxed);
+            }
+        }
+        return stats;
+    }
+
+    //  Runs
+    bool enter()
+    {
+        return myDepth++ == 0;
+    }
+
+    void leave(const RunStats* stats)
+    {
+        if (stats)
+        {
+            lock_guard<mutex> lk(myMutex);
+            myLast = *stats;
+        }
+        --myDepth;
+    }
+
+    //  Statistics of the last run
+    RunStats last()
+    {
+        lock_guard<mutex> lk(myMutex);
+        return myLast;
+    }
+};
+
+//  Cycles of a phase, on scope
+class ProfileScope
+{
+    const ProfilePhase  myPhase;
+    const uint64_t      myStart;
+
+public:
+
+    ProfileScope(const ProfilePhase phase) : myPhase(phase), myStart(profileClock()) {}
+
+    ~ProfileScope()
+    {
+        Profiler::instance().add(myPhase, profileClock() - myStart);
+    }
+};
+
+//  Profiled run, on scope
+//  The outermost run resets the counters, and collects them in stats()
+//  Nested runs, like the valuations of bumpRisk(), count in the outer one
+class ProfileRun
+{
+    const bool                                  myOuter;
+    const chrono::steady_clock::time_point      myStart;
+    bool                                        myDone = false;
+
+public:
+
+    ProfileRun() : myOuter(Profiler::instance().enter()), myStart(chrono::steady_clock::now())
+    {
+#if MCPROFILE
+        if (myOuter) Profiler::instance().reset();
+#endif
+    }
+
+    ~ProfileRun()
+    {
+        if (!myDone) Profiler::instance().leave(nullptr);
+    }
+
+    //  Statistics of the run, once, at the end
+    RunStats stats()
+    {
+        RunStats stats;
+#if MCPROFILE
+        if (myOuter) stats = Profiler::instance().collect();
+#endif
+        stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - myStart).count();
+
+        if (!myDone)
+        {
+            myDone = true;
+            Profiler::instance().leave(myOuter ? &stats : nullptr);
+        }
+        return stats;
+    }
+};
+
+#if MCPROFILE
+
+//  Statement timed in a phase, PROFILE(rng, rng.nextG(gaussVec))
+#define PROFILE(phase, ...)     { ProfileScope profileScope(ProfilePhase::phase); __VA_ARGS__; }
+//  Rest of the scope timed in a phase
+#define PROFILE_SCOPE(phase)    ProfileScope profileScope(ProfilePhase::phase)
+//  Add to a count
+#define PROFILE_COUNT(count, n) Profiler::instance().add(ProfileCount::count, n)
+//  Slot of a worker thread
+#define PROFILE_THREAD(num)     Profiler::instance().setThread(num)
+
+#else
+
+#define PROFILE(phase, ...)     { __VA_ARGS__; }
+#define PROFILE_SCOPE(phase)
+#define PROFILE_COUNT(count, n)
+#define PROFILE_THREAD(num)
+
+#endif
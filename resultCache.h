@@ -0,0 +1,164 @@
+/*
+Written by Antoine Savine in 2018
+
+This code is the strict IP of Antoine Savine
+
+License to use and alter this code for personal and commercial applications
+is freely granted to any person or company who purchased a copy of the book
+
+Modern Computational Finance: AAD and Parallel Simulations
+Antoine Savine
+Wiley, 2018
+
+As long as this comment is preserved at the top of the file
+*/
+
+#pragma once
+
+//  Cache of results, see value() and the risk functions in main.h
+
+//  Keys are strings built from content hashes of the model and product definitions,
+//      see definitionHash() in store.h, the numerical parameters and the arguments,
+//      so that a model or product put again in the store is a new key,
+//      and the same definition under another id is the same key
+//  Values are results of any type, copied in and out, shared between threads
+//  Memory is bounded: least recently used results are evicted first
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+using namespace std;
+
+class ResultCache
+{
+    struct Entry
+    {
+        string                  key;
+        shared_ptr<const void>  value;
+        size_t                  bytes;
+    };
+
+    mutable mutex                                   myMutex;
+
+    //  Most recently used first
+    list<Entry>                                     myEntries;
+    unordered_map<string, list<Entry>::iterator>    myIndex;
+
+    size_t                                          myBytes = 0;
+    size_t                                          myMaxBytes;
+
+    //  Diagnostics
+    size_t                                          myHits = 0;
+    size_t                                          myMisses = 0;
+    size_t                                          myEvictions = 0;
+
+    //  Evict until within budget, caller must hold the mutex
+    void trim()
+    {
+        while (myBytes > myMaxBytes && !myEntries.empty())
+        {
+            myBytes -= myEntries.back().bytes;
+            myIndex.erase(myEntries.back().key);
+            myEntries.pop_back();
+            ++myEvictions;
+        }
+    }
+
+public:
+
+    ResultCache(const size_t maxBytes) : myMaxBytes(maxBytes) {}
+
+    //  Find a result, copied into value, false if not found
+    //  T must be the type the result was inserted with
+    template <class T>
+    bool find(const string& key, T& value)
+    {
+        lock_guard<mutex> lk(myMutex);
+
+        auto it = myIndex.find(key);
+        if (it == myIndex.end())
+        {
+            ++myMisses;
+            return false;
+        }
+
+        //  Most recently used
+        myEntries.splice(myEntries.begin(), myEntries, it->second);
+        value = *static_pointer_cast<const T>(it->second->value);
+        ++myHits;
+        return true;
+    }
+
+    //  Insert or replace a result of the given approximate size
+    //  Results larger than the budget are not cached
+    template <class T>
+    void insert(const string& key, const T& value, const size_t bytes)
+    {
+        lock_guard<mutex> lk(myMutex);
+
+        auto it = myIndex.find(key);
+        if (it != myIndex.end())
+        {
+            myBytes -= it->second->bytes;
+            myEntries.erase(it->second);
+            myIndex.erase(it);
+        }
+
+        const size_t total = bytes + 2 * key.size() + sizeof(Entry);
+        if (total > myMaxBytes) return;
+
+        myEntries.push_front(Entry{ key, make_shared<const T>(value), total });
+        myIndex[key] = myEntries.begin();
+        myBytes += total;
+
+        trim();
+    }
+
+    //  Change the budget, 0 disables the cache
+    void setMaxBytes(const size_t maxBytes)
+    {
+        lock_guard<mutex> lk(myMutex);
+        myMaxBytes = maxBytes;
+        trim();
+    }
+
+    bool enabled() const
+    {
+        lock_guard<mutex> lk(myMutex);
+        return myMaxBytes > 0;
+    }
+
+    //  Empty the cache and reset the diagnostics
+    void clear()
+    {
+        lock_guard<mutex> lk(myMutex);
+        myEntries.clear();
+        myIndex.clear();
+        myBytes = 0;
+        myHits = myMisses = myEvictions = 0;
+    }
+
+    //  Diagnostics
+    struct Stats
+    {
+        size_t  hits;
+        size_t  misses;
+        size_t  evictions;
+        size_t  entries;
+        size_t  bytes;
+        size_t  maxBytes;
+
+        double hitRate() const
+        {
+            return hits + misses ? double(hits) / (hits + misses) : 0.0;
+        }
+    };
+
+    Stats stats() const
+    {
+        lock_guard<mutex> lk(myMutex);
+        return Stats{ myHits, myMisses, myEvictions, myEntries.size(), myBytes, myMaxBytes };
+    }
+};
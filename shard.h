@@ -0,0 +1,522 @@
+/*
+Written by Antoine Savine in 2018
+
+This code is the strict IP of Antoine Savine
+
+License to use and alter this code for personal and commercial applications
+is freely granted to any person or company who purchased a copy of the book
+
+Modern Computational Finance: AAD and Parallel Simulations
+Antoine Savine
+Wiley, 2018
+
+As long as this comment is preserved at the top of the file
+*/
+
+#pragma once
+
+//  Path sharding
+//  Split one simulation [0, nPath) into shards of whole slots of tasks, see TaskSlots in mcBase.h,
+//      that run independently, on different processes or machines,
+//      each with the same model and product definition
+
+//  Valuation: the shards return statistics by slot,
+//      which are reduced in slot order,
+//      so the results are the same, bit for bit,
+//      as value() with the same batch size, for any number of shards
+
+//  AAD risks: the shards return sums over their paths,
+//      reduced in shard order
+//  The results match AADriskAggregate() to rounding only, not bit for bit:
+//      the sums are not accumulated in the same order, 
+//      and adjoints are summed by thread, as in mcParallelSimulAAD()
+
+//  A shard request is the model and product ids in the store,
+//      the numerical parameters and a PathShard (two numbers).
+//  Shard results are serialized to binary streams, see serialize() below, 
+//      so any message passing or batch scheduling system can carry them.
+
+//  All shards must run with the same batch size,
+//      fixed in the numerical parameters by the coordinator
+//      so that task boundaries don't depend on a node's number of threads
+
+#include "main.h"
+#include <istream>
+#include <ostream>
+#include <cstdint>
+
+//  A range of paths
+struct PathShard
+{
+    size_t  firstPath;
+    size_t  numPath;
+};
+
+//  Split [0, nPath) into at most nShard shards of whole slots of tasks
+inline vector<PathShard> shardPaths(
+    const size_t    nPath,
+    const size_t    nShard,
+    //  Paths per task
+    const size_t    batchSz)
+{
+    const TaskSlots slots(nPath, batchSz);
+    const size_t slotsPerShard = (slots.nSlot + nShard - 1) / nShard;
+    const size_t pathsPerShard = slotsPerShard * slots.pathsPerSlot();
+
+    vector<PathShard> shards;
+    for (size_t firstPath = 0; firstPath < nPath; firstPath += pathsPerShard)
+    {
+        shards.push_back({ firstPath, min(nPath, firstPath + pathsPerShard) - firstPath });
+    }
+
+    return shards;
+}
+
+//  Slots of a shard, the same as the slots of the whole simulation
+inline TaskSlots shardSlots(
+    const NumericalParam&   num,
+    const PathShard&        shard)
+{
+    const TaskSlots slots(num.numPath, num.batchSize);
+    if (shard.firstPath % slots.pathsPerSlot())
+    {
+        throw runtime_error("shardSlots() : shard does not start on a slot");
+    }
+    return TaskSlots(shard.numPath, num.batchSize, slots.tasksPerSlot);
+}
+
+//  Batch size for sharded runs
+//  The one in the numerical parameters if set, otherwise automatic
+template <class T>
+inline size_t shardBatchSize(
+    const Model<T>&         model,
+    const Product<T>&       product,
+    const NumericalParam&   num)
+{
+    size_t batchSz = num.batchSize;
+    if (!batchSz)
+    {
+        auto cMdl = model.clone();
+        cMdl->allocate(product.timeline(), product.defline());
+        batchSz = batchSize(
+            num.numPath,
+            cMdl->simDim(),
+            product.payoffLabels().size(),
+            ThreadPool::getInstance()->numThreads());
+    }
+
+    //  Antithetic pairs don't straddle tasks, same as mcParallelSimulStats()
+    if (makeRng(num)->antithetic() && batchSz % 2) ++batchSz;
+
+    return batchSz;
+}
+
+//  Valuation
+//  =========
+
+//  Partial result of a valuation: statistics by slot
+struct ValueShard
+{
+    PathShard           shard;
+    vector<SimulStats>  slotStats;
+};
+
+//  Worker side: value one shard
+//  num.batchSize must be set
+inline ValueShard valueShard(
+    const string&           modelId,
+    const string&           productId,
+    const NumericalParam&   num,
+    const PathShard&        shard)
+{
+    const auto model = getModel<double>(modelId);
+    const auto product = getProduct<double>(productId);
+
+    if (!model || !product)
+    {
+        throw runtime_error("valueShard() : Could not retrieve model and product");
+    }
+    if (num.batchSize <= 0)
+    {
+        throw runtime_error("valueShard() : batch size must be set for sharding");
+    }
+
+    auto rng = makeRng(num);
+
+    //  Variance reduction, same as value()
+    VarReduction varRed;
+    varRed.antithetic = rng->antithetic();
+    if (num.controlVariate) analyticControl(*model, *product, varRed);
+
+    if (varRed.antithetic && num.batchSize % 2)
+    {
+        throw runtime_error("valueShard() : batch size must be even with antithetic paths");
+    }
+
+    ValueShard results;
+    results.shard = shard;
+    results.slotStats = mcParallelSimulTaskStats(
+        *product, *model, *rng, shard.firstPath, shard.numPath, num.batchSize,
+        false, varRed, shardSlots(num, shard).tasksPerSlot);
+
+    return results;
+}
+
+//  Coordinator side: reduce
+//  Same results as value() with the same batch size
+inline ValueResults reduceValueShards(
+    const string&               productId,
+    vector<ValueShard>          shards)
+{
+    const auto product = getProduct<double>(productId);
+
+    if (!product)
+    {
+        throw runtime_error("reduceValueShards() : Could not retrieve product");
+    }
+
+    //  Slot order
+    sort(shards.begin(), shards.end(),
+        [](const ValueShard& lhs, const ValueShard& rhs)
+        {
+            return lhs.shard.firstPath < rhs.shard.firstPath;
+        });
+
+    //  The variance reduction is the one of the slots, see SimulStats::merge()
+    SimulStats stats(product->payoffLabels().size());
+    for (const auto& shard : shards)
+    {
+        for (const auto& ss : shard.slotStats) stats.merge(ss);
+    }
+
+    //  Same as value()
+    ValueResults results;
+    results.identifiers = product->payoffLabels();
+    results.values = stats.values();
+    results.errors = stats.stdErrs();
+    results.numPath = stats.numPath;
+
+    return results;
+}
+
+//  Runs all the shards here, one after the other, and reduces
+//  Reference for distributed runs
+inline ValueResults valueSharded(
+    const string&           modelId,
+    const string&           productId,
+    const NumericalParam&   num,
+    const size_t            nShard)
+{
+    const auto model = getModel<double>(modelId);
+    const auto product = getProduct<double>(productId);
+
+    if (!model || !product)
+    {
+        throw runtime_error("valueSharded() : Could not retrieve model and product");
+    }
+
+    NumericalParam shardNum = num;
+    shardNum.batchSize = int(shardBatchSize(*model, *product, num));
+
+    vector<ValueShard> results;
+    for (const auto& shard : shardPaths(num.numPath, nShard, shardNum.batchSize))
+    {
+        results.push_back(valueShard(modelId, productId, shardNum, shard));
+    }
+
+    return reduceValueShards(productId, move(results));
+}
+
+//  AAD risk, aggregate portfolio
+//  =============================
+
+//  Partial result of an AAD risk: sums over the paths of the shard
+struct AADShard
+{
+    PathShard               shard;
+    //  [payoff]
+    vector<double>          payoffSums;
+    double                  aggregatedSum = 0.0;
+    //  [param]
+    vector<double>          riskSums;
+};
+
+//  Worker side: AAD risk of one shard
+//  num.batchSize must be set
+inline AADShard AADriskAggregateShard(
+    const string&               modelId,
+    const string&               productId,
+    const map<string, double>&  notionals,
+    const NumericalParam&       num,
+    const PathShard&            shard)
+{
+    const auto model = getModel<Number>(modelId);
+    const auto product = getProduct<Number>(productId);
+
+    if (!model || !product)
+    {
+        throw runtime_error("AADriskAggregateShard() : Could not retrieve model and product");
+    }
+    if (num.batchSize <= 0)
+    {
+        throw runtime_error("AADriskAggregateShard() : batch size must be set for sharding");
+    }
+
+    auto rng = makeRng(num);
+
+    //  Vector of notionals, same as AADriskAggregate()
+    const vector<string>& allPayoffs = product->payoffLabels();
+    vector<double> vnots(allPayoffs.size(), 0.0);
+    for (const auto& notional : notionals)
+    {
+        auto it = find(allPayoffs.begin(), allPayoffs.end(), notional.first);
+        if (it == allPayoffs.end())
+        {
+            throw runtime_error("AADriskAggregateShard() : payoff not found");
+        }
+        vnots[distance(allPayoffs.begin(), it)] = notional.second;
+    }
+
+    auto aggregator = [&vnots](const vector<Number>& payoffs)
+    {
+        return Number::weightedSum(payoffs.begin(), payoffs.end(), vnots.begin());
+    };
+
+    //  Simulate the paths of the shard
+    //  One propagation from mark to start by thread, see mcParallelSimulAAD()
+    const auto simulResults = mcParallelSimulAAD(*product, *model, *rng, shard.numPath, 
+        aggregator, num.batchSize, nullptr, shard.firstPath);
+
+    //  Sum over the paths, in order
+    AADShard results;
+    results.shard = shard;
+    results.payoffSums.assign(allPayoffs.size(), 0.0);
+    for (const auto& pays : simulResults.payoffs)
+    {
+        for (size_t j = 0; j < pays.size(); ++j) results.payoffSums[j] += pays[j];
+    }
+    results.aggregatedSum = accumulate(
+        simulResults.aggregated.begin(), simulResults.aggregated.end(), 0.0);
+    //  Risks are averages over the shard's paths
+    results.riskSums.resize(simulResults.risks.size());
+    transform(simulResults.risks.begin(), simulResults.risks.end(), results.riskSums.begin(),
+        [&shard](const double risk) { return risk * shard.numPath; });
+
+    return results;
+}
+
+//  Coordinator side: reduce
+//  Same results as AADriskAggregate() to rounding
+inline AADRiskResults reduceAADShards(
+    const string&               modelId,
+    const string&               productId,
+    vector<AADShard>            shards)
+{
+    const auto model = getModel<Number>(modelId);
+    const auto product = getProduct<Number>(productId);
+
+    if (!model || !product)
+    {
+        throw runtime_error("reduceAADShards() : Could not retrieve model and product");
+    }
+
+    //  Shard order
+    sort(shards.begin(), shards.end(),
+        [](const AADShard& lhs, const AADShard& rhs)
+        {
+            return lhs.shard.firstPath < rhs.shard.firstPath;
+        });
+
+    const size_t nPay = product->payoffLabels().size();
+    const size_t nParam = model->numParams();
+
+    //  Sum over shards, in order
+    size_t nPath = 0;
+    vector<double> paySums(nPay, 0.0);
+    double aggSum = 0.0;
+    vector<double> riskSums(nParam, 0.0);
+    for (const auto& shard : shards)
+    {
+        if (shard.payoffSums.size() != nPay || shard.riskSums.size() != nParam)
+        {
+            throw runtime_error("reduceAADShards() : shard does not match model and product");
+        }
+        nPath += shard.shard.numPath;
+        for (size_t j = 0; j < nPay; ++j) paySums[j] += shard.payoffSums[j];
+        aggSum += shard.aggregatedSum;
+        for (size_t j = 0; j < nParam; ++j) riskSums[j] += shard.riskSums[j];
+    }
+
+    AADRiskResults results;
+
+    results.payoffIds = product->payoffLabels();
+    results.payoffValues.resize(nPay);
+    transform(paySums.begin(), paySums.end(), results.payoffValues.begin(),
+        [nPath](const double sum) { return sum / nPath; });
+    results.riskPayoffValue = aggSum / nPath;
+    results.paramIds = model->parameterLabels();
+    results.risks.resize(nParam);
+    transform(riskSums.begin(), riskSums.end(), results.risks.begin(),
+        [nPath](const double sum) { return sum / nPath; });
+
+    return results;
+}
+
+//  Runs all the shards here, one after the other, and reduces
+//  Reference for distributed runs
+inline AADRiskResults AADriskAggregateSharded(
+    const string&               modelId,
+    const string&               productId,
+    const map<string, double>&  notionals,
+    const NumericalParam&       num,
+    const size_t                nShard)
+{
+    const auto model = getModel<Number>(modelId);
+    const auto product = getProduct<Number>(productId);
+
+    if (!model || !product)
+    {
+        throw runtime_error("AADriskAggregateSharded() : Could not retrieve model and product");
+    }
+
+    NumericalParam shardNum = num;
+    shardNum.batchSize = int(shardBatchSize(*model, *product, num));
+
+    vector<AADShard> results;
+    for (const auto& shard : shardPaths(num.numPath, nShard, shardNum.batchSize))
+    {
+        results.push_back(
+            AADriskAggregateShard(modelId, productId, notionals, shardNum, shard));
+    }
+
+    return reduceAADShards(modelId, productId, move(results));
+}
+
+//  Serialization
+//  =============
+
+//  Shard results to and from binary streams, opened in binary mode
+//  Native sizes and byte order: coordinator and workers run the same build
+
+//  Tags identify the type of result and the layout version
+constexpr uint32_t VALUESHARDTAG = 0x31535643;     //  "CVS1"
+constexpr uint32_t AADSHARDTAG = 0x31534143;       //  "CAS1"
+
+template <class T>
+inline void serializeNum(ostream& os, const T x)
+{
+    os.write(reinterpret_cast<const char*>(&x), sizeof(T));
+}
+
+template <class T>
+inline T deserializeNum(istream& is)
+{
+    T x;
+    is.read(reinterpret_cast<char*>(&x), sizeof(T));
+    if (!is) throw runtime_error("deserialize() : truncated shard result");
+    return x;
+}
+
+inline void serializeVec(ostream& os, const vector<double>& v)
+{
+    serializeNum<uint64_t>(os, v.size());
+    os.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(double));
+}
+
+inline vector<double> deserializeVec(istream& is)
+{
+    const uint64_t n = deserializeNum<uint64_t>(is);
+    //  Guard against corrupt sizes before we allocate
+    if (n > (uint64_t(1) << 32)) throw runtime_error("deserialize() : corrupt shard result");
+    vector<double> v(static_cast<size_t>(n));
+    is.read(reinterpret_cast<char*>(v.data()), v.size() * sizeof(double));
+    if (!is) throw runtime_error("deserialize() : truncated shard result");
+    return v;
+}
+
+inline void serialize(ostream& os, const PathShard& shard)
+{
+    serializeNum<uint64_t>(os, shard.firstPath);
+    serializeNum<uint64_t>(os, shard.numPath);
+}
+
+inline void deserialize(istream& is, PathShard& shard)
+{
+    shard.firstPath = size_t(deserializeNum<uint64_t>(is));
+    shard.numPath = size_t(deserializeNum<uint64_t>(is));
+}
+
+//  All the state of the statistics, so they merge as the originals
+inline void serialize(ostream& os, const SimulStats& stats)
+{
+    serializeNum<uint64_t>(os, stats.numPath);
+    serializeVec(os, stats.means);
+    serializeVec(os, stats.sqDevs);
+    serializeNum<uint8_t>(os, stats.varReduction.antithetic);
+    serializeNum<uint64_t>(os, stats.varReduction.control);
+    serializeNum<double>(os, stats.varReduction.controlValue);
+    serializeNum<uint64_t>(os, stats.numObs);
+    serializeVec(os, stats.obsMeans);
+    serializeVec(os, stats.obsSqDevs);
+    serializeVec(os, stats.obsCoDevs);
+    serializeNum<uint8_t>(os, stats.hasPending);
+    serializeVec(os, stats.pending);
+}
+
+inline void deserialize(istream& is, SimulStats& stats)
+{
+    stats.numPath = size_t(deserializeNum<uint64_t>(is));
+    stats.means = deserializeVec(is);
+    stats.sqDevs = deserializeVec(is);
+    stats.varReduction.antithetic = deserializeNum<uint8_t>(is) != 0;
+    stats.varReduction.control = size_t(deserializeNum<uint64_t>(is));
+    stats.varReduction.controlValue = deserializeNum<double>(is);
+    stats.numObs = size_t(deserializeNum<uint64_t>(is));
+    stats.obsMeans = deserializeVec(is);
+    stats.obsSqDevs = deserializeVec(is);
+    stats.obsCoDevs = deserializeVec(is);
+    stats.hasPending = deserializeNum<uint8_t>(is) != 0;
+    stats.pending = deserializeVec(is);
+}
+
+inline void serialize(ostream& os, const ValueShard& result)
+{
+    serializeNum<uint32_t>(os, VALUESHARDTAG);
+    serialize(os, result.shard);
+    serializeNum<uint64_t>(os, result.slotStats.size());
+    for (const auto& stats : result.slotStats) serialize(os, stats);
+}
+
+inline void deserialize(istream& is, ValueShard& result)
+{
+    if (deserializeNum<uint32_t>(is) != VALUESHARDTAG)
+    {
+        throw runtime_error("deserialize() : not a value shard");
+    }
+    deserialize(is, result.shard);
+    const uint64_t nSlot = deserializeNum<uint64_t>(is);
+    if (nSlot > MAXSLOTS) throw runtime_error("deserialize() : corrupt shard result");
+    result.slotStats.resize(size_t(nSlot));
+    for (auto& stats : result.slotStats) deserialize(is, stats);
+}
+
+inline void serialize(ostream& os, const AADShard& result)
+{
+    serializeNum<uint32_t>(os, AADSHARDTAG);
+    serialize(os, result.shard);
+    serializeVec(os, result.payoffSums);
+    serializeNum<double>(os, result.aggregatedSum);
+    serializeVec(os, result.riskSums);
+}
+
+inline void deserialize(istream& is, AADShard& result)
+{
+    if (deserializeNum<uint32_t>(is) != AADSHARDTAG)
+    {
+        throw runtime_error("deserialize() : not an AAD shard");
+    }
+    deserialize(is, result.shard);
+    result.payoffSums = deserializeVec(is);
+    result.aggregatedSum = deserializeNum<double>(is);
+    result.riskSums = deserializeVec(is);
+}
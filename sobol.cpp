@@ -3670,3 +3670,45 @@ const unsigned * const * getjkDir()
 {
     return jkDir;
 }
+
+//  Directions of the Sobol generators, see sobol.h
+
+#include "sobol.h"
+#include <fstream>
+
+//  Number of dimensions in the table
+static_assert(sizeof(jkDir1) == sizeof(jkDir32), "Sobol directions : rows of different sizes");
+
+size_t getjkDim()
+{
+    return sizeof(jkDir1) / sizeof(jkDir1[0]);
+}
+
+static mutex sobolDirMutex;
+static shared_ptr<const SobolDirections> sobolDirs;
+
+shared_ptr<const SobolDirections> sobolDirections()
+{
+    lock_guard<mutex> lk(sobolDirMutex);
+    if (!sobolDirs) sobolDirs = make_shared<const SobolDirections>();
+    return sobolDirs;
+}
+
+//  Generators already initialized keep their directions
+void setSobolDirections(shared_ptr<const SobolDirections> dirs)
+{
+    lock_guard<mutex> lk(sobolDirMutex);
+    sobolDirs = move(dirs);
+}
+
+size_t loadSobolDirections(const string& file, const size_t maxDim)
+{
+    ifstream ifs(file);
+    if (!ifs) throw runtime_error("loadSobolDirections() : could not open " + file);
+
+    auto dirs = make_shared<const SobolDirections>(ifs, maxDim);
+    const size_t dim = dirs->dim();
+    setSobolDirections(move(dirs));
+
+    return dim;
+}
@@ -22,10 +22,137 @@ As long as this comment is preserved at the top of the file
 
 #include "mcBase.h"
 #include "gaussians.h"
+#include <istream>
+#include <mutex>
 
 #define ONEOVER2POW32 2.3283064365387E-10
 
 const unsigned * const * getjkDir();
+//  Number of dimensions of the table of sobol.cpp
+size_t getjkDim();
+
+//  Number of direction numbers by dimension, bits of the sequence
+constexpr size_t SOBOLBITS = 32;
+
+//  Direction numbers of Sobol's sequence, bit major:
+//      row i holds the i-th (0 to 31) direction number of every dimension,
+//      so next() and skipTo() XOR contiguous rows into the state
+//  Rows are 64-byte aligned and padded to a multiple of 16 dimensions
+//  Built from the table of sobol.cpp (1101 dimensions), 
+//      or from the initializers of a file of Joe and Kuo,
+//      for example new-joe-kuo-6.21201 (21201 dimensions), 
+//      see https://web.maths.unsw.edu.au/~fkuo/sobol/
+class SobolDirections
+{
+    //  Number of dimensions and padded row length
+    size_t                      myDim;
+    size_t                      myStride;
+
+    //  Storage, over-allocated for alignment, and the aligned rows
+    vector<unsigned>            myStorage;
+    unsigned*                   myRows;
+
+    void allocate(const size_t dim)
+    {
+        constexpr size_t perLine = 64 / sizeof(unsigned);
+        myDim = dim;
+        myStride = (dim + perLine - 1) / perLine * perLine;
+        myStorage.assign(SOBOLBITS * myStride + perLine, 0);
+        const size_t misalign = reinterpret_cast<uintptr_t>(myStorage.data()) % 64;
+        myRows = myStorage.data() + (misalign ? (64 - misalign) / sizeof(unsigned) : 0);
+    }
+
+public:
+
+    //  From the table of sobol.cpp
+    SobolDirections()
+    {
+        const unsigned * const * jkDir = getjkDir();
+        allocate(getjkDim());
+        for (size_t i = 0; i < SOBOLBITS; ++i)
+        {
+            copy(jkDir[i], jkDir[i] + myDim, myRows + i * myStride);
+        }
+    }
+
+    //  From a file of initializers: a header line, then one line per dimension 2, 3, ...
+    //      d s a m1 ... ms
+    //  with s the degree and a the coefficients of the primitive polynomial, 
+    //      and m1 ... ms the initial direction numbers
+    //  Dimension 1 is van der Corput's
+    //  The first maxDim dimensions, 0 = all
+    SobolDirections(istream& is, const size_t maxDim = 0)
+    {
+        string header;
+        getline(is, header);
+
+        //  Initializers
+        vector<unsigned> degrees, polys;
+        vector<vector<unsigned>> inits;
+        unsigned d, s, a;
+        while ((!maxDim || degrees.size() + 1 < maxDim) && is >> d >> s >> a)
+        {
+            vector<unsigned> m(s);
+            for (auto& mi : m) is >> mi;
+            if (!is || !s) throw runtime_error("SobolDirections : invalid initializers");
+            degrees.push_back(s);
+            polys.push_back(a);
+            inits.push_back(move(m));
+        }
+
+        allocate(degrees.size() + 1);
+
+        //  Dimension 1: v(i) = 2^(31-i)
+        for (size_t i = 0; i < SOBOLBITS; ++i) myRows[i * myStride] = 1u << (SOBOLBITS - 1 - i);
+
+        //  Other dimensions: Bratley and Fox's recurrence
+        vector<unsigned> v(SOBOLBITS);
+        for (size_t k = 1; k < myDim; ++k)
+        {
+            const unsigned deg = degrees[k - 1], poly = polys[k - 1];
+            const vector<unsigned>& m = inits[k - 1];
+
+            for (size_t i = 0; i < SOBOLBITS; ++i)
+            {
+                if (i < deg)
+                {
+                    v[i] = m[i] << (SOBOLBITS - 1 - i);
+                }
+                else
+                {
+                    v[i] = v[i - deg] ^ (v[i - deg] >> deg);
+                    for (size_t j = 1; j < deg; ++j)
+                    {
+                        if ((poly >> (deg - 1 - j)) & 1) v[i] ^= v[i - j];
+                    }
+                }
+                myRows[i * myStride + k] = v[i];
+            }
+        }
+    }
+
+    //  Rows point into the storage
+    SobolDirections(const SobolDirections&) = delete;
+    SobolDirections& operator=(const SobolDirections&) = delete;
+
+    size_t dim() const
+    {
+        return myDim;
+    }
+
+    //  Direction number i of all the dimensions
+    const unsigned* operator[](const size_t i) const
+    {
+        return myRows + i * myStride;
+    }
+};
+
+//  Directions of the Sobol generators initialized from now on, 
+//      the table of sobol.cpp unless set or loaded, nullptr restores it
+shared_ptr<const SobolDirections> sobolDirections();
+void setSobolDirections(shared_ptr<const SobolDirections> dirs);
+//  Load a file of Joe and Kuo, returns the number of dimensions
+size_t loadSobolDirections(const string& file, const size_t maxDim = 0);
 
 class Sobol : public RNG
 {
@@ -38,13 +165,39 @@ class Sobol : public RNG
     //  Current index in the sequence
     unsigned                    myIndex;
 
-    //  The direction numbers listed in sobol.cpp
-    //  Note jkDir[i][dim] gives the i-th (0 to 31) 
+    //  The direction numbers, shared by the clones
+    //  Note (*myDirs)[i][dim] gives the i-th (0 to 31) 
     //      direction number of dimension dim
-    const unsigned * const *    jkDir;
+    shared_ptr<const SobolDirections>
+                                myDirs;
+
+    //  Digital shift: the points are (state ^ shift + 0.5) / 2^32, 
+    //      random shifts by dimension, drawn from the seed
+    //  Skip ahead is unchanged
+    //  Without scrambling, shifts and offset are 0: the points are state / 2^32
+    bool                        myScramble;
+    unsigned                    mySeed;
+    vector<unsigned>            myShift;
+    double                      myOffset;
+
+    //  Shift of dimension i, splitmix64 of the seed and the dimension
+    static unsigned shift(const unsigned seed, const size_t i)
+    {
+        uint64_t z = (uint64_t(seed) << 32) + i + 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return unsigned((z ^ (z >> 31)) >> 32);
+    }
+
+    //  Workspace for blocks of uniforms
+    matrix<double>              myUniforms;
 
 public:
 
+    //  Scrambled with a digital shift, from the seed
+    Sobol(const bool scramble = false, const unsigned seed = 0) : 
+        myDim(0), myIndex(0), myScramble(scramble), mySeed(seed), myOffset(0.0) {}
+
     //  Virtual copy constructor
     unique_ptr<RNG> clone() const override
     {
@@ -54,13 +207,24 @@ public:
     //  Initializer 
     void init(const size_t simDim) override
     {
-        //  Set pointer on direction numbers 
-        jkDir = getjkDir();
+        //  Direction numbers 
+        myDirs = sobolDirections();
+        if (simDim > myDirs->dim())
+        {
+            throw runtime_error("Sobol::init() : dimension " + to_string(simDim) 
+                + " exceeds the " + to_string(myDirs->dim()) 
+                + " dimensions of the direction numbers, see loadSobolDirections()");
+        }
 
         //  Dimension
         myDim = simDim;
         myState.resize(myDim);
 
+        //  Scrambling
+        myShift.assign(myDim, 0);
+        if (myScramble) for (size_t i = 0; i < myDim; ++i) myShift[i] = shift(mySeed, i);
+        myOffset = myScramble ? 0.5 * ONEOVER2POW32 : 0.0;
+
         //  Reset to 0
         reset();
     }
@@ -86,7 +250,7 @@ public:
 		}
 
         //  Direction numbers
-        const unsigned* dirNums = jkDir[j];
+        const unsigned* dirNums = (*myDirs)[j];
 
 		//	XOR the appropriate direction number 
 		//		into each component of the integer sequence
@@ -102,40 +266,78 @@ public:
 	void nextU(vector<double>& uVec) override
 	{
 		next();
-		transform(myState.begin(), myState.end(), uVec.begin(),
-			[](const unsigned long i) 
-				{return ONEOVER2POW32 * i; });
+        for (size_t i = 0; i < myDim; ++i)
+        {
+            uVec[i] = ONEOVER2POW32 * (myState[i] ^ myShift[i]) + myOffset;
+        }
 	}
 
 	void nextG(vector<double>& gaussVec) override
     {
 		next();
-		transform(myState.begin(), myState.end(), gaussVec.begin(),
-			[](const unsigned long i) 
-				{return invNormalCdf(ONEOVER2POW32 * i); });
+        for (size_t i = 0; i < myDim; ++i)
+        {
+            gaussVec[i] = invNormalCdf(ONEOVER2POW32 * (myState[i] ^ myShift[i]) + myOffset);
+        }
+    }
+
+    //  Blocks of points, same numbers as nextU() / nextG() point by point
+
+    void nextUBlock(const size_t nPath, matrix<double>& uBlock) override
+    {
+        for (size_t p = 0; p < nPath; ++p)
+        {
+            //  Gray code, loop over dimensions vectorizes
+            next();
+            for (size_t i = 0; i < myDim; ++i)
+            {
+                uBlock[i][p] = ONEOVER2POW32 * (myState[i] ^ myShift[i]) + myOffset;
+            }
+        }
+    }
+
+    void nextGBlock(const size_t nPath, matrix<double>& gaussBlock) override
+    {
+        //  Uniforms first
+        myUniforms.resize(myDim, gaussBlock.cols());
+        nextUBlock(nPath, myUniforms);
+
+        //  Then inverse CDF, dimension by dimension, over contiguous paths
+        for (size_t i = 0; i < myDim; ++i)
+        {
+            invNormalCdfBlock(myUniforms[i], nPath, gaussBlock[i]);
+        }
     }
 
     //  Skip ahead (from 0 to b)
-    void skipTo(const unsigned b) override
+    void skipTo(const size_t b) override
     {
+        //	Reset Sobol to 0 
+        reset();
+
         //	Check skip
         if (!b) return;
 
-        //	Reset Sobol to 0 
-        reset();
+        //  32bit sequence: 2^32 points
+        if (b >> SOBOLBITS)
+        {
+            throw runtime_error("Sobol::skipTo() : skip beyond the 2^32 points of the sequence");
+        }
 
         //	The actual Sobol skipping algo
-        unsigned im = b;
-        unsigned two_i = 1, two_i_plus_one = 2;
+        //  64bit arithmetic, 2^(i+1) overflows 32bit for b >= 2^31
+        const uint64_t im = b;
+        uint64_t two_i = 1, two_i_plus_one = 2;
 
         unsigned i = 0;
         while (two_i <= im)
         {
             if (((im + two_i) / two_i_plus_one) & 1)
             {
+                const unsigned* dirNums = (*myDirs)[i];
                 for (unsigned k = 0; k<myDim; ++k)
                 {
-                    myState[k] ^= jkDir[i][k];
+                    myState[k] ^= dirNums[k];
                 }
             }
 
@@ -24,15 +24,199 @@ As long as this comment is preserved at the top of the file
 #include "mcPrd.h"
 #include <unordered_map>
 #include <memory>
+#include <atomic>
+#include <mutex>
+#include <sstream>
 using namespace std;
 
-using ModelStore =
-unordered_map<string, pair<unique_ptr<Model<double>>, unique_ptr<Model<Number>>>>;
-using ProductStore =
-unordered_map<string, pair<unique_ptr<Product<double>>, unique_ptr<Product<Number>>>>;
+//  Concurrent store
+//  Entries are immutable: a put builds a new entry and publishes it,
+//      readers hold the entry they found by shared pointer,
+//      so a valuation in flight keeps a stable snapshot of its model and product
+//      while a put replaces them under the same id
+//  The map is copy on write (RCU): readers atomically load the current map without locking,
+//      writers copy it under a mutex, change the copy and publish it
+//  Old maps and entries are released with their last reader
+
+//  Entry: one object for valuation, one for single precision valuation, 
+//      one for AAD risk, one for forward mode risk and one for second order risk, 
+//      with its version, changed on every put, 
+//      and content hash, see definitionHash()
+template <template <class> class Obj>
+struct StoreEntry
+{
+    unique_ptr<Obj<double>>     value;
+    unique_ptr<Obj<float>>      single;
+    unique_ptr<Obj<Number>>     risk;
+    unique_ptr<Obj<Dual>>       tangent;
+    unique_ptr<Obj<DualNumber>> second;
+    size_t                      version;
+    size_t                      hash;
+
+    template <class T>
+    const Obj<T>* get() const
+    {
+        if constexpr (is_same_v<T, double>) return value.get();
+        else if constexpr (is_same_v<T, float>) return single.get();
+        else if constexpr (is_same_v<T, Dual>) return tangent.get();
+        else if constexpr (is_same_v<T, DualNumber>) return second.get();
+        else return risk.get();
+    }
+};
+
+//  Snapshot of an entry, used like a pointer to the object
+//  The object stays alive as long as the reference, whatever happens to the store
+template <template <class> class Obj, class T>
+class StoreRef
+{
+    shared_ptr<const StoreEntry<Obj>>   myEntry;
+
+public:
+
+    StoreRef() {}
+    StoreRef(shared_ptr<const StoreEntry<Obj>> entry) : myEntry(move(entry)) {}
+
+    const Obj<T>* get() const { return myEntry ? myEntry->template get<T>() : nullptr; }
+    const Obj<T>& operator*() const { return *get(); }
+    const Obj<T>* operator->() const { return get(); }
+    explicit operator bool() const { return bool(myEntry); }
+
+    //  Same snapshot, object in another precision
+    template <class U>
+    StoreRef<Obj, U> as() const { return StoreRef<Obj, U>(myEntry); }
+
+    //  0 if empty
+    size_t version() const { return myEntry ? myEntry->version : 0; }
+    size_t hash() const { return myEntry ? myEntry->hash : 0; }
+};
+
+template <class T>
+using ModelRef = StoreRef<Model, T>;
+template <class T>
+using ProductRef = StoreRef<Product, T>;
+
+template <template <class> class Obj>
+class Store
+{
+    using Entry = StoreEntry<Obj>;
+    using Map = unordered_map<string, shared_ptr<const Entry>>;
+
+    //  Current map, read lock free
+    atomic<shared_ptr<const Map>>   myMap;
+
+    //  Writers
+    mutex                           myMutex;
+    size_t                          myVersion = 0;
+
+public:
+
+    Store() : myMap(make_shared<const Map>()) {}
+
+    //  nullptr if not found
+    shared_ptr<const Entry> find(const string& id) const
+    {
+        const shared_ptr<const Map> map = myMap.load();
+        auto it = map->find(id);
+        return it == map->end() ? nullptr : it->second;
+    }
+
+    void put(
+        const string&               id,
+        unique_ptr<Obj<double>>     value,
+        unique_ptr<Obj<float>>      single,
+        unique_ptr<Obj<Number>>     risk,
+        unique_ptr<Obj<Dual>>       tangent,
+        unique_ptr<Obj<DualNumber>> second,
+        const size_t                hash)
+    {
+        auto entry = make_shared<Entry>();
+        entry->value = move(value);
+        entry->single = move(single);
+        entry->risk = move(risk);
+        entry->tangent = move(tangent);
+        entry->second = move(second);
+        entry->hash = hash;
+
+        shared_ptr<const Map> old;
+        {
+            lock_guard<mutex> lk(myMutex);
+            entry->version = ++myVersion;
+            old = myMap.load();
+            auto map = make_shared<Map>(*old);
+            (*map)[id] = move(entry);
+            myMap.store(move(map));
+        }
+        //  Old map released outside the lock
+    }
+};
+
+Store<Model> modelStore;
+Store<Product> productStore;
 
-ModelStore modelStore;
-ProductStore productStore;
+//  Version of the model or product under every id, changed on every put
+//  Results cached against store ids check them, see RiskSession in main.h
+size_t modelVersion(const string& store)
+{
+    auto entry = modelStore.find(store);
+    return entry ? entry->version : 0;
+}
+
+size_t productVersion(const string& store)
+{
+    auto entry = productStore.find(store);
+    return entry ? entry->version : 0;
+}
+
+//  Content hash of the model or product under every id, 
+//      from the type and construction arguments
+//  Same definition, same hash, whatever the id or the number of puts
+//  Results cached by content use them, see ResultCache in main.h
+
+inline void hashArg(ostream& ost, const double x) { ost << x << ' '; }
+inline void hashArg(ostream& ost, const size_t x) { ost << x << ' '; }
+inline void hashArg(ostream& ost, const string& x) { ost << x.size() << ':' << x << ' '; }
+inline void hashArg(ostream& ost, const vector<double>& x)
+{
+    ost << x.size() << ':';
+    for (const double d : x) hashArg(ost, d);
+}
+inline void hashArg(ostream& ost, const matrixView<const double>& x)
+{
+    ost << x.rows() << 'x' << x.cols() << ':';
+    for (size_t i = 0; i < x.rows(); ++i)
+        for (size_t j = 0; j < x.cols(); ++j) hashArg(ost, x(i, j));
+}
+inline void hashArg(ostream& ost, const matrix<double>& x)
+{
+    hashArg(ost, x.view());
+}
+inline void hashArg(ostream& ost, const vector<string>& x)
+{
+    ost << x.size() << ':';
+    for (const auto& str : x) hashArg(ost, str);
+}
+
+template <class... Args>
+size_t definitionHash(const string& type, const Args&... args)
+{
+    ostringstream ost;
+    ost.precision(17);
+    ost << type << ' ';
+    (hashArg(ost, args), ...);
+    return hash<string>()(ost.str());
+}
+
+size_t modelHash(const string& store)
+{
+    auto entry = modelStore.find(store);
+    return entry ? entry->hash : 0;
+}
+
+size_t productHash(const string& store)
+{
+    auto entry = productStore.find(store);
+    return entry ? entry->hash : 0;
+}
 
 void putBlackScholes(
     const double            spot,
@@ -42,63 +226,89 @@ void putBlackScholes(
     const double            div,
     const string&           store)
 {
-    //  We create 2 models, one for valuation and one for risk
+    //  We create 5 models, for valuation in double and float, and for AAD, forward and second order risk
     unique_ptr<Model<double>> mdl = make_unique<BlackScholes<double>>(
         spot, vol, qSpot, rate, div);
+    unique_ptr<Model<float>> singleMdl = make_unique<BlackScholes<float>>(
+        spot, vol, qSpot, rate, div);
     unique_ptr<Model<Number>> riskMdl = make_unique<BlackScholes<Number>>(
         spot, vol, qSpot, rate, div);
+    unique_ptr<Model<Dual>> tangentMdl = make_unique<BlackScholes<Dual>>(
+        spot, vol, qSpot, rate, div);
+    unique_ptr<Model<DualNumber>> secondMdl = make_unique<BlackScholes<DualNumber>>(
+        spot, vol, qSpot, rate, div);
 
-    //  And move them into the map
-    modelStore[store] = make_pair(move(mdl), move(riskMdl));
+    //  And move them into the store
+    modelStore.put(store, move(mdl), move(singleMdl), move(riskMdl), 
+        move(tangentMdl), move(secondMdl), 
+        definitionHash("BlackScholes", spot, vol, double(qSpot), rate, div));
 }
 
 void putDupire(
     const double            spot,
     const vector<double>&   spots,
     const vector<Time>&     times,
-    //  spot major
-    const matrix<double>&   vols,
+    //  spot major, read in place, 
+    //      each of the 5 models copies it once into its own storage
+    const matrixView<const double>& vols,
     const double            maxDt,
-    const string&           store)
+    const string&           store,
+    //  Time steps between AAD checkpoints, 0 = none
+    const size_t            checkpointSteps = 0,
+    //  Time stepping scheme
+    const DupireScheme      scheme = DupireScheme::euler)
 {
-    //  We create 2 models, one for valuation and one for risk
+    //  We create 5 models, for valuation in double and float, and for AAD, forward and second order risk
+    //  Checkpointing only affects the AAD risk model
     unique_ptr<Model<double>> mdl = make_unique<Dupire<double>>(
-        spot, spots, times, vols, maxDt);
+        spot, spots, times, vols, maxDt, 0, scheme);
+    unique_ptr<Model<float>> singleMdl = make_unique<Dupire<float>>(
+        spot, spots, times, vols, maxDt, 0, scheme);
     unique_ptr<Model<Number>> riskMdl = make_unique<Dupire<Number>>(
-        spot, spots, times, vols, maxDt);
-
-    //  And move them into the map
-    modelStore[store] = make_pair(move(mdl), move(riskMdl));
+        spot, spots, times, vols, maxDt, checkpointSteps, scheme);
+    unique_ptr<Model<Dual>> tangentMdl = make_unique<Dupire<Dual>>(
+        spot, spots, times, vols, maxDt, 0, scheme);
+    unique_ptr<Model<DualNumber>> secondMdl = make_unique<Dupire<DualNumber>>(
+        spot, spots, times, vols, maxDt, 0, scheme);
+
+    //  And move them into the store
+    modelStore.put(store, move(mdl), move(singleMdl), move(riskMdl), 
+        move(tangentMdl), move(secondMdl), 
+        definitionHash("Dupire", spot, spots, times, vols, maxDt, 
+        checkpointSteps, size_t(scheme)));
 }
 
-template<class T>
-const Model<T>* getModel(const string& store);
-
-template<>
-const Model<double>* getModel(const string& store)
+void putDupire(
+    const double            spot,
+    const vector<double>&   spots,
+    const vector<Time>&     times,
+    const matrix<double>&   vols,
+    const double            maxDt,
+    const string&           store,
+    const size_t            checkpointSteps = 0,
+    const DupireScheme      scheme = DupireScheme::euler)
 {
-    auto it = modelStore.find(store);
-    if (it == modelStore.end()) return nullptr;
-    else return it->second.first.get();
+    putDupire(spot, spots, times, vols.view(), maxDt, store, checkpointSteps, scheme);
 }
 
-template<>
-const Model<Number>* getModel(const string& store)
+//  Snapshot of the model under an id, empty if not found
+template<class T>
+ModelRef<T> getModel(const string& store)
 {
-    auto it = modelStore.find(store);
-    if (it == modelStore.end()) return nullptr;
-    else return it->second.second.get();
+    return ModelRef<T>(modelStore.find(store));
 }
 
-pair<const vector<string>*, const vector<double*>*> getModelParameters(const string& store)
+//  Copies of the parameter labels and values
+pair<vector<string>, vector<double>> getModelParameters(const string& store)
 {
-    auto it = modelStore.find(store);
-    if (it == modelStore.end()) return make_pair(nullptr, nullptr);
-    else
-    {
-        auto* mdl = it->second.first.get();
-        return make_pair(&mdl->parameterLabels(),&mdl->parameters());
-    }
+    const ModelRef<double> mdl = getModel<double>(store);
+    if (!mdl) return {};
+
+    const vector<double*> params = const_cast<Model<double>*>(mdl.get())->parameters();
+    vector<double> values(params.size());
+    transform(params.begin(), params.end(), values.begin(), [](const double* p) { return *p; });
+
+    return make_pair(mdl->parameterLabels(), values);
 }
 
 void putEuropean(
@@ -107,14 +317,22 @@ void putEuropean(
     const Time              settlementDate,
     const string&           store)
 {
-    //  We create 2 products, one for valuation and one for risk
+    //  We create 5 products, for valuation in double and float, and for AAD, forward and second order risk
     unique_ptr<Product<double>> prd = make_unique<European<double>>(
         strike, exerciseDate, settlementDate);
+    unique_ptr<Product<float>> singlePrd = make_unique<European<float>>(
+        strike, exerciseDate, settlementDate);
     unique_ptr<Product<Number>> riskPrd = make_unique<European<Number>>(
         strike, exerciseDate, settlementDate);
+    unique_ptr<Product<Dual>> tangentPrd = make_unique<European<Dual>>(
+        strike, exerciseDate, settlementDate);
+    unique_ptr<Product<DualNumber>> secondPrd = make_unique<European<DualNumber>>(
+        strike, exerciseDate, settlementDate);
 
-    //  And move them into the map
-    productStore[store] = make_pair(move(prd), move(riskPrd));
+    //  And move them into the store
+    productStore.put(store, move(prd), move(singlePrd), move(riskPrd), 
+        move(tangentPrd), move(secondPrd), 
+        definitionHash("European", strike, exerciseDate, settlementDate));
 }
 
 void putBarrier(
@@ -127,14 +345,22 @@ void putBarrier(
 {
     const double smoothFactor = smooth <= 0 ? EPS : smooth;
 
-    //  We create 2 products, one for valuation and one for risk
+    //  We create 5 products, for valuation in double and float, and for AAD, forward and second order risk
     unique_ptr<Product<double>> prd = make_unique<UOC<double>>(
         strike, barrier, maturity, monitorFreq, smoothFactor);
+    unique_ptr<Product<float>> singlePrd = make_unique<UOC<float>>(
+        strike, barrier, maturity, monitorFreq, smoothFactor);
     unique_ptr<Product<Number>> riskPrd = make_unique<UOC<Number>>(
         strike, barrier, maturity, monitorFreq, smoothFactor);
+    unique_ptr<Product<Dual>> tangentPrd = make_unique<UOC<Dual>>(
+        strike, barrier, maturity, monitorFreq, smoothFactor);
+    unique_ptr<Product<DualNumber>> secondPrd = make_unique<UOC<DualNumber>>(
+        strike, barrier, maturity, monitorFreq, smoothFactor);
 
-    //  And move them into the map
-    productStore[store] = make_pair(move(prd), move(riskPrd));
+    //  And move them into the store
+    productStore.put(store, move(prd), move(singlePrd), move(riskPrd), 
+        move(tangentPrd), move(secondPrd), 
+        definitionHash("UOC", strike, barrier, maturity, monitorFreq, smoothFactor));
 }
 
 void putContingent(
@@ -146,14 +372,22 @@ void putContingent(
 {
     const double smoothFactor = smooth <= 0 ? 0.0 : smooth;
 
-    //  We create 2 products, one for valuation and one for risk
+    //  We create 5 products, for valuation in double and float, and for AAD, forward and second order risk
     unique_ptr<Product<double>> prd = make_unique<ContingentBond<double>>(
         maturity, coupon, payFreq, smoothFactor);
+    unique_ptr<Product<float>> singlePrd = make_unique<ContingentBond<float>>(
+        maturity, coupon, payFreq, smoothFactor);
     unique_ptr<Product<Number>> riskPrd = make_unique<ContingentBond<Number>>(
         maturity, coupon, payFreq, smoothFactor);
+    unique_ptr<Product<Dual>> tangentPrd = make_unique<ContingentBond<Dual>>(
+        maturity, coupon, payFreq, smoothFactor);
+    unique_ptr<Product<DualNumber>> secondPrd = make_unique<ContingentBond<DualNumber>>(
+        maturity, coupon, payFreq, smoothFactor);
 
-    //  And move them into the map
-    productStore[store] = make_pair(move(prd), move(riskPrd));
+    //  And move them into the store
+    productStore.put(store, move(prd), move(singlePrd), move(riskPrd), 
+        move(tangentPrd), move(secondPrd), 
+        definitionHash("ContingentBond", coupon, maturity, payFreq, smoothFactor));
 }
 
 void putEuropeans(
@@ -169,39 +403,89 @@ void putEuropeans(
         options[maturities[i]].push_back(strikes[i]);
     }
 
-    //  We create 2 products, one for valuation and one for risk
+    //  We create 5 products, for valuation in double and float, and for AAD, forward and second order risk
     unique_ptr<Product<double>> prd = make_unique<Europeans<double>>(
         options);
+    unique_ptr<Product<float>> singlePrd = make_unique<Europeans<float>>(
+        options);
     unique_ptr<Product<Number>> riskPrd = make_unique<Europeans<Number>>(
         options);
+    unique_ptr<Product<Dual>> tangentPrd = make_unique<Europeans<Dual>>(
+        options);
+    unique_ptr<Product<DualNumber>> secondPrd = make_unique<Europeans<DualNumber>>(
+        options);
 
     //  And move them into the map
-    productStore[store] = make_pair(move(prd), move(riskPrd));
+    vector<double> mats, strs;
+    for (const auto& option : options) for (const double strike : option.second)
+    {
+        mats.push_back(option.first);
+        strs.push_back(strike);
+    }
+    productStore.put(store, move(prd), move(singlePrd), move(riskPrd), 
+        move(tangentPrd), move(secondPrd), 
+        definitionHash("Europeans", mats, strs));
 }
 
-template<class T>
-const Product<T>* getProduct(const string& store);
-
-template<>
-const Product<double>* getProduct(const string& store)
+void putPortfolio(
+    //  ids of products in the store
+    const vector<string>&   productIds,
+    const string&           store)
 {
-    auto it = productStore.find(store);
-    if (it == productStore.end()) return nullptr;
-    else return it->second.first.get();
+    //  Snapshots of the legs
+    vector<shared_ptr<const StoreEntry<Product>>> entries;
+    vector<const Product<double>*> legs;
+    vector<const Product<float>*> singleLegs;
+    vector<const Product<Number>*> riskLegs;
+    vector<const Product<Dual>*> tangentLegs;
+    vector<const Product<DualNumber>*> secondLegs;
+    vector<string> legHashes;
+    for (const auto& id : productIds)
+    {
+        auto entry = productStore.find(id);
+        if (!entry)
+        {
+            throw runtime_error("putPortfolio() : Could not retrieve product " + id);
+        }
+        legs.push_back(entry->value.get());
+        singleLegs.push_back(entry->single.get());
+        riskLegs.push_back(entry->risk.get());
+        tangentLegs.push_back(entry->tangent.get());
+        secondLegs.push_back(entry->second.get());
+        legHashes.push_back(to_string(entry->hash));
+        entries.push_back(move(entry));
+    }
+
+    //  We create 5 products, for valuation in double and float, and for AAD, forward and second order risk
+    //  The legs are copied, the portfolio doesn't change with the products in the store
+    unique_ptr<Product<double>> prd = make_unique<Portfolio<double>>(
+        legs, productIds);
+    unique_ptr<Product<float>> singlePrd = make_unique<Portfolio<float>>(
+        singleLegs, productIds);
+    unique_ptr<Product<Number>> riskPrd = make_unique<Portfolio<Number>>(
+        riskLegs, productIds);
+    unique_ptr<Product<Dual>> tangentPrd = make_unique<Portfolio<Dual>>(
+        tangentLegs, productIds);
+    unique_ptr<Product<DualNumber>> secondPrd = make_unique<Portfolio<DualNumber>>(
+        secondLegs, productIds);
+
+    //  And move them into the store
+    //  Labels depend on the ids of the legs
+    productStore.put(store, move(prd), move(singlePrd), move(riskPrd), 
+        move(tangentPrd), move(secondPrd), 
+        definitionHash("Portfolio", productIds, legHashes));
 }
 
-template<>
-const Product<Number>* getProduct(const string& store)
+//  Snapshot of the product under an id, empty if not found
+template<class T>
+ProductRef<T> getProduct(const string& store)
 {
-    auto it = productStore.find(store);
-    if (it == productStore.end()) return nullptr;
-    else return it->second.second.get();
+    return ProductRef<T>(productStore.find(store));
 }
 
-const vector<string>* getPayoffLabels(const string& store)
+//  Copy of the payoff labels, empty if not found
+vector<string> getPayoffLabels(const string& store)
 {
-    auto it = productStore.find(store);
-    if (it == productStore.end()) return nullptr;
-    else return & it->second.first.get()->payoffLabels();
-
-}
\ No newline at end of file
+    const ProductRef<double> prd = getProduct<double>(store);
+    return prd ? prd->payoffLabels() : vector<string>();
+}
@@ -18,9 +18,29 @@ As long as this comment is preserved at the top of the file
 
 //  Thread pool of chapter 3
 
+//  Work stealing version:
+//      each worker owns a lock-free deque for the tasks it spawns
+//      and an inbox for the tasks spawned from outside the pool,
+//      idle threads steal from the others at random
+
+//  Workers may be pinned to processors, ordered by NUMA node, see start()
+//  Memory is placed on the node of the thread that first touches it,
+//      so the parallel simulators allocate their per-thread state
+//      in the first task of each thread, see mcBase.h
+
+//  Nested parallelism: tasks that spawn and wait on tasks
+//      use a TaskGroup, see below
+
 #include <future>
 #include <thread>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <tuple>
 #include "ConcurrentQueue.h"
+#include "WorkStealingQueue.h"
+#include "profiler.h"
 
 using namespace std;
 
@@ -32,39 +52,142 @@ class ThreadPool
 	//	The one and only instance
 	static ThreadPool myInstance;
 
-	//	The task queue
-    ConcurrentQueue<Task> myQueue;
+	//	The task queues, one of each per worker thread
+	//	Tasks are heap allocated and moved through the queues by pointer
+	//	Deques: tasks spawned from inside the pool, lock-free
+	vector<unique_ptr<WorkStealingQueue<Task*>>>	myDeques;
+	//	Inboxes: tasks spawned from the outside, dealt round robin
+	vector<unique_ptr<ConcurrentQueue<Task*>>>		myInboxes;
+	atomic<size_t>									myNextInbox;
+
+	//	Number of tasks queued and not yet picked
+	atomic<size_t>	myPending;
+
+	//	Idle threads sleep here until tasks are queued
+	mutex					mySleepMutex;
+	condition_variable		mySleepCV;
+	atomic<size_t>			mySleepers;
 
 	//	The threads
 	vector<thread> myThreads;
 
+	//	Pinning: processor and NUMA node of each thread, 0 = main
+	bool			myPin;
+	vector<size_t>	myProcessors;
+	vector<size_t>	myNodes;
+	size_t			myNumNodes;
+
     //  Active indicator
     bool myActive;
 
 	//	Interruption indicator
-	bool myInterrupt;
+	atomic<bool> myInterrupt;
 
 	//	Thread number
 	static thread_local size_t myTLSNum;
 
+	//	Execute and destroy a task picked from a queue
+	static void run(Task* t)
+	{
+		PROFILE_COUNT(tasks, 1);
+		(*t)();
+		delete t;
+	}
+
+	//	Find a task for thread num, null if none
+	//	Local deque first, then own inbox, then steal at random 
+	Task* findTask(const size_t num)
+	{
+		Task* t = nullptr;
+		const size_t n = myDeques.size();
+		if (!n) return nullptr;
+
+		if (num > 0)
+		{
+			if (myDeques[num - 1]->tryPop(t) || myInboxes[num - 1]->tryPop(t))
+			{
+				--myPending;
+				return t;
+			}
+		}
+
+		//	Random victim, then round robin
+		static thread_local minstd_rand rand(unsigned(num) + 1);
+		const size_t first = rand() % n;
+		for (size_t i = 0; i < n; ++i)
+		{
+			const size_t victim = (first + i) % n;
+			if (victim + 1 == num) continue;
+			if (myDeques[victim]->trySteal(t) || myInboxes[victim]->tryPop(t))
+			{
+				--myPending;
+				PROFILE_COUNT(steals, 1);
+				return t;
+			}
+		}
+
+		return nullptr;
+	}
+
+	//	Wake up a sleeping thread, if any, after a task is queued
+	void notify()
+	{
+		++myPending;
+		if (mySleepers > 0)
+		{
+			lock_guard<mutex> lk(mySleepMutex);
+			mySleepCV.notify_one();
+		}
+	}
+
 	//	The function that is executed on every thread
 	void threadFunc(const size_t num)
 	{
 		myTLSNum = num;
-
-		Task t;
+		//	Pin before the thread touches any memory
+		if (myPin) pinCurrentThread(myProcessors[num]);
+		PROFILE_THREAD(num);
 
 		//	"Infinite" loop, only broken on destruction
 		while (!myInterrupt) 
 		{
-			//	Pop and executes tasks
-			myQueue.pop(t);
-			if (!myInterrupt) t();			
+			//	Find and execute tasks
+			Task* t = findTask(num);
+			if (t)
+			{
+				run(t);
+				continue;
+			}
+			
+			//	Nothing found: yield a few times before sleeping
+			PROFILE_SCOPE(idle);
+			bool found = false;
+			for (int i = 0; i < 16 && !found; ++i)
+			{
+				this_thread::yield();
+				found = myPending > 0;
+			}
+			if (found) continue;
+
+			//	Sleep until a task is queued or interrupted
+			unique_lock<mutex> lk(mySleepMutex);
+			++mySleepers;
+			mySleepCV.wait(lk, [this] { return myInterrupt || myPending > 0; });
+			--mySleepers;
 		}
 	}
 
     //  The constructor stays private, ensuring single instance
-    ThreadPool() : myActive(false), myInterrupt(false) {}
+    ThreadPool() : 
+		myNextInbox(0), myPending(0), mySleepers(0), myPin(false), myNumNodes(1), 
+		myActive(false), myInterrupt(false) {}
+
+	//	Platform specific, see ThreadPool.cpp
+	//	Available processors and their NUMA nodes, ordered by node
+	//	All on node 0 where NUMA information is not available
+	static vector<pair<size_t, size_t>> processorsByNode();
+	//	Pin the caller thread to a processor, false if not supported
+	static bool pinCurrentThread(const size_t processor);
 
 public:
 
@@ -77,11 +200,49 @@ public:
 	//	The number of the caller thread
 	static size_t threadNum() { return myTLSNum; }
 
+	//	Is the caller a worker thread, i.e. running in a task?
+	static bool inPool() { return myTLSNum > 0; }
+
+	//	NUMA node of thread num, 0 = main, and number of nodes
+	//	All threads are on node 0 unless pinned
+	size_t numaNode(const size_t num) const { return myPin ? myNodes[num] : 0; }
+	size_t numNumaNodes() const { return myPin ? myNumNodes : 1; }
+
 	//	Starter
-	void start(const size_t nThread = thread::hardware_concurrency() - 1)
+	//	pin: pin worker threads to processors, filling NUMA nodes in order, 
+	//		so workers that share data share a node
+	//		and first touch memory on their own node
+	//	Processor 0 is left to the main thread, which is not pinned
+	void start(
+		const size_t nThread = thread::hardware_concurrency() - 1,
+		const bool pin = false)
 	{
         if (!myActive)  //  Only start once
         {
+			//	Processors and nodes of the threads
+			myPin = pin;
+			if (pin)
+			{
+				const auto procs = processorsByNode();
+				myProcessors.resize(nThread + 1);
+				myNodes.resize(nThread + 1);
+				myNumNodes = 0;
+				for (size_t i = 0; i <= nThread; ++i)
+				{
+					tie(myProcessors[i], myNodes[i]) = procs[i % procs.size()];
+				}
+				for (const auto& proc : procs) myNumNodes = max(myNumNodes, proc.second + 1);
+			}
+
+			//	Queues first, threads may steal as soon as they start
+			myDeques.clear();
+			myInboxes.clear();
+			for (size_t i = 0; i < nThread; i++)
+			{
+				myDeques.push_back(make_unique<WorkStealingQueue<Task*>>());
+				myInboxes.push_back(make_unique<ConcurrentQueue<Task*>>());
+			}
+
             myThreads.reserve(nThread);
 
             //	Launch threads on threadFunc and keep handles in a vector
@@ -103,10 +264,13 @@ public:
         if (myActive)
         {
             //	Interrupt mode
-            myInterrupt = true;
+			{
+				lock_guard<mutex> lk(mySleepMutex);
+				myInterrupt = true;
+			}
 
             //	Interrupt all waiting threads
-            myQueue.interrupt();
+			mySleepCV.notify_all();
 
             //	Wait for them all to join
             for_each(myThreads.begin(), myThreads.end(), mem_fn(&thread::join));
@@ -114,9 +278,13 @@ public:
             //  Clear all threads
             myThreads.clear();
 
-            //  Clear the queue and reset interrupt
-            myQueue.clear();
-            myQueue.resetInterrupt();
+            //  Clear the queues, destroying the tasks left
+			Task* t;
+			for (auto& deque : myDeques) while (deque->tryPop(t)) delete t;
+			for (auto& inbox : myInboxes) while (inbox->tryPop(t)) delete t;
+			myDeques.clear();
+			myInboxes.clear();
+			myPending = 0;
 
             //  Mark as inactive
             myActive = false;
@@ -133,12 +301,57 @@ public:
 	ThreadPool& operator=(ThreadPool&& rhs) = delete;
 
 	//	Spawn task
+	//	From a worker: on its own deque
+	//	From the outside: in the inboxes, round robin
 	template<typename Callable>
 	TaskHandle spawnTask(Callable c)
 	{
-		Task t(move(c));
-		TaskHandle f = t.get_future();
-		myQueue.push(move(t));
+		Task* t = new Task(move(c));
+		TaskHandle f = t->get_future();
+
+		//	No threads: execute synchronously
+		if (myDeques.empty())
+		{
+			run(t);
+			return f;
+		}
+
+		const size_t num = myTLSNum;
+		if (num > 0)
+		{
+			myDeques[num - 1]->push(t);
+		}
+		else
+		{
+			myInboxes[myNextInbox++ % myInboxes.size()]->push(t);
+		}
+		notify();
+
+		return f;
+	}
+
+	//	Spawn task for worker thread num, in its inbox
+	//	For work on the thread's own data, hot in its cache, like its tape
+	//	Idle threads may still steal it, so it never waits for a busy thread
+	//	num = 0 or no threads: same as spawnTask()
+	template<typename Callable>
+	TaskHandle spawnTaskTo(const size_t num, Callable c)
+	{
+		if (num == 0 || num > myInboxes.size()) return spawnTask(move(c));
+
+		Task* t = new Task(move(c));
+		TaskHandle f = t->get_future();
+
+		myInboxes[num - 1]->push(t);
+
+		//	Wake all sleepers, so thread num is one of them
+		++myPending;
+		if (mySleepers > 0)
+		{
+			lock_guard<mutex> lk(mySleepMutex);
+			mySleepCV.notify_all();
+		}
+
 		return f;
 	}
 
@@ -147,7 +360,6 @@ public:
 	//	return true if at least one task was run
 	bool activeWait(const TaskHandle& f)
 	{
-		Task t;
 		bool b = false;
 
 		//	Check if the future is ready without blocking
@@ -155,18 +367,88 @@ public:
 		//	wait 0 seconds and return status
 		while (f.wait_for(0s) != future_status::ready)
 		{
-			//	Non blocking
-			if (myQueue.tryPop(t)) 
+			//	Non blocking, local deque first
+			Task* t = findTask(myTLSNum);
+			if (t) 
 			{
-				t();
+				run(t);
 				b = true;
 			}
-			else //	Nothing in the queue: go to sleep
+			else //	Nothing in the queues: go to sleep
 			{
-				f.wait();
+				PROFILE(wait, f.wait());
 			}
 		}
 
 		return b;
 	}
-};
\ No newline at end of file
+};
+
+//  Group of tasks, waited on together, safe to use inside tasks
+//  activeWait() runs any queued task while waiting, 
+//      so inside a task it may start another task of the outer loop, 
+//      on the same thread, which then overwrites the per-thread workspace (by threadNum())
+//      of the task that waits
+//  A group's wait() only runs the tasks of the group, 
+//      so families of tasks nest without interference, 
+//      and the idle threads steal them as usual
+//  Usage: 
+//      TaskGroup group;
+//      for (...) group.spawn([&, i]() { ...; return true; });
+//      group.wait();
+class TaskGroup
+{
+    //  The tasks of the group not yet picked, shared with their launchers
+    shared_ptr<ConcurrentQueue<Task*>>  myTasks;
+    vector<TaskHandle>                  myFutures;
+
+    //  Run the next task of the group, if any
+    static bool runNext(ConcurrentQueue<Task*>& tasks)
+    {
+        Task* t;
+        if (!tasks.tryPop(t)) return false;
+        (*t)();
+        delete t;
+        return true;
+    }
+
+public:
+
+    TaskGroup() : myTasks(make_shared<ConcurrentQueue<Task*>>()) {}
+
+    //  Wait before destruction, the tasks reference the caller's data
+    ~TaskGroup()
+    {
+        wait();
+    }
+
+    TaskGroup(const TaskGroup& rhs) = delete;
+    TaskGroup& operator=(const TaskGroup& rhs) = delete;
+
+    //  Spawn a task in the group
+    //  The pool receives a launcher that runs the next task of the group, 
+    //      or nothing if the waiting thread ran them all
+    template<typename Callable>
+    void spawn(Callable c)
+    {
+        Task* t = new Task(move(c));
+        myFutures.push_back(t->get_future());
+        myTasks->push(t);
+
+        auto tasks = myTasks;
+        ThreadPool::getInstance()->spawnTask([tasks]()
+        {
+            runNext(*tasks);
+            return true;
+        });
+    }
+
+    //  Run the tasks left in the group on the caller thread,
+    //      then wait for those running on other threads
+    void wait()
+    {
+        while (runNext(*myTasks));
+        for (auto& future : myFutures) future.wait();
+        myFutures.clear();
+    }
+};
@@ -0,0 +1,415 @@
+/*
+Written by Antoine Savine in 2018
+
+This code is the strict IP of Antoine Savine
+
+License to use and alter this code for personal and commercial applications
+is freely granted to any person or company who purchased a copy of the book
+
+Modern Computational Finance: AAD and Parallel Simulations
+Antoine Savine
+Wiley, 2018
+
+As long as this comment is preserved at the top of the file
+*/
+
+#pragma once
+
+//  Differential training sets for machine learning surrogates
+//  See Workshop/dlBlackScholes.ipynb and the toy code in toyCode.h
+
+//  A sample is an initial state x,
+//      i.e. the values of some parameters of the model, like the spot,
+//      drawn uniformly in given bounds,
+//  the aggregate payoff y on one path simulated from x,
+//  and its pathwise differentials dy/dx, by AAD
+//  A surrogate trained on (x, y) regresses the price,
+//      the differentials train its derivatives,
+//      see Huge and Savine, Differential Machine Learning, 2020
+
+//  Samples are simulated in parallel, in shards of consecutive samples,
+//      and written to disk while the next shard is simulated
+//  Every sample only depends on its index,
+//      so the files are the same, bit for bit, for any number of threads
+
+//  Files are NumPy .npy arrays of little endian doubles, 3 per shard:
+//      prefix_00000_x.npy      samples x states
+//      prefix_00000_y.npy      samples x 1
+//      prefix_00000_dydx.npy   samples x states
+//  All shards have the same number of samples, except possibly the last one
+//  In Python: x = numpy.load("prefix_00000_x.npy")
+
+#include "main.h"
+#include <fstream>
+#include <future>
+#include <iomanip>
+
+//  State of the samples, a parameter of the model, with its bounds
+struct TrainingState
+{
+    size_t  param;
+    double  lower;
+    double  upper;
+};
+
+//  A shard of samples [firstSample, firstSample + numSample)
+struct TrainingShard
+{
+    size_t          shard;
+    size_t          firstSample;
+    size_t          numSample;
+    //  [sample][state]
+    matrix<double>  states;
+    //  [sample]
+    vector<double>  payoffs;
+    //  [sample][state]
+    matrix<double>  differentials;
+};
+
+//  Generator, simulation of shards in the pool, or on the caller thread
+//  Same workspace and initialization as mcParallelSimulAAD(),
+//      except the model is initialized on every sample, from its state,
+//      so states may be any parameters, including those of the pre-calculations
+//  Paths use the RNG in position sample, dimension simDim
+//  States use the state RNG in position sample, dimension number of states,
+//      it must be independent of the RNG, e.g. another mrg32k3a seed
+//  write: void(const TrainingShard&), called on an I/O thread
+//      at most one at a time, in shard order,
+//      while the pool simulates the next shard
+//  pathwise: the states are only read in generatePath(), 
+//      not in the pre-calculations of init(), 
+//      like the spot of Dupire, or of Black-Scholes under the risk neutral measure
+//  The model is then initialized once per thread, 
+//      and the states set on their parameters, on tape below the mark, for every path,
+//      about as fast as mcParallelSimulAAD() and wrong otherwise
+template<class W, class F = decltype(defaultAggregator)>
+inline void mcTrainingSet(
+    const Product<Number>&          prd,
+    const Model<Number>&            mdl,
+    const RNG&                      rng,
+    const RNG&                      stateRng,
+    const vector<TrainingState>&    states,
+    const size_t                    nSample,
+    const size_t                    samplesPerShard,
+    const W&                        write,
+    const F&                        aggFun = defaultAggregator,
+    //  Samples per task, 0 = automatic
+    const size_t                    batch = 0,
+    const bool                      parallel = true,
+    const bool                      pathwise = false)
+{
+    const size_t nPay = prd.payoffLabels().size();
+    const size_t nState = states.size();
+    const size_t nParam = mdl.numParams();
+    for (const auto& state : states)
+    {
+        if (state.param >= nParam)
+        {
+            throw runtime_error("mcTrainingSet() : state is not a parameter of the model");
+        }
+    }
+    if (!samplesPerShard)
+    {
+        throw runtime_error("mcTrainingSet() : shards must have samples");
+    }
+
+    //  Clear and initialise tape
+    Number::tape->clear();
+    auto resetter = setNumResultsForAAD();
+
+    ThreadPool* pool = ThreadPool::getInstance();
+    const size_t nThread = parallel ? pool->numThreads() : 0;
+
+    //  Per-thread workspace, allocated on each thread's first task,
+    //      on its NUMA node, see threadPool.h
+    vector<unique_ptr<Model<Number>>> models(nThread + 1);
+    vector<Scenario<Number>> paths(nThread + 1);
+    vector<vector<Number>> payoffs(nThread + 1);
+    vector<PayoffScratch<Number>> scratches(nThread + 1);
+    vector<Tape> tapes(nThread);
+    vector<unique_ptr<RNG>> rngs(nThread + 1), stateRngs(nThread + 1);
+    vector<vector<double>> gaussVecs(nThread + 1), uVecs(nThread + 1);
+    //  Note we don't use vector<bool>
+    //      because vector<bool> is not thread safe
+    vector<int> threadInit(nThread + 1, false);
+
+    auto initThread = [&](const size_t threadNum)
+    {
+        models[threadNum] = mdl.clone();
+        models[threadNum]->allocate(prd.timeline(), prd.defline());
+        allocatePath(prd.defline(), paths[threadNum]);
+        payoffs[threadNum].resize(nPay);
+        scratches[threadNum].allocate(prd, 1);
+
+        const size_t simDim = models[threadNum]->simDim();
+        rngs[threadNum] = rng.clone();
+        rngs[threadNum]->init(simDim);
+        gaussVecs[threadNum].resize(simDim);
+        stateRngs[threadNum] = stateRng.clone();
+        stateRngs[threadNum]->init(nState);
+        uVecs[threadNum].resize(nState);
+
+        //  Pre-calculations once, on this thread's tape
+        if (pathwise) initModel4ParallelAAD(prd, *models[threadNum], paths[threadNum]);
+
+        threadInit[threadNum] = true;
+    };
+
+    //  Initialize main thread, 
+    //      its model gives the simulation dimension for the task granularity
+    initThread(0);
+    const size_t simDim = models[0]->simDim();
+
+    //  Sample i of the shard, on thread threadNum
+    auto simulSample = [&](const size_t threadNum, TrainingShard& shard, const size_t i)
+    {
+        Model<Number>& model = *models[threadNum];
+        const vector<Number*>& params = model.parameters();
+        const size_t sample = shard.firstSample + i;
+
+        //  Draw the state
+        auto& sRandom = stateRngs[threadNum];
+        sRandom->skipTo(sample);
+        sRandom->nextU(uVecs[threadNum]);
+        for (size_t k = 0; k < nState; ++k)
+        {
+            const auto& state = states[k];
+            const double x = state.lower + (state.upper - state.lower) * uVecs[threadNum][k];
+            params[state.param]->value() = x;
+            if (pathwise) params[state.param]->adjoint() = 0.0;
+            shard.states[i][k] = x;
+        }
+
+        //  Initialize the model from the state, on tape, see initModel4ParallelAAD()
+        if (pathwise) Number::tape->rewindToMark();
+        else initModel4ParallelAAD(prd, model, paths[threadNum]);
+
+        //  One path
+        auto& random = rngs[threadNum];
+        random->skipTo(sample);
+        PROFILE(rng, random->nextG(gaussVecs[threadNum]));
+        PROFILE(path, model.generatePath(gaussVecs[threadNum], paths[threadNum]));
+        PROFILE(payoff, prd.payoffs(paths[threadNum], payoffs[threadNum], scratches[threadNum]));
+
+        //  Differentials, to the pre-calculations then to the state
+        //  Pathwise states are read after the mark, their adjoints are complete
+        Number result = aggFun(payoffs[threadNum]);
+        PROFILE_COUNT(tapeNodes, Number::tape->numNodesAfterMark());
+        PROFILE(backward, result.propagateToMark());
+        PROFILE(backward, model.propagatePath(gaussVecs[threadNum], paths[threadNum]));
+        if (!pathwise) PROFILE(backward, Number::propagateMarkToStart());
+
+        shard.payoffs[i] = double(result);
+        for (size_t k = 0; k < nState; ++k)
+        {
+            shard.differentials[i][k] = params[states[k].param]->adjoint();
+        }
+    };
+
+    //  Simulate shard s into buffer
+    Tape* mainThreadPtr = Number::tape;
+    auto simulShard = [&](const size_t s, TrainingShard& shard)
+    {
+        shard.shard = s;
+        shard.firstSample = s * samplesPerShard;
+        shard.numSample = min(samplesPerShard, nSample - shard.firstSample);
+        shard.states.resize(shard.numSample, nState);
+        shard.payoffs.resize(shard.numSample);
+        shard.differentials.resize(shard.numSample, nState);
+
+        const size_t batchSz = batchSize(shard.numSample, simDim, nPay, nThread, batch);
+        vector<TaskHandle> futures;
+        futures.reserve(shard.numSample / batchSz + 1);
+
+        for (size_t first = 0; first < shard.numSample; first += batchSz)
+        {
+            const size_t samplesInTask = min(batchSz, shard.numSample - first);
+
+            auto task = [&, first, samplesInTask]()
+            {
+                const size_t threadNum = parallel ? pool->threadNum() : 0;
+
+                if (threadNum > 0) Number::tape = &tapes[threadNum - 1];
+                if (!threadInit[threadNum]) initThread(threadNum);
+
+                for (size_t i = first; i < first + samplesInTask; ++i)
+                {
+                    simulSample(threadNum, shard, i);
+                }
+
+                return true;
+            };
+
+            if (parallel) futures.push_back(pool->spawnTask(task));
+            else task();
+        }
+
+        for (auto& future : futures) pool->activeWait(future);
+        Number::tape = mainThreadPtr;
+    };
+
+    //  Pipeline: the simulation of shard s in one buffer
+    //      overlaps the write of shard s - 1 from the other, on an I/O thread
+    const size_t nShard = (nSample + samplesPerShard - 1) / samplesPerShard;
+    TrainingShard buffers[2];
+    future<void> writing;
+
+    for (size_t s = 0; s < nShard; ++s)
+    {
+        TrainingShard& shard = buffers[s % 2];
+        simulShard(s, shard);
+
+        //  Wait for the previous write, rethrows its errors
+        if (writing.valid()) writing.get();
+        writing = async(launch::async, [&write, &shard]() { write(shard); });
+    }
+    if (writing.valid()) writing.get();
+
+    Number::tape->clear();
+}
+
+//  NumPy files
+//  Format 1.0: magic string, version, header length, header padded to 64 bytes
+inline void writeNpy(
+    const string&   file,
+    const double*   data,
+    const size_t    rows,
+    const size_t    cols)
+{
+    ofstream ofs(file, ios::binary);
+    if (!ofs) throw runtime_error("writeNpy() : could not open " + file);
+
+    ostringstream dict;
+    dict << "{'descr': '<f8', 'fortran_order': False, 'shape': (" << rows << ", " << cols << "), }";
+    string header = dict.str();
+    const size_t unpadded = 10 + header.size() + 1;
+    header.append((64 - unpadded % 64) % 64, ' ');
+    header.push_back('\n');
+
+    const unsigned short len = static_cast<unsigned short>(header.size());
+    ofs.write("\x93NUMPY\x01\x00", 8);
+    ofs.put(char(len & 0xff));
+    ofs.put(char(len >> 8));
+    ofs.write(header.data(), header.size());
+    ofs.write(reinterpret_cast<const char*>(data), rows * cols * sizeof(double));
+
+    if (!ofs) throw runtime_error("writeNpy() : could not write " + file);
+}
+
+//  Writer of the shards in .npy files, see the top of the file
+struct NpyShardWriter
+{
+    string prefix;
+
+    //  Files of shard s
+    string file(const size_t s, const string& name) const
+    {
+        ostringstream ost;
+        ost << prefix << '_' << setw(5) << setfill('0') << s << '_' << name << ".npy";
+        return ost.str();
+    }
+
+    void operator()(const TrainingShard& shard) const
+    {
+        const size_t n = shard.numSample, m = shard.states.cols();
+        writeNpy(file(shard.shard, "x"), n ? shard.states[0] : nullptr, n, m);
+        writeNpy(file(shard.shard, "y"), shard.payoffs.data(), n, 1);
+        writeNpy(file(shard.shard, "dydx"), n ? shard.differentials[0] : nullptr, n, m);
+    }
+};
+
+//  Differential training set of a model and product in the store
+//  One sample per path: num.numPath samples,
+//      with the RNG of the numerical parameters for the paths
+//      and an mrg32k3a with the seeds swapped for the states
+//  notionals: weights of the payoffs in the aggregate payoff y
+//  states: labels of the model parameters, with their bounds
+//  pathwise: the states are not used in the pre-calculations, see mcTrainingSet()
+struct TrainingSetResults
+{
+    vector<string>  stateIds;
+    size_t          numSample;
+    size_t          numShard;
+    //  In shard order, x, y and dydx
+    vector<string>  files;
+    RunStats        runStats;
+};
+
+inline TrainingSetResults trainingSet(
+    const string&               modelId,
+    const string&               productId,
+    const map<string, double>&  notionals,
+    const vector<string>&       stateIds,
+    const vector<double>&       lower,
+    const vector<double>&       upper,
+    const size_t                samplesPerShard,
+    const string&               prefix,
+    const NumericalParam&       num,
+    const bool                  pathwise = false)
+{
+    const auto model = getModel<Number>(modelId);
+    const auto product = getProduct<Number>(productId);
+
+    if (!model || !product)
+    {
+        throw runtime_error("trainingSet() : Could not retrieve model and product");
+    }
+    if (stateIds.size() != lower.size() || stateIds.size() != upper.size())
+    {
+        throw runtime_error("trainingSet() : states and bounds don't match");
+    }
+
+    ProfileRun run;
+
+    //  States
+    const vector<string>& paramIds = model->parameterLabels();
+    vector<TrainingState> states;
+    for (size_t k = 0; k < stateIds.size(); ++k)
+    {
+        auto it = find(paramIds.begin(), paramIds.end(), stateIds[k]);
+        if (it == paramIds.end())
+        {
+            throw runtime_error("trainingSet() : state not found");
+        }
+        states.push_back({ size_t(distance(paramIds.begin(), it)), lower[k], upper[k] });
+    }
+
+    //  Vector of notionals, same as AADriskAggregate()
+    const vector<string>& allPayoffs = product->payoffLabels();
+    vector<double> vnots(allPayoffs.size(), 0.0);
+    for (const auto& notional : notionals)
+    {
+        auto it = find(allPayoffs.begin(), allPayoffs.end(), notional.first);
+        if (it == allPayoffs.end())
+        {
+            throw runtime_error("trainingSet() : payoff not found");
+        }
+        vnots[distance(allPayoffs.begin(), it)] = notional.second;
+    }
+
+    auto aggregator = [&vnots](const vector<Number>& payoffs)
+    {
+        return Number::weightedSum(payoffs.begin(), payoffs.end(), vnots.begin());
+    };
+
+    auto rng = makeRng(num);
+    mrg32k3a stateRng(unsigned(num.seed2), unsigned(num.seed1), false);
+
+    //  Simulate and write
+    NpyShardWriter writer{ prefix };
+    mcTrainingSet(*product, *model, *rng, stateRng, states, num.numPath, samplesPerShard,
+        writer, aggregator, num.batchSize, num.parallel, pathwise);
+
+    TrainingSetResults results;
+
+    results.stateIds = stateIds;
+    results.numSample = num.numPath;
+    results.numShard = (num.numPath + samplesPerShard - 1) / samplesPerShard;
+    for (size_t s = 0; s < results.numShard; ++s)
+    {
+        for (const char* name : { "x", "y", "dydx" }) results.files.push_back(writer.file(s, name));
+    }
+    results.runStats = run.stats();
+
+    return results;
+}
@@ -18,8 +18,9 @@ As long as this comment is preserved at the top of the file
 
 #pragma warning(disable:4996)
 
-#include "ThreadPool.h"
+#include "threadPool.h"
 #include "main.h"
+#include "trainingSet.h"
 #include "toyCode.h"
 
 #define WIN32_LEAN_AND_MEAN
@@ -41,7 +42,10 @@ NumericalParam xl2num(
     NumericalParam num;
 
     num.numPath = static_cast<int>(numPath + EPS);
-    num.parallel = parallel > EPS;
+    //  parallel + 2: single precision valuation, see NumericalParam::singlePrecision
+    const int flags = static_cast<int>(parallel + EPS);
+    num.parallel = (flags & 1) != 0;
+    num.singlePrecision = (flags & 2) != 0;
 	if (seed1 >= 1)
 	{
 		num.seed1 = static_cast<int>(seed1 + EPS);
@@ -60,7 +64,12 @@ NumericalParam xl2num(
 		num.seed2 = num.seed1 + 1;
 	}
 
+	//	useSobol = 2: Sobol with Brownian bridge
+    //  useSobol = 3, 4: same, scrambled with a digital shift from seed1
+    const int sobol = static_cast<int>(useSobol + EPS);
 	num.useSobol = useSobol > EPS;
+	num.brownianBridge = sobol == 2 || sobol == 4;
+    num.scramble = sobol >= 3;
 
     return num;
 }
@@ -68,13 +77,20 @@ NumericalParam xl2num(
 //	Wrappers
 
 //  change number of threads in the pool
+//  pin: pin the worker threads to processors by NUMA node, see threadPool.h
 extern "C" __declspec(dllexport)
 double xRestartThreadPool(
-    double              xNthread)
+    double              xNthread,
+    double              xPin)
 {
     const int numThread = int(xNthread + EPS);
+    const bool pin = xPin > EPS;
+
+    //  Not while parallel simulations run, see asyncJobs.h
+    lock_guard<mutex> poolCaller(poolCallerMutex());
+
     ThreadPool::getInstance()->stop();
-    ThreadPool::getInstance()->start(numThread);
+    ThreadPool::getInstance()->start(numThread, pin);
 
     return numThread;
 }
@@ -87,14 +103,22 @@ extern "C" __declspec(dllexport)
     FP12*               times,
     FP12*               vols,
     double              maxDt,
-    LPXLOPER12          xid)
+    LPXLOPER12          xid,
+    //  Optional, time steps between AAD checkpoints
+    double              checkpointSteps,
+    //  Optional, time stepping scheme:
+    //      0 = Euler, 1 = predictor-corrector, 2 = midpoint, see DupireScheme
+    double              scheme)
 {
     FreeAllTempMemory();
 
     const string id = getString(xid);
 
     //  Make sure we have an id
-    if (maxDt <= 0.0 || id.empty()) return TempErr12(xlerrNA);
+    if (maxDt <= 0.0 || id.empty() || checkpointSteps < 0 || scheme < 0 || scheme > 2.5) 
+    {
+        return TempErr12(xlerrNA);
+    }
 
     //  Unpack
 
@@ -105,10 +129,12 @@ extern "C" __declspec(dllexport)
 
     vector<double> vspots = to_vector(spots);
     vector<double> vtimes = to_vector(times);
-    matrix<double> vvols = to_matrix(vols);
 
     //  Call and return
-    putDupire(spot, vspots, vtimes, vvols, maxDt, id);
+    //  The vol grid is read in place from Excel's array, 
+    //      the models copy it straight into their own storage
+    putDupire(spot, vspots, vtimes, to_matrixView(vols), maxDt, id, size_t(checkpointSteps + 0.5), 
+        DupireScheme(int(scheme + 0.5)));
 
     return TempStr12(id);
 }
@@ -247,6 +273,35 @@ LPXLOPER12 xPutEuropeans(
     return TempStr12(id);
 }
 
+extern "C" __declspec(dllexport)
+LPXLOPER12 xPutPortfolio(
+    LPXLOPER12          productids,
+    LPXLOPER12          xid)
+{
+    FreeAllTempMemory();
+
+    const string id = getString(xid);
+
+    //  Make sure we have an id
+    if (id.empty()) return TempErr12(xlerrNA);
+
+    //  Make sure we have products
+    const vector<string> pids = to_strVector(productids);
+    if (pids.empty()) return TempErr12(xlerrNA);
+
+    //  Call and return
+    try
+    {
+        putPortfolio(pids, id);
+    }
+    catch (const exception&)
+    {
+        return TempErr12(xlerrNA);
+    }
+
+    return TempStr12(id);
+}
+
 //  Access payoff identifiers and parameters
 
 extern "C" __declspec(dllexport)
@@ -259,7 +314,7 @@ LPXLOPER12 xPayoffIds(
     //  Make sure we have an id
     if (id.empty()) return TempErr12(xlerrNA);
 
-    const auto* prd = getProduct<double>(id);
+    const auto prd = getProduct<double>(id);
     //  Make sure we have a product
     if (!prd) return TempErr12(xlerrNA);
 
@@ -276,16 +331,130 @@ LPXLOPER12 xParameters(
     //  Make sure we have an id
     if (id.empty()) return TempErr12(xlerrNA);
 
-    Model<double>* mdl = const_cast<Model<double>*>(getModel<double>(id));
+    //  Copies, from a snapshot of the model
+    const auto params = getModelParameters(id);
     //  Make sure we have a model
-    if (!mdl) return TempErr12(xlerrNA);
+    if (params.first.empty()) return TempErr12(xlerrNA);
+
+    return from_labelsAndNumbers(params.first, params.second);
+}
+
+//  Result cache, see resultCache.h
+
+extern "C" __declspec(dllexport)
+LPXLOPER12 xCacheStats()
+{
+    FreeAllTempMemory();
+
+    const auto stats = resultCache.stats();
+
+    return from_labelsAndNumbers(
+        { "hits", "misses", "hit rate", "entries", "bytes", "max bytes", "evictions" },
+        { double(stats.hits), double(stats.misses), stats.hitRate(), double(stats.entries), 
+            double(stats.bytes), double(stats.maxBytes), double(stats.evictions) });
+}
+
+//  Set the memory budget in megabytes, 0 disables the cache, negative clears it
+extern "C" __declspec(dllexport)
+double xSetCacheSize(
+    double              megabytes)
+{
+    if (megabytes < 0) 
+    {
+        resultCache.clear();
+    }
+    else
+    {
+        resultCache.setMaxBytes(size_t(megabytes * 1024 * 1024));
+    }
+
+    return double(resultCache.stats().maxBytes) / (1024 * 1024);
+}
+
+//  Memory budget of the tapes in megabytes, beyond which they spill to disk, 
+//      see Tape::setBudget() in AADTape.h, 0 or negative for unlimited
+//  Applies to the global tape and the tapes created from now on,
+//      the persistent workspace of parallel AAD is reset
+
+extern "C" __declspec(dllexport)
+double xSetTapeBudget(
+    double              megabytes)
+{
+    const auto poolCaller = lockPoolCaller();
+    lock_guard<mutex> lk(aadWorkspaceMutex);
+
+    const size_t bytes = megabytes > 0 
+        ? size_t(megabytes * 1024 * 1024) 
+        : numeric_limits<size_t>::max();
+    Tape::setDefaultBudget(bytes);
+    Number::tape->setBudget(bytes);
+    aadWorkspace.reset();
+
+    return megabytes > 0 ? megabytes : 0.0;
+}
+
+//  Load the direction numbers of Sobol's sequence from a file of Joe and Kuo,
+//      see SobolDirections in sobol.h, returns the number of dimensions
+//  Empty file name restores the 1111 built-in dimensions
+
+extern "C" __declspec(dllexport)
+double xLoadSobolDirections(
+    LPXLOPER12          xfile)
+{
+    const string file = getString(xfile);
+
+    try
+    {
+        if (file.empty())
+        {
+            setSobolDirections(nullptr);
+            return double(sobolDirections()->dim());
+        }
+        return double(loadSobolDirections(file));
+    }
+    catch (const exception&)
+    {
+        return 0.0;
+    }
+}
+
+//  Profiling counters of the last run, see profiler.h
+//  Phases in cycles, tasks, steals and tape nodes in numbers, 
+//      in total and by thread, 0 = caller
+//  Only seconds unless compiled with MCPROFILE
+
+extern "C" __declspec(dllexport)
+LPXLOPER12 xRunStats()
+{
+    FreeAllTempMemory();
+
+    const RunStats stats = Profiler::instance().last();
+    const size_t nThread = stats.cycles.size();
+
+    vector<string> rowLabels = { "seconds" };
+    const auto& phases = RunStats::phaseLabels();
+    const auto& counts = RunStats::countLabels();
+    rowLabels.insert(rowLabels.end(), phases.begin(), phases.end());
+    rowLabels.insert(rowLabels.end(), counts.begin(), counts.end());
 
-    const auto& paramLabels = mdl->parameterLabels();
-    const auto& params = mdl->parameters();
-    vector<double> paramsCopy(params.size());
-    transform(params.begin(), params.end(), paramsCopy.begin(), [](const double* p) { return *p; });
+    vector<string> colLabels = { "total" };
+    for (size_t i = 0; i < nThread; ++i) colLabels.push_back("thread " + to_string(i));
+
+    matrix<double> mat(rowLabels.size(), colLabels.size());
+    fill(mat.begin(), mat.end(), 0.0);
+    mat[0][0] = stats.seconds;
+    for (size_t j = 0; j < numProfilePhases; ++j)
+    {
+        mat[1 + j][0] = double(stats.totalCycles(ProfilePhase(j)));
+        for (size_t i = 0; i < nThread; ++i) mat[1 + j][1 + i] = double(stats.cycles[i][j]);
+    }
+    for (size_t j = 0; j < numProfileCounts; ++j)
+    {
+        mat[1 + numProfilePhases + j][0] = double(stats.totalCount(ProfileCount(j)));
+        for (size_t i = 0; i < nThread; ++i) mat[1 + numProfilePhases + j][1 + i] = double(stats.counts[i][j]);
+    }
 
-    return from_labelsAndNumbers(paramLabels, paramsCopy);
+    return from_labelledMatrix(rowLabels, colLabels, mat);
 }
 
 extern "C" __declspec(dllexport)
@@ -305,7 +474,7 @@ LPXLOPER12 xValue(
     //  Make sure we have an id
     if (pid.empty()) return TempErr12(xlerrNA);
 
-    const auto* prd = getProduct<double>(pid);
+    const auto prd = getProduct<double>(pid);
     //  Make sure we have a product
     if (!prd) return TempErr12(xlerrNA);
 
@@ -313,7 +482,7 @@ LPXLOPER12 xValue(
     //  Make sure we have an id
     if (mid.empty()) return TempErr12(xlerrNA);
 
-    Model<double>* mdl = const_cast<Model<double>*>(getModel<double>(mid));
+    const auto mdl = getModel<double>(mid);
     //  Make sure we have a model
     if (!mdl) return TempErr12(xlerrNA);
 
@@ -322,11 +491,121 @@ LPXLOPER12 xValue(
     //  Make sure we have a numPath
     if (!num.numPath) return TempErr12(xlerrNA);
 
+    //  One caller of parallel simulations at a time, see asyncJobs.h
+    const auto poolCaller = lockPoolCaller(num.parallel);
+
+    //  Call and return;
+    try 
+    {
+        auto results = value(mid, pid, num);
+
+        //  Labels, values and standard errors
+        const size_t n = results.identifiers.size();
+        if (!n) return TempErr12(xlerrNA);
+        LPXLOPER12 oper = TempMulti12(n, 3);
+        if (!oper || !setStrings(oper, results.identifiers, 0, 0)) return TempErr12(xlerrNA);
+        setNums(oper, results.values, 0, 1);
+        setNums(oper, results.errors, 0, 2);
+
+        return oper;
+    }
+    catch (const exception&)
+    {
+        return TempErr12(xlerrNA);
+    }
+}
+
+//  Value to a target standard error, N is the maximum number of paths
+//  Returns the values with the standard errors reached, 
+//      and the number of paths simulated in the last row
+extern "C" __declspec(dllexport)
+LPXLOPER12 xValueTarget(
+    LPXLOPER12          modelid,
+    LPXLOPER12          productid,
+    //  numerical parameters
+    double              useSobol,
+    double              seed1,
+    double              seed2,
+    double              numPath,
+    double              parallel,
+    double              targetError)
+{
+    FreeAllTempMemory();
+
+    const string pid = getString(productid);
+    //  Make sure we have an id
+    if (pid.empty()) return TempErr12(xlerrNA);
+
+    const string mid = getString(modelid);
+    //  Make sure we have an id
+    if (mid.empty()) return TempErr12(xlerrNA);
+
+    //  Numerical params
+    auto num = xl2num(useSobol, seed1, seed2, numPath, parallel);
+    //  Make sure we have a numPath and a target
+    if (!num.numPath || targetError <= 0) return TempErr12(xlerrNA);
+
+    //  One caller of parallel simulations at a time, see asyncJobs.h
+    const auto poolCaller = lockPoolCaller(num.parallel);
+    num.targetError = targetError;
+
     //  Call and return;
     try 
     {
         auto results = value(mid, pid, num);
-        return from_labelsAndNumbers(results.identifiers, results.values);
+
+        //  Labels, values and standard errors, then paths
+        const size_t n = results.identifiers.size();
+        LPXLOPER12 oper = TempMulti12(n + 1, 3);
+        if (!oper 
+            || !setStrings(oper, results.identifiers, 0, 0)
+            || !setStrings(oper, { "paths" }, n, 0)) return TempErr12(xlerrNA);
+        setNums(oper, results.values, 0, 1);
+        setNums(oper, results.errors, 0, 2);
+        setNum(oper, double(results.numPath), n, 1);
+
+        return oper;
+    }
+    catch (const exception&)
+    {
+        return TempErr12(xlerrNA);
+    }
+}
+
+extern "C" __declspec(dllexport)
+LPXLOPER12 xValueModels(
+    LPXLOPER12          modelids,
+    LPXLOPER12          productid,
+    //  numerical parameters
+    double              useSobol,
+    double              seed1,
+    double              seed2,
+    double              numPath,
+    double              parallel)
+{
+    FreeAllTempMemory();
+
+    const string pid = getString(productid);
+    //  Make sure we have an id
+    if (pid.empty()) return TempErr12(xlerrNA);
+
+    const vector<string> mids = to_strVector(modelids);
+    //  Make sure we have ids
+    if (mids.empty()) return TempErr12(xlerrNA);
+
+    //  Numerical params
+    const auto num = xl2num(useSobol, seed1, seed2, numPath, parallel);
+    //  Make sure we have a numPath
+    if (!num.numPath) return TempErr12(xlerrNA);
+
+    //  One caller of parallel simulations at a time, see asyncJobs.h
+    const auto poolCaller = lockPoolCaller(num.parallel);
+
+    //  Call and return, one row per model
+    try 
+    {
+        const auto results = valueModels(mids, pid, num);
+        return from_labelledMatrix(mids, results.identifiers, results.values);
     }
     catch (const exception&)
     {
@@ -351,7 +630,7 @@ LPXLOPER12 xValueTime(
 	//  Make sure we have an id
 	if (pid.empty()) return TempErr12(xlerrNA);
 
-	const auto* prd = getProduct<double>(pid);
+	const auto prd = getProduct<double>(pid);
 	//  Make sure we have a product
 	if (!prd) return TempErr12(xlerrNA);
 
@@ -359,14 +638,19 @@ LPXLOPER12 xValueTime(
 	//  Make sure we have an id
 	if (mid.empty()) return TempErr12(xlerrNA);
 
-	Model<double>* mdl = const_cast<Model<double>*>(getModel<double>(mid));
+	const auto mdl = getModel<double>(mid);
 	//  Make sure we have a model
 	if (!mdl) return TempErr12(xlerrNA);
 
 	//  Numerical params
-	const auto num = xl2num(useSobol, seed1, seed2, numPath, parallel);
+	auto num = xl2num(useSobol, seed1, seed2, numPath, parallel);
 	//  Make sure we have a numPath
 	if (!num.numPath) return TempErr12(xlerrNA);
+	//  Time the calculation, not the cache
+	num.cache = false;
+
+	//  One caller of parallel simulations at a time, see asyncJobs.h
+	const auto poolCaller = lockPoolCaller(num.parallel);
 
 	//  Call and return;
 	try
@@ -388,10 +672,222 @@ LPXLOPER12 xValueTime(
 }
 
 extern "C" __declspec(dllexport)
-LPXLOPER12 xAADrisk(
+LPXLOPER12 xAADrisk(
+    LPXLOPER12          modelid,
+    LPXLOPER12          productid,
+    LPXLOPER12          xRiskPayoff,
+    //  numerical parameters
+    double              useSobol,
+    double              seed1,
+    double              seed2,
+    double              numPath,
+    double              parallel)
+{
+    FreeAllTempMemory();
+
+    const string pid = getString(productid);
+    //  Make sure we have an id
+    if (pid.empty()) return TempErr12(xlerrNA);
+
+    const string mid = getString(modelid);
+    //  Make sure we have an id
+    if (mid.empty()) return TempErr12(xlerrNA);
+
+    //  Numerical params
+    const auto num = xl2num(useSobol, seed1, seed2, numPath, parallel);
+    //  Make sure we have a numPath
+    if (!num.numPath) return TempErr12(xlerrNA);
+
+    //  One caller of parallel simulations at a time, see asyncJobs.h
+    lock_guard<mutex> poolCaller(poolCallerMutex());
+
+    //  Risk payoff
+    const string riskPayoff = getString(xRiskPayoff);
+
+    try
+    {
+        auto results = AADriskOne(mid, pid, num, riskPayoff);
+		const size_t n = results.risks.size(), N = n + 1;
+
+        LPXLOPER12 oper = TempXLOPER12();
+        resize(oper, N, 2);
+
+        setString(oper, "value", 0, 0);
+        setNum(oper, results.riskPayoffValue, 0, 1);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            setString(oper, results.paramIds[i], i + 1, 0);
+            setNum(oper, results.risks[i], i + 1, 1);
+        }
+
+        return oper;
+    }
+    catch (const exception&)
+    {
+        return TempErr12(xlerrNA);
+    }
+}
+
+//  Payoffs and notionals, removing blanks, false if sizes don't match
+bool getNotionals(
+    LPXLOPER12              xPayoffs,
+    FP12*                   xNotionals,
+    map<string, double>&    notionals)
+{
+    size_t rows = getRows(xPayoffs);
+    size_t cols = getCols(xPayoffs);
+
+    if (rows * cols == 0 ||
+        xNotionals->rows * xNotionals->columns != rows * cols) 
+            return false;
+
+    size_t idx = 0;
+    for (size_t i = 0; i < rows; ++i) for (size_t j = 0; j < cols; ++j)
+    {
+        string payoff = getString(xPayoffs, i, j);
+        double notional = xNotionals->array[idx++];
+        if (payoff != "" && fabs(notional) > EPS)
+        {
+            notionals[payoff] = notional;
+        }
+    }
+
+    return true;
+}
+
+extern "C" __declspec(dllexport)
+LPXLOPER12 xAADriskAggregate(
+    LPXLOPER12          modelid,
+    LPXLOPER12          productid,
+    LPXLOPER12          xPayoffs,
+    FP12*               xNotionals,
+    //  numerical parameters
+    double              useSobol,
+    double              seed1,
+    double              seed2,
+    double              numPath,
+    double              parallel)
+{
+    FreeAllTempMemory();
+
+    const string pid = getString(productid);
+    //  Make sure we have an id
+    if (pid.empty()) return TempErr12(xlerrNA);
+
+    const string mid = getString(modelid);
+    //  Make sure we have an id
+    if (mid.empty()) return TempErr12(xlerrNA);
+
+    //  Numerical params
+    const auto num = xl2num(useSobol, seed1, seed2, numPath, parallel);
+    //  Make sure we have a numPath
+    if (!num.numPath) return TempErr12(xlerrNA);
+
+    //  One caller of parallel simulations at a time, see asyncJobs.h
+    lock_guard<mutex> poolCaller(poolCallerMutex());
+
+    //  Payoffs and notionals, removing blanks
+    map<string, double> notionals;
+    if (!getNotionals(xPayoffs, xNotionals, notionals)) return TempErr12(xlerrNA);
+
+    try
+    {
+        //  Cached session: a change of notionals only doesn't simulate
+        auto results = AADriskAggregateCached(mid, pid, notionals, num);
+        const size_t n = results.risks.size(), N = n + 1;
+
+        LPXLOPER12 oper = TempXLOPER12();
+        resize(oper, N, 2);
+
+        setString(oper, "value", 0, 0);
+        setNum(oper, results.riskPayoffValue, 0, 1);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            setString(oper, results.paramIds[i], i + 1, 0);
+            setNum(oper, results.risks[i], i + 1, 1);
+        }
+
+        return oper;
+    }
+    catch (const exception&)
+    {
+        return TempErr12(xlerrNA);
+    }
+}
+
+//  Forward mode risk: values of all payoffs 
+//      and their derivatives in a direction in the model parameters,
+//      given by parameter labels and weights
+extern "C" __declspec(dllexport)
+LPXLOPER12 xDirectionalRisk(
+    LPXLOPER12          modelid,
+    LPXLOPER12          productid,
+    LPXLOPER12          xParams,
+    FP12*               xWeights,
+    //  numerical parameters
+    double              useSobol,
+    double              seed1,
+    double              seed2,
+    double              numPath,
+    double              parallel)
+{
+    FreeAllTempMemory();
+
+    const string pid = getString(productid);
+    //  Make sure we have an id
+    if (pid.empty()) return TempErr12(xlerrNA);
+
+    const string mid = getString(modelid);
+    //  Make sure we have an id
+    if (mid.empty()) return TempErr12(xlerrNA);
+
+    //  Numerical params
+    const auto num = xl2num(useSobol, seed1, seed2, numPath, parallel);
+    //  Make sure we have a numPath
+    if (!num.numPath) return TempErr12(xlerrNA);
+
+    //  One caller of parallel simulations at a time, see asyncJobs.h
+    lock_guard<mutex> poolCaller(poolCallerMutex());
+
+    //  Parameters and weights, removing blanks
+    map<string, double> direction;
+    if (!getNotionals(xParams, xWeights, direction)) return TempErr12(xlerrNA);
+
+    try
+    {
+        auto results = directionalRisk(mid, pid, direction, num);
+        const size_t n = results.payoffIds.size();
+
+        LPXLOPER12 oper = TempXLOPER12();
+        resize(oper, n, 3);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            setString(oper, results.payoffIds[i], i, 0);
+            setNum(oper, results.payoffValues[i], i, 1);
+            setNum(oper, results.derivatives[i], i, 2);
+        }
+
+        return oper;
+    }
+    catch (const exception&)
+    {
+        return TempErr12(xlerrNA);
+    }
+}
+
+//  Second order AAD risk: value and first order risks of a payoff 
+//      and its Hessian times a direction in the model parameters,
+//      given by parameter labels and weights
+extern "C" __declspec(dllexport)
+LPXLOPER12 xAADrisk2(
     LPXLOPER12          modelid,
     LPXLOPER12          productid,
     LPXLOPER12          xRiskPayoff,
+    LPXLOPER12          xParams,
+    FP12*               xWeights,
     //  numerical parameters
     double              useSobol,
     double              seed1,
@@ -414,24 +910,33 @@ LPXLOPER12 xAADrisk(
     //  Make sure we have a numPath
     if (!num.numPath) return TempErr12(xlerrNA);
 
+    //  One caller of parallel simulations at a time, see asyncJobs.h
+    lock_guard<mutex> poolCaller(poolCallerMutex());
+
     //  Risk payoff
     const string riskPayoff = getString(xRiskPayoff);
 
+    //  Parameters and weights, removing blanks
+    map<string, double> direction;
+    if (!getNotionals(xParams, xWeights, direction)) return TempErr12(xlerrNA);
+
     try
     {
-        auto results = AADriskOne(mid, pid, num, riskPayoff);
-		const size_t n = results.risks.size(), N = n + 1;
+        auto results = AADrisk2(mid, pid, direction, num, riskPayoff);
+        const size_t n = results.risks.size(), N = n + 1;
 
         LPXLOPER12 oper = TempXLOPER12();
-        resize(oper, N, 2);
+        resize(oper, N, 3);
 
         setString(oper, "value", 0, 0);
         setNum(oper, results.riskPayoffValue, 0, 1);
+        setString(oper, "", 0, 2);
 
         for (size_t i = 0; i < n; ++i)
         {
             setString(oper, results.paramIds[i], i + 1, 0);
             setNum(oper, results.risks[i], i + 1, 1);
+            setNum(oper, results.secondRisks[i], i + 1, 2);
         }
 
         return oper;
@@ -442,18 +947,29 @@ LPXLOPER12 xAADrisk(
     }
 }
 
+//  Differential training set, written to .npy files, see trainingSet.h
+//  states: labels of model parameters, with their lower and upper bounds
+//  filePrefix: path and prefix of the files, e.g. C:\data\set
+//  Returns the number of samples, shards and files
 extern "C" __declspec(dllexport)
-LPXLOPER12 xAADriskAggregate(
+LPXLOPER12 xTrainingSet(
     LPXLOPER12          modelid,
     LPXLOPER12          productid,
     LPXLOPER12          xPayoffs,
     FP12*               xNotionals,
+    LPXLOPER12          xStates,
+    FP12*               xLower,
+    FP12*               xUpper,
+    LPXLOPER12          xPrefix,
+    double              xSamplesPerShard,
     //  numerical parameters
     double              useSobol,
     double              seed1,
     double              seed2,
     double              numPath,
-    double              parallel)
+    double              parallel,
+    //  States not used in the pre-calculations, see mcTrainingSet()
+    double              xPathwise)
 {
     FreeAllTempMemory();
 
@@ -465,6 +981,10 @@ LPXLOPER12 xAADriskAggregate(
     //  Make sure we have an id
     if (mid.empty()) return TempErr12(xlerrNA);
 
+    const string prefix = getString(xPrefix);
+    const size_t samplesPerShard = size_t(xSamplesPerShard + EPS);
+    if (prefix.empty() || !samplesPerShard) return TempErr12(xlerrNA);
+
     //  Numerical params
     const auto num = xl2num(useSobol, seed1, seed2, numPath, parallel);
     //  Make sure we have a numPath
@@ -472,52 +992,289 @@ LPXLOPER12 xAADriskAggregate(
 
     //  Payoffs and notionals, removing blanks
     map<string, double> notionals;
+    if (!getNotionals(xPayoffs, xNotionals, notionals)) return TempErr12(xlerrNA);
+
+    //  States and bounds, removing blank labels, 
+    //      bounds of 0 are legitimate so we don't use getNotionals()
+    const size_t nState = getRows(xStates) * getCols(xStates);
+    if (!nState 
+        || xLower->rows * xLower->columns != nState 
+        || xUpper->rows * xUpper->columns != nState) return TempErr12(xlerrNA);
+    vector<string> states;
+    vector<double> lower, upper;
+    size_t idx = 0;
+    for (size_t i = 0; i < getRows(xStates); ++i) for (size_t j = 0; j < getCols(xStates); ++j, ++idx)
     {
-        size_t rows = getRows(xPayoffs);
-        size_t cols = getCols(xPayoffs);
-
-        if (rows * cols == 0 ||
-            xNotionals->rows * xNotionals->columns != rows * cols) 
-                return TempErr12(xlerrNA);
-
-        size_t idx = 0;
-        for (size_t i = 0; i < rows; ++i) for (size_t j = 0; j < cols; ++j)
-        {
-            string payoff = getString(xPayoffs, i, j);
-            double notional = xNotionals->array[idx++];
-            if (payoff != "" && fabs(notional) > EPS)
-            {
-                notionals[payoff] = notional;
-            }
-        }
+        const string state = getString(xStates, i, j);
+        if (state.empty()) continue;
+        states.push_back(state);
+        lower.push_back(xLower->array[idx]);
+        upper.push_back(xUpper->array[idx]);
     }
 
+    //  One caller of parallel simulations at a time, see asyncJobs.h
+    lock_guard<mutex> poolCaller(poolCallerMutex());
+
     try
     {
-        auto results = AADriskAggregate(mid, pid, notionals, num);
-        const size_t n = results.risks.size(), N = n + 1;
+        auto results = trainingSet(mid, pid, notionals, states, lower, upper, samplesPerShard, prefix, num,
+            xPathwise > EPS);
 
         LPXLOPER12 oper = TempXLOPER12();
-        resize(oper, N, 2);
+        resize(oper, 3, 2);
 
-        setString(oper, "value", 0, 0);
-        setNum(oper, results.riskPayoffValue, 0, 1);
+        setString(oper, "samples", 0, 0);
+        setNum(oper, double(results.numSample), 0, 1);
+        setString(oper, "shards", 1, 0);
+        setNum(oper, double(results.numShard), 1, 1);
+        setString(oper, "files", 2, 0);
+        setNum(oper, double(results.files.size()), 2, 1);
+
+        return oper;
+    }
+    catch (const exception&)
+    {
+        return TempErr12(xlerrNA);
+    }
+}
+
+//  Asynchronous versions, Excel 2010 and later, see asyncJobs.h
+//  The function returns immediately, Excel keeps calculating
+//      and the results come back through xlAsyncReturn when the job completes
+//  Identical requests in flight are coalesced,
+//      a cell that recalculates with different arguments cancels its stale job,
+//      and so does an interrupted recalculation, see xCalcCanceled()
+//  Jobs work with the model and product in the store:
+//      they should not be changed while jobs are running
+//  The synchronous functions that may run parallel simulations
+//      wait for the job running, if any, see poolCallerMutex() in asyncJobs.h
+
+//  Results: labels and numbers, in 2 columns
+struct AsyncResults
+{
+    vector<string>  labels;
+    vector<double>  numbers;
+};
+
+//  Return results to Excel from a driver thread
+//  Temporary memory of the framework is not used on driver threads:
+//      the array is built in memory owned here, Excel copies it
+void asyncReturn(const XLOPER12& handle, const AsyncResults* results)
+{
+    XLOPER12 oper;
+    vector<XLOPER12> cells;
+    vector<wstring> strs;
 
+    if (!results || results->labels.empty() || results->labels.size() != results->numbers.size())
+    {
+        oper.xltype = xltypeErr;
+        oper.val.err = xlerrNA;
+    }
+    else
+    {
+        const size_t n = results->labels.size();
+        cells.resize(2 * n);
+        strs.resize(n);
         for (size_t i = 0; i < n; ++i)
         {
-            setString(oper, results.paramIds[i], i + 1, 0);
-            setNum(oper, results.risks[i], i + 1, 1);
+            //  Counted string, length first
+            const string& label = results->labels[i];
+            strs[i] = wstring(1, static_cast<wchar_t>(label.size())) 
+                + wstring(label.begin(), label.end());
+            cells[2 * i].xltype = xltypeStr;
+            cells[2 * i].val.str = &strs[i][0];
+            cells[2 * i + 1].xltype = xltypeNum;
+            cells[2 * i + 1].val.num = results->numbers[i];
         }
+        oper.xltype = xltypeMulti;
+        oper.val.array.rows = static_cast<int>(n);
+        oper.val.array.columns = 2;
+        oper.val.array.lparray = cells.data();
+    }
 
-        return oper;
+    XLOPER12 h = handle;
+    Excel12(xlAsyncReturn, 0, 2, &h, &oper);
+}
+
+AsyncJobs<XLOPER12, AsyncResults> asyncJobs(asyncReturn);
+
+//  The calling cell, identifies stale requests
+//  Calls from elsewhere, VBA for instance, get a unique identifier
+string asyncCaller()
+{
+    static atomic<size_t> anonymous(0);
+    string caller;
+
+    XLOPER12 xCaller;
+    if (Excel12(xlfCaller, &xCaller, 0) == xlretSuccess)
+    {
+        if (xCaller.xltype == xltypeRef && xCaller.val.mref.lpmref->count > 0)
+        {
+            const auto& ref = xCaller.val.mref.lpmref->reftbl[0];
+            caller = to_string(xCaller.val.mref.idSheet) + '!' 
+                + to_string(ref.rwFirst) + ':' + to_string(ref.colFirst);
+        }
+        Excel12(xlFree, 0, 1, &xCaller);
     }
-    catch (const exception&)
+
+    if (caller.empty()) caller = "anonymous " + to_string(++anonymous);
+    return caller;
+}
+
+//  Request key: function, arguments and versions of model and product in the store
+string asyncKey(
+    const string&           function,
+    const string&           mid,
+    const string&           pid,
+    const NumericalParam&   num,
+    const string&           args = "")
+{
+    ostringstream ost;
+    ost.precision(17);
+    ost << function << '\n' << mid << '\n' << pid << '\n'
+        << modelVersion(mid) << '\n' << productVersion(pid) << '\n'
+        << num.useSobol << ' ' << num.brownianBridge << ' ' << num.scramble << ' ' 
+        << num.seed1 << ' ' << num.seed2 << ' ' << num.numPath << ' ' 
+        << num.parallel << ' ' << num.singlePrecision << '\n' << args;
+    return ost.str();
+}
+
+extern "C" __declspec(dllexport)
+void xValueAsync(
+    LPXLOPER12          modelid,
+    LPXLOPER12          productid,
+    //  numerical parameters
+    double              useSobol,
+    double              seed1,
+    double              seed2,
+    double              numPath,
+    double              parallel,
+    //  async handle
+    LPXLOPER12          handle)
+{
+    FreeAllTempMemory();
+
+    const string pid = getString(productid);
+    const string mid = getString(modelid);
+    const auto num = xl2num(useSobol, seed1, seed2, numPath, parallel);
+
+    //  Make sure we have ids, a model, a product and a numPath
+    if (pid.empty() || mid.empty() || !getProduct<double>(pid) || !getModel<double>(mid) 
+        || !num.numPath)
     {
-        return TempErr12(xlerrNA);
+        asyncReturn(*handle, nullptr);
+        return;
+    }
+
+    asyncJobs.submit(asyncKey("xValue", mid, pid, num), asyncCaller(), *handle,
+        [mid, pid, num](const atomic<bool>& cancelled)
+        {
+            NumericalParam jobNum = num;
+            jobNum.cancel = &cancelled;
+            auto results = value(mid, pid, jobNum);
+            return AsyncResults{ results.identifiers, results.values };
+        });
+}
+
+extern "C" __declspec(dllexport)
+void xAADriskAsync(
+    LPXLOPER12          modelid,
+    LPXLOPER12          productid,
+    LPXLOPER12          xRiskPayoff,
+    //  numerical parameters
+    double              useSobol,
+    double              seed1,
+    double              seed2,
+    double              numPath,
+    double              parallel,
+    //  async handle
+    LPXLOPER12          handle)
+{
+    FreeAllTempMemory();
+
+    const string pid = getString(productid);
+    const string mid = getString(modelid);
+    const string riskPayoff = getString(xRiskPayoff);
+    const auto num = xl2num(useSobol, seed1, seed2, numPath, parallel);
+
+    //  Make sure we have ids, a model, a product and a numPath
+    if (pid.empty() || mid.empty() || !getProduct<Number>(pid) || !getModel<Number>(mid) 
+        || !num.numPath)
+    {
+        asyncReturn(*handle, nullptr);
+        return;
+    }
+
+    asyncJobs.submit(asyncKey("xAADrisk", mid, pid, num, riskPayoff), asyncCaller(), *handle,
+        [mid, pid, riskPayoff, num](const atomic<bool>& cancelled)
+        {
+            NumericalParam jobNum = num;
+            jobNum.cancel = &cancelled;
+            auto risk = AADriskOne(mid, pid, jobNum, riskPayoff);
+            AsyncResults results{ risk.paramIds, risk.risks };
+            results.labels.insert(results.labels.begin(), "value");
+            results.numbers.insert(results.numbers.begin(), risk.riskPayoffValue);
+            return results;
+        });
+}
+
+extern "C" __declspec(dllexport)
+void xAADriskAggregateAsync(
+    LPXLOPER12          modelid,
+    LPXLOPER12          productid,
+    LPXLOPER12          xPayoffs,
+    FP12*               xNotionals,
+    //  numerical parameters
+    double              useSobol,
+    double              seed1,
+    double              seed2,
+    double              numPath,
+    double              parallel,
+    //  async handle
+    LPXLOPER12          handle)
+{
+    FreeAllTempMemory();
+
+    const string pid = getString(productid);
+    const string mid = getString(modelid);
+    const auto num = xl2num(useSobol, seed1, seed2, numPath, parallel);
+    map<string, double> notionals;
+
+    //  Make sure we have ids, a model, a product, notionals and a numPath
+    if (pid.empty() || mid.empty() || !getProduct<Number>(pid) || !getModel<Number>(mid) 
+        || !num.numPath || !getNotionals(xPayoffs, xNotionals, notionals))
+    {
+        asyncReturn(*handle, nullptr);
+        return;
     }
+
+    ostringstream args;
+    args.precision(17);
+    for (const auto& notional : notionals) args << notional.first << '\n' << notional.second << '\n';
+
+    asyncJobs.submit(asyncKey("xAADriskAggregate", mid, pid, num, args.str()), asyncCaller(), *handle,
+        [mid, pid, notionals, num](const atomic<bool>& cancelled)
+        {
+            NumericalParam jobNum = num;
+            jobNum.cancel = &cancelled;
+            auto risk = AADriskAggregate(mid, pid, notionals, jobNum);
+            AsyncResults results{ risk.paramIds, risk.risks };
+            results.labels.insert(results.labels.begin(), "value");
+            results.numbers.insert(results.numbers.begin(), risk.riskPayoffValue);
+            return results;
+        });
+}
+
+//  Event handler: interrupted recalculation, cancel the jobs in flight
+extern "C" __declspec(dllexport)
+int xCalcCanceled(void)
+{
+    asyncJobs.cancelAll();
+    return 1;
 }
 
 unordered_map<string, RiskReports> riskStore;
+mutex riskStoreMutex;
 
 extern "C" __declspec(dllexport)
 LPXLOPER12 xBumprisk(
@@ -548,6 +1305,9 @@ LPXLOPER12 xBumprisk(
     //  Make sure we have a numPath
     if (!num.numPath) return TempErr12(xlerrNA);
 
+    //  One caller of parallel simulations at a time, see asyncJobs.h
+    const auto poolCaller = lockPoolCaller(num.parallel);
+
     try
     {
         auto results = bumpRisk(mid, pid, num);
@@ -559,6 +1319,7 @@ LPXLOPER12 xBumprisk(
         {
             const string riskId = getString(storeid);
             if (riskId == "") return TempErr12(xlerrNA);
+            lock_guard<mutex> lk(riskStoreMutex);
             riskStore[riskId] = results;
             return storeid;
         }
@@ -598,6 +1359,9 @@ LPXLOPER12 xAADriskMulti(
     //  Make sure we have a numPath
     if (!num.numPath) return TempErr12(xlerrNA);
 
+    //  One caller of parallel simulations at a time, see asyncJobs.h
+    lock_guard<mutex> poolCaller(poolCallerMutex());
+
     try
     {
         auto results = AADriskMulti(mid, pid, num);
@@ -609,6 +1373,7 @@ LPXLOPER12 xAADriskMulti(
         {
             const string riskId = getString(storeid);
             if (riskId == "") return TempErr12(xlerrNA);
+            lock_guard<mutex> lk(riskStoreMutex);
             riskStore[riskId] = results;
             return storeid;
         }
@@ -626,6 +1391,8 @@ LPXLOPER12 xDisplayRisk(
 {
     FreeAllTempMemory();
 
+    lock_guard<mutex> lk(riskStoreMutex);
+
     RiskReports* results;
     const string riskId = getString(riskid);
     auto& it = riskStore.find(riskId);
@@ -761,6 +1528,9 @@ extern "C" __declspec(dllexport)
     //  Make sure we have a numPath
     if (!num.numPath) return TempErr12(xlerrNA);
 
+    //  One caller of parallel simulations at a time, see asyncJobs.h
+    lock_guard<mutex> poolCaller(poolCallerMutex());
+
     //  Payoffs and notionals, removing blanks
     map<string, double> notionals;
     {
@@ -823,22 +1593,16 @@ extern "C" __declspec(dllexport)
         const size_t n = results.vega.rows(), m = results.vega.cols();
         const size_t N = n + 4, M = m + 2;
 
-        LPXLOPER12 oper = TempXLOPER12();
-        resize(oper, N, M);
+        LPXLOPER12 oper = TempMulti12(N, M);
+        if (!oper
+            || !setStrings(oper, { "value", "delta", "vega", "strikes" }, 0, 0)
+            || !setStrings(oper, { "mats" }, 2, 1)) return TempErr12(xlerrNA);
 
-        setString(oper, "value", 0, 0);
         setNum(oper, results.value, 0, 1);
-        setString(oper, "delta", 1, 0);
         setNum(oper, results.delta, 1, 1);
-        setString(oper, "vega", 2, 0);
-        setString(oper, "mats", 2, 1);
-        for (size_t i = 0; i < m; ++i) setNum(oper, results.mats[i], 2, 2 + i);
-        setString(oper, "strikes", 3, 0);
-        for (size_t i = 0; i < n; ++i)
-        {
-            setNum(oper, results.strikes[i], 4 + i, 0);
-            for (size_t j = 0; j < m; ++j) setNum(oper, results.vega[i][j], 4 + i, 2 + j);
-        }
+        setNums(oper, results.mats, 2, 2, false);
+        setNums(oper, results.strikes, 4, 0);
+        setNums(oper, results.vega, 4, 2);
 
         // Return it
         return oper;
@@ -975,19 +1739,19 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xRestartThreadPool"),
-        (LPXLOPER12)TempStr12(L"BB"),
+        (LPXLOPER12)TempStr12(L"BBB$"),
         (LPXLOPER12)TempStr12(L"xRestartThreadPool"),
-        (LPXLOPER12)TempStr12(L"numThreads"),
+        (LPXLOPER12)TempStr12(L"numThreads, pinThreads"),
         (LPXLOPER12)TempStr12(L"1"),
         (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
         (LPXLOPER12)TempStr12(L""),
         (LPXLOPER12)TempStr12(L""),
-        (LPXLOPER12)TempStr12(L"Restarts the thread pool with n threads"),
+        (LPXLOPER12)TempStr12(L"Restarts the thread pool with n threads, optionally pinned by NUMA node"),
         (LPXLOPER12)TempStr12(L""));
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xPutBlackScholes"),
-        (LPXLOPER12)TempStr12(L"QBBBBBQ"),
+        (LPXLOPER12)TempStr12(L"QBBBBBQ$"),
         (LPXLOPER12)TempStr12(L"xPutBlackScholes"),
         (LPXLOPER12)TempStr12(L"spot, vol, qSpot, rate, div, id"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -999,9 +1763,9 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xPutDupire"),
-        (LPXLOPER12)TempStr12(L"QBK%K%K%BQ"),
+        (LPXLOPER12)TempStr12(L"QBK%K%K%BQBB$"),
         (LPXLOPER12)TempStr12(L"xPutDupire"),
-        (LPXLOPER12)TempStr12(L"spot, spots, times, vols, maxDt, id"),
+        (LPXLOPER12)TempStr12(L"spot, spots, times, vols, maxDt, id, [checkpointSteps], [scheme]"),
         (LPXLOPER12)TempStr12(L"1"),
         (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
         (LPXLOPER12)TempStr12(L""),
@@ -1011,7 +1775,7 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xPutEuropean"),
-        (LPXLOPER12)TempStr12(L"QBBBQ"),
+        (LPXLOPER12)TempStr12(L"QBBBQ$"),
         (LPXLOPER12)TempStr12(L"xPutEuropean"),
         (LPXLOPER12)TempStr12(L"strike, exerciseDate, [settlementDate], id"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -1023,7 +1787,7 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xPutBarrier"),
-        (LPXLOPER12)TempStr12(L"QBBBBBQ"),
+        (LPXLOPER12)TempStr12(L"QBBBBBQ$"),
         (LPXLOPER12)TempStr12(L"xPutBarrier"),
         (LPXLOPER12)TempStr12(L"strike, barrier, maturity, monitoringFreq, [smoothingFactor], id"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -1035,7 +1799,7 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xPutContingent"),
-        (LPXLOPER12)TempStr12(L"QBBBBQ"),
+        (LPXLOPER12)TempStr12(L"QBBBBQ$"),
         (LPXLOPER12)TempStr12(L"xPutContingent"),
         (LPXLOPER12)TempStr12(L"coupon, maturity, payFreq, [smoothingFactor], id"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -1047,7 +1811,7 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xPutEuropeans"),
-        (LPXLOPER12)TempStr12(L"QK%K%Q"),
+        (LPXLOPER12)TempStr12(L"QK%K%Q$"),
         (LPXLOPER12)TempStr12(L"xPutEuropeans"),
         (LPXLOPER12)TempStr12(L"maturities, strikes, id"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -1057,9 +1821,21 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
         (LPXLOPER12)TempStr12(L"Initializes a collection of European call in memory"),
         (LPXLOPER12)TempStr12(L""));
 
+    Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
+        (LPXLOPER12)TempStr12(L"xPutPortfolio"),
+        (LPXLOPER12)TempStr12(L"QQQ$"),
+        (LPXLOPER12)TempStr12(L"xPutPortfolio"),
+        (LPXLOPER12)TempStr12(L"productIds, id"),
+        (LPXLOPER12)TempStr12(L"1"),
+        (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"Initializes a portfolio of products in memory"),
+        (LPXLOPER12)TempStr12(L""));
+
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xPayoffIds"),
-        (LPXLOPER12)TempStr12(L"QQ"),
+        (LPXLOPER12)TempStr12(L"QQ$"),
         (LPXLOPER12)TempStr12(L"xPayoffIds"),
         (LPXLOPER12)TempStr12(L"id"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -1071,7 +1847,7 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xParameters"),
-        (LPXLOPER12)TempStr12(L"QQ"),
+        (LPXLOPER12)TempStr12(L"QQ$"),
         (LPXLOPER12)TempStr12(L"xParameters"),
         (LPXLOPER12)TempStr12(L"id"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -1083,19 +1859,43 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xValue"),
-        (LPXLOPER12)TempStr12(L"QQQBBBBB"),
+        (LPXLOPER12)TempStr12(L"QQQBBBBB$"),
         (LPXLOPER12)TempStr12(L"xValue"),
         (LPXLOPER12)TempStr12(L"modelId, productId, useSobol, [seed1], [seed2], N, [Parallel]"),
         (LPXLOPER12)TempStr12(L"1"),
         (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
         (LPXLOPER12)TempStr12(L""),
         (LPXLOPER12)TempStr12(L""),
-        (LPXLOPER12)TempStr12(L"Monte-Carlo valuation"),
+        (LPXLOPER12)TempStr12(L"Monte-Carlo values and standard errors"),
+        (LPXLOPER12)TempStr12(L""));
+
+    Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
+        (LPXLOPER12)TempStr12(L"xValueTarget"),
+        (LPXLOPER12)TempStr12(L"QQQBBBBBB$"),
+        (LPXLOPER12)TempStr12(L"xValueTarget"),
+        (LPXLOPER12)TempStr12(L"modelId, productId, useSobol, [seed1], [seed2], maxN, [Parallel], targetError"),
+        (LPXLOPER12)TempStr12(L"1"),
+        (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"Monte-Carlo valuation to a target standard error"),
+        (LPXLOPER12)TempStr12(L""));
+
+    Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
+        (LPXLOPER12)TempStr12(L"xValueModels"),
+        (LPXLOPER12)TempStr12(L"QQQBBBBB$"),
+        (LPXLOPER12)TempStr12(L"xValueModels"),
+        (LPXLOPER12)TempStr12(L"modelIds, productId, useSobol, [seed1], [seed2], N, [Parallel]"),
+        (LPXLOPER12)TempStr12(L"1"),
+        (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"Monte-Carlo valuation in several models with common random numbers"),
         (LPXLOPER12)TempStr12(L""));
 
 	Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
 		(LPXLOPER12)TempStr12(L"xValueTime"),
-		(LPXLOPER12)TempStr12(L"QQQBBBBB"),
+		(LPXLOPER12)TempStr12(L"QQQBBBBB$"),
 		(LPXLOPER12)TempStr12(L"xValueTime"),
 		(LPXLOPER12)TempStr12(L"modelId, productId, useSobol, [seed1], [seed2], N, [Parallel]"),
 		(LPXLOPER12)TempStr12(L"1"),
@@ -1107,7 +1907,7 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 	
 	Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xAADrisk"),
-        (LPXLOPER12)TempStr12(L"QQQQBBBBB"),
+        (LPXLOPER12)TempStr12(L"QQQQBBBBB$"),
         (LPXLOPER12)TempStr12(L"xAADrisk"),
         (LPXLOPER12)TempStr12(L"modelId, productId, riskPayoff, useSobol, [seed1], [seed2], N, [Parallel]"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -1119,7 +1919,7 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xAADriskAggregate"),
-        (LPXLOPER12)TempStr12(L"QQQQK%BBBBB"),
+        (LPXLOPER12)TempStr12(L"QQQQK%BBBBB$"),
         (LPXLOPER12)TempStr12(L"xAADriskAggregate"),
         (LPXLOPER12)TempStr12(L"modelId, productId, payoffs, notionals, useSobol, [seed1], [seed2], N, [Parallel]"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -1129,9 +1929,149 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
         (LPXLOPER12)TempStr12(L"AAD risk report for aggregate book of payoffs"),
         (LPXLOPER12)TempStr12(L""));
 
+    Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
+        (LPXLOPER12)TempStr12(L"xDirectionalRisk"),
+        (LPXLOPER12)TempStr12(L"QQQQK%BBBBB$"),
+        (LPXLOPER12)TempStr12(L"xDirectionalRisk"),
+        (LPXLOPER12)TempStr12(L"modelId, productId, parameters, weights, useSobol, [seed1], [seed2], N, [Parallel]"),
+        (LPXLOPER12)TempStr12(L"1"),
+        (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"Values and derivatives of all payoffs in a direction of the model parameters, forward mode"),
+        (LPXLOPER12)TempStr12(L""));
+
+    Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
+        (LPXLOPER12)TempStr12(L"xAADrisk2"),
+        (LPXLOPER12)TempStr12(L"QQQQQK%BBBBB$"),
+        (LPXLOPER12)TempStr12(L"xAADrisk2"),
+        (LPXLOPER12)TempStr12(L"modelId, productId, [riskPayoff], parameters, weights, useSobol, [seed1], [seed2], N, [Parallel]"),
+        (LPXLOPER12)TempStr12(L"1"),
+        (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"AAD risk report with Hessian times a direction of the model parameters"),
+        (LPXLOPER12)TempStr12(L""));
+
+    Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
+        (LPXLOPER12)TempStr12(L"xTrainingSet"),
+        (LPXLOPER12)TempStr12(L"QQQQK%QK%K%QBBBBBBB$"),
+        (LPXLOPER12)TempStr12(L"xTrainingSet"),
+        (LPXLOPER12)TempStr12(L"modelId, productId, payoffs, notionals, states, lower, upper, filePrefix, samplesPerShard, useSobol, [seed1], [seed2], N, [Parallel], [pathwise]"),
+        (LPXLOPER12)TempStr12(L"1"),
+        (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"Differential training set: states, pathwise payoffs and differentials, in .npy files"),
+        (LPXLOPER12)TempStr12(L""));
+
+    Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
+        (LPXLOPER12)TempStr12(L"xValueAsync"),
+        (LPXLOPER12)TempStr12(L">QQBBBBBX"),
+        (LPXLOPER12)TempStr12(L"xValueAsync"),
+        (LPXLOPER12)TempStr12(L"modelId, productId, useSobol, [seed1], [seed2], N, [Parallel]"),
+        (LPXLOPER12)TempStr12(L"1"),
+        (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"Asynchronous Monte-Carlo valuation"),
+        (LPXLOPER12)TempStr12(L""));
+
+    Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
+        (LPXLOPER12)TempStr12(L"xAADriskAsync"),
+        (LPXLOPER12)TempStr12(L">QQQBBBBBX"),
+        (LPXLOPER12)TempStr12(L"xAADriskAsync"),
+        (LPXLOPER12)TempStr12(L"modelId, productId, riskPayoff, useSobol, [seed1], [seed2], N, [Parallel]"),
+        (LPXLOPER12)TempStr12(L"1"),
+        (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"Asynchronous AAD risk report"),
+        (LPXLOPER12)TempStr12(L""));
+
+    Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
+        (LPXLOPER12)TempStr12(L"xAADriskAggregateAsync"),
+        (LPXLOPER12)TempStr12(L">QQQK%BBBBBX"),
+        (LPXLOPER12)TempStr12(L"xAADriskAggregateAsync"),
+        (LPXLOPER12)TempStr12(L"modelId, productId, payoffs, notionals, useSobol, [seed1], [seed2], N, [Parallel]"),
+        (LPXLOPER12)TempStr12(L"1"),
+        (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"Asynchronous AAD risk report for aggregate book of payoffs"),
+        (LPXLOPER12)TempStr12(L""));
+
+    Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
+        (LPXLOPER12)TempStr12(L"xCacheStats"),
+        (LPXLOPER12)TempStr12(L"Q!$"),
+        (LPXLOPER12)TempStr12(L"xCacheStats"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"1"),
+        (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"Diagnostics of the result cache"),
+        (LPXLOPER12)TempStr12(L""));
+
+    Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
+        (LPXLOPER12)TempStr12(L"xSetTapeBudget"),
+        (LPXLOPER12)TempStr12(L"BB$"),
+        (LPXLOPER12)TempStr12(L"xSetTapeBudget"),
+        (LPXLOPER12)TempStr12(L"megabytes"),
+        (LPXLOPER12)TempStr12(L"1"),
+        (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"Memory budget of the AAD tapes, spilled to disk beyond, 0 for unlimited"),
+        (LPXLOPER12)TempStr12(L""));
+
+    Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
+        (LPXLOPER12)TempStr12(L"xLoadSobolDirections"),
+        (LPXLOPER12)TempStr12(L"BQ$"),
+        (LPXLOPER12)TempStr12(L"xLoadSobolDirections"),
+        (LPXLOPER12)TempStr12(L"file"),
+        (LPXLOPER12)TempStr12(L"1"),
+        (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"Load Joe and Kuo's direction numbers for Sobol, empty for the built-in ones"),
+        (LPXLOPER12)TempStr12(L""));
+
+    Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
+        (LPXLOPER12)TempStr12(L"xRunStats"),
+        (LPXLOPER12)TempStr12(L"Q!$"),
+        (LPXLOPER12)TempStr12(L"xRunStats"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"1"),
+        (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"Profiling counters of the last run"),
+        (LPXLOPER12)TempStr12(L""));
+
+    Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
+        (LPXLOPER12)TempStr12(L"xSetCacheSize"),
+        (LPXLOPER12)TempStr12(L"BB$"),
+        (LPXLOPER12)TempStr12(L"xSetCacheSize"),
+        (LPXLOPER12)TempStr12(L"megabytes"),
+        (LPXLOPER12)TempStr12(L"1"),
+        (LPXLOPER12)TempStr12(L"myOwnCppFunctions"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempStr12(L"Memory budget of the result cache, 0 disables it, negative clears it"),
+        (LPXLOPER12)TempStr12(L""));
+
+    /*  Hidden command, handler of interrupted recalculations   */
+    Excel12f(xlfRegister, 0, 6, (LPXLOPER12)&xDLL,
+        (LPXLOPER12)TempStr12(L"xCalcCanceled"),
+        (LPXLOPER12)TempStr12(L"J"),
+        (LPXLOPER12)TempStr12(L"xCalcCanceled"),
+        (LPXLOPER12)TempStr12(L""),
+        (LPXLOPER12)TempNum12(2));
+
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xBumprisk"),
-        (LPXLOPER12)TempStr12(L"QQQBBBBBBQ"),
+        (LPXLOPER12)TempStr12(L"QQQBBBBBBQ$"),
         (LPXLOPER12)TempStr12(L"xBumprisk"),
         (LPXLOPER12)TempStr12(L"modelId, productId, useSobol, [seed1], [seed2], N, [Parallel], [display?], [storeId]"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -1143,7 +2083,7 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xAADriskMulti"),
-        (LPXLOPER12)TempStr12(L"QQQBBBBBBQ"),
+        (LPXLOPER12)TempStr12(L"QQQBBBBBBQ$"),
         (LPXLOPER12)TempStr12(L"xAADriskMulti"),
         (LPXLOPER12)TempStr12(L"modelId, productId, useSobol, [seed1], [seed2], N, [Parallel], [display?], [storeId]"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -1155,7 +2095,7 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xDisplayRisk"),
-        (LPXLOPER12)TempStr12(L"QQQ"),
+        (LPXLOPER12)TempStr12(L"QQQ$"),
         (LPXLOPER12)TempStr12(L"xDisplayRisk"),
         (LPXLOPER12)TempStr12(L"reportId, payoffId"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -1167,7 +2107,7 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xDupireSuperbucket"),
-        (LPXLOPER12)TempStr12(L"QBBBBBK%K%K%BK%BBQQK%BBBBBB"),
+        (LPXLOPER12)TempStr12(L"QBBBBBK%K%K%BK%BBQQK%BBBBBB$"),
         (LPXLOPER12)TempStr12(L"xDupireSuperbucket"),
         (LPXLOPER12)TempStr12(L"spot, vol, jmpIt, jmpAve, jmpStd, RiskStrikes, riskMats, volSpots, maxDs, volTimes, maxDtVol, maxDtSimul, productId, payoffs, notionals, sobol, s1, s2, numPth, parallel, [bump?]"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -1179,7 +2119,7 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xDupireCalib"),
-        (LPXLOPER12)TempStr12(L"QBBBBBK%BK%B"),
+        (LPXLOPER12)TempStr12(L"QBBBBBK%BK%B$"),
         (LPXLOPER12)TempStr12(L"xDupireCalib"),
         (LPXLOPER12)TempStr12(L"spot, vol, jumpIntensity, jumpAverage, jumpStd, spots, maxds, times, mxdt"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -1191,7 +2131,7 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xMerton"),
-        (LPXLOPER12)TempStr12(L"BBBBBBBB"),
+        (LPXLOPER12)TempStr12(L"BBBBBBBB$"),
         (LPXLOPER12)TempStr12(L"xMerton"),
         (LPXLOPER12)TempStr12(L"spot, vol, mat, strike, intens, meanJmp, stdJmp"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -1203,7 +2143,7 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
     Excel12f(xlfRegister, 0, 11, (LPXLOPER12)&xDLL,
         (LPXLOPER12)TempStr12(L"xBarrierBlackScholes"),
-        (LPXLOPER12)TempStr12(L"BBBBBBBB"),
+        (LPXLOPER12)TempStr12(L"BBBBBBBB$"),
         (LPXLOPER12)TempStr12(L"xBarrierBlackScholes"),
         (LPXLOPER12)TempStr12(L"spot, rate, div, vol, mat, strike, barrier"),
         (LPXLOPER12)TempStr12(L"1"),
@@ -1240,6 +2180,11 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 	/* Free the XLL filename */
 	Excel12f(xlFree, 0, 1, (LPXLOPER12)&xDLL);
 
+    /*  Cancel asynchronous jobs on interrupted recalculations  */
+    Excel12f(xlEventRegister, 0, 2, 
+        (LPXLOPER12)TempStr12(L"xCalcCanceled"), 
+        (LPXLOPER12)TempNum12(xleventCalculationCanceled));
+
     /*  Start the thread pool   */
     ThreadPool::getInstance()->start(thread::hardware_concurrency() - 1);
 
@@ -1248,6 +2193,9 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void)
 
 extern "C" __declspec(dllexport) int xlAutoClose(void)
 {
+    /*  Cancel asynchronous jobs and stop their driver  */
+    asyncJobs.stop();
+
     /*  Stop the thread pool   */
     ThreadPool::getInstance()->stop();
 
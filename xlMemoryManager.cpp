@@ -14,6 +14,8 @@
 //              as MEMORYPOOLS, defined in MemoryManager.h.  When a new thread
 //              needs a pool, and the current set of pools are all assigned,
 //              the number of pools increases by a factor of two.
+//              The pools are guarded by a mutex, for thread safe functions
+//              called concurrently in multi-threaded recalculation.
 // 
 // Platform:    Microsoft Windows
 //
@@ -97,6 +99,7 @@ MemoryManager::~MemoryManager(void)
 //
 LPSTR MemoryManager::CPP_GetTempMemory(int cByte)
 {
+	std::lock_guard<std::mutex> lock(m_mutex); //pools are shared between threads
 	DWORD dwThreadID;
 	MemoryPool* pmp;
 
@@ -117,6 +120,7 @@ LPSTR MemoryManager::CPP_GetTempMemory(int cByte)
 //
 void MemoryManager::CPP_FreeAllTempMemory()
 {
+	std::lock_guard<std::mutex> lock(m_mutex); //pools are shared between threads
 	DWORD dwThreadID;
 	MemoryPool* pmp;
 
@@ -7,6 +7,7 @@
 #include "xlcall.h"
 #include "xlframework.h"
 #include <string>
+#include <climits>
 using namespace std;
 
 #include "matrix.h"
@@ -120,17 +121,69 @@ double getNum(const LPXLOPER12& oper, const size_t i = 0, const size_t j = 0)
     }
 }
 
+//  Bulk allocation of arrays
+
+//  All the temporary memory of an array in one call to GetTempMemory,
+//      so one lock on the memory manager and one bump of the thread's pool
+//      instead of one or two per cell:
+//      the header if any, the cells, 
+//      then an empty string shared by all the blank cells
+//  Excel displays nil cells as 0, so blank cells are empty strings
+//  Returns 0 if the array does not fit in the pool
+LPXLOPER12 tempBlankCells(const size_t rows, const size_t cols, const bool header)
+{
+    const size_t n = rows * cols, h = header ? 1 : 0;
+    if (n == 0 || n / rows != cols
+        || n + h > (INT_MAX - sizeof(XCHAR)) / sizeof(XLOPER12)) return 0;
+
+    LPXLOPER12 block = (LPXLOPER12)GetTempMemory(int((n + h) * sizeof(XLOPER12) + sizeof(XCHAR)));
+    if (!block) return 0;
+
+    LPXLOPER12 cells = block + h;
+    XCHAR* blank = (XCHAR*)(cells + n);
+    blank[0] = 0;
+
+    XLOPER12 nilOper;
+    nilOper.xltype = xltypeStr;
+    nilOper.val.str = blank;
+    fill(cells, cells + n, nilOper);
+
+    return block;
+}
+
+//  Blank array of rows x cols, header and cells in one block
+//  Returns 0 if the array does not fit in the pool
+LPXLOPER12 TempMulti12(const size_t rows, const size_t cols)
+{
+    LPXLOPER12 oper = tempBlankCells(rows, cols, true);
+    if (!oper) return 0;
+
+    oper->xltype = xltypeMulti;
+    oper->val.array.rows = RW(rows);
+    oper->val.array.columns = COL(cols);
+    oper->val.array.lparray = oper + 1;
+
+    return oper;
+}
+
 //  Setter to return result to Excel
 //  Register as type Q
 //  Return as LPXLOPER12
-void resize(LPXLOPER12& oper, const size_t rows, const size_t cols)
+//  Returns false if the array does not fit in the pool
+bool resize(LPXLOPER12& oper, const size_t rows, const size_t cols)
 {
+    if (!oper) return false;
     oper->xltype = xltypeMulti;
-    oper->val.array.rows = rows;
-    oper->val.array.columns = cols;
-    oper->val.array.lparray = (LPXLOPER12)GetTempMemory(rows*cols*sizeof(XLOPER12));
-    LPXLOPER12 nilOper = TempStr12("");
-    fill(oper->val.array.lparray, oper->val.array.lparray + rows*cols, *nilOper);
+    oper->val.array.rows = RW(rows);
+    oper->val.array.columns = COL(cols);
+    oper->val.array.lparray = tempBlankCells(rows, cols, false);
+    if (!oper->val.array.lparray)
+    {
+        oper->xltype = xltypeErr;
+        oper->val.err = xlerrNA;
+        return false;
+    }
+    return true;
 }
 
 //  Set string in position (i, j) 
@@ -148,6 +201,85 @@ void setNum(LPXLOPER12& oper, const double num, const size_t i = 0, const size_t
     nOper.val.num = num;
 }
 
+//  Bulk setters
+
+//  Numbers from any storage with contiguous or strided rows, 
+//      written row by row into the cells from position (i0, j0)
+void setNums(LPXLOPER12& oper, const matrixView<const double>& nums, const size_t i0 = 0, const size_t j0 = 0)
+{
+    const size_t operCols = getCols(oper);
+    const size_t rows = nums.rows(), cols = nums.cols();
+    for (size_t i = 0; i < rows; ++i)
+    {
+        LPXLOPER12 dst = oper->val.array.lparray + (i0 + i) * operCols + j0;
+        if (nums.contiguousRows())
+        {
+            const double* src = nums[i];
+            for (size_t j = 0; j < cols; ++j)
+            {
+                dst[j].xltype = xltypeNum;
+                dst[j].val.num = src[j];
+            }
+        }
+        else
+        {
+            for (size_t j = 0; j < cols; ++j)
+            {
+                dst[j].xltype = xltypeNum;
+                dst[j].val.num = nums(i, j);
+            }
+        }
+    }
+}
+
+//  Matrix from its contiguous storage
+void setNums(LPXLOPER12& oper, const matrix<double>& nums, const size_t i0 = 0, const size_t j0 = 0)
+{
+    setNums(oper, nums.view(), i0, j0);
+}
+
+//  Vector down a column or across a row from position (i0, j0)
+void setNums(LPXLOPER12& oper, const vector<double>& nums, const size_t i0 = 0, const size_t j0 = 0, 
+    const bool down = true)
+{
+    const size_t n = nums.size();
+    if (n == 0) return;
+    setNums(oper, down
+        ? matrixView<const double>(nums.data(), n, 1, 1)
+        : matrixView<const double>(nums.data(), 1, n, n),
+        i0, j0);
+}
+
+//  Strings down a column or across a row from position (i0, j0)
+//  All the characters in one call to GetTempMemory
+//  Returns false if they do not fit in the pool
+bool setStrings(LPXLOPER12& oper, const vector<string>& strs, const size_t i0 = 0, const size_t j0 = 0, 
+    const bool down = true)
+{
+    if (strs.empty()) return true;
+
+    size_t chars = 0;
+    for (const auto& str : strs) chars += str.size() + 1;
+    if (chars > INT_MAX / sizeof(XCHAR)) return false;
+
+    XCHAR* buffer = (XCHAR*)GetTempMemory(int(chars * sizeof(XCHAR)));
+    if (!buffer) return false;
+
+    const size_t step = down ? getCols(oper) : 1;
+    LPXLOPER12 dst = oper->val.array.lparray + i0 * getCols(oper) + j0;
+    for (const auto& str : strs)
+    {
+        if (str.size() > 0) mbstowcs(buffer + 1, str.data(), str.size());
+        buffer[0] = static_cast<XCHAR>(str.size());
+        dst->xltype = xltypeStr;
+        dst->val.str = buffer;
+        buffer += str.size() + 1;
+        dst += step;
+    }
+
+    return true;
+}
+
 //  Various utilities
 
 //  FP12* to vector<double>
@@ -196,18 +328,24 @@ matrix<double> to_matrix(const FP12* oper)
     return m;
 }
 
+//  FP12* read in place, without copy
+//  Register as type K%: Excel owns the array, valid for the duration of the call
+matrixView<const double> to_matrixView(const FP12* oper)
+{
+    return matrixView<const double>(oper->array, oper->rows, oper->columns, oper->columns);
+}
+
+//  Results filled in bulk: one allocation for the array, one for its strings,
+//      numbers copied row by row from contiguous storage
+//  #N/A if inconsistent, or too large for the temporary memory
+
 LPXLOPER12 from_strVector(const vector<string>& strv, const bool rowVector = true)
 {
-    LPXLOPER12 oper = TempXLOPER12();
-    oper->xltype = xltypeMulti;
-    oper->val.array.rows = rowVector ? strv.size() : 1;
-    oper->val.array.columns = rowVector ? 1 : strv.size();
-    oper->val.array.lparray = (LPXLOPER12) GetTempMemory(strv.size() * sizeof(XLOPER12));
-    transform(strv.begin(), strv.end(), oper->val.array.lparray,
-        [](const string& s)
-    {
-        return *TempStr12(s);
-    });
+    const size_t n = strv.size();
+    if (n == 0) return TempErr12(xlerrNA);
+
+    LPXLOPER12 oper = TempMulti12(rowVector ? n : 1, rowVector ? 1 : n);
+    if (!oper || !setStrings(oper, strv, 0, 0, rowVector)) return TempErr12(xlerrNA);
 
     return oper;
 }
@@ -216,17 +354,10 @@ LPXLOPER12 from_labelsAndNumbers(const vector<string>& labels, const vector<doub
 {
     const size_t n = labels.size();
     if (n == 0 || n != numbers.size()) return TempErr12(xlerrNA);
-    LPXLOPER12 oper = TempXLOPER12();
-    oper->xltype = xltypeMulti;
-    oper->val.array.rows = n;
-    oper->val.array.columns = 2;
-    oper->val.array.lparray = (LPXLOPER12)GetTempMemory(2 * n * sizeof(XLOPER12));
 
-    for (size_t i = 0; i < n; ++i)
-    {
-        oper->val.array.lparray[2 * i] = *TempStr12(labels[i]);
-        oper->val.array.lparray[2 * i + 1] = *TempNum12(numbers[i]);
-    }
+    LPXLOPER12 oper = TempMulti12(n, 2);
+    if (!oper || !setStrings(oper, labels, 0, 0)) return TempErr12(xlerrNA);
+    setNums(oper, numbers, 0, 1);
 
     return oper;
 }
@@ -236,12 +367,11 @@ LPXLOPER12 from_labelledMatrix(const vector<string>& rowLabels, const vector<str
     const size_t n = rowLabels.size(), m = colLabels.size();
     if (n == 0 || m == 0 || n != mat.rows() || m != mat.cols()) return TempErr12(xlerrNA);
 
-    LPXLOPER12 oper = TempXLOPER12();
-    resize(oper, n + 1, m + 1);
-    for (size_t i = 0; i < n; ++i) setString(oper, rowLabels[i], i + 1, 0);
-    for (size_t i = 0; i < m; ++i) setString(oper, colLabels[i], 0, i + 1);
-
-    for (size_t i = 0; i < n; ++i)  for (size_t j = 0; j < m; ++j) setNum(oper, mat[i][j], i + 1, j + 1);
+    LPXLOPER12 oper = TempMulti12(n + 1, m + 1);
+    if (!oper 
+        || !setStrings(oper, rowLabels, 1, 0) 
+        || !setStrings(oper, colLabels, 0, 1, false)) return TempErr12(xlerrNA);
+    setNums(oper, mat, 1, 1);
 
     return oper;
 }
@@ -251,12 +381,11 @@ LPXLOPER12 from_labelledMatrix(const vector<double>& rowLabels, const vector<dou
     const size_t n = rowLabels.size(), m = colLabels.size();
     if (n == 0 || m == 0 || n != mat.rows() || m != mat.cols()) return TempErr12(xlerrNA);
 
-    LPXLOPER12 oper = TempXLOPER12();
-    resize(oper, n + 1, m + 1);
-    for (size_t i = 0; i < n; ++i) setNum(oper, rowLabels[i], i + 1, 0);
-    for (size_t i = 0; i < m; ++i) setNum(oper, colLabels[i], 0, i + 1);
-
-    for (size_t i = 0; i < n; ++i)  for (size_t j = 0; j < m; ++j) setNum(oper, mat[i][j], i + 1, j + 1);
+    LPXLOPER12 oper = TempMulti12(n + 1, m + 1);
+    if (!oper) return TempErr12(xlerrNA);
+    setNums(oper, rowLabels, 1, 0);
+    setNums(oper, colLabels, 0, 1, false);
+    setNums(oper, mat, 1, 1);
 
     return oper;
 }
@@ -267,13 +396,13 @@ LPXLOPER12 from_labelledMatrix(const vector<string>& rowLabels, const vector<str
 	const size_t n = rowLabels.size(), m = colLabels.size();
 	if (n == 0 || m == 0 || n != mat.rows() || m != mat.cols() || m != firstLine.size()) return TempErr12(xlerrNA);
 
-	LPXLOPER12 oper = TempXLOPER12();
-	resize(oper, n + 2, m + 1);
-	setString(oper, firstLineLabel, 1, 0);
-	for (size_t i = 0; i < m; ++i) setString(oper, colLabels[i], 0, i + 1);
-	for (size_t i = 0; i < m; ++i) setNum(oper, firstLine[i], 1, i + 1);
-	for (size_t i = 0; i < n; ++i) setString(oper, rowLabels[i], i + 2, 0);
-	for (size_t i = 0; i < n; ++i)  for (size_t j = 0; j < m; ++j) setNum(oper, mat[i][j], i + 2, j + 1);
+	LPXLOPER12 oper = TempMulti12(n + 2, m + 1);
+	if (!oper
+		|| !setStrings(oper, { firstLineLabel }, 1, 0)
+		|| !setStrings(oper, colLabels, 0, 1, false)
+		|| !setStrings(oper, rowLabels, 2, 0)) return TempErr12(xlerrNA);
+	setNums(oper, firstLine, 1, 1, false);
+	setNums(oper, mat, 2, 1);
 
 	return oper;
-}
\ No newline at end of file
+}
@@ -365,6 +365,13 @@ int pascal Excel12v(int xlfn, LPXLOPER12 operRes, int count, LPXLOPER12 opers[])
 /* GetFooInfo are valid only for calls to LPenHelper */
 #define xlGetFmlaInfo	(14 | xlSpecial)
 #define xlGetMouseInfo	(15 | xlSpecial)
+/* Excel 2010 and later: asynchronous functions and events */
+#define xlAsyncReturn	(16 | xlSpecial)
+#define xlEventRegister	(17 | xlSpecial)
+
+/* events, see xlEventRegister */
+#define xleventCalculationEnded		1
+#define xleventCalculationCanceled	2
 
 /* edit modes */
 #define xlModeReady	0	// not in edit mode
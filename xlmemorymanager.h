@@ -14,6 +14,7 @@
 #ifdef __cplusplus
 
 #include "xlMemoryPool.h"
+#include <mutex>
 
 //
 // Total number of memory allocation pools to manage
@@ -40,6 +41,7 @@ private:
 	int m_impCur;		// Current number of pools
 	int m_impMax;		// Max number of mem pools
 	MemoryPool* m_rgmp;	// Storage for the memory pools
+	std::mutex m_mutex;	// Guards the pools, they move when they grow
 };
 
 #endif //__cplusplus